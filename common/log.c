@@ -23,15 +23,20 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <syslog.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 #include "list.h"
 #include "file.h"
 #include "os_calls.h"
+#include "spsc_ring.h"
 #include "thread_calls.h"
 #include "string_calls.h"
 
@@ -45,6 +50,9 @@
 /* Here we store the current state and configuration of the log */
 static struct log_config *g_staticLogConfig = NULL;
 
+/* see struct log_callsite. Starts at 1 so a new call site is out of date */
+unsigned int g_log_generation = 1;
+
 /* This file first start with all private functions.
    In the end of the file the public functions is defined */
 
@@ -146,6 +154,557 @@ internal_log_lvl2str(const enum logLevels lvl, char *str)
     }
 }
 
+/*
+ * Asynchronous log writer
+ *
+ * When EnableAsync is set, messages for the log file are not written by
+ * the thread which logs them. Each thread queues them on its own lock
+ * free ring, made the first time the thread logs, and a background
+ * thread empties the rings, writing as many messages as it can with each
+ * writev(). Messages from one thread stay in order. Messages from
+ * different threads may be interleaved a little differently from when
+ * they were logged, their timestamps still show the order.
+ *
+ * Syslog and console messages are still written synchronously.
+ *
+ * The writer sleeps when there's nothing to do. A thread only wakes it
+ * if it is sleeping, so a busy writer costs the logging threads nothing
+ * but the push onto the ring.
+ *
+ * The writer thread is lost on a fork(), so the child falls back to
+ * synchronous writes until log_fork_child() is called. Whatever is left
+ * is written by log_end(), at exit(), or on a fatal signal.
+ *
+ * Other threads may still be logging when the writer is stopped, so a
+ * struct log_async is never freed. Once it is stopped, messages are
+ * written synchronously.
+ *
+ * The rings have one consumer at a time. Draining and the crash flush
+ * both take the consumer flag before popping a ring or freeing a queue,
+ * as the crash flush runs in a signal handler and can't take the lock.
+ */
+
+#define LOG_ASYNC_MAX_IOV 64
+#define LOG_ASYNC_IDLE_WAIT_MS 100
+#define LOG_ASYNC_CRASH_WAIT_MS 100
+
+struct log_async_msg
+{
+    int len;
+    char text[];
+};
+
+struct log_async_queue
+{
+    struct spsc_ring *ring;
+    struct log_async *owner;
+    int dead; /* the thread has exited, the writer frees the queue */
+    struct log_async_queue *next;
+};
+
+struct log_async
+{
+    int fd;
+    enum log_async_overflow overflow;
+    int queue_size;
+    pthread_mutex_t lock; /* guards queues, and the sleep below */
+    pthread_cond_t wake;
+    struct log_async_queue *queues;
+    pthread_t writer;
+    int idle; /* writer is (about to be) asleep */
+    int stop;
+    int users; /* threads which have seen stop unset and may still push */
+    int consumer; /* set while the rings are popped or queues freed */
+    unsigned int dropped;
+};
+
+static struct log_async *g_async = NULL;
+static pthread_key_t g_async_key;
+static pthread_once_t g_async_once = PTHREAD_ONCE_INIT;
+
+static void internal_log_async_stop(void);
+
+/*****************************************************************************/
+/* called when a thread which has logged exits */
+static void
+internal_log_async_thread_exit(void *arg)
+{
+    struct log_async_queue *queue = (struct log_async_queue *)arg;
+
+    __atomic_store_n(&queue->dead, 1, __ATOMIC_RELEASE);
+}
+
+/*****************************************************************************/
+static void
+internal_log_async_fork_child(void)
+{
+    /* The writer thread and the other threads' queues belong to the
+     * parent. The lock may even be held by one of its threads. Leave
+     * them all alone, and write synchronously */
+    __atomic_store_n(&g_async, NULL, __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************/
+static void
+internal_log_async_exit(void)
+{
+    internal_log_async_stop();
+}
+
+/*****************************************************************************/
+/* Returns non zero if the caller is now the only consumer of the rings */
+static int
+internal_log_async_consumer_get(struct log_async *async)
+{
+    return __atomic_exchange_n(&async->consumer, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+/*****************************************************************************/
+static void
+internal_log_async_consumer_put(struct log_async *async)
+{
+    __atomic_store_n(&async->consumer, 0, __ATOMIC_RELEASE);
+}
+
+/*****************************************************************************/
+/* Writes as much as it can, with no locks or frees, for a crash. If a
+   drain doesn't finish soon, it may be the one that crashed, so nothing
+   is written. The consumer flag is kept, so no drain starts after this */
+static void
+internal_log_async_crash_flush(struct log_async *async)
+{
+    struct log_async_queue *queue;
+    struct log_async_msg *msg;
+    struct timespec pause;
+    int waited;
+
+    __atomic_store_n(&async->stop, 1, __ATOMIC_RELEASE);
+    pause.tv_sec = 0;
+    pause.tv_nsec = 1000000L;
+    waited = 0;
+    while (!internal_log_async_consumer_get(async))
+    {
+        if (++waited > LOG_ASYNC_CRASH_WAIT_MS)
+        {
+            return;
+        }
+        nanosleep(&pause, NULL);
+    }
+    for (queue = __atomic_load_n(&async->queues, __ATOMIC_ACQUIRE);
+            queue != NULL;
+            queue = __atomic_load_n(&queue->next, __ATOMIC_ACQUIRE))
+    {
+        while ((msg = (struct log_async_msg *)spsc_ring_pop(queue->ring))
+                != NULL)
+        {
+            if (write(async->fd, msg->text, msg->len) < 0)
+            {
+                return;
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+internal_log_async_crash_handler(int sig)
+{
+    struct log_async *async = __atomic_load_n(&g_async, __ATOMIC_ACQUIRE);
+
+    if (async != NULL)
+    {
+        internal_log_async_crash_flush(async);
+    }
+    /* SA_RESETHAND has put back the default action */
+    raise(sig);
+}
+
+/*****************************************************************************/
+static void
+internal_log_async_init_once(void)
+{
+    static const int fatal_signals[] =
+    {
+        SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT
+    };
+    struct sigaction action;
+    struct sigaction old_action;
+    unsigned int i;
+
+    pthread_key_create(&g_async_key, internal_log_async_thread_exit);
+    pthread_atfork(NULL, NULL, internal_log_async_fork_child);
+    atexit(internal_log_async_exit);
+
+    /* Don't take over signals the program handles itself */
+    g_memset(&action, 0, sizeof(action));
+    action.sa_handler = internal_log_async_crash_handler;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    for (i = 0; i < sizeof(fatal_signals) / sizeof(fatal_signals[0]); ++i)
+    {
+        if (sigaction(fatal_signals[i], NULL, &old_action) == 0 &&
+                old_action.sa_handler == SIG_DFL)
+        {
+            sigaction(fatal_signals[i], &action, NULL);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* Writes all of a set of buffers, returns 0 for success */
+static int
+internal_log_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t written;
+
+    while (iovcnt > 0)
+    {
+        written = writev(fd, iov, iovcnt);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 1;
+        }
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Writes out everything queued. Writer thread only, or once it has
+   stopped. Returns the number of messages written */
+static int
+internal_log_async_drain(struct log_async *async)
+{
+    struct iovec iov[LOG_ASYNC_MAX_IOV];
+    struct log_async_msg *msgs[LOG_ASYNC_MAX_IOV];
+    struct log_async_queue **pqueue;
+    struct log_async_queue *queue;
+    char dropped_text[LOG_BUFFER_SIZE];
+    unsigned int dropped;
+    int count;
+    int total;
+    int dead;
+    int i;
+
+    total = 0;
+    pthread_mutex_lock(&async->lock);
+    if (!internal_log_async_consumer_get(async))
+    {
+        /* the crash flush has the rings */
+        pthread_mutex_unlock(&async->lock);
+        return 0;
+    }
+    pqueue = &async->queues;
+    while ((queue = *pqueue) != NULL)
+    {
+        /* read dead before emptying the ring, so nothing pushed before
+           the thread exited is missed */
+        dead = __atomic_load_n(&queue->dead, __ATOMIC_ACQUIRE);
+        do
+        {
+            count = 0;
+            while (count < LOG_ASYNC_MAX_IOV &&
+                    (msgs[count] = (struct log_async_msg *)
+                                   spsc_ring_pop(queue->ring)) != NULL)
+            {
+                iov[count].iov_base = msgs[count]->text;
+                iov[count].iov_len = msgs[count]->len;
+                ++count;
+            }
+            if (count > 0)
+            {
+                /* nowhere to report a failure to, so the messages go */
+                internal_log_writev_all(async->fd, iov, count);
+                for (i = 0; i < count; ++i)
+                {
+                    g_free(msgs[i]);
+                }
+                total += count;
+            }
+        }
+        while (count == LOG_ASYNC_MAX_IOV);
+
+        if (dead)
+        {
+            *pqueue = queue->next;
+            spsc_ring_delete(queue->ring);
+            g_free(queue);
+        }
+        else
+        {
+            pqueue = &queue->next;
+        }
+    }
+    internal_log_async_consumer_put(async);
+    pthread_mutex_unlock(&async->lock);
+
+    dropped = __atomic_exchange_n(&async->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0)
+    {
+        getFormattedDateTime(dropped_text, 32);
+        internal_log_lvl2str(LOG_LEVEL_WARNING, dropped_text + 31);
+        g_snprintf(dropped_text + 39, sizeof(dropped_text) - 39,
+                   "%u log messages dropped, the log queue was full\n",
+                   dropped);
+        iov[0].iov_base = dropped_text;
+        iov[0].iov_len = g_strlen(dropped_text);
+        internal_log_writev_all(async->fd, iov, 1);
+    }
+
+    return total;
+}
+
+/*****************************************************************************/
+static void *
+internal_log_async_writer(void *arg)
+{
+    struct log_async *async = (struct log_async *)arg;
+    struct log_async_queue *queue;
+    struct timespec deadline;
+    int pending;
+
+    while (!__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE))
+    {
+        if (internal_log_async_drain(async) > 0)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&async->lock);
+        __atomic_store_n(&async->idle, 1, __ATOMIC_SEQ_CST);
+        /* pairs with the fence in internal_log_async_queue() so a message
+           pushed as we went idle is seen here, or its thread sees idle */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        pending = 0;
+        for (queue = async->queues; queue != NULL; queue = queue->next)
+        {
+            pending |= spsc_ring_count(queue->ring) > 0;
+        }
+        if (!pending && !__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE))
+        {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_ASYNC_IDLE_WAIT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&async->wake, &async->lock, &deadline);
+        }
+        __atomic_store_n(&async->idle, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&async->lock);
+    }
+
+    internal_log_async_drain(async);
+    return NULL;
+}
+
+/*****************************************************************************/
+static void
+internal_log_async_wake(struct log_async *async)
+{
+    pthread_mutex_lock(&async->lock);
+    pthread_cond_signal(&async->wake);
+    pthread_mutex_unlock(&async->lock);
+}
+
+/*****************************************************************************/
+/* Gets the calling thread's queue, making it if needed */
+static struct log_async_queue *
+internal_log_async_get_queue(struct log_async *async)
+{
+    struct log_async_queue *queue;
+
+    queue = (struct log_async_queue *)pthread_getspecific(g_async_key);
+    if (queue != NULL && queue->owner == async)
+    {
+        return queue;
+    }
+
+    /* first message from this thread, or the first since a fork or a
+       log restart */
+    queue = g_new0(struct log_async_queue, 1);
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+    queue->ring = spsc_ring_create(async->queue_size);
+    if (queue->ring == NULL)
+    {
+        g_free(queue);
+        return NULL;
+    }
+    queue->owner = async;
+    pthread_mutex_lock(&async->lock);
+    queue->next = async->queues;
+    /* the crash flush walks the list without the lock */
+    __atomic_store_n(&async->queues, queue, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&async->lock);
+    pthread_setspecific(g_async_key, queue);
+    return queue;
+}
+
+/*****************************************************************************/
+/* Queues a message for the writer. Returns 0 if queued, 1 if dropped, or
+   2 if the writer has stopped and the caller must write the message */
+static int
+internal_log_async_queue(struct log_async *async, const char *text, int len)
+{
+    struct log_async_queue *queue;
+    struct log_async_msg *msg;
+    int rv = 0;
+
+    /* internal_log_async_stop() sets stop, then waits for users to be 0,
+       so if we see stop unset, what we push is written */
+    __atomic_add_fetch(&async->users, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&async->stop, __ATOMIC_SEQ_CST))
+    {
+        __atomic_sub_fetch(&async->users, 1, __ATOMIC_SEQ_CST);
+        return 2;
+    }
+
+    queue = internal_log_async_get_queue(async);
+    msg = (struct log_async_msg *)g_malloc(sizeof(*msg) + len, 0);
+    if (queue == NULL || msg == NULL)
+    {
+        g_free(msg);
+        __atomic_add_fetch(&async->dropped, 1, __ATOMIC_RELAXED);
+        rv = 1;
+    }
+    else
+    {
+        msg->len = len;
+        g_memcpy(msg->text, text, len);
+
+        while (rv == 0 && spsc_ring_push(queue->ring, msg) != 0)
+        {
+            if (__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE))
+            {
+                g_free(msg);
+                rv = 2;
+            }
+            else if (async->overflow == LOG_ASYNC_OVERFLOW_DROP)
+            {
+                g_free(msg);
+                __atomic_add_fetch(&async->dropped, 1, __ATOMIC_RELAXED);
+                rv = 1;
+            }
+            else
+            {
+                internal_log_async_wake(async);
+                usleep(1000);
+            }
+        }
+
+        if (rv == 0)
+        {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&async->idle, __ATOMIC_SEQ_CST))
+            {
+                internal_log_async_wake(async);
+            }
+        }
+    }
+    __atomic_sub_fetch(&async->users, 1, __ATOMIC_SEQ_CST);
+    return rv;
+}
+
+/*****************************************************************************/
+static enum logReturns
+internal_log_async_start(struct log_config *l_cfg)
+{
+    struct log_async *async;
+
+    pthread_once(&g_async_once, internal_log_async_init_once);
+
+    async = g_new0(struct log_async, 1);
+    if (async == NULL)
+    {
+        return LOG_ERROR_MALLOC;
+    }
+    async->fd = l_cfg->fd;
+    async->overflow = l_cfg->async_overflow;
+    async->queue_size = l_cfg->async_queue_size;
+    if (async->queue_size <= 0)
+    {
+        async->queue_size = LOG_ASYNC_DEFAULT_QUEUE_SIZE;
+    }
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->wake, NULL);
+    if (pthread_create(&async->writer, NULL,
+                       internal_log_async_writer, async) != 0)
+    {
+        pthread_cond_destroy(&async->wake);
+        pthread_mutex_destroy(&async->lock);
+        g_free(async);
+        return LOG_GENERAL_ERROR;
+    }
+    __atomic_store_n(&g_async, async, __ATOMIC_RELEASE);
+    return LOG_STARTUP_OK;
+}
+
+/*****************************************************************************/
+/* Stops the writer once everything queued is written. The struct is
+   left for threads which loaded g_async before it was cleared */
+static void
+internal_log_async_stop(void)
+{
+    struct log_async *async;
+    struct log_async_queue *queue;
+
+    async = __atomic_exchange_n(&g_async, NULL, __ATOMIC_ACQ_REL);
+    if (async == NULL)
+    {
+        return;
+    }
+    __atomic_store_n(&async->stop, 1, __ATOMIC_SEQ_CST);
+    /* a thread blocked on a full queue gives up when it sees stop */
+    while (__atomic_load_n(&async->users, __ATOMIC_SEQ_CST) > 0)
+    {
+        internal_log_async_wake(async);
+        usleep(1000);
+    }
+    internal_log_async_wake(async);
+    pthread_join(async->writer, NULL);
+    /* a thread may have pushed after the writer's last drain */
+    internal_log_async_drain(async);
+
+    /* queues of threads still running can't be freed, they are marked
+       so those threads make new ones if logging starts again */
+    if (!internal_log_async_consumer_get(async))
+    {
+        return;
+    }
+    while ((queue = async->queues) != NULL)
+    {
+        async->queues = queue->next;
+        if (__atomic_load_n(&queue->dead, __ATOMIC_ACQUIRE))
+        {
+            spsc_ring_delete(queue->ring);
+            g_free(queue);
+        }
+        else
+        {
+            queue->owner = NULL;
+        }
+    }
+    internal_log_async_consumer_put(async);
+}
+
 /******************************************************************************/
 enum logReturns
 internal_log_start(struct log_config *l_cfg)
@@ -192,6 +751,12 @@ internal_log_start(struct log_config *l_cfg)
     pthread_mutex_init(&(l_cfg->log_lock), &(l_cfg->log_lock_attr));
 #endif
 
+    if (l_cfg->enable_async && l_cfg->fd >= 0 &&
+            internal_log_async_start(l_cfg) != LOG_STARTUP_OK)
+    {
+        g_writeln("Could not start the log writer - logging synchronously");
+    }
+
     return LOG_STARTUP_OK;
 }
 
@@ -207,6 +772,8 @@ internal_log_end(struct log_config *l_cfg)
         return ret;
     }
 
+    internal_log_async_stop();
+
     if (-1 != l_cfg->fd)
     {
         /* closing logfile... */
@@ -313,6 +880,9 @@ internal_config_read_logging(int file,
     lc->syslog_level = LOG_LEVEL_INFO;
     lc->dump_on_start = 0;
     lc->enable_pid = 0;
+    lc->enable_async = 0;
+    lc->async_queue_size = LOG_ASYNC_DEFAULT_QUEUE_SIZE;
+    lc->async_overflow = LOG_ASYNC_OVERFLOW_BLOCK;
 
     g_snprintf(section_name, 511, "%s%s", section_prefix, SESMAN_CFG_LOGGING);
     file_read_section(file, section_name, param_n, param_v);
@@ -366,6 +936,39 @@ internal_config_read_logging(int file,
         {
             lc->enable_pid = g_text2bool((char *)list_get_item(param_v, i));
         }
+
+        if (0 == g_strcasecmp(buf, SESMAN_CFG_LOG_ENABLE_ASYNC))
+        {
+            lc->enable_async = g_text2bool((char *)list_get_item(param_v, i));
+        }
+
+        if (0 == g_strcasecmp(buf, SESMAN_CFG_LOG_ASYNC_QUEUE))
+        {
+            int size = g_atoi((char *)list_get_item(param_v, i));
+            if (size > 0)
+            {
+                lc->async_queue_size = size;
+            }
+        }
+
+        if (0 == g_strcasecmp(buf, SESMAN_CFG_LOG_ASYNC_OVERFLOW))
+        {
+            const char *value = (char *)list_get_item(param_v, i);
+            if (0 == g_strcasecmp(value, "drop"))
+            {
+                lc->async_overflow = LOG_ASYNC_OVERFLOW_DROP;
+            }
+            else if (0 == g_strcasecmp(value, "block"))
+            {
+                lc->async_overflow = LOG_ASYNC_OVERFLOW_BLOCK;
+            }
+            else
+            {
+                g_writeln("Unknown %s '%s' - blocking when the log "
+                          "queue is full", SESMAN_CFG_LOG_ASYNC_OVERFLOW,
+                          value);
+            }
+        }
     }
 
     if (0 == lc->log_file)
@@ -453,6 +1056,18 @@ internal_log_config_dump(struct log_config *config)
     }
     g_printf("\tSyslogLevel:   %s\r\n", str_level);
 
+    if (config->enable_async)
+    {
+        g_printf("\tAsync:         queue %d, %s when full\r\n",
+                 config->async_queue_size,
+                 config->async_overflow == LOG_ASYNC_OVERFLOW_DROP ?
+                 "drop" : "block");
+    }
+    else
+    {
+        g_printf("\tAsync:         %s\r\n", "<disabled>");
+    }
+
 #ifdef LOG_PER_LOGGER_LEVEL
     g_printf("per logger configuration:\r\n");
     for (i = 0; i < config->per_logger_level->count; i++)
@@ -562,6 +1177,9 @@ internal_log_config_copy(struct log_config *dest, const struct log_config *src)
         dest->program_name = src->program_name;
         dest->enable_pid = src->enable_pid;
         dest->dump_on_start = src->dump_on_start;
+        dest->enable_async = src->enable_async;
+        dest->async_queue_size = src->async_queue_size;
+        dest->async_overflow = src->async_overflow;
 
         internal_log_config_copy_levels(dest, src);
     }
@@ -643,6 +1261,24 @@ internal_log_location_overrides_level(const char *function_name,
     return 0;
 }
 
+/*****************************************************************************/
+/* makes every call site work out its state again, called after the log
+ * config has changed */
+static void
+internal_log_config_changed(void)
+{
+    unsigned int generation;
+
+    generation = __atomic_load_n(&g_log_generation, __ATOMIC_RELAXED);
+    /* 24 bits, as the low 8 bits of a call site state hold the level */
+    generation = (generation + 1) & 0xffffff;
+    if (generation == 0)
+    {
+        generation = 1;
+    }
+    __atomic_store_n(&g_log_generation, generation, __ATOMIC_RELEASE);
+}
+
 /*
  * Here below the public functions
  */
@@ -781,6 +1417,7 @@ log_restart_from_param(const struct log_config *lc)
 
         /* ... and the log levels */
         internal_log_config_copy_levels(g_staticLogConfig, lc);
+        internal_log_config_changed();
         rv = LOG_STARTUP_OK;
     }
     return rv;
@@ -820,6 +1457,7 @@ log_start_from_param(const struct log_config *src_log_config)
             log_config_free(g_staticLogConfig);
             g_staticLogConfig = NULL;
         }
+        internal_log_config_changed();
     }
 
     return ret;
@@ -882,10 +1520,184 @@ log_end(void)
     ret = internal_log_end(g_staticLogConfig);
     log_config_free(g_staticLogConfig);
     g_staticLogConfig = NULL;
+    internal_log_config_changed();
 
     return ret;
 }
 
+/*****************************************************************************/
+void
+log_fork_child(void)
+{
+    if (g_staticLogConfig != NULL && g_staticLogConfig->enable_async &&
+            g_staticLogConfig->fd >= 0 &&
+            __atomic_load_n(&g_async, __ATOMIC_ACQUIRE) == NULL &&
+            internal_log_async_start(g_staticLogConfig) != LOG_STARTUP_OK)
+    {
+        log_message(LOG_LEVEL_WARNING,
+                    "Could not start the log writer - logging synchronously");
+    }
+}
+
+/*****************************************************************************/
+void
+log_flush(void)
+{
+    struct log_async *async = __atomic_load_n(&g_async, __ATOMIC_ACQUIRE);
+    struct log_async_queue *queue;
+    int pending;
+
+    if (async == NULL)
+    {
+        return;
+    }
+
+    /* the writer holds the lock while it writes, so once we have it and
+       the rings are empty, everything has been written */
+    do
+    {
+        internal_log_async_wake(async);
+        pthread_mutex_lock(&async->lock);
+        pending = 0;
+        for (queue = async->queues; queue != NULL; queue = queue->next)
+        {
+            pending |= spsc_ring_count(queue->ring) > 0;
+        }
+        pthread_mutex_unlock(&async->lock);
+        if (pending)
+        {
+            usleep(1000);
+        }
+    }
+    while (pending);
+}
+
+/*****************************************************************************/
+unsigned int
+log_callsite_update(struct log_callsite *cs)
+{
+    unsigned int generation;
+    unsigned int state;
+    enum logLevels level = LOG_LEVEL_NEVER;
+    int max_level = -1;
+
+    generation = __atomic_load_n(&g_log_generation, __ATOMIC_ACQUIRE);
+    if (g_staticLogConfig == NULL)
+    {
+        /* let the message through to report the log isn't set up, and
+         * don't remember that */
+        return LOG_LEVEL_TRACE + 1;
+    }
+    if (internal_log_location_overrides_level(cs->function_name,
+            cs->file_name, &level))
+    {
+        state = LOG_CALLSITE_OVERRIDE;
+        max_level = level;
+        if (g_staticLogConfig->fd < 0 && !g_staticLogConfig->enable_syslog &&
+                !g_staticLogConfig->enable_console)
+        {
+            max_level = -1;
+        }
+    }
+    else
+    {
+        state = 0;
+        if (g_staticLogConfig->fd >= 0)
+        {
+            max_level = MAX(max_level, (int)g_staticLogConfig->log_level);
+        }
+        if (g_staticLogConfig->enable_syslog)
+        {
+            max_level = MAX(max_level, (int)g_staticLogConfig->syslog_level);
+        }
+        if (g_staticLogConfig->enable_console)
+        {
+            max_level = MAX(max_level, (int)g_staticLogConfig->console_level);
+        }
+    }
+    max_level = MIN(max_level, LOG_LEVEL_TRACE);
+    state |= (generation << 8) | (unsigned int)(max_level + 1);
+    __atomic_store_n(&cs->state, state, __ATOMIC_RELAXED);
+    return state;
+}
+
+/*****************************************************************************/
+int
+log_callsite_rate_ok(struct log_callsite *cs, enum logLevels log_level,
+                     unsigned int per_second)
+{
+    unsigned int now;
+    unsigned int count;
+    unsigned int suppressed;
+
+    now = (unsigned int)g_time4();
+    if (now - __atomic_load_n(&cs->window_start, __ATOMIC_RELAXED) >= 1000)
+    {
+        __atomic_store_n(&cs->window_start, now, __ATOMIC_RELAXED);
+        __atomic_store_n(&cs->window_count, 0, __ATOMIC_RELAXED);
+        suppressed = __atomic_exchange_n(&cs->suppressed, 0,
+                                         __ATOMIC_RELAXED);
+        if (suppressed > 0)
+        {
+            log_callsite_message(cs, log_level,
+                                 "%u similar messages suppressed",
+                                 suppressed);
+        }
+    }
+    count = __atomic_add_fetch(&cs->window_count, 1, __ATOMIC_RELAXED);
+    if (count > per_second)
+    {
+        __atomic_add_fetch(&cs->suppressed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+enum logReturns
+log_callsite_message(struct log_callsite *cs, enum logLevels log_level,
+                     const char *msg, ...)
+{
+    va_list ap;
+    enum logReturns rv;
+    unsigned int state;
+    bool_t override_destination_level;
+    enum logLevels override_log_level = LOG_LEVEL_NEVER;
+#ifdef USE_DEVEL_LOGGING
+    char buff[LOG_BUFFER_SIZE];
+#endif
+
+    if (g_staticLogConfig == NULL)
+    {
+        g_writeln("The log reference is NULL - log not initialized properly "
+                  "when called from [%s(%s:%d)]",
+                  cs->function_name, cs->file_name, cs->line_number);
+        return LOG_ERROR_NO_CFG;
+    }
+
+    /* the level check has been done, so only the override is wanted */
+    state = __atomic_load_n(&cs->state, __ATOMIC_RELAXED);
+    override_destination_level = (state & LOG_CALLSITE_OVERRIDE) != 0;
+    if (override_destination_level)
+    {
+        override_log_level =
+            (enum logLevels)((state & LOG_CALLSITE_LEVEL_MASK) - 1);
+    }
+
+    va_start(ap, msg);
+#ifdef USE_DEVEL_LOGGING
+    g_snprintf(buff, LOG_BUFFER_SIZE, "[%s(%s:%d)] %s",
+               cs->function_name, cs->file_name, cs->line_number, msg);
+    rv = internal_log_message(log_level, override_destination_level,
+                              override_log_level, buff, ap);
+#else
+    rv = internal_log_message(log_level, override_destination_level,
+                              override_log_level, msg, ap);
+#endif
+    va_end(ap);
+    return rv;
+}
+
 /*****************************************************************************/
 /* log a hex dump */
 enum logReturns
@@ -1021,6 +1833,7 @@ internal_log_message(const enum logLevels lvl,
     int len = 0;
     enum logReturns rv = LOG_STARTUP_OK;
     int writereply = 0;
+    struct log_async *async;
 
     if (g_staticLogConfig == NULL)
     {
@@ -1097,7 +1910,10 @@ internal_log_message(const enum logLevels lvl,
             || (!override_destination_level && lvl <= g_staticLogConfig->log_level))
     {
         /* log to application logfile */
-        if (g_staticLogConfig->fd >= 0)
+        async = __atomic_load_n(&g_async, __ATOMIC_ACQUIRE);
+        if ((async == NULL ||
+                internal_log_async_queue(async, buff, g_strlen(buff)) == 2) &&
+                g_staticLogConfig->fd >= 0)
         {
 #ifdef LOG_ENABLE_THREAD
             pthread_mutex_lock(&(g_staticLogConfig->log_lock));
@@ -1156,12 +1972,14 @@ getFormattedDateTime(char *replybuf, int bufsize)
     char buf_millisec[4];  /* 357 */
     char buf_timezone[6];  /* +0900 */
 
+    struct tm now_tm;
     struct tm *now;
     struct timeval tv;
     int millisec;
 
     gettimeofday(&tv, NULL);
-    now = localtime(&tv.tv_sec);
+    /* reentrant, messages can be formatted on more than one thread */
+    now = localtime_r(&tv.tv_sec, &now_tm);
 
     millisec = (tv.tv_usec + 500 / 1000);
     g_snprintf(buf_millisec, sizeof(buf_millisec), "%03d", millisec);
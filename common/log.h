@@ -69,10 +69,144 @@ enum logReturns
 #define SESMAN_CFG_LOG_ENABLE_SYSLOG  "EnableSyslog"
 #define SESMAN_CFG_LOG_SYSLOG_LEVEL   "SyslogLevel"
 #define SESMAN_CFG_LOG_ENABLE_PID     "EnableProcessId"
+#define SESMAN_CFG_LOG_ENABLE_ASYNC   "EnableAsync"
+#define SESMAN_CFG_LOG_ASYNC_QUEUE    "AsyncQueueSize"
+#define SESMAN_CFG_LOG_ASYNC_OVERFLOW "AsyncOverflow"
+
+/* default number of messages each thread can queue for the log writer */
+#define LOG_ASYNC_DEFAULT_QUEUE_SIZE  1024
+
+/* what a thread does when its log queue is full */
+enum log_async_overflow
+{
+    LOG_ASYNC_OVERFLOW_BLOCK = 0, /* wait for the writer */
+    LOG_ASYNC_OVERFLOW_DROP       /* drop the message and count it */
+};
 
 /* enable threading */
 /*#define LOG_ENABLE_THREAD*/
 
+/**
+ * Highest log level compiled in. LOG() calls with a constant level above
+ * this are removed by the compiler. Define it on the command line (e.g.
+ * -DLOG_MAX_COMPILED_LEVEL=LOG_LEVEL_DEBUG) to strip trace logging
+ * from a build.
+ */
+#ifndef LOG_MAX_COMPILED_LEVEL
+#define LOG_MAX_COMPILED_LEVEL LOG_LEVEL_TRACE
+#endif
+
+/**
+ * State kept for each logging call site
+ *
+ * Every LOG() call has one of these in static storage. It caches whether
+ * the call site is enabled, so working this out (which may mean looking
+ * the file and function up in the [LoggingPerLogger] section) is only
+ * done again when the log config changes.
+ */
+struct log_callsite
+{
+    const char *function_name;
+    const char *file_name;
+    int line_number;
+    /* (config generation << 8) | override flag | (max level + 1) */
+    unsigned int state;
+    /* used by LOG_RATELIMITED() */
+    unsigned int window_start;
+    unsigned int window_count;
+    unsigned int suppressed;
+};
+
+#define LOG_CALLSITE_OVERRIDE 0x10
+#define LOG_CALLSITE_LEVEL_MASK 0x0f
+
+#define LOG_CALLSITE_INIT { __func__, __FILE__, __LINE__, 0, 0, 0, 0 }
+
+/* Changed every time the log config changes, never 0. Use
+ * log_callsite_enabled() rather than reading this */
+extern unsigned int g_log_generation;
+
+/**
+ * Works out the state of a call site for the current log config
+ * @param cs Call site
+ * @return the new state
+ */
+unsigned int
+log_callsite_update(struct log_callsite *cs);
+
+/**
+ * @param cs Call site
+ * @param log_level Level of the message
+ * @return true if a message at this level from this call site is logged
+ */
+static inline int
+log_callsite_enabled(struct log_callsite *cs, enum logLevels log_level)
+{
+    unsigned int state = __atomic_load_n(&cs->state, __ATOMIC_RELAXED);
+
+    if ((state >> 8) != __atomic_load_n(&g_log_generation, __ATOMIC_RELAXED))
+    {
+        state = log_callsite_update(cs);
+    }
+    return (unsigned int)log_level < (state & LOG_CALLSITE_LEVEL_MASK);
+}
+
+/**
+ * Checks a rate limited call site hasn't logged too much recently
+ *
+ * When a new one second window starts, the number of messages
+ * suppressed in the last one is logged.
+ *
+ * @param cs Call site
+ * @param log_level Level of the message
+ * @param per_second Messages allowed from the call site each second
+ * @return true if the message can be logged
+ */
+int
+log_callsite_rate_ok(struct log_callsite *cs, enum logLevels log_level,
+                     unsigned int per_second);
+
+/**
+ * Logs a message from a call site which is enabled
+ *
+ * Please use the LOG and LOG_DEVEL macros rather than this.
+ */
+enum logReturns
+log_callsite_message(struct log_callsite *cs, enum logLevels log_level,
+                     const char *msg, ...) printflike(3, 4);
+
+/* Logs from a call site, if it's enabled. An expression, returning an
+ * enum logReturns */
+#define LOG_CALLSITE(log_level, args...) \
+    ({ \
+        static struct log_callsite log_cs_ = LOG_CALLSITE_INIT; \
+        enum logLevels log_lvl_ = (log_level); \
+        (log_lvl_ <= LOG_MAX_COMPILED_LEVEL && \
+         log_callsite_enabled(&log_cs_, log_lvl_)) ? \
+        log_callsite_message(&log_cs_, log_lvl_, args) : LOG_STARTUP_OK; \
+    })
+
+/* As LOG_CALLSITE(), but at most per_second messages a second */
+#define LOG_CALLSITE_RATELIMITED(log_level, per_second, args...) \
+    ({ \
+        static struct log_callsite log_cs_ = LOG_CALLSITE_INIT; \
+        enum logLevels log_lvl_ = (log_level); \
+        (log_lvl_ <= LOG_MAX_COMPILED_LEVEL && \
+         log_callsite_enabled(&log_cs_, log_lvl_) && \
+         log_callsite_rate_ok(&log_cs_, log_lvl_, (per_second))) ? \
+        log_callsite_message(&log_cs_, log_lvl_, args) : LOG_STARTUP_OK; \
+    })
+
+/* Calls a hex dump function, if the call site is enabled */
+#define LOG_CALLSITE_HEXDUMP(log_level, dump_call) \
+    ({ \
+        static struct log_callsite log_cs_ = LOG_CALLSITE_INIT; \
+        enum logLevels log_lvl_ = (log_level); \
+        (log_lvl_ <= LOG_MAX_COMPILED_LEVEL && \
+         log_callsite_enabled(&log_cs_, log_lvl_)) ? \
+        (dump_call) : LOG_STARTUP_OK; \
+    })
+
 #ifdef USE_DEVEL_LOGGING
 
 #define LOG_PER_LOGGER_LEVEL
@@ -103,8 +237,19 @@ enum logReturns
  * @param msg, the log text as a printf format c-string
  * @param ... the arguments for the printf format c-string
  */
-#define LOG_DEVEL(log_level, args...) \
-    log_message_with_location(__func__, __FILE__, __LINE__, log_level, args)
+#define LOG_DEVEL(log_level, args...) LOG_CALLSITE(log_level, args)
+
+/**
+ * @brief As LOG_DEVEL(), but logs at most per_second messages a second
+ * from the call site. The number of messages suppressed is logged later.
+ *
+ * @param lvl, the log level
+ * @param per_second, the number of messages allowed each second
+ * @param msg, the log text as a printf format c-string
+ * @param ... the arguments for the printf format c-string
+ */
+#define LOG_DEVEL_RATELIMITED(log_level, per_second, args...) \
+    LOG_CALLSITE_RATELIMITED(log_level, per_second, args)
 
 /**
  * @brief Logging macro for messages that are for a system administrator to
@@ -117,8 +262,7 @@ enum logReturns
  * @param msg, the log text as a printf format c-string
  * @param ... the arguments for the printf format c-string
  */
-#define LOG(log_level, args...) \
-    log_message_with_location(__func__, __FILE__, __LINE__, log_level, args)
+#define LOG(log_level, args...) LOG_CALLSITE(log_level, args)
 
 /**
  * @brief Logging macro for logging the contents of a byte array using a hex
@@ -134,7 +278,8 @@ enum logReturns
  * @param length, the length of the byte array to log
  */
 #define LOG_DEVEL_HEXDUMP(log_level, message, buffer, length)  \
-    log_hexdump_with_location(__func__, __FILE__, __LINE__, log_level, message, buffer, length)
+    LOG_CALLSITE_HEXDUMP(log_level, \
+                         log_hexdump_with_location(__func__, __FILE__, __LINE__, log_level, message, buffer, length))
 
 /**
  * @brief Logging macro for logging the contents of a byte array using a hex
@@ -147,24 +292,42 @@ enum logReturns
  * @param length, the length of the byte array to log
  */
 #define LOG_HEXDUMP(log_level, message, buffer, length)  \
-    log_hexdump_with_location(__func__, __FILE__, __LINE__, log_level, message, buffer, length)
+    LOG_CALLSITE_HEXDUMP(log_level, \
+                         log_hexdump_with_location(__func__, __FILE__, __LINE__, log_level, message, buffer, length))
 
 #define LOG_DEVEL_LEAKING_FDS(exe,min,max) log_devel_leaking_fds(exe,min,max)
 
 #else
-#define LOG(log_level, args...) log_message(log_level, args)
+#define LOG(log_level, args...) LOG_CALLSITE(log_level, args)
 #define LOG_HEXDUMP(log_level, message, buffer, length)  \
-    log_hexdump(log_level, message, buffer, length)
+    LOG_CALLSITE_HEXDUMP(log_level, \
+                         log_hexdump(log_level, message, buffer, length))
 
 /* Since log_message() returns a value ensure that the elided versions of
  * LOG_DEVEL and LOG_DEVEL_HEXDUMP also "fake" returning the success value
  */
 #define LOG_DEVEL(log_level, args...) UNUSED_VAR(LOG_STARTUP_OK)
+#define LOG_DEVEL_RATELIMITED(log_level, per_second, args...) UNUSED_VAR(LOG_STARTUP_OK)
 #define LOG_DEVEL_HEXDUMP(log_level, message, buffer, length) UNUSED_VAR(LOG_STARTUP_OK)
 
 #define LOG_DEVEL_LEAKING_FDS(exe,min,max)
 #endif
 
+/**
+ * @brief As LOG(), but logs at most per_second messages a second from the
+ * call site. The number of messages suppressed is logged later.
+ *
+ * Use this for messages which may come from a busy loop, such as errors
+ * for each frame or PDU.
+ *
+ * @param lvl, the log level
+ * @param per_second, the number of messages allowed each second
+ * @param msg, the log text as a printf format c-string
+ * @param ... the arguments for the printf format c-string
+ */
+#define LOG_RATELIMITED(log_level, per_second, args...) \
+    LOG_CALLSITE_RATELIMITED(log_level, per_second, args)
+
 /* Flags values for log_start() */
 
 /**
@@ -211,6 +374,9 @@ struct log_config
 #endif
     int dump_on_start;
     int enable_pid;
+    int enable_async; /* log file written by a background thread */
+    int async_queue_size;
+    enum log_async_overflow async_overflow;
 #ifdef LOG_ENABLE_THREAD
     pthread_mutex_t log_lock;
     pthread_mutexattr_t log_lock_attr;
@@ -380,6 +546,27 @@ log_config_free(struct log_config *config);
 enum logReturns
 log_end(void);
 
+/**
+ * Restarts the asynchronous log writer in a forked child
+ *
+ * The writer thread doesn't survive a fork(), so a child logs
+ * synchronously. Call this in a child which goes on to run for a while,
+ * rather than exec'ing another program, to get the writer back.
+ *
+ * Does nothing if EnableAsync is not set.
+ */
+void
+log_fork_child(void);
+
+/**
+ * Writes out any messages queued for the asynchronous log writer
+ *
+ * Returns when the queues are empty. Does nothing if the log is
+ * synchronous.
+ */
+void
+log_flush(void);
+
 /**
  * the log function that all files use to log an event.
  *
@@ -57,10 +57,12 @@
 #define SEC_TAG_CLI_CHANNELS   0xc003 /* CS_CHANNELS? */
 #define SEC_TAG_CLI_4          0xc004 /* CS_CLUSTER? */
 #define SEC_TAG_CLI_MONITOR    0xc005 /* CS_MONITOR */
+#define SEC_TAG_CLI_MSGCHANNEL 0xc006 /* CS_MCS_MSGCHANNEL */
 #define SEC_TAG_CLI_MONITOR_EX 0xc008 /* CS_MONITOR_EX */
 #define SEC_TAG_SRV_INFO       0x0c01 /* SC_CORE */
 #define SEC_TAG_SRV_CRYPT      0x0c02 /* SC_SECURITY */
 #define SEC_TAG_SRV_CHANNELS   0x0c03 /* SC_NET? */
+#define SEC_TAG_SRV_MSGCHANNEL 0x0c04 /* SC_MCS_MSGCHANNEL */
 
 
 /* Client Core Data: colorDepth, postBeta2ColorDepth (2.2.1.3.2) */
@@ -79,6 +81,7 @@
 /* Client Core Data: earlyCapabilityFlags (2.2.1.3.2) */
 #define RNS_UD_CS_WANT_32BPP_SESSION         0x0002
 #define RNS_UD_CS_SUPPORT_MONITOR_LAYOUT_PDU 0x0040
+#define RNS_UD_CS_SUPPORT_NETCHAR_AUTODETECT 0x0080
 #define RNS_UD_CS_SUPPORT_DYNVC_GFX_PROTOCOL 0x0100
 
 /* Client Core Data: connectionType  (2.2.1.3.2) */
@@ -230,6 +233,7 @@
 
 #define CAPSTYPE_VIRTUALCHANNEL                 0x0014
 #define CAPSTYPE_VIRTUALCHANNEL_LEN             0x08
+#define CAPSTYPE_VIRTUALCHANNEL_CHUNK_LEN       0x0C /* with VCChunkSize */
 
 #define CAPSTYPE_DRAWNINGRIDCACHE               0x0015
 #define CAPSTYPE_DRAWGDIPLUS                    0x0016
@@ -287,6 +291,7 @@
 
 /* Virtual channel PDU (2.2.6.1) */
 #define CHANNEL_CHUNK_LENGTH                          1600
+#define CHANNEL_CHUNK_MAX_LENGTH                      16256
 
 /* Channel PDU Header flags (2.2.6.1.1) */
 /* NOTE: XR_ prefixed to avoid conflict with FreeRDP */
@@ -468,6 +473,23 @@
 #define SEC_INFO_PKT                   0x0040
 #define SEC_LICENSE_PKT                0x0080
 #define SEC_LICENSE_ENCRYPT_CS         0x0280
+#define SEC_AUTODETECT_REQ             0x1000
+#define SEC_AUTODETECT_RSP             0x2000
+
+/* Network auto-detect: headerTypeId (2.2.14.1, 2.2.14.2) */
+#define TYPE_ID_AUTODETECT_REQUEST     0x00
+#define TYPE_ID_AUTODETECT_RESPONSE    0x01
+
+/* Network auto-detect: requestType, responseType (2.2.14.1, 2.2.14.2) */
+#define RDP_RTT_REQUEST_TYPE_CONTINUOUS           0x0001
+#define RDP_RTT_REQUEST_TYPE_CONNECTTIME          0x1001
+#define RDP_RTT_RESPONSE_TYPE                     0x0000
+#define RDP_BW_START_REQUEST_TYPE_CONTINUOUS      0x0014
+#define RDP_BW_STOP_REQUEST_TYPE_CONTINUOUS       0x0429
+#define RDP_BW_RESULTS_RESPONSE_TYPE_CONNECTTIME  0x0003
+#define RDP_BW_RESULTS_RESPONSE_TYPE_CONTINUOUS   0x000B
+#define RDP_NETCHAR_SYNC_RESPONSE_TYPE            0x0018
+#define RDP_NETCHAR_RESULT_BASE_BW_AVG            0x08C0
 
 /* Slow-Path Input Event: messageType (2.2.8.1.1.3.1.1) */
 /* TODO: to be renamed */
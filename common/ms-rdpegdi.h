@@ -42,10 +42,19 @@
 #define RDP_ORDER_DESKSAVE  11
 #define RDP_ORDER_MEMBLT    13
 #define RDP_ORDER_TRIBLT    14
+#define RDP_ORDER_MULTIDSTBLT     15
+#define RDP_ORDER_MULTIPATBLT     16
+#define RDP_ORDER_MULTISCRBLT     17
+#define RDP_ORDER_MULTIOPAQUERECT 18
 #define RDP_ORDER_POLYLINE  22
 #define RDP_ORDER_TEXT2     27
 #define RDP_ORDER_COMPOSITE 37 /* 0x25  - not defined in RDPEGDI */
 
+/* DELTA_RECTS_FIELD (2.2.2.2.1.1.1.5) and DELTA_PTS_FIELD (2.2.2.2.1.1.1.4)
+   entry limits */
+#define TS_MAX_DELTA_RECTS  45
+#define TS_MAX_DELTA_POINTS 32
+
 /* Secondary Drawing Order Header: orderType (2.2.2.2.1.2.1.1) */
 #define TS_CACHE_BITMAP_UNCOMPRESSED        0x00
 #define TS_CACHE_COLOR_TABLE                0x01
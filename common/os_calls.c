@@ -3825,6 +3825,24 @@ g_time3(void)
 #endif
 }
 
+/*****************************************************************************/
+/* returns time in milliseconds from a monotonic clock, for timers and
+   intervals, not affected by changes to the system time. The value wraps,
+   so only compare the difference of two values */
+int
+g_time4(void)
+{
+#if defined(_WIN32)
+    return (int)GetTickCount();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int)((unsigned int)ts.tv_sec * 1000 +
+                 (unsigned int)(ts.tv_nsec / 1000000));
+#endif
+}
+
 /******************************************************************************/
 /******************************************************************************/
 struct bmp_magic
@@ -0,0 +1,128 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/spsc_ring.c
+ * @brief   Lock free single producer, single consumer pointer queue
+ *
+ * 'head' and 'tail' are free running counters, only ever written by the
+ * consumer and producer respectively. The producer stores the item, then
+ * publishes it with a release store of 'tail'. The consumer's acquire
+ * load of 'tail' makes sure it sees the item. The same pairing on 'head'
+ * hands the slot back. Each counter sits on its own cache line so the
+ * two threads don't fight over one.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "arch.h"
+#include "os_calls.h"
+#include "spsc_ring.h"
+
+#define CACHE_LINE 64
+
+#define LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define LOAD_RELAXED(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+struct spsc_ring
+{
+    unsigned int head; /* next to pop, consumer writes */
+    char pad1[CACHE_LINE - sizeof(unsigned int)];
+    unsigned int tail; /* next to push, producer writes */
+    char pad2[CACHE_LINE - sizeof(unsigned int)];
+    unsigned int mask;
+    void **items;
+};
+
+/*****************************************************************************/
+struct spsc_ring *
+spsc_ring_create(int capacity)
+{
+    struct spsc_ring *self;
+    unsigned int size;
+
+    size = 1;
+    while ((int)size < capacity)
+    {
+        size <<= 1;
+    }
+    self = g_new0(struct spsc_ring, 1);
+    if (self != NULL)
+    {
+        self->mask = size - 1;
+        self->items = g_new0(void *, size);
+        if (self->items == NULL)
+        {
+            g_free(self);
+            self = NULL;
+        }
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+spsc_ring_delete(struct spsc_ring *self)
+{
+    if (self != NULL)
+    {
+        g_free(self->items);
+        g_free(self);
+    }
+}
+
+/*****************************************************************************/
+int
+spsc_ring_push(struct spsc_ring *self, void *item)
+{
+    unsigned int tail;
+
+    tail = LOAD_RELAXED(&self->tail);
+    if (tail - LOAD_ACQUIRE(&self->head) > self->mask)
+    {
+        return 1;
+    }
+    self->items[tail & self->mask] = item;
+    STORE_RELEASE(&self->tail, tail + 1);
+    return 0;
+}
+
+/*****************************************************************************/
+void *
+spsc_ring_pop(struct spsc_ring *self)
+{
+    unsigned int head;
+    void *item;
+
+    head = LOAD_RELAXED(&self->head);
+    if (head == LOAD_ACQUIRE(&self->tail))
+    {
+        return NULL;
+    }
+    item = self->items[head & self->mask];
+    STORE_RELEASE(&self->head, head + 1);
+    return item;
+}
+
+/*****************************************************************************/
+int
+spsc_ring_count(struct spsc_ring *self)
+{
+    return (int)(LOAD_ACQUIRE(&self->tail) - LOAD_ACQUIRE(&self->head));
+}
@@ -0,0 +1,81 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/spsc_ring.h
+ * @brief   Lock free single producer, single consumer pointer queue
+ *
+ * A fixed size ring of pointers shared by exactly two threads. One
+ * thread only ever calls spsc_ring_push(), the other only ever calls
+ * spsc_ring_pop(). Neither call blocks or takes a lock, so the threads
+ * need some other way of waking each other, e.g. a semaphore or a wait
+ * object.
+ */
+
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+
+struct spsc_ring;
+
+/**
+ * Create a ring
+ *
+ * @param capacity Number of items the ring can hold, rounded up to a
+ *                 power of two
+ * @return ring, or NULL if no memory
+ */
+struct spsc_ring *
+spsc_ring_create(int capacity);
+
+/**
+ * Delete a ring
+ *
+ * Items still in the ring are not freed.
+ *
+ * @param self ring to delete (may be NULL)
+ */
+void
+spsc_ring_delete(struct spsc_ring *self);
+
+/**
+ * Add an item, producer thread only
+ *
+ * @param self ring
+ * @param item Item to add, not NULL
+ * @return 0 for success, 1 if the ring is full
+ */
+int
+spsc_ring_push(struct spsc_ring *self, void *item);
+
+/**
+ * Remove the oldest item, consumer thread only
+ *
+ * @param self ring
+ * @return item, or NULL if the ring is empty
+ */
+void *
+spsc_ring_pop(struct spsc_ring *self);
+
+/**
+ * Get the number of items in the ring
+ *
+ * @param self ring
+ * @return count. Only a hint if the other thread is active
+ */
+int
+spsc_ring_count(struct spsc_ring *self);
+
+#endif
@@ -0,0 +1,343 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/timer_heap.c
+ * @brief   One shot timers for a main loop
+ *
+ * Timers live in 'slots', an array which only grows. Free slots are
+ * chained through 'next_free'. The heap is an array of slot indexes
+ * ordered on (due, seq), and each pending slot records its position in
+ * the heap so it can be removed from the middle when cancelled.
+ *
+ * A handle is the slot index + 1 in the low 16 bits, and the slot's
+ * generation in the high bits. The generation is bumped each time the
+ * slot is freed, so an old handle no longer matches.
+ *
+ * Times are from g_time4(), which is monotonic but wraps, so they are
+ * only ever compared by the sign of their difference.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdlib.h>
+
+#include "defines.h"
+#include "os_calls.h"
+#include "timer_heap.h"
+
+#define MAX_TIMERS 0xffff
+#define GEN_MASK 0x7fff
+
+struct timer_slot
+{
+    int due;
+    unsigned int seq;
+    int heap_pos; /* -1 when free */
+    int gen;
+    int next_free;
+    timer_heap_callback callback;
+    void *data;
+};
+
+struct timer_heap
+{
+    struct timer_slot *slots;
+    int slot_count;
+    int first_free; /* -1 for none */
+    int *heap;
+    int heap_count;
+    unsigned int next_seq;
+};
+
+/*****************************************************************************/
+/* returns non zero if slot a expires before slot b */
+static int
+timer_before(const struct timer_heap *self, int a, int b)
+{
+    const struct timer_slot *sa = self->slots + a;
+    const struct timer_slot *sb = self->slots + b;
+    int diff;
+
+    diff = (int)((unsigned int)sa->due - (unsigned int)sb->due);
+    if (diff != 0)
+    {
+        return diff < 0;
+    }
+    return (int)(sa->seq - sb->seq) < 0;
+}
+
+/*****************************************************************************/
+static void
+heap_set(struct timer_heap *self, int pos, int slot)
+{
+    self->heap[pos] = slot;
+    self->slots[slot].heap_pos = pos;
+}
+
+/*****************************************************************************/
+static void
+heap_up(struct timer_heap *self, int pos)
+{
+    int slot;
+    int parent;
+
+    slot = self->heap[pos];
+    while (pos > 0)
+    {
+        parent = (pos - 1) / 2;
+        if (!timer_before(self, slot, self->heap[parent]))
+        {
+            break;
+        }
+        heap_set(self, pos, self->heap[parent]);
+        pos = parent;
+    }
+    heap_set(self, pos, slot);
+}
+
+/*****************************************************************************/
+static void
+heap_down(struct timer_heap *self, int pos)
+{
+    int slot;
+    int child;
+
+    slot = self->heap[pos];
+    for (;;)
+    {
+        child = pos * 2 + 1;
+        if (child >= self->heap_count)
+        {
+            break;
+        }
+        if ((child + 1 < self->heap_count) &&
+                timer_before(self, self->heap[child + 1], self->heap[child]))
+        {
+            child++;
+        }
+        if (!timer_before(self, self->heap[child], slot))
+        {
+            break;
+        }
+        heap_set(self, pos, self->heap[child]);
+        pos = child;
+    }
+    heap_set(self, pos, slot);
+}
+
+/*****************************************************************************/
+/* takes a pending slot out of the heap and frees it */
+static void
+timer_remove(struct timer_heap *self, int slot)
+{
+    struct timer_slot *ts = self->slots + slot;
+    int pos;
+    int last;
+
+    pos = ts->heap_pos;
+    self->heap_count--;
+    if (pos != self->heap_count)
+    {
+        last = self->heap[self->heap_count];
+        heap_set(self, pos, last);
+        if ((pos > 0) && timer_before(self, last, self->heap[(pos - 1) / 2]))
+        {
+            heap_up(self, pos);
+        }
+        else
+        {
+            heap_down(self, pos);
+        }
+    }
+    ts->heap_pos = -1;
+    ts->gen = (ts->gen + 1) & GEN_MASK;
+    ts->callback = NULL;
+    ts->data = NULL;
+    ts->next_free = self->first_free;
+    self->first_free = slot;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+timer_grow(struct timer_heap *self)
+{
+    struct timer_slot *slots;
+    int *heap;
+    int new_count;
+    int index;
+
+    if (self->slot_count >= MAX_TIMERS)
+    {
+        return 1;
+    }
+    new_count = (self->slot_count == 0) ? 16 : self->slot_count * 2;
+    new_count = MIN(new_count, MAX_TIMERS);
+    slots = (struct timer_slot *)
+            realloc(self->slots, sizeof(struct timer_slot) * new_count);
+    if (slots == NULL)
+    {
+        return 1;
+    }
+    self->slots = slots;
+    heap = (int *)realloc(self->heap, sizeof(int) * new_count);
+    if (heap == NULL)
+    {
+        return 1;
+    }
+    self->heap = heap;
+    for (index = new_count - 1; index >= self->slot_count; index--)
+    {
+        g_memset(slots + index, 0, sizeof(struct timer_slot));
+        slots[index].heap_pos = -1;
+        slots[index].next_free = self->first_free;
+        self->first_free = index;
+    }
+    self->slot_count = new_count;
+    return 0;
+}
+
+/*****************************************************************************/
+struct timer_heap *
+timer_heap_create(void)
+{
+    struct timer_heap *self;
+
+    self = g_new0(struct timer_heap, 1);
+    if (self != NULL)
+    {
+        self->first_free = -1;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+timer_heap_delete(struct timer_heap *self)
+{
+    if (self != NULL)
+    {
+        free(self->slots);
+        free(self->heap);
+        g_free(self);
+    }
+}
+
+/*****************************************************************************/
+int
+timer_heap_add(struct timer_heap *self, int msoffset,
+               timer_heap_callback callback, void *data)
+{
+    struct timer_slot *ts;
+    int slot;
+
+    if ((self->first_free < 0) && (timer_grow(self) != 0))
+    {
+        return 0;
+    }
+    slot = self->first_free;
+    ts = self->slots + slot;
+    self->first_free = ts->next_free;
+    ts->due = (int)((unsigned int)g_time4() + (unsigned int)MAX(msoffset, 0));
+    ts->seq = self->next_seq++;
+    ts->callback = callback;
+    ts->data = data;
+    self->heap[self->heap_count] = slot;
+    self->heap_count++;
+    heap_up(self, self->heap_count - 1);
+    return (ts->gen << 16) | (slot + 1);
+}
+
+/*****************************************************************************/
+int
+timer_heap_cancel(struct timer_heap *self, int handle)
+{
+    int slot;
+
+    slot = (handle & 0xffff) - 1;
+    if ((slot < 0) || (slot >= self->slot_count) ||
+            (self->slots[slot].heap_pos < 0) ||
+            (self->slots[slot].gen != ((handle >> 16) & GEN_MASK)))
+    {
+        return 0;
+    }
+    timer_remove(self, slot);
+    return 1;
+}
+
+/*****************************************************************************/
+int
+timer_heap_count(const struct timer_heap *self)
+{
+    return self->heap_count;
+}
+
+/*****************************************************************************/
+void
+timer_heap_get_timeout(struct timer_heap *self, int *timeout)
+{
+    int diff;
+
+    if ((self == NULL) || (self->heap_count == 0))
+    {
+        return;
+    }
+    diff = (int)((unsigned int)self->slots[self->heap[0]].due -
+                 (unsigned int)g_time4());
+    diff = MAX(diff, 0);
+    if ((*timeout < 0) || (*timeout > diff))
+    {
+        *timeout = diff;
+    }
+}
+
+/*****************************************************************************/
+int
+timer_heap_check(struct timer_heap *self)
+{
+    struct timer_slot *ts;
+    timer_heap_callback callback;
+    void *data;
+    unsigned int end_seq;
+    int now;
+    int count;
+
+    if (self == NULL)
+    {
+        return 0;
+    }
+    count = 0;
+    now = g_time4();
+    end_seq = self->next_seq;
+    while (self->heap_count > 0)
+    {
+        ts = self->slots + self->heap[0];
+        if (((int)((unsigned int)ts->due - (unsigned int)now) > 0) ||
+                ((int)(ts->seq - end_seq) >= 0))
+        {
+            break;
+        }
+        callback = ts->callback;
+        data = ts->data;
+        timer_remove(self, self->heap[0]);
+        callback(data);
+        count++;
+    }
+    return count;
+}
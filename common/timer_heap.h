@@ -0,0 +1,123 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/timer_heap.h
+ * @brief   One shot timers for a main loop
+ *
+ * Declares a set of one shot timers kept in a binary min-heap on a
+ * monotonic millisecond clock. Adding and cancelling a timer are
+ * O(log n), finding the next one to expire is O(1).
+ *
+ * A main loop calls timer_heap_get_timeout() to lower the timeout it
+ * passes to g_obj_wait(), and timer_heap_check() after the wait to run
+ * the callbacks of expired timers.
+ */
+
+#ifndef _TIMER_HEAP_H
+#define _TIMER_HEAP_H
+
+struct timer_heap;
+
+/**
+ * Function called when a timer expires
+ *
+ * @param data Pointer passed to timer_heap_add()
+ *
+ * The timer is already removed when this is called, so the callback can
+ * add new timers, or cancel other ones.
+ */
+typedef void (*timer_heap_callback)(void *data);
+
+/**
+ * Create a new set of timers
+ *
+ * @return timer heap, or NULL if no memory
+ */
+struct timer_heap *
+timer_heap_create(void);
+
+/**
+ * Delete a set of timers
+ *
+ * Pending timers are dropped without calling their callbacks.
+ *
+ * @param self timer heap to delete (may be NULL)
+ */
+void
+timer_heap_delete(struct timer_heap *self);
+
+/**
+ * Add a one shot timer
+ *
+ * @param self timer heap
+ * @param msoffset Milliseconds from now until the timer expires
+ * @param callback Function to call when it does
+ * @param data Passed to callback
+ * @return Handle for timer_heap_cancel(), never 0, or 0 for no memory
+ *
+ * Timers expiring at the same time run in the order they were added.
+ */
+int
+timer_heap_add(struct timer_heap *self, int msoffset,
+               timer_heap_callback callback, void *data);
+
+/**
+ * Cancel a timer
+ *
+ * @param self timer heap
+ * @param handle Handle from timer_heap_add()
+ * @return 1 if the timer was pending and is now cancelled, 0 if it has
+ *         already run or been cancelled
+ *
+ * A handle is not reused until a large number of timers later, so it is
+ * safe to cancel a timer which might already have run.
+ */
+int
+timer_heap_cancel(struct timer_heap *self, int handle);
+
+/**
+ * Get the number of pending timers
+ *
+ * @param self timer heap
+ * @return count
+ */
+int
+timer_heap_count(const struct timer_heap *self);
+
+/**
+ * Lower a main loop timeout to the next timer expiry
+ *
+ * @param self timer heap (may be NULL)
+ * @param[in,out] timeout Milliseconds, < 0 for no timeout. Lowered to
+ *                the time until the earliest timer, 0 if one has expired
+ */
+void
+timer_heap_get_timeout(struct timer_heap *self, int *timeout);
+
+/**
+ * Run the callbacks of all expired timers, earliest first
+ *
+ * @param self timer heap (may be NULL)
+ * @return Number of callbacks run
+ *
+ * Timers added by a callback with a zero offset run on the next call,
+ * so a callback which re-arms itself can't hold up the main loop.
+ */
+int
+timer_heap_check(struct timer_heap *self);
+
+#endif
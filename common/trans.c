@@ -234,6 +234,44 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
     return 0;
 }
 
+/*****************************************************************************/
+/* returns the number of bytes queued on wait_s, not yet sent */
+int
+trans_get_wait_bytes(const struct trans *self)
+{
+    const struct stream *temp_s;
+    int bytes;
+
+    bytes = 0;
+    if (self != 0)
+    {
+        for (temp_s = self->wait_s; temp_s != 0; temp_s = temp_s->next)
+        {
+            bytes += (int) (temp_s->end - temp_s->p);
+        }
+    }
+    return bytes;
+}
+
+/*****************************************************************************/
+/* returns the number of streams queued on wait_s */
+int
+trans_get_wait_count(const struct trans *self)
+{
+    const struct stream *temp_s;
+    int count;
+
+    count = 0;
+    if (self != 0)
+    {
+        for (temp_s = self->wait_s; temp_s != 0; temp_s = temp_s->next)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
 /*****************************************************************************/
 static int
 trans_send_waiting(struct trans *self, int block)
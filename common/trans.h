@@ -134,6 +134,10 @@ trans_get_wait_objs_rw(struct trans *self,
 int
 trans_check_wait_objs(struct trans *self);
 int
+trans_get_wait_bytes(const struct trans *self);
+int
+trans_get_wait_count(const struct trans *self);
+int
 trans_force_read_s(struct trans *self, struct stream *in_s, int size);
 int
 trans_force_write_s(struct trans *self, struct stream *out_s);
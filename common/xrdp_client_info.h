@@ -255,6 +255,23 @@ struct xrdp_client_info
 
     enum unicode_input_state unicode_input_support;
     enum xrdp_capture_code capture_code;
+
+    int order_batching; /* reorder queued primary orders before sending */
+    int order_stats; /* log bytes per order type at disconnect */
+
+    /* static channel data scheduling, see xrdp_channel_sched.c */
+    int channel_qos;
+    int channel_qos_max_queued_kb; /* client backlog above which only
+                                      interactive channels are sent */
+    int channel_qos_rate[3]; /* bytes a second per class, 0 unlimited */
+
+    /* largest static channel chunk the client may send, see
+       CAPSTYPE_VIRTUALCHANNEL. Chunks to the client are always
+       CHANNEL_CHUNK_LENGTH */
+    int vc_chunk_size;
+
+    /* network auto-detect, see xrdp_autodetect.c */
+    int detected_connection_type; /* CONNECTION_TYPE_*, 0 until measured */
 };
 
 enum xrdp_encoder_flags
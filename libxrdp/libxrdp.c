@@ -1094,6 +1094,46 @@ libxrdp_orders_text(struct xrdp_session *session,
                             x, y, data, data_len, rect);
 }
 
+/******************************************************************************/
+int EXPORT_CC
+libxrdp_orders_multi_rect(struct xrdp_session *session, int color,
+                          const struct xrdp_rect *rects, int num_rects)
+{
+    return xrdp_orders_multi_rect((struct xrdp_orders *)session->orders,
+                                  color, rects, num_rects);
+}
+
+/******************************************************************************/
+int EXPORT_CC
+libxrdp_orders_multi_dest_blt(struct xrdp_session *session, int rop,
+                              const struct xrdp_rect *rects, int num_rects)
+{
+    return xrdp_orders_multi_dest_blt((struct xrdp_orders *)session->orders,
+                                      rop, rects, num_rects);
+}
+
+/******************************************************************************/
+int EXPORT_CC
+libxrdp_orders_multi_pat_blt(struct xrdp_session *session, int rop,
+                             int bg_color, int fg_color,
+                             struct xrdp_brush *brush,
+                             const struct xrdp_rect *rects, int num_rects)
+{
+    return xrdp_orders_multi_pat_blt((struct xrdp_orders *)session->orders,
+                                     rop, bg_color, fg_color, brush,
+                                     rects, num_rects);
+}
+
+/******************************************************************************/
+int EXPORT_CC
+libxrdp_orders_multi_screen_blt(struct xrdp_session *session, int dx, int dy,
+                                int rop, const struct xrdp_rect *rects,
+                                int num_rects)
+{
+    return xrdp_orders_multi_screen_blt((struct xrdp_orders *)session->orders,
+                                        dx, dy, rop, rects, num_rects);
+}
+
 /******************************************************************************/
 int EXPORT_CC
 libxrdp_orders_send_palette(struct xrdp_session *session, int *palette,
@@ -1233,6 +1273,64 @@ libxrdp_get_channel_count(const struct xrdp_session *session)
     return count;
 }
 
+/*****************************************************************************/
+void EXPORT_CC
+libxrdp_get_bulk_stats(const struct xrdp_session *session,
+                       tui64 *bytes_in, tui64 *bytes_out)
+{
+    const struct xrdp_rdp *rdp = (const struct xrdp_rdp *)session->rdp;
+
+    *bytes_in = 0;
+    *bytes_out = 0;
+    if (rdp != NULL && rdp->mppc_enc != NULL)
+    {
+        *bytes_in = rdp->mppc_enc->total_in;
+        *bytes_out = rdp->mppc_enc->total_out;
+    }
+}
+
+/*****************************************************************************/
+static struct xrdp_autodetect *
+libxrdp_get_autodetect(struct xrdp_session *session)
+{
+    struct xrdp_rdp *rdp = (struct xrdp_rdp *)session->rdp;
+
+    if (rdp == NULL || rdp->sec_layer == NULL)
+    {
+        return NULL;
+    }
+    return rdp->sec_layer->autodetect;
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_autodetect_rtt(struct xrdp_session *session)
+{
+    struct xrdp_autodetect *autodetect = libxrdp_get_autodetect(session);
+
+    return (autodetect == NULL) ? 1 : xrdp_autodetect_send_rtt(autodetect);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_autodetect_bw_start(struct xrdp_session *session)
+{
+    struct xrdp_autodetect *autodetect = libxrdp_get_autodetect(session);
+
+    return (autodetect == NULL) ? 1 :
+           xrdp_autodetect_send_bw_start(autodetect);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_autodetect_bw_stop(struct xrdp_session *session)
+{
+    struct xrdp_autodetect *autodetect = libxrdp_get_autodetect(session);
+
+    return (autodetect == NULL) ? 1 :
+           xrdp_autodetect_send_bw_stop(autodetect);
+}
+
 /*****************************************************************************/
 /* returns error */
 /* this function gets the channel name and its flags, index is zero
@@ -1331,6 +1429,161 @@ libxrdp_get_channel_id(struct xrdp_session *session, const char *name)
     return -1;
 }
 
+/*****************************************************************************/
+/* returns error
+   data can be bigger than CHANNEL_CHUNK_LENGTH, chansrv sends up to 16K
+   at a time, then it goes out as several chunks with the first and last
+   flags moved to the first and last of them. The client's VCChunkSize
+   does not change this, see xrdp_caps_process_virtual_channel() */
+static int
+libxrdp_channel_send_chunk(struct xrdp_channel *chan, struct stream *s,
+                           int channel_id, const char *data, int data_len,
+                           int total_data_len, int flags)
+{
+    int sending_bytes;
+    int chunk_flags;
+
+    do
+    {
+        sending_bytes = MIN(data_len, CHANNEL_CHUNK_LENGTH);
+        chunk_flags = flags;
+        if (sending_bytes < data_len)
+        {
+            chunk_flags &= ~XR_CHANNEL_FLAG_LAST;
+        }
+        /* the stream is reused, it only grows */
+        init_stream(s, sending_bytes + 1024);
+
+        if (xrdp_channel_init(chan, s) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "libxrdp_send_to_channel: xrdp_channel_init failed");
+            return 1;
+        }
+
+        /* the one copy, from the chansrv input buffer into the PDU */
+        out_uint8a(s, data, sending_bytes);
+        s_mark_end(s);
+        LOG_DEVEL(LOG_LEVEL_TRACE, "Sending [MS-RDPBCGR] Virtual Channel PDU "
+                  "data <omitted from log>");
+
+        if (xrdp_channel_send(chan, s, channel_id, total_data_len,
+                              chunk_flags) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "libxrdp_send_to_channel: xrdp_channel_send failed");
+            return 1;
+        }
+        data += sending_bytes;
+        data_len -= sending_bytes;
+        flags &= ~XR_CHANNEL_FLAG_FIRST;
+    }
+    while (data_len > 0);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns the scheduler, creating it on first use, or NULL if channel_qos
+   is off */
+static struct xrdp_channel_sched *
+libxrdp_get_channel_sched(struct xrdp_rdp *rdp)
+{
+    struct xrdp_channel *chan;
+
+    chan = rdp->sec_layer->chan_layer;
+    if ((chan->sched == NULL) && rdp->client_info.channel_qos)
+    {
+        chan->sched = xrdp_channel_sched_create(&(rdp->client_info));
+        if (chan->sched == NULL)
+        {
+            rdp->client_info.channel_qos = 0;
+        }
+    }
+    return chan->sched;
+}
+
+/*****************************************************************************/
+/* when the scheduler holds too much, its queue is counted as output owed
+   to chansrv, so the chansrv transport is not read until it drains */
+static void
+libxrdp_channel_sched_set_owed(struct xrdp_session *session,
+                               struct xrdp_channel_sched *sched)
+{
+    int owed;
+
+    owed = (sched->queued_bytes > XRDP_CHAN_SCHED_MAX_QUEUED) ?
+           sched->queued_bytes : 0;
+    session->si.source[XRDP_SOURCE_CHANSRV] += owed - sched->owed;
+    sched->owed = owed;
+}
+
+/*****************************************************************************/
+/* send what the channel scheduler lets go now */
+int
+libxrdp_channel_sched_check(struct xrdp_session *session)
+{
+    struct xrdp_rdp *rdp;
+    struct xrdp_channel *chan;
+    struct xrdp_channel_sched *sched;
+    struct xrdp_channel_chunk *chunk;
+    enum xrdp_source cur_source;
+    int now;
+    int rv;
+
+    rdp = (struct xrdp_rdp *)session->rdp;
+    chan = rdp->sec_layer->chan_layer;
+    sched = chan->sched;
+    if ((sched == NULL) || (sched->queued_bytes == 0))
+    {
+        return 0;
+    }
+    /* anything left buffered is owed to chansrv for flow control */
+    cur_source = session->si.cur_source;
+    session->si.cur_source = XRDP_SOURCE_CHANSRV;
+    rv = 0;
+    now = g_time3();
+    while (rv == 0)
+    {
+        chunk = xrdp_channel_sched_next(sched, now,
+                                        trans_get_wait_bytes(session->trans));
+        if (chunk == NULL)
+        {
+            break;
+        }
+        rv = libxrdp_channel_send_chunk(chan, sched->s, chunk->channel_id,
+                                        (const char *)(chunk + 1),
+                                        chunk->size, chunk->total_data_len,
+                                        chunk->flags);
+        g_free(chunk);
+    }
+    session->si.cur_source = cur_source;
+    libxrdp_channel_sched_set_owed(session, sched);
+    return rv;
+}
+
+/*****************************************************************************/
+/* returns bytes held back by the channel scheduler, lowers *timeout if it
+   needs to be called again before then */
+int
+libxrdp_channel_sched_get_timeout(struct xrdp_session *session, int *timeout)
+{
+    struct xrdp_rdp *rdp;
+    struct xrdp_channel_sched *sched;
+    int ms;
+
+    rdp = (struct xrdp_rdp *)session->rdp;
+    sched = rdp->sec_layer->chan_layer->sched;
+    if ((sched == NULL) || (sched->queued_bytes == 0))
+    {
+        return 0;
+    }
+    ms = xrdp_channel_sched_get_timeout(sched, g_time3(),
+                                        trans_get_wait_bytes(session->trans));
+    if ((ms >= 0) && ((*timeout < 0) || (*timeout > ms)))
+    {
+        *timeout = ms;
+    }
+    return sched->queued_bytes;
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_send_to_channel(struct xrdp_session *session, int channel_id,
@@ -1340,40 +1593,47 @@ libxrdp_send_to_channel(struct xrdp_session *session, int channel_id,
     struct xrdp_rdp *rdp = NULL;
     struct xrdp_sec *sec = NULL;
     struct xrdp_channel *chan = NULL;
+    struct xrdp_channel_sched *sched = NULL;
+    struct mcs_channel_item *channel_item = NULL;
     struct stream *s = NULL;
+    int class_id;
+    int rv;
 
     rdp = (struct xrdp_rdp *)session->rdp;
     sec = rdp->sec_layer;
     chan = sec->chan_layer;
-    make_stream(s);
-    init_stream(s, data_len + 1024); /* this should be big enough */
-
-    if (xrdp_channel_init(chan, s) != 0)
+    sched = libxrdp_get_channel_sched(rdp);
+    if (sched == NULL)
     {
-        LOG(LOG_LEVEL_ERROR, "libxrdp_send_to_channel: xrdp_channel_init failed");
+        make_stream(s);
+        rv = libxrdp_channel_send_chunk(chan, s, channel_id, data, data_len,
+                                        total_data_len, flags);
         free_stream(s);
-        return 1;
+        return rv;
     }
-    else
+
+    if (sec->mcs_layer->channel_list != NULL)
     {
-        LOG(LOG_LEVEL_TRACE, "libxrdp_send_to_channel: xrdp_channel_init successful!");
+        channel_item = (struct mcs_channel_item *)
+                       list_get_item(sec->mcs_layer->channel_list, channel_id);
     }
-
-    /* here we make a copy of the data */
-    out_uint8a(s, data, data_len);
-    s_mark_end(s);
-    LOG_DEVEL(LOG_LEVEL_TRACE, "Sending [MS-RDPBCGR] Virtual Channel PDU "
-              "data <omitted from log>");
-
-    if (xrdp_channel_send(chan, s, channel_id, total_data_len, flags) != 0)
+    class_id = (channel_item == NULL) ? XRDP_CHAN_CLASS_BULK :
+               xrdp_channel_sched_class(channel_item->name);
+    if (xrdp_channel_sched_can_send(sched, class_id, data_len, g_time3(),
+                                    trans_get_wait_bytes(session->trans)))
     {
-        LOG(LOG_LEVEL_ERROR, "libxrdp_send_to_channel: xrdp_channel_send failed");
-        free_stream(s);
+        return libxrdp_channel_send_chunk(chan, sched->s, channel_id,
+                                          data, data_len,
+                                          total_data_len, flags);
+    }
+    if (xrdp_channel_sched_add(sched, class_id, channel_id, data, data_len,
+                               total_data_len, flags) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "libxrdp_send_to_channel: out of memory");
         return 1;
     }
-
-    free_stream(s);
-    return 0;
+    /* a higher class may be able to go ahead of what is waiting */
+    return libxrdp_channel_sched_check(session);
 }
 
 /*****************************************************************************/
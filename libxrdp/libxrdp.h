@@ -70,6 +70,26 @@ struct xrdp_mcs
     /* This boolean is set to indicate we're expecting channel join
      * requests as part of the connect sequence */
     int expecting_channel_join_requests;
+    int msg_chanid; /* MCS message channel, 0 if there isn't one */
+};
+
+/* planar codec kernels, all sets give identical output */
+struct xrdp_planar_kernels
+{
+    const char *name;
+    /* split one line of 32 bpp pixels into planes */
+    void (*split3_row)(const char *in_data, int width,
+                       char *r_data, char *g_data, char *b_data);
+    void (*split4_row)(const char *in_data, int width,
+                       char *a_data, char *r_data, char *g_data,
+                       char *b_data);
+    /* delta encode cur against prev into out_plane */
+    void (*delta)(const char *prev, const char *cur, char *out_plane,
+                  int count);
+    /* count leading positions i < count where ptr8[i] == ptr8[i + 1]
+       (equal_run) or ptr8[i] != ptr8[i + 1] (differ_run) */
+    int (*equal_run)(const char *ptr8, int count);
+    int (*differ_run)(const char *ptr8, int count);
 };
 
 /* fastpath */
@@ -133,6 +153,24 @@ struct xrdp_sec
     void *decrypt_fips_info;
     void *sign_fips_info;
     int is_security_header_present; /* boolean */
+    struct xrdp_autodetect *autodetect; /* NULL unless the client asked */
+};
+
+/* network auto-detect, see xrdp_autodetect.c */
+struct xrdp_autodetect
+{
+    struct xrdp_sec *sec_layer; /* owner */
+    int seq; /* last sequenceNumber used */
+    int rtt_seq; /* RTT request waiting for a response, -1 for none */
+    int rtt_sent; /* g_time3() the RTT request went */
+    int bw_started; /* a bandwidth measure has been started */
+    int bw_seq; /* bandwidth measure waiting for results, -1 for none */
+    int base_rtt; /* least RTT in ms, -1 until measured */
+    int avg_rtt; /* smoothed RTT in ms, -1 until measured */
+    int bandwidth; /* smoothed kbit/s, 0 until measured */
+    int connection_type; /* CONNECTION_TYPE_* in use, 0 until measured */
+    int next_type; /* a different type the last results gave */
+    int next_type_count; /* results in a row giving next_type */
 };
 
 struct xrdp_drdynvc
@@ -148,6 +186,53 @@ struct xrdp_drdynvc
 };
 
 /* channel */
+/* static channel priority classes, see xrdp_channel_sched.c */
+#define XRDP_CHAN_CLASS_INTERACTIVE 0
+#define XRDP_CHAN_CLASS_AUDIO       1
+#define XRDP_CHAN_CLASS_BULK        2
+#define XRDP_CHAN_CLASSES           3
+
+/* a static channel chunk waiting in the scheduler, data follows */
+struct xrdp_channel_chunk
+{
+    struct xrdp_channel_chunk *next;
+    int channel_id;
+    int total_data_len;
+    int flags;
+    int size;
+};
+
+struct xrdp_channel_class
+{
+    struct xrdp_channel_chunk *head;
+    struct xrdp_channel_chunk *tail;
+    int queued_bytes;
+    int quantum; /* bytes added to deficit each round */
+    int deficit;
+    int rate; /* bytes a second, 0 unlimited */
+    int tokens; /* can go negative, the class waits until it is positive */
+    int last_refill; /* g_time3() */
+    /* statistics */
+    long long sent_bytes;
+    int sent_chunks;
+    int queued_chunks;
+};
+
+struct xrdp_channel_sched
+{
+    struct xrdp_channel_class classes[XRDP_CHAN_CLASSES];
+    int queued_bytes;
+    int max_backlog; /* client bytes waiting above which only
+                        XRDP_CHAN_CLASS_INTERACTIVE goes */
+    int current; /* weighted class being served */
+    int fresh; /* current has not had its quantum yet */
+    int owed; /* bytes counted against chansrv in the session source_info */
+    struct stream *s; /* reused for every chunk sent */
+};
+
+/* queued channel bytes above which xrdp stops reading chansrv */
+#define XRDP_CHAN_SCHED_MAX_QUEUED (256 * 1024)
+
 struct xrdp_channel
 {
     struct xrdp_sec *sec_layer;
@@ -156,6 +241,7 @@ struct xrdp_channel
     int drdynvc_state;
     struct stream *s;
     struct xrdp_drdynvc drdynvcs[256];
+    struct xrdp_channel_sched *sched; /* NULL unless channel_qos */
 };
 
 /* rdp */
@@ -269,9 +355,91 @@ struct xrdp_orders_state
     int com_blt_height;                               /* 2 */
     int com_blt_dstformat;                            /* 2 */
 
+    int multi_dst_blt_x; /* RDP_ORDER_MULTIDSTBLT */
+    int multi_dst_blt_y;
+    int multi_dst_blt_cx;
+    int multi_dst_blt_cy;
+    int multi_dst_blt_rop;
+
+    int multi_pat_blt_x; /* RDP_ORDER_MULTIPATBLT */
+    int multi_pat_blt_y;
+    int multi_pat_blt_cx;
+    int multi_pat_blt_cy;
+    int multi_pat_blt_rop;
+    int multi_pat_blt_bg_color;
+    int multi_pat_blt_fg_color;
+    struct xrdp_brush multi_pat_blt_brush;
+
+    int multi_scr_blt_x; /* RDP_ORDER_MULTISCRBLT */
+    int multi_scr_blt_y;
+    int multi_scr_blt_cx;
+    int multi_scr_blt_cy;
+    int multi_scr_blt_rop;
+    int multi_scr_blt_srcx;
+    int multi_scr_blt_srcy;
+
+    int multi_rect_x; /* RDP_ORDER_MULTIOPAQUERECT */
+    int multi_rect_y;
+    int multi_rect_cx;
+    int multi_rect_cy;
+    int multi_rect_color;
+
+    int polyline_x; /* RDP_ORDER_POLYLINE */
+    int polyline_y;
+    int polyline_rop;
+    int polyline_color;
 };
 
 /* orders */
+/* a primary drawing order held back by the order batcher */
+struct xrdp_batched_order
+{
+    int type; /* RDP_ORDER_RECT, RDP_ORDER_SCREENBLT... */
+    int sent;
+    int x;
+    int y;
+    int cx; /* line end x */
+    int cy; /* line end y */
+    int srcx;
+    int srcy;
+    int rop;
+    int bg_color; /* rect color */
+    int fg_color;
+    int mix_mode;
+    int cache_id;
+    int cache_idx;
+    int color_table;
+    int has_bounds;
+    struct xrdp_rect bounds;
+    struct xrdp_rect area; /* screen area read or written by the order */
+    int has_brush;
+    struct xrdp_brush brush;
+    int has_pen;
+    struct xrdp_pen pen;
+};
+
+#define XRDP_ORDERS_BATCH_MAX 256
+/* how far ahead the batcher looks for an order to move forward */
+#define XRDP_ORDERS_BATCH_WINDOW 32
+
+struct xrdp_orders_batch
+{
+    struct xrdp_batched_order orders[XRDP_ORDERS_BATCH_MAX];
+    int count;
+    int replaying; /* set while the batch is being encoded */
+    /* statistics */
+    int flushes;
+    int batched;
+    int moved;
+};
+
+/* bytes and count per primary order type, for order_stats */
+struct xrdp_orders_stats
+{
+    long long bytes[64];
+    int count[64];
+};
+
 struct xrdp_orders
 {
     struct stream *out_s;
@@ -288,6 +456,8 @@ struct xrdp_orders
     /* shared */
     struct stream *s;
     struct stream *temp_s;
+    struct xrdp_orders_batch *batch; /* NULL unless order_batching */
+    struct xrdp_orders_stats *stats; /* NULL unless order_stats */
 };
 
 #define PROTO_RDP_40 1
@@ -306,6 +476,8 @@ struct xrdp_mppc_enc
     int    flagsHold;
     int    first_pkt;        /* this is the first pkt passing through enc */
     tui16 *hash_table;
+    tui64  total_in;         /* bytes passed to compress_rdp() */
+    tui64  total_out;        /* bytes sent for them, compressed or not */
 };
 
 int
@@ -401,6 +573,11 @@ int
 xrdp_sec_disconnect(struct xrdp_sec *self);
 int
 xrdp_sec_process_mcs_data_monitors(struct xrdp_sec *self, struct stream *s);
+int
+xrdp_sec_init_msg_channel(struct xrdp_sec *self, struct stream *s);
+int
+xrdp_sec_send_msg_channel(struct xrdp_sec *self, struct stream *s,
+                          int flags);
 
 /* xrdp_rdp.c */
 
@@ -535,6 +712,25 @@ xrdp_orders_text(struct xrdp_orders *self,
                  int x, int y, char *data, int data_len,
                  struct xrdp_rect *rect);
 int
+xrdp_orders_multi_rect(struct xrdp_orders *self, int color,
+                       const struct xrdp_rect *rects, int num_rects);
+int
+xrdp_orders_multi_dest_blt(struct xrdp_orders *self, int rop,
+                           const struct xrdp_rect *rects, int num_rects);
+int
+xrdp_orders_multi_pat_blt(struct xrdp_orders *self, int rop,
+                          int bg_color, int fg_color,
+                          struct xrdp_brush *brush,
+                          const struct xrdp_rect *rects, int num_rects);
+int
+xrdp_orders_multi_screen_blt(struct xrdp_orders *self, int dx, int dy,
+                             int rop,
+                             const struct xrdp_rect *rects, int num_rects);
+int
+xrdp_orders_polyline(struct xrdp_orders *self, int startx, int starty,
+                     const int *points, int num_points, int rop, int color,
+                     struct xrdp_rect *rect);
+int
 xrdp_orders_send_palette(struct xrdp_orders *self, int *palette,
                          int cache_id);
 int
@@ -571,6 +767,82 @@ xrdp_orders_send_create_os_surface(struct xrdp_orders *self, int id,
 int
 xrdp_orders_send_switch_os_surface(struct xrdp_orders *self, int id);
 
+/* xrdp_channel_sched.c */
+struct xrdp_channel_sched *
+xrdp_channel_sched_create(const struct xrdp_client_info *client_info);
+void
+xrdp_channel_sched_delete(struct xrdp_channel_sched *self);
+int
+xrdp_channel_sched_class(const char *channel_name);
+int
+xrdp_channel_sched_can_send(struct xrdp_channel_sched *self, int class_id,
+                            int size, int now, int backlog);
+int
+xrdp_channel_sched_add(struct xrdp_channel_sched *self, int class_id,
+                       int channel_id, const char *data, int size,
+                       int total_data_len, int flags);
+struct xrdp_channel_chunk *
+xrdp_channel_sched_next(struct xrdp_channel_sched *self, int now,
+                        int backlog);
+int
+xrdp_channel_sched_get_timeout(struct xrdp_channel_sched *self, int now,
+                               int backlog);
+
+/* xrdp_autodetect.c */
+struct xrdp_autodetect *
+xrdp_autodetect_create(struct xrdp_sec *owner);
+void
+xrdp_autodetect_delete(struct xrdp_autodetect *self);
+int
+xrdp_autodetect_send_rtt(struct xrdp_autodetect *self);
+int
+xrdp_autodetect_send_bw_start(struct xrdp_autodetect *self);
+int
+xrdp_autodetect_send_bw_stop(struct xrdp_autodetect *self);
+int
+xrdp_autodetect_process(struct xrdp_autodetect *self, struct stream *s,
+                        int now);
+int
+xrdp_autodetect_connection_type(int bandwidth, int rtt);
+
+/* xrdp_orders_batch.c */
+int
+xrdp_orders_batch_active(struct xrdp_orders *self);
+int
+xrdp_orders_batch_flush(struct xrdp_orders *self);
+int
+xrdp_orders_batch_rect(struct xrdp_orders *self, int x, int y,
+                       int cx, int cy, int color, struct xrdp_rect *rect);
+int
+xrdp_orders_batch_screen_blt(struct xrdp_orders *self, int x, int y,
+                             int cx, int cy, int srcx, int srcy,
+                             int rop, struct xrdp_rect *rect);
+int
+xrdp_orders_batch_pat_blt(struct xrdp_orders *self, int x, int y,
+                          int cx, int cy, int rop, int bg_color,
+                          int fg_color, struct xrdp_brush *brush,
+                          struct xrdp_rect *rect);
+int
+xrdp_orders_batch_dest_blt(struct xrdp_orders *self, int x, int y,
+                           int cx, int cy, int rop,
+                           struct xrdp_rect *rect);
+int
+xrdp_orders_batch_line(struct xrdp_orders *self, int mix_mode,
+                       int startx, int starty,
+                       int endx, int endy, int rop, int bg_color,
+                       struct xrdp_pen *pen,
+                       struct xrdp_rect *rect);
+int
+xrdp_orders_batch_mem_blt(struct xrdp_orders *self, int cache_id,
+                          int color_table, int x, int y, int cx, int cy,
+                          int rop, int srcx, int srcy,
+                          int cache_idx, struct xrdp_rect *rect);
+void
+xrdp_orders_stats_add(struct xrdp_orders *self, int order_type,
+                      const char *order_start);
+void
+xrdp_orders_stats_log(struct xrdp_orders *self);
+
 /* xrdp_bitmap_compress.c */
 int
 xrdp_bitmap_compress(char *in_data, int width, int height,
@@ -583,6 +855,18 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
                        int start_line, struct stream *temp_s,
                        int e, int flags);
 int
+xrdp_bitmap32_compress_kernels(const struct xrdp_planar_kernels *kernels,
+                               char *in_data, int width, int height,
+                               struct stream *s, int bpp, int byte_limit,
+                               int start_line, struct stream *temp_s,
+                               int e, int flags);
+
+/* xrdp_bitmap32_kernels.c */
+const struct xrdp_planar_kernels *
+xrdp_planar_kernels_scalar(void);
+const struct xrdp_planar_kernels *
+xrdp_planar_kernels_best(void);
+int
 xrdp_jpeg_compress(void *handle, char *in_data, int width, int height,
                    struct stream *s, int bpp, int byte_limit,
                    int start_line, struct stream *temp_s,
@@ -181,6 +181,21 @@ libxrdp_orders_text(struct xrdp_session *session,
                     int x, int y, char *data, int data_len,
                     struct xrdp_rect *rect);
 int
+libxrdp_orders_multi_rect(struct xrdp_session *session, int color,
+                          const struct xrdp_rect *rects, int num_rects);
+int
+libxrdp_orders_multi_dest_blt(struct xrdp_session *session, int rop,
+                              const struct xrdp_rect *rects, int num_rects);
+int
+libxrdp_orders_multi_pat_blt(struct xrdp_session *session, int rop,
+                             int bg_color, int fg_color,
+                             struct xrdp_brush *brush,
+                             const struct xrdp_rect *rects, int num_rects);
+int
+libxrdp_orders_multi_screen_blt(struct xrdp_session *session, int dx, int dy,
+                                int rop, const struct xrdp_rect *rects,
+                                int num_rects);
+int
 libxrdp_orders_send_palette(struct xrdp_session *session, int *palette,
                             int cache_id);
 int
@@ -219,6 +234,33 @@ libxrdp_orders_send_bitmap3(struct xrdp_session *session,
  */
 int
 libxrdp_get_channel_count(const struct xrdp_session *session);
+/**
+ * Returns the bulk compression totals for the session
+ *
+ * @param session RDP session
+ * @param[out] bytes_in Bytes given to the bulk compressor
+ * @param[out] bytes_out Bytes sent for them
+ */
+void
+libxrdp_get_bulk_stats(const struct xrdp_session *session,
+                       tui64 *bytes_in, tui64 *bytes_out);
+/**
+ * Network auto-detect requests, results come back through the session
+ * callback as 0x555b (average RTT ms, bandwidth kbit/s, base RTT ms)
+ *
+ * A bandwidth measure covers what is sent between the start and the stop
+ *
+ * @param session RDP session
+ * @return 0 if sent, non zero if auto-detect isn't available, the
+ *         send failed, or for the start and stop, the measure is already
+ *         started or not started
+ */
+int
+libxrdp_autodetect_rtt(struct xrdp_session *session);
+int
+libxrdp_autodetect_bw_start(struct xrdp_session *session);
+int
+libxrdp_autodetect_bw_stop(struct xrdp_session *session);
 int
 libxrdp_query_channel(struct xrdp_session *session, int channel_id,
                       char *channel_name, int *channel_flags);
@@ -238,6 +280,10 @@ libxrdp_send_to_channel(struct xrdp_session *session, int channel_id,
                         char *data, int data_len,
                         int total_data_len, int flags);
 int
+libxrdp_channel_sched_check(struct xrdp_session *session);
+int
+libxrdp_channel_sched_get_timeout(struct xrdp_session *session, int *timeout);
+int
 libxrdp_disable_channel(struct xrdp_session *session, int channel_id,
                         int is_disabled);
 int
@@ -0,0 +1,400 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * network auto-detect
+ *
+ * [MS-RDPBCGR] 2.2.14 and 3.2.5.4. When the client asks for it, PDUs go
+ * over the MCS message channel to measure the link once the session is
+ * up. An RTT request is answered at once by the client. A bandwidth
+ * measure is a start request, the normal server output for a while, and
+ * a stop request, the client answers with the bytes it got and the time
+ * between the two. The results are smoothed, sent back to the client as
+ * network characteristics and passed on to the session callback as
+ * 0x555b (average RTT, bandwidth in kbit/s, base RTT).
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+
+/* bandwidth measures with less than this in them say more about the
+   timer than the link, so they are dropped */
+#define XRDP_AUTODETECT_MIN_BW_BYTES (16 * 1024)
+
+/* results in a row needed to change the connection type, so a link near
+   a threshold doesn't reopen the encoders with every RTT sample */
+#define XRDP_AUTODETECT_TYPE_RESULTS 3
+
+/*****************************************************************************/
+struct xrdp_autodetect *
+xrdp_autodetect_create(struct xrdp_sec *owner)
+{
+    struct xrdp_autodetect *self;
+
+    self = g_new0(struct xrdp_autodetect, 1);
+    if (self != NULL)
+    {
+        self->sec_layer = owner;
+        self->rtt_seq = -1;
+        self->bw_seq = -1;
+        self->base_rtt = -1;
+        self->avg_rtt = -1;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_autodetect_delete(struct xrdp_autodetect *self)
+{
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* [MS-RDPBCGR] 2.2.14.3 Auto-Detect Request PDU, returns error */
+static int
+xrdp_autodetect_send(struct xrdp_autodetect *self, int request_type,
+                     int seq, const char *data, int data_bytes)
+{
+    struct stream *s;
+    int rv;
+
+    if (self->sec_layer == NULL)
+    {
+        return 0;
+    }
+    make_stream(s);
+    init_stream(s, 8192);
+    if (xrdp_sec_init_msg_channel(self->sec_layer, s) != 0)
+    {
+        free_stream(s);
+        return 1;
+    }
+    out_uint8(s, 6 + data_bytes); /* headerLength */
+    out_uint8(s, TYPE_ID_AUTODETECT_REQUEST); /* headerTypeId */
+    out_uint16_le(s, seq); /* sequenceNumber */
+    out_uint16_le(s, request_type); /* requestType */
+    if (data_bytes > 0)
+    {
+        out_uint8a(s, data, data_bytes);
+    }
+    s_mark_end(s);
+    LOG_DEVEL(LOG_LEVEL_TRACE, "Sending [MS-RDPBCGR] Auto-Detect Request "
+              "headerLength %d, sequenceNumber %d, requestType 0x%4.4x",
+              6 + data_bytes, seq, request_type);
+    rv = xrdp_sec_send_msg_channel(self->sec_layer, s, SEC_AUTODETECT_REQ);
+    free_stream(s);
+    return rv;
+}
+
+/*****************************************************************************/
+static int
+xrdp_autodetect_next_seq(struct xrdp_autodetect *self)
+{
+    self->seq = (self->seq + 1) & 0xffff;
+    return self->seq;
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_autodetect_send_rtt(struct xrdp_autodetect *self)
+{
+    self->rtt_seq = xrdp_autodetect_next_seq(self);
+    self->rtt_sent = g_time3();
+    return xrdp_autodetect_send(self, RDP_RTT_REQUEST_TYPE_CONTINUOUS,
+                                self->rtt_seq, NULL, 0);
+}
+
+/*****************************************************************************/
+/* returns error, or 1 if a measure is already started */
+int
+xrdp_autodetect_send_bw_start(struct xrdp_autodetect *self)
+{
+    if (self->bw_started)
+    {
+        return 1;
+    }
+    self->bw_started = 1;
+    return xrdp_autodetect_send(self, RDP_BW_START_REQUEST_TYPE_CONTINUOUS,
+                                xrdp_autodetect_next_seq(self), NULL, 0);
+}
+
+/*****************************************************************************/
+/* returns error, or 1 if no measure is started */
+int
+xrdp_autodetect_send_bw_stop(struct xrdp_autodetect *self)
+{
+    if (!self->bw_started)
+    {
+        return 1;
+    }
+    self->bw_started = 0;
+    self->bw_seq = xrdp_autodetect_next_seq(self);
+    return xrdp_autodetect_send(self, RDP_BW_STOP_REQUEST_TYPE_CONTINUOUS,
+                                self->bw_seq, NULL, 0);
+}
+
+/*****************************************************************************/
+/* lets the client and the session know what has been measured */
+static int
+xrdp_autodetect_result(struct xrdp_autodetect *self)
+{
+    struct xrdp_session *session;
+    struct xrdp_client_info *client_info;
+    char data[12];
+    char *p;
+
+    if (self->sec_layer == NULL)
+    {
+        return 0;
+    }
+    client_info = &(self->sec_layer->rdp_layer->client_info);
+    if (self->connection_type != 0)
+    {
+        client_info->detected_connection_type = self->connection_type;
+
+        /* [MS-RDPBCGR] 2.2.14.1.6 Network Characteristics Result */
+        p = data;
+        p[0] = self->base_rtt;
+        p[1] = self->base_rtt >> 8;
+        p[2] = self->base_rtt >> 16;
+        p[3] = self->base_rtt >> 24;
+        p += 4;
+        p[0] = self->bandwidth;
+        p[1] = self->bandwidth >> 8;
+        p[2] = self->bandwidth >> 16;
+        p[3] = self->bandwidth >> 24;
+        p += 4;
+        p[0] = self->avg_rtt;
+        p[1] = self->avg_rtt >> 8;
+        p[2] = self->avg_rtt >> 16;
+        p[3] = self->avg_rtt >> 24;
+        if (xrdp_autodetect_send(self, RDP_NETCHAR_RESULT_BASE_BW_AVG,
+                                 xrdp_autodetect_next_seq(self),
+                                 data, 12) != 0)
+        {
+            return 1;
+        }
+    }
+    session = self->sec_layer->rdp_layer->session;
+    if (session != NULL && session->callback != 0)
+    {
+        /* call to xrdp_wm.c : callback */
+        session->callback(session->id, 0x555b, self->avg_rtt,
+                          self->bandwidth, self->base_rtt, 0);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+xrdp_autodetect_add_rtt(struct xrdp_autodetect *self, int rtt)
+{
+    if (self->base_rtt < 0 || rtt < self->base_rtt)
+    {
+        self->base_rtt = rtt;
+    }
+    if (self->avg_rtt < 0)
+    {
+        self->avg_rtt = rtt;
+    }
+    else
+    {
+        self->avg_rtt = (self->avg_rtt * 7 + rtt) / 8;
+    }
+}
+
+/*****************************************************************************/
+static void
+xrdp_autodetect_add_bandwidth(struct xrdp_autodetect *self, int kbps)
+{
+    if (self->bandwidth <= 0)
+    {
+        self->bandwidth = kbps;
+    }
+    else
+    {
+        self->bandwidth = (self->bandwidth * 3 + kbps) / 4;
+    }
+}
+
+/*****************************************************************************/
+/* the first type measured is used at once, after that a change needs
+   XRDP_AUTODETECT_TYPE_RESULTS results in a row */
+static void
+xrdp_autodetect_update_type(struct xrdp_autodetect *self)
+{
+    int type;
+
+    if (self->bandwidth <= 0 || self->avg_rtt < 0)
+    {
+        return;
+    }
+    type = xrdp_autodetect_connection_type(self->bandwidth, self->avg_rtt);
+    if (type == self->connection_type)
+    {
+        self->next_type_count = 0;
+        return;
+    }
+    if (type != self->next_type)
+    {
+        self->next_type = type;
+        self->next_type_count = 0;
+    }
+    self->next_type_count++;
+    if (self->connection_type == 0 ||
+            self->next_type_count >= XRDP_AUTODETECT_TYPE_RESULTS)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_autodetect_update_type: "
+                  "connection type %d to %d", self->connection_type, type);
+        self->connection_type = type;
+        self->next_type_count = 0;
+    }
+}
+
+/*****************************************************************************/
+/* [MS-RDPBCGR] 2.2.14.4 Auto-Detect Response PDU, the security header has
+   been read, returns error */
+int
+xrdp_autodetect_process(struct xrdp_autodetect *self, struct stream *s,
+                        int now)
+{
+    int header_length;
+    int header_type_id;
+    int seq;
+    int response_type;
+    int time_delta;
+    int byte_count;
+    int rtt;
+    tui64 kbps;
+
+    if (!s_check_rem_and_log(s, 6, "Parsing [MS-RDPBCGR] Auto-Detect "
+                             "Response"))
+    {
+        return 1;
+    }
+    in_uint8(s, header_length);
+    in_uint8(s, header_type_id);
+    in_uint16_le(s, seq);
+    in_uint16_le(s, response_type);
+    LOG_DEVEL(LOG_LEVEL_TRACE, "Received [MS-RDPBCGR] Auto-Detect Response "
+              "headerLength %d, headerTypeId %d, sequenceNumber %d, "
+              "responseType 0x%4.4x", header_length, header_type_id, seq,
+              response_type);
+    if (header_type_id != TYPE_ID_AUTODETECT_RESPONSE || header_length < 6)
+    {
+        LOG(LOG_LEVEL_WARNING, "[MS-RDPBCGR] Protocol error: bad "
+            "Auto-Detect Response headerLength %d, headerTypeId %d",
+            header_length, header_type_id);
+        return 1;
+    }
+
+    switch (response_type)
+    {
+        case RDP_RTT_RESPONSE_TYPE:
+            if (seq != self->rtt_seq)
+            {
+                LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_autodetect_process: "
+                          "RTT response %d is not for %d", seq, self->rtt_seq);
+                return 0;
+            }
+            self->rtt_seq = -1;
+            rtt = now - self->rtt_sent;
+            xrdp_autodetect_add_rtt(self, MAX(rtt, 0));
+            break;
+
+        case RDP_BW_RESULTS_RESPONSE_TYPE_CONNECTTIME:
+        case RDP_BW_RESULTS_RESPONSE_TYPE_CONTINUOUS:
+            if (!s_check_rem_and_log(s, 8, "Parsing [MS-RDPBCGR] "
+                                     "Bandwidth Measure Results"))
+            {
+                return 1;
+            }
+            in_uint32_le(s, time_delta);
+            in_uint32_le(s, byte_count);
+            if (seq != self->bw_seq)
+            {
+                LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_autodetect_process: "
+                          "bandwidth results %d are not for %d",
+                          seq, self->bw_seq);
+                return 0;
+            }
+            self->bw_seq = -1;
+            if (time_delta <= 0 ||
+                    (unsigned int) byte_count < XRDP_AUTODETECT_MIN_BW_BYTES)
+            {
+                LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_autodetect_process: "
+                          "bandwidth measure too small, %u bytes in %d ms",
+                          (unsigned int) byte_count, time_delta);
+                return 0;
+            }
+            kbps = ((tui64) (unsigned int) byte_count) * 8 / time_delta;
+            /* capped so the smoothing can't overflow */
+            xrdp_autodetect_add_bandwidth(self,
+                                          (int) MIN(kbps, 0x1fffffff));
+            break;
+
+        case RDP_NETCHAR_SYNC_RESPONSE_TYPE:
+            if (!s_check_rem_and_log(s, 8, "Parsing [MS-RDPBCGR] "
+                                     "Network Characteristics Sync"))
+            {
+                return 1;
+            }
+            in_uint32_le(s, byte_count); /* bandwidth */
+            in_uint32_le(s, rtt);
+            if (byte_count > 0)
+            {
+                self->bandwidth = byte_count;
+            }
+            if (rtt >= 0)
+            {
+                self->base_rtt = rtt;
+                self->avg_rtt = rtt;
+            }
+            break;
+
+        default:
+            LOG(LOG_LEVEL_WARNING, "xrdp_autodetect_process: unknown "
+                "responseType 0x%4.4x (ignored)", response_type);
+            return 0;
+    }
+    xrdp_autodetect_update_type(self);
+    return xrdp_autodetect_result(self);
+}
+
+/*****************************************************************************/
+/* maps a measured link to a [MS-RDPBCGR] connectionType */
+int
+xrdp_autodetect_connection_type(int bandwidth, int rtt)
+{
+    if (bandwidth < 256)
+    {
+        return CONNECTION_TYPE_MODEM;
+    }
+    if (bandwidth < 2000)
+    {
+        return CONNECTION_TYPE_BROADBAND_LOW;
+    }
+    if (bandwidth < 10000)
+    {
+        return (rtt >= 300) ? CONNECTION_TYPE_SATELLITE :
+               CONNECTION_TYPE_BROADBAND_HIGH;
+    }
+    return (rtt >= 50) ? CONNECTION_TYPE_WAN : CONNECTION_TYPE_LAN;
+}
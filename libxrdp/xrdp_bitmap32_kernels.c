@@ -0,0 +1,809 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2014
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * planar bitmap compressor
+ * plane split, delta and run detection kernels
+ *
+ * Every kernel set here must produce exactly the same output as the
+ * scalar set, the planar encoder picks one at runtime
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XRDP_PLANAR_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__ARM_NEON)
+#define XRDP_PLANAR_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*****************************************************************************/
+/* scalar kernels */
+
+/*****************************************************************************/
+static void
+split3_row_c(const char *in_data, int width,
+             char *r_data, char *g_data, char *b_data)
+{
+#if defined(L_ENDIAN)
+    int rp;
+    int gp;
+    int bp;
+#endif
+    int index;
+    int pixel;
+    const int *ptr32;
+
+    ptr32 = (const int *) in_data;
+    index = 0;
+#if defined(L_ENDIAN)
+    while (index + 4 <= width)
+    {
+        pixel = *ptr32;
+        ptr32++;
+        rp  = (pixel >> 16) & 0x000000ff;
+        gp  = (pixel >>  8) & 0x000000ff;
+        bp  = (pixel >>  0) & 0x000000ff;
+        pixel  = *ptr32;
+        ptr32++;
+        rp |= (pixel >>  8) & 0x0000ff00;
+        gp |= (pixel <<  0) & 0x0000ff00;
+        bp |= (pixel <<  8) & 0x0000ff00;
+        pixel = *ptr32;
+        ptr32++;
+        rp |= (pixel >>  0) & 0x00ff0000;
+        gp |= (pixel <<  8) & 0x00ff0000;
+        bp |= (pixel << 16) & 0x00ff0000;
+        pixel = *ptr32;
+        ptr32++;
+        rp |= (pixel <<  8) & 0xff000000;
+        gp |= (pixel << 16) & 0xff000000;
+        bp |= (pixel << 24) & 0xff000000;
+        *((int *)(r_data + index)) = rp;
+        *((int *)(g_data + index)) = gp;
+        *((int *)(b_data + index)) = bp;
+        index += 4;
+    }
+#endif
+    while (index < width)
+    {
+        pixel = *ptr32;
+        ptr32++;
+        r_data[index] = pixel >> 16;
+        g_data[index] = pixel >> 8;
+        b_data[index] = pixel >> 0;
+        index++;
+    }
+}
+
+/*****************************************************************************/
+static void
+split4_row_c(const char *in_data, int width,
+             char *a_data, char *r_data, char *g_data, char *b_data)
+{
+#if defined(L_ENDIAN)
+    int ap;
+    int rp;
+    int gp;
+    int bp;
+#endif
+    int index;
+    int pixel;
+    const int *ptr32;
+
+    ptr32 = (const int *) in_data;
+    index = 0;
+#if defined(L_ENDIAN)
+    while (index + 4 <= width)
+    {
+        pixel = *ptr32;
+        ptr32++;
+        ap  = (pixel >> 24) & 0x000000ff;
+        rp  = (pixel >> 16) & 0x000000ff;
+        gp  = (pixel >>  8) & 0x000000ff;
+        bp  = (pixel >>  0) & 0x000000ff;
+        pixel  = *ptr32;
+        ptr32++;
+        ap |= (pixel >> 16) & 0x0000ff00;
+        rp |= (pixel >>  8) & 0x0000ff00;
+        gp |= (pixel <<  0) & 0x0000ff00;
+        bp |= (pixel <<  8) & 0x0000ff00;
+        pixel = *ptr32;
+        ptr32++;
+        ap |= (pixel >>  8) & 0x00ff0000;
+        rp |= (pixel >>  0) & 0x00ff0000;
+        gp |= (pixel <<  8) & 0x00ff0000;
+        bp |= (pixel << 16) & 0x00ff0000;
+        pixel = *ptr32;
+        ptr32++;
+        ap |= (pixel <<  0) & 0xff000000;
+        rp |= (pixel <<  8) & 0xff000000;
+        gp |= (pixel << 16) & 0xff000000;
+        bp |= (pixel << 24) & 0xff000000;
+        *((int *)(a_data + index)) = ap;
+        *((int *)(r_data + index)) = rp;
+        *((int *)(g_data + index)) = gp;
+        *((int *)(b_data + index)) = bp;
+        index += 4;
+    }
+#endif
+    while (index < width)
+    {
+        pixel = *ptr32;
+        ptr32++;
+        a_data[index] = pixel >> 24;
+        r_data[index] = pixel >> 16;
+        g_data[index] = pixel >> 8;
+        b_data[index] = pixel >> 0;
+        index++;
+    }
+}
+
+/*****************************************************************************/
+#define DELTA_ONE \
+    do { \
+        delta = cur8[0] - prev8[0]; \
+        is_neg = (delta >> 7) & 1; \
+        dst8[0] = (((delta ^ -is_neg) + is_neg) << 1) - is_neg; \
+        prev8++; \
+        cur8++; \
+        dst8++; \
+    } while (0)
+
+/*****************************************************************************/
+/* out_plane[i] = sign-magnitude-2x(cur[i] - prev[i]) */
+static void
+delta_c(const char *prev, const char *cur, char *out_plane, int count)
+{
+    char delta;
+    char is_neg;
+    const char *prev8;
+    const char *cur8;
+    const char *cur8_end;
+    char *dst8;
+
+    prev8 = prev;
+    cur8 = cur;
+    dst8 = out_plane;
+    cur8_end = cur8 + count;
+    while (cur8 + 8 <= cur8_end)
+    {
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+        DELTA_ONE;
+    }
+    while (cur8 < cur8_end)
+    {
+        DELTA_ONE;
+    }
+}
+
+/*****************************************************************************/
+/* returns the number of leading positions i in [0, count) where
+   ptr8[i] == ptr8[i + 1], reads count + 1 bytes */
+static int
+equal_run_c(const char *ptr8, int count)
+{
+    int index;
+
+    for (index = 0; index < count; index++)
+    {
+        if (ptr8[index] != ptr8[index + 1])
+        {
+            break;
+        }
+    }
+    return index;
+}
+
+/*****************************************************************************/
+/* returns the number of leading positions i in [0, count) where
+   ptr8[i] != ptr8[i + 1], reads count + 1 bytes */
+static int
+differ_run_c(const char *ptr8, int count)
+{
+    int index;
+
+    for (index = 0; index < count; index++)
+    {
+        if (ptr8[index] == ptr8[index + 1])
+        {
+            break;
+        }
+    }
+    return index;
+}
+
+static const struct xrdp_planar_kernels g_planar_kernels_c =
+{
+    "scalar",
+    split3_row_c,
+    split4_row_c,
+    delta_c,
+    equal_run_c,
+    differ_run_c
+};
+
+#if defined(XRDP_PLANAR_X86)
+
+/*****************************************************************************/
+/* SSE2 kernels, 16 pixels / bytes per step */
+
+/*****************************************************************************/
+__attribute__((target("sse2")))
+static void
+split3_row_sse2(const char *in_data, int width,
+                char *r_data, char *g_data, char *b_data)
+{
+    __m128i mask;
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+    __m128i c01;
+    __m128i c23;
+    int index;
+
+    mask = _mm_set1_epi32(0xff);
+    index = 0;
+    while (index + 16 <= width)
+    {
+        p0 = _mm_loadu_si128((const __m128i *) (in_data + index * 4));
+        p1 = _mm_loadu_si128((const __m128i *) (in_data + index * 4 + 16));
+        p2 = _mm_loadu_si128((const __m128i *) (in_data + index * 4 + 32));
+        p3 = _mm_loadu_si128((const __m128i *) (in_data + index * 4 + 48));
+        c01 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                              _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+        c23 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 16), mask),
+                              _mm_and_si128(_mm_srli_epi32(p3, 16), mask));
+        _mm_storeu_si128((__m128i *) (r_data + index),
+                         _mm_packus_epi16(c01, c23));
+        c01 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                              _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+        c23 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 8), mask),
+                              _mm_and_si128(_mm_srli_epi32(p3, 8), mask));
+        _mm_storeu_si128((__m128i *) (g_data + index),
+                         _mm_packus_epi16(c01, c23));
+        c01 = _mm_packs_epi32(_mm_and_si128(p0, mask),
+                              _mm_and_si128(p1, mask));
+        c23 = _mm_packs_epi32(_mm_and_si128(p2, mask),
+                              _mm_and_si128(p3, mask));
+        _mm_storeu_si128((__m128i *) (b_data + index),
+                         _mm_packus_epi16(c01, c23));
+        index += 16;
+    }
+    split3_row_c(in_data + index * 4, width - index,
+                 r_data + index, g_data + index, b_data + index);
+}
+
+/*****************************************************************************/
+__attribute__((target("sse2")))
+static void
+split4_row_sse2(const char *in_data, int width,
+                char *a_data, char *r_data, char *g_data, char *b_data)
+{
+    __m128i mask;
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+    __m128i c01;
+    __m128i c23;
+    int index;
+
+    mask = _mm_set1_epi32(0xff);
+    index = 0;
+    while (index + 16 <= width)
+    {
+        p0 = _mm_loadu_si128((const __m128i *) (in_data + index * 4));
+        p1 = _mm_loadu_si128((const __m128i *) (in_data + index * 4 + 16));
+        p2 = _mm_loadu_si128((const __m128i *) (in_data + index * 4 + 32));
+        p3 = _mm_loadu_si128((const __m128i *) (in_data + index * 4 + 48));
+        c01 = _mm_packs_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24));
+        c23 = _mm_packs_epi32(_mm_srli_epi32(p2, 24), _mm_srli_epi32(p3, 24));
+        _mm_storeu_si128((__m128i *) (a_data + index),
+                         _mm_packus_epi16(c01, c23));
+        c01 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask),
+                              _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+        c23 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 16), mask),
+                              _mm_and_si128(_mm_srli_epi32(p3, 16), mask));
+        _mm_storeu_si128((__m128i *) (r_data + index),
+                         _mm_packus_epi16(c01, c23));
+        c01 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask),
+                              _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+        c23 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 8), mask),
+                              _mm_and_si128(_mm_srli_epi32(p3, 8), mask));
+        _mm_storeu_si128((__m128i *) (g_data + index),
+                         _mm_packus_epi16(c01, c23));
+        c01 = _mm_packs_epi32(_mm_and_si128(p0, mask),
+                              _mm_and_si128(p1, mask));
+        c23 = _mm_packs_epi32(_mm_and_si128(p2, mask),
+                              _mm_and_si128(p3, mask));
+        _mm_storeu_si128((__m128i *) (b_data + index),
+                         _mm_packus_epi16(c01, c23));
+        index += 16;
+    }
+    split4_row_c(in_data + index * 4, width - index,
+                 a_data + index, r_data + index, g_data + index,
+                 b_data + index);
+}
+
+/*****************************************************************************/
+/* (d << 1) ^ (d >> 7) is the same mapping as DELTA_ONE */
+__attribute__((target("sse2")))
+static void
+delta_sse2(const char *prev, const char *cur, char *out_plane, int count)
+{
+    __m128i zero;
+    __m128i d;
+    int index;
+
+    zero = _mm_setzero_si128();
+    index = 0;
+    while (index + 16 <= count)
+    {
+        d = _mm_sub_epi8(_mm_loadu_si128((const __m128i *) (cur + index)),
+                         _mm_loadu_si128((const __m128i *) (prev + index)));
+        d = _mm_xor_si128(_mm_add_epi8(d, d), _mm_cmpgt_epi8(zero, d));
+        _mm_storeu_si128((__m128i *) (out_plane + index), d);
+        index += 16;
+    }
+    delta_c(prev + index, cur + index, out_plane + index, count - index);
+}
+
+/*****************************************************************************/
+__attribute__((target("sse2")))
+static int
+equal_run_sse2(const char *ptr8, int count)
+{
+    __m128i a;
+    __m128i b;
+    unsigned int mask;
+    int index;
+
+    index = 0;
+    while (index + 16 <= count)
+    {
+        a = _mm_loadu_si128((const __m128i *) (ptr8 + index));
+        b = _mm_loadu_si128((const __m128i *) (ptr8 + index + 1));
+        mask = ~((unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+        mask &= 0xffff;
+        if (mask != 0)
+        {
+            return index + __builtin_ctz(mask);
+        }
+        index += 16;
+    }
+    return index + equal_run_c(ptr8 + index, count - index);
+}
+
+/*****************************************************************************/
+__attribute__((target("sse2")))
+static int
+differ_run_sse2(const char *ptr8, int count)
+{
+    __m128i a;
+    __m128i b;
+    unsigned int mask;
+    int index;
+
+    index = 0;
+    while (index + 16 <= count)
+    {
+        a = _mm_loadu_si128((const __m128i *) (ptr8 + index));
+        b = _mm_loadu_si128((const __m128i *) (ptr8 + index + 1));
+        mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+        if (mask != 0)
+        {
+            return index + __builtin_ctz(mask);
+        }
+        index += 16;
+    }
+    return index + differ_run_c(ptr8 + index, count - index);
+}
+
+static const struct xrdp_planar_kernels g_planar_kernels_sse2 =
+{
+    "sse2",
+    split3_row_sse2,
+    split4_row_sse2,
+    delta_sse2,
+    equal_run_sse2,
+    differ_run_sse2
+};
+
+/*****************************************************************************/
+/* AVX2 kernels, 32 pixels / bytes per step */
+
+/*****************************************************************************/
+/* pack four vectors of 8 dwords (0 - 255) into 32 ordered bytes, the
+   packs work per 128 bit lane so the dwords need a fixup permute */
+__attribute__((target("avx2")))
+static __m256i
+pack_plane_avx2(__m256i c0, __m256i c1, __m256i c2, __m256i c3)
+{
+    __m256i c01;
+    __m256i c23;
+
+    c01 = _mm256_packs_epi32(c0, c1);
+    c23 = _mm256_packs_epi32(c2, c3);
+    return _mm256_permutevar8x32_epi32(_mm256_packus_epi16(c01, c23),
+                                       _mm256_setr_epi32(0, 4, 1, 5,
+                                               2, 6, 3, 7));
+}
+
+/*****************************************************************************/
+__attribute__((target("avx2")))
+static void
+split3_row_avx2(const char *in_data, int width,
+                char *r_data, char *g_data, char *b_data)
+{
+    __m256i mask;
+    __m256i p0;
+    __m256i p1;
+    __m256i p2;
+    __m256i p3;
+    int index;
+
+    mask = _mm256_set1_epi32(0xff);
+    index = 0;
+    while (index + 32 <= width)
+    {
+        p0 = _mm256_loadu_si256((const __m256i *) (in_data + index * 4));
+        p1 = _mm256_loadu_si256((const __m256i *) (in_data + index * 4 + 32));
+        p2 = _mm256_loadu_si256((const __m256i *) (in_data + index * 4 + 64));
+        p3 = _mm256_loadu_si256((const __m256i *) (in_data + index * 4 + 96));
+        _mm256_storeu_si256((__m256i *) (r_data + index),
+                            pack_plane_avx2(
+                                _mm256_and_si256(_mm256_srli_epi32(p0, 16), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p1, 16), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p2, 16), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p3, 16), mask)));
+        _mm256_storeu_si256((__m256i *) (g_data + index),
+                            pack_plane_avx2(
+                                _mm256_and_si256(_mm256_srli_epi32(p0, 8), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p1, 8), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p2, 8), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p3, 8), mask)));
+        _mm256_storeu_si256((__m256i *) (b_data + index),
+                            pack_plane_avx2(
+                                _mm256_and_si256(p0, mask),
+                                _mm256_and_si256(p1, mask),
+                                _mm256_and_si256(p2, mask),
+                                _mm256_and_si256(p3, mask)));
+        index += 32;
+    }
+    split3_row_sse2(in_data + index * 4, width - index,
+                    r_data + index, g_data + index, b_data + index);
+}
+
+/*****************************************************************************/
+__attribute__((target("avx2")))
+static void
+split4_row_avx2(const char *in_data, int width,
+                char *a_data, char *r_data, char *g_data, char *b_data)
+{
+    __m256i mask;
+    __m256i p0;
+    __m256i p1;
+    __m256i p2;
+    __m256i p3;
+    int index;
+
+    mask = _mm256_set1_epi32(0xff);
+    index = 0;
+    while (index + 32 <= width)
+    {
+        p0 = _mm256_loadu_si256((const __m256i *) (in_data + index * 4));
+        p1 = _mm256_loadu_si256((const __m256i *) (in_data + index * 4 + 32));
+        p2 = _mm256_loadu_si256((const __m256i *) (in_data + index * 4 + 64));
+        p3 = _mm256_loadu_si256((const __m256i *) (in_data + index * 4 + 96));
+        _mm256_storeu_si256((__m256i *) (a_data + index),
+                            pack_plane_avx2(
+                                _mm256_srli_epi32(p0, 24),
+                                _mm256_srli_epi32(p1, 24),
+                                _mm256_srli_epi32(p2, 24),
+                                _mm256_srli_epi32(p3, 24)));
+        _mm256_storeu_si256((__m256i *) (r_data + index),
+                            pack_plane_avx2(
+                                _mm256_and_si256(_mm256_srli_epi32(p0, 16), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p1, 16), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p2, 16), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p3, 16), mask)));
+        _mm256_storeu_si256((__m256i *) (g_data + index),
+                            pack_plane_avx2(
+                                _mm256_and_si256(_mm256_srli_epi32(p0, 8), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p1, 8), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p2, 8), mask),
+                                _mm256_and_si256(_mm256_srli_epi32(p3, 8), mask)));
+        _mm256_storeu_si256((__m256i *) (b_data + index),
+                            pack_plane_avx2(
+                                _mm256_and_si256(p0, mask),
+                                _mm256_and_si256(p1, mask),
+                                _mm256_and_si256(p2, mask),
+                                _mm256_and_si256(p3, mask)));
+        index += 32;
+    }
+    split4_row_sse2(in_data + index * 4, width - index,
+                    a_data + index, r_data + index, g_data + index,
+                    b_data + index);
+}
+
+/*****************************************************************************/
+__attribute__((target("avx2")))
+static void
+delta_avx2(const char *prev, const char *cur, char *out_plane, int count)
+{
+    __m256i zero;
+    __m256i d;
+    int index;
+
+    zero = _mm256_setzero_si256();
+    index = 0;
+    while (index + 32 <= count)
+    {
+        d = _mm256_sub_epi8(
+                _mm256_loadu_si256((const __m256i *) (cur + index)),
+                _mm256_loadu_si256((const __m256i *) (prev + index)));
+        d = _mm256_xor_si256(_mm256_add_epi8(d, d),
+                             _mm256_cmpgt_epi8(zero, d));
+        _mm256_storeu_si256((__m256i *) (out_plane + index), d);
+        index += 32;
+    }
+    delta_sse2(prev + index, cur + index, out_plane + index, count - index);
+}
+
+/*****************************************************************************/
+__attribute__((target("avx2")))
+static int
+equal_run_avx2(const char *ptr8, int count)
+{
+    __m256i a;
+    __m256i b;
+    unsigned int mask;
+    int index;
+
+    index = 0;
+    while (index + 32 <= count)
+    {
+        a = _mm256_loadu_si256((const __m256i *) (ptr8 + index));
+        b = _mm256_loadu_si256((const __m256i *) (ptr8 + index + 1));
+        mask = ~((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+        if (mask != 0)
+        {
+            return index + __builtin_ctz(mask);
+        }
+        index += 32;
+    }
+    return index + equal_run_sse2(ptr8 + index, count - index);
+}
+
+/*****************************************************************************/
+__attribute__((target("avx2")))
+static int
+differ_run_avx2(const char *ptr8, int count)
+{
+    __m256i a;
+    __m256i b;
+    unsigned int mask;
+    int index;
+
+    index = 0;
+    while (index + 32 <= count)
+    {
+        a = _mm256_loadu_si256((const __m256i *) (ptr8 + index));
+        b = _mm256_loadu_si256((const __m256i *) (ptr8 + index + 1));
+        mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        if (mask != 0)
+        {
+            return index + __builtin_ctz(mask);
+        }
+        index += 32;
+    }
+    return index + differ_run_sse2(ptr8 + index, count - index);
+}
+
+static const struct xrdp_planar_kernels g_planar_kernels_avx2 =
+{
+    "avx2",
+    split3_row_avx2,
+    split4_row_avx2,
+    delta_avx2,
+    equal_run_avx2,
+    differ_run_avx2
+};
+
+#endif /* XRDP_PLANAR_X86 */
+
+#if defined(XRDP_PLANAR_NEON)
+
+/*****************************************************************************/
+/* NEON kernels, 16 pixels / bytes per step */
+
+/*****************************************************************************/
+/* 4 bits per input byte, lowest byte first */
+static uint64_t
+neon_mask_u8(uint8x16_t cmp)
+{
+    uint8x8_t nibbles;
+
+    nibbles = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+
+/*****************************************************************************/
+static void
+split3_row_neon(const char *in_data, int width,
+                char *r_data, char *g_data, char *b_data)
+{
+    uint8x16x4_t bgra;
+    int index;
+
+    index = 0;
+    while (index + 16 <= width)
+    {
+        bgra = vld4q_u8((const uint8_t *) (in_data + index * 4));
+        vst1q_u8((uint8_t *) (r_data + index), bgra.val[2]);
+        vst1q_u8((uint8_t *) (g_data + index), bgra.val[1]);
+        vst1q_u8((uint8_t *) (b_data + index), bgra.val[0]);
+        index += 16;
+    }
+    split3_row_c(in_data + index * 4, width - index,
+                 r_data + index, g_data + index, b_data + index);
+}
+
+/*****************************************************************************/
+static void
+split4_row_neon(const char *in_data, int width,
+                char *a_data, char *r_data, char *g_data, char *b_data)
+{
+    uint8x16x4_t bgra;
+    int index;
+
+    index = 0;
+    while (index + 16 <= width)
+    {
+        bgra = vld4q_u8((const uint8_t *) (in_data + index * 4));
+        vst1q_u8((uint8_t *) (a_data + index), bgra.val[3]);
+        vst1q_u8((uint8_t *) (r_data + index), bgra.val[2]);
+        vst1q_u8((uint8_t *) (g_data + index), bgra.val[1]);
+        vst1q_u8((uint8_t *) (b_data + index), bgra.val[0]);
+        index += 16;
+    }
+    split4_row_c(in_data + index * 4, width - index,
+                 a_data + index, r_data + index, g_data + index,
+                 b_data + index);
+}
+
+/*****************************************************************************/
+static void
+delta_neon(const char *prev, const char *cur, char *out_plane, int count)
+{
+    int8x16_t d;
+    int index;
+
+    index = 0;
+    while (index + 16 <= count)
+    {
+        d = vsubq_s8(vld1q_s8((const int8_t *) (cur + index)),
+                     vld1q_s8((const int8_t *) (prev + index)));
+        d = veorq_s8(vshlq_n_s8(d, 1), vshrq_n_s8(d, 7));
+        vst1q_s8((int8_t *) (out_plane + index), d);
+        index += 16;
+    }
+    delta_c(prev + index, cur + index, out_plane + index, count - index);
+}
+
+/*****************************************************************************/
+static int
+equal_run_neon(const char *ptr8, int count)
+{
+    uint8x16_t a;
+    uint8x16_t b;
+    uint64_t mask;
+    int index;
+
+    index = 0;
+    while (index + 16 <= count)
+    {
+        a = vld1q_u8((const uint8_t *) (ptr8 + index));
+        b = vld1q_u8((const uint8_t *) (ptr8 + index + 1));
+        mask = ~neon_mask_u8(vceqq_u8(a, b));
+        if (mask != 0)
+        {
+            return index + (__builtin_ctzll(mask) >> 2);
+        }
+        index += 16;
+    }
+    return index + equal_run_c(ptr8 + index, count - index);
+}
+
+/*****************************************************************************/
+static int
+differ_run_neon(const char *ptr8, int count)
+{
+    uint8x16_t a;
+    uint8x16_t b;
+    uint64_t mask;
+    int index;
+
+    index = 0;
+    while (index + 16 <= count)
+    {
+        a = vld1q_u8((const uint8_t *) (ptr8 + index));
+        b = vld1q_u8((const uint8_t *) (ptr8 + index + 1));
+        mask = neon_mask_u8(vceqq_u8(a, b));
+        if (mask != 0)
+        {
+            return index + (__builtin_ctzll(mask) >> 2);
+        }
+        index += 16;
+    }
+    return index + differ_run_c(ptr8 + index, count - index);
+}
+
+static const struct xrdp_planar_kernels g_planar_kernels_neon =
+{
+    "neon",
+    split3_row_neon,
+    split4_row_neon,
+    delta_neon,
+    equal_run_neon,
+    differ_run_neon
+};
+
+#endif /* XRDP_PLANAR_NEON */
+
+/*****************************************************************************/
+const struct xrdp_planar_kernels *
+xrdp_planar_kernels_scalar(void)
+{
+    return &g_planar_kernels_c;
+}
+
+/*****************************************************************************/
+/* best kernel set for this cpu, the check is cheap so it is not cached */
+const struct xrdp_planar_kernels *
+xrdp_planar_kernels_best(void)
+{
+#if defined(XRDP_PLANAR_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return &g_planar_kernels_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return &g_planar_kernels_sse2;
+    }
+#elif defined(XRDP_PLANAR_NEON)
+    return &g_planar_kernels_neon;
+#endif
+    return &g_planar_kernels_c;
+}
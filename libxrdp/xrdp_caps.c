@@ -446,6 +446,32 @@ xrdp_caps_process_input(struct xrdp_rdp *self, struct stream *s,
     return 0;
 }
 
+/*****************************************************************************/
+static int
+xrdp_caps_process_virtual_channel(struct xrdp_rdp *self, struct stream *s,
+                                  int len)
+{
+    int flags;
+    int chunk_size;
+
+    if (len < 4)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_caps_process_virtual_channel: error");
+        return 1;
+    }
+    in_uint32_le(s, flags);
+    /* [MS-RDPBCGR] 2.2.7.1.10 the server ignores the client's VCChunkSize
+       and only sends chunks of up to CHANNEL_CHUNK_LENGTH */
+    chunk_size = 0;
+    if (len >= 8)
+    {
+        in_uint32_le(s, chunk_size);
+    }
+    LOG(LOG_LEVEL_DEBUG, "xrdp_caps_process_virtual_channel: flags 0x%8.8x "
+        "VCChunkSize %d (ignored)", flags, chunk_size);
+    return 0;
+}
+
 /*****************************************************************************/
 /* get the type of client brush cache */
 static int
@@ -900,7 +926,8 @@ xrdp_caps_process_confirm_active(struct xrdp_rdp *self, struct stream *s)
                 break;
             case CAPSTYPE_VIRTUALCHANNEL:
                 LOG_DEVEL(LOG_LEVEL_INFO, "Received [MS-RDPBCGR] TS_CONFIRM_ACTIVE_PDU - TS_CAPS_SET "
-                          "capabilitySetType = CAPSTYPE_VIRTUALCHANNEL - Ignored");
+                          "capabilitySetType = CAPSTYPE_VIRTUALCHANNEL");
+                xrdp_caps_process_virtual_channel(self, s, len);
                 break;
             case CAPSTYPE_DRAWNINGRIDCACHE:
                 LOG_DEVEL(LOG_LEVEL_INFO, "Received [MS-RDPBCGR] TS_CONFIRM_ACTIVE_PDU - TS_CAPS_SET "
@@ -1176,14 +1203,14 @@ xrdp_caps_send_demand_active(struct xrdp_rdp *self)
     out_uint8(s, 0); /* NEG_WTEXTOUT_INDEX              0x0C 12 */
     out_uint8(s, 0); /* NEG_MEMBLT_V2_INDEX             0x0D 13 */
     out_uint8(s, 0); /* NEG_MEM3BLT_V2_INDEX            0x0E 14 */
-    out_uint8(s, 0); /* NEG_MULTIDSTBLT_INDEX           0x0F 15 */
-    out_uint8(s, 0); /* NEG_MULTIPATBLT_INDEX           0x10 16 */
-    out_uint8(s, 0); /* NEG_MULTISCRBLT_INDEX           0x11 17 */
+    out_uint8(s, 1); /* NEG_MULTIDSTBLT_INDEX           0x0F 15 */
+    out_uint8(s, 1); /* NEG_MULTIPATBLT_INDEX           0x10 16 */
+    out_uint8(s, 1); /* NEG_MULTISCRBLT_INDEX           0x11 17 */
     out_uint8(s, 1); /* NEG_MULTIOPAQUERECT_INDEX       0x12 18 */
     out_uint8(s, 0); /* NEG_FAST_INDEX_INDEX            0x13 19 */
     out_uint8(s, 0); /* NEG_POLYGON_SC_INDEX            0x14 20 */
     out_uint8(s, 0); /* NEG_POLYGON_CB_INDEX            0x15 21 */
-    out_uint8(s, 0); /* NEG_POLYLINE_INDEX              0x16 22 */
+    out_uint8(s, 1); /* NEG_POLYLINE_INDEX              0x16 22 */
     out_uint8(s, 0); /* unused                          0x17 23 */
     out_uint8(s, 0); /* NEG_FAST_GLYPH_INDEX            0x18 24 */
     out_uint8(s, 0); /* NEG_ELLIPSE_SC_INDEX            0x19 25 */
@@ -1303,6 +1330,17 @@ xrdp_caps_send_demand_active(struct xrdp_rdp *self)
               "CAPSTYPE_INPUT: "
               "inputFlags = 0x%x", flags);
 
+    /* Output virtual channel capability set, VCChunkSize is the largest
+       chunk the client may send us */
+    caps_count++;
+    out_uint16_le(s, CAPSTYPE_VIRTUALCHANNEL);
+    out_uint16_le(s, CAPSTYPE_VIRTUALCHANNEL_CHUNK_LEN);
+    out_uint32_le(s, 0); /* flags, no compression */
+    out_uint32_le(s, self->client_info.vc_chunk_size);
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_caps_send_demand_active: Server Capability "
+              "CAPSTYPE_VIRTUALCHANNEL: "
+              "flags = 0, VCChunkSize = %d", self->client_info.vc_chunk_size);
+
     if (self->client_info.rail_enable) /* MS-RDPERP 3.3.5.1.4 */
     {
         /* Remote Programs Capability Set */
@@ -78,6 +78,7 @@ xrdp_channel_delete(struct xrdp_channel *self)
         return;
     }
     free_stream(self->s);
+    xrdp_channel_sched_delete(self->sched);
     g_memset(self, 0, sizeof(struct xrdp_channel));
     g_free(self);
 }
@@ -0,0 +1,375 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * static channel send scheduler
+ *
+ * Static channel data from chansrv shares the client connection with
+ * graphics. Each channel is put in a class by name. The interactive class
+ * (RemoteApp window and cursor state) is always sent first. The other
+ * classes share what is left by deficit round robin, audio 4 and bulk 1.
+ * If max_backlog is set, they are only sent while less than that is
+ * waiting to be written to the client, graphics included, so graphics
+ * get the link first. A class can also be limited to a rate by a token
+ * bucket. Chunks of one channel always go out in the order they came in.
+ *
+ * drdynvc has no class, as dynamic channel data is sent by
+ * xrdp_channel.c without coming through here.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+#include "string_calls.h"
+
+/* bytes a token bucket can save up while its class is idle */
+#define XRDP_CHAN_SCHED_BURST (64 * 1024)
+
+static const int g_class_weights[XRDP_CHAN_CLASSES] = { 0, 4, 1 };
+
+/*****************************************************************************/
+struct xrdp_channel_sched *
+xrdp_channel_sched_create(const struct xrdp_client_info *client_info)
+{
+    struct xrdp_channel_sched *self;
+    struct xrdp_channel_class *cls;
+    int index;
+    int now;
+
+    self = g_new0(struct xrdp_channel_sched, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    now = g_time3();
+    for (index = 0; index < XRDP_CHAN_CLASSES; index++)
+    {
+        cls = self->classes + index;
+        cls->quantum = g_class_weights[index] * CHANNEL_CHUNK_LENGTH;
+        cls->rate = MAX(client_info->channel_qos_rate[index], 0);
+        cls->tokens = XRDP_CHAN_SCHED_BURST;
+        cls->last_refill = now;
+    }
+    self->max_backlog = MAX(client_info->channel_qos_max_queued_kb, 0) * 1024;
+    self->current = XRDP_CHAN_CLASS_AUDIO;
+    self->fresh = 1;
+    make_stream(self->s);
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_channel_sched_delete(struct xrdp_channel_sched *self)
+{
+    struct xrdp_channel_chunk *chunk;
+    struct xrdp_channel_class *cls;
+    int index;
+
+    if (self == NULL)
+    {
+        return;
+    }
+    for (index = 0; index < XRDP_CHAN_CLASSES; index++)
+    {
+        cls = self->classes + index;
+        LOG(LOG_LEVEL_DEBUG, "xrdp_channel_sched_delete: class %d sent "
+            "%lld bytes in %d chunks, %d chunks queued first",
+            index, cls->sent_bytes, cls->sent_chunks, cls->queued_chunks);
+        while (cls->head != NULL)
+        {
+            chunk = cls->head;
+            cls->head = chunk->next;
+            g_free(chunk);
+        }
+    }
+    free_stream(self->s);
+    g_free(self);
+}
+
+/*****************************************************************************/
+int
+xrdp_channel_sched_class(const char *channel_name)
+{
+    if (g_strncasecmp(channel_name, "rail", 4) == 0)
+    {
+        return XRDP_CHAN_CLASS_INTERACTIVE;
+    }
+    if (g_strcasecmp(channel_name, "rdpsnd") == 0)
+    {
+        return XRDP_CHAN_CLASS_AUDIO;
+    }
+    /* rdpdr, cliprdr and anything unknown */
+    return XRDP_CHAN_CLASS_BULK;
+}
+
+/*****************************************************************************/
+static void
+xrdp_channel_sched_refill(struct xrdp_channel_class *cls, int now)
+{
+    int diff;
+
+    if (cls->rate == 0)
+    {
+        return;
+    }
+    diff = now - cls->last_refill;
+    if (diff <= 0)
+    {
+        return;
+    }
+    /* a second at a time so the multiply can't overflow */
+    diff = MIN(diff, 1000);
+    cls->tokens = MIN(cls->tokens + (int)((long long)cls->rate * diff / 1000),
+                      XRDP_CHAN_SCHED_BURST);
+    cls->last_refill = now;
+}
+
+/*****************************************************************************/
+/* returns boolean */
+static int
+xrdp_channel_sched_class_ok(struct xrdp_channel_sched *self, int class_id,
+                            int backlog)
+{
+    struct xrdp_channel_class *cls;
+
+    cls = self->classes + class_id;
+    if ((cls->rate != 0) && (cls->tokens <= 0))
+    {
+        return 0;
+    }
+    if ((class_id != XRDP_CHAN_CLASS_INTERACTIVE) &&
+            (self->max_backlog > 0) && (backlog > self->max_backlog))
+    {
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+xrdp_channel_sched_charge(struct xrdp_channel_sched *self, int class_id,
+                          int size)
+{
+    struct xrdp_channel_class *cls;
+
+    cls = self->classes + class_id;
+    if (cls->rate != 0)
+    {
+        cls->tokens -= size;
+    }
+    cls->sent_bytes += size;
+    cls->sent_chunks++;
+}
+
+/*****************************************************************************/
+/* returns boolean, if true the chunk can be sent now without queueing and
+   has been charged to its class */
+int
+xrdp_channel_sched_can_send(struct xrdp_channel_sched *self, int class_id,
+                            int size, int now, int backlog)
+{
+    if (self->queued_bytes > 0)
+    {
+        /* keep the order of anything already waiting */
+        return 0;
+    }
+    xrdp_channel_sched_refill(self->classes + class_id, now);
+    if (!xrdp_channel_sched_class_ok(self, class_id, backlog))
+    {
+        return 0;
+    }
+    xrdp_channel_sched_charge(self, class_id, size);
+    return 1;
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_channel_sched_add(struct xrdp_channel_sched *self, int class_id,
+                       int channel_id, const char *data, int size,
+                       int total_data_len, int flags)
+{
+    struct xrdp_channel_chunk *chunk;
+    struct xrdp_channel_class *cls;
+
+    chunk = (struct xrdp_channel_chunk *)
+            g_malloc(sizeof(struct xrdp_channel_chunk) + size, 0);
+    if (chunk == NULL)
+    {
+        return 1;
+    }
+    chunk->next = NULL;
+    chunk->channel_id = channel_id;
+    chunk->total_data_len = total_data_len;
+    chunk->flags = flags;
+    chunk->size = size;
+    g_memcpy(chunk + 1, data, size);
+    cls = self->classes + class_id;
+    if (cls->tail == NULL)
+    {
+        cls->head = chunk;
+    }
+    else
+    {
+        cls->tail->next = chunk;
+    }
+    cls->tail = chunk;
+    cls->queued_bytes += size;
+    cls->queued_chunks++;
+    self->queued_bytes += size;
+    return 0;
+}
+
+/*****************************************************************************/
+static struct xrdp_channel_chunk *
+xrdp_channel_sched_pop(struct xrdp_channel_sched *self, int class_id)
+{
+    struct xrdp_channel_chunk *chunk;
+    struct xrdp_channel_class *cls;
+
+    cls = self->classes + class_id;
+    chunk = cls->head;
+    cls->head = chunk->next;
+    if (cls->head == NULL)
+    {
+        cls->tail = NULL;
+    }
+    chunk->next = NULL;
+    cls->queued_bytes -= chunk->size;
+    self->queued_bytes -= chunk->size;
+    xrdp_channel_sched_charge(self, class_id, chunk->size);
+    return chunk;
+}
+
+/*****************************************************************************/
+static void
+xrdp_channel_sched_advance(struct xrdp_channel_sched *self)
+{
+    self->current++;
+    if (self->current >= XRDP_CHAN_CLASSES)
+    {
+        self->current = XRDP_CHAN_CLASS_AUDIO;
+    }
+    self->fresh = 1;
+}
+
+/*****************************************************************************/
+/* returns the next chunk to send, to be freed with g_free(), or NULL if
+   nothing can go now */
+struct xrdp_channel_chunk *
+xrdp_channel_sched_next(struct xrdp_channel_sched *self, int now,
+                        int backlog)
+{
+    struct xrdp_channel_class *cls;
+    int index;
+    int blocked;
+
+    if (self->queued_bytes == 0)
+    {
+        return NULL;
+    }
+    for (index = 0; index < XRDP_CHAN_CLASSES; index++)
+    {
+        xrdp_channel_sched_refill(self->classes + index, now);
+    }
+    if ((self->classes[XRDP_CHAN_CLASS_INTERACTIVE].head != NULL) &&
+            xrdp_channel_sched_class_ok(self, XRDP_CHAN_CLASS_INTERACTIVE,
+                                        backlog))
+    {
+        return xrdp_channel_sched_pop(self, XRDP_CHAN_CLASS_INTERACTIVE);
+    }
+    /* deficit round robin over the weighted classes, a class may need
+       several rounds for a chunk bigger than its quantum */
+    blocked = 0;
+    while (blocked < XRDP_CHAN_CLASSES - 1)
+    {
+        cls = self->classes + self->current;
+        if (cls->head == NULL)
+        {
+            cls->deficit = 0;
+            xrdp_channel_sched_advance(self);
+            blocked++;
+            continue;
+        }
+        if (!xrdp_channel_sched_class_ok(self, self->current, backlog))
+        {
+            xrdp_channel_sched_advance(self);
+            blocked++;
+            continue;
+        }
+        blocked = 0;
+        if (self->fresh)
+        {
+            cls->deficit += cls->quantum;
+            self->fresh = 0;
+        }
+        if (cls->deficit >= cls->head->size)
+        {
+            cls->deficit -= cls->head->size;
+            return xrdp_channel_sched_pop(self, self->current);
+        }
+        xrdp_channel_sched_advance(self);
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+/* returns milliseconds until xrdp_channel_sched_next() may have something,
+   or -1 if nothing is queued */
+int
+xrdp_channel_sched_get_timeout(struct xrdp_channel_sched *self, int now,
+                               int backlog)
+{
+    struct xrdp_channel_class *cls;
+    int index;
+    int rv;
+    int ms;
+
+    if (self->queued_bytes == 0)
+    {
+        return -1;
+    }
+    rv = -1;
+    for (index = 0; index < XRDP_CHAN_CLASSES; index++)
+    {
+        cls = self->classes + index;
+        if (cls->head == NULL)
+        {
+            continue;
+        }
+        xrdp_channel_sched_refill(cls, now);
+        if (xrdp_channel_sched_class_ok(self, index, backlog))
+        {
+            return 0;
+        }
+        if ((cls->rate != 0) && (cls->tokens <= 0))
+        {
+            ms = (int)((1 - (long long)cls->tokens) * 1000 / cls->rate) + 1;
+        }
+        else
+        {
+            /* waiting on the client backlog, a socket write wakes us, this
+               is a fallback */
+            ms = 100;
+        }
+        if ((rv < 0) || (ms < rv))
+        {
+            rv = ms;
+        }
+    }
+    return rv;
+}
@@ -1006,21 +1006,27 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
 int
 compress_rdp(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
 {
+    int rv;
+
     if ((enc == 0) || (srcData == 0) || (len <= 0) || (len > enc->buf_len))
     {
         return 0;
     }
 
+    rv = 0;
     switch (enc->protocol_type)
     {
         case PROTO_RDP_40:
-            return compress_rdp_4(enc, srcData, len);
+            rv = compress_rdp_4(enc, srcData, len);
             break;
 
         case PROTO_RDP_50:
-            return compress_rdp_5(enc, srcData, len);
+            rv = compress_rdp_5(enc, srcData, len);
             break;
     }
 
-    return 0;
+    /* on failure the caller sends the data as it is */
+    enc->total_in += len;
+    enc->total_out += rv ? enc->bytes_in_opb : len;
+    return rv;
 }
@@ -56,6 +56,14 @@ xrdp_orders_create(struct xrdp_session *session, struct xrdp_rdp *rdp_layer)
     }
     make_stream(self->s);
     make_stream(self->temp_s);
+    if (rdp_layer->client_info.order_batching)
+    {
+        self->batch = g_new0(struct xrdp_orders_batch, 1);
+    }
+    if (rdp_layer->client_info.order_stats)
+    {
+        self->stats = g_new0(struct xrdp_orders_stats, 1);
+    }
     return self;
 }
 
@@ -67,6 +75,9 @@ xrdp_orders_delete(struct xrdp_orders *self)
     {
         return;
     }
+    xrdp_orders_stats_log(self);
+    g_free(self->batch);
+    g_free(self->stats);
     xrdp_jpeg_deinit(self->jpeg_han);
     free_stream(self->out_s);
     free_stream(self->s);
@@ -146,6 +157,11 @@ xrdp_orders_send(struct xrdp_orders *self)
     int rv;
 
     rv = 0;
+    if (self->order_level == 1)
+    {
+        /* outermost send, encode anything the batcher is holding */
+        rv = xrdp_orders_batch_flush(self);
+    }
     if (self->order_level > 0)
     {
         self->order_level--;
@@ -190,6 +206,7 @@ xrdp_orders_force_send(struct xrdp_orders *self)
     {
         return 1;
     }
+    xrdp_orders_batch_flush(self);
     if ((self->order_level > 0) && (self->order_count > 0))
     {
         s_mark_end(self->out_s);
@@ -232,6 +249,12 @@ xrdp_orders_check(struct xrdp_orders *self, int max_size)
     ci = &(self->rdp_layer->client_info);
     max_order_size = MAX_ORDERS_SIZE(ci);
 
+    /* anything encoded directly must go after the queued orders */
+    if (xrdp_orders_batch_flush(self) != 0)
+    {
+        return 1;
+    }
+
     if (self->order_level < 1)
     {
         if (max_size > max_order_size)
@@ -492,6 +515,8 @@ xrdp_order_pack_small_or_tiny(struct xrdp_orders *self,
     }
 
     order_flags_ptr[0] = orders_flags;
+    xrdp_orders_stats_add(self, self->orders_state.last_order,
+                          order_flags_ptr);
     return 0;
 }
 
@@ -509,6 +534,10 @@ xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
     char *present_ptr;
     char *order_flags_ptr;
 
+    if (xrdp_orders_batch_active(self))
+    {
+        return xrdp_orders_batch_rect(self, x, y, cx, cy, color, rect);
+    }
     if (xrdp_orders_check(self, 23) != 0)
     {
         return 1;
@@ -680,6 +709,11 @@ xrdp_orders_screen_blt(struct xrdp_orders *self, int x, int y,
     char *present_ptr = (char *)NULL;
     char *order_flags_ptr = (char *)NULL;
 
+    if (xrdp_orders_batch_active(self))
+    {
+        return xrdp_orders_batch_screen_blt(self, x, y, cx, cy, srcx, srcy,
+                                            rop, rect);
+    }
     if (xrdp_orders_check(self, 25) != 0)
     {
         return 1;
@@ -872,6 +906,11 @@ xrdp_orders_pat_blt(struct xrdp_orders *self, int x, int y,
     char *order_flags_ptr;
     struct xrdp_brush blank_brush;
 
+    if (xrdp_orders_batch_active(self))
+    {
+        return xrdp_orders_batch_pat_blt(self, x, y, cx, cy, rop, bg_color,
+                                         fg_color, brush, rect);
+    }
     if (xrdp_orders_check(self, 39) != 0)
     {
         return 1;
@@ -1089,6 +1128,10 @@ xrdp_orders_dest_blt(struct xrdp_orders *self, int x, int y,
     char *present_ptr;
     char *order_flags_ptr;
 
+    if (xrdp_orders_batch_active(self))
+    {
+        return xrdp_orders_batch_dest_blt(self, x, y, cx, cy, rop, rect);
+    }
     if (xrdp_orders_check(self, 21) != 0)
     {
         return 1;
@@ -1260,6 +1303,11 @@ xrdp_orders_line(struct xrdp_orders *self, int mix_mode,
         rop = 0x0d; /* R2_COPYPEN */
     }
 
+    if (xrdp_orders_batch_active(self))
+    {
+        return xrdp_orders_batch_line(self, mix_mode, startx, starty,
+                                      endx, endy, rop, bg_color, pen, rect);
+    }
     if (xrdp_orders_check(self, 32) != 0)
     {
         return 1;
@@ -1462,6 +1510,12 @@ xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
     char *present_ptr = (char *)NULL;
     char *order_flags_ptr = (char *)NULL;
 
+    if (xrdp_orders_batch_active(self))
+    {
+        return xrdp_orders_batch_mem_blt(self, cache_id, color_table,
+                                         x, y, cx, cy, rop, srcx, srcy,
+                                         cache_idx, rect);
+    }
     if (xrdp_orders_check(self, 30) != 0)
     {
         return 1;
@@ -2179,6 +2233,925 @@ xrdp_orders_text(struct xrdp_orders *self,
     return 0;
 }
 
+/*****************************************************************************/
+/* the smallest rect holding all the rects */
+static void
+xrdp_orders_rects_extents(const struct xrdp_rect *rects, int num_rects,
+                          struct xrdp_rect *extents)
+{
+    int index;
+
+    *extents = rects[0];
+    for (index = 1; index < num_rects; index++)
+    {
+        extents->left = MIN(extents->left, rects[index].left);
+        extents->top = MIN(extents->top, rects[index].top);
+        extents->right = MAX(extents->right, rects[index].right);
+        extents->bottom = MAX(extents->bottom, rects[index].bottom);
+    }
+}
+
+/*****************************************************************************/
+/* starts a primary order, vals are the coord pairs for the delta check and
+   extents is the area drawn, checked against the bounds rect
+   returns the order flags, set later by xrdp_order_pack_small_or_tiny */
+static int
+xrdp_orders_start_primary(struct xrdp_orders *self, int order_type,
+                          int *vals, int num_vals,
+                          const struct xrdp_rect *extents,
+                          struct xrdp_rect *rect, int present_size,
+                          char **order_flags_ptr, char **present_ptr)
+{
+    int order_flags;
+
+    self->order_count++;
+    order_flags = TS_STANDARD;
+
+    if (self->orders_state.last_order != order_type)
+    {
+        order_flags |= TS_TYPE_CHANGE;
+    }
+
+    self->orders_state.last_order = order_type;
+
+    if (rect != 0)
+    {
+        /* if clip is present, still check if it's needed */
+        if (extents->left < rect->left || extents->top < rect->top ||
+                extents->right > rect->right ||
+                extents->bottom > rect->bottom)
+        {
+            order_flags |= TS_BOUNDS;
+
+            if (xrdp_orders_last_bounds(self, rect))
+            {
+                order_flags |= TS_ZERO_BOUNDS_DELTAS;
+            }
+        }
+    }
+
+    if (xrdp_orders_send_delta(self, vals, num_vals))
+    {
+        order_flags |= TS_DELTA_COORDINATES;
+    }
+
+    /* order_flags, set later, 1 byte */
+    *order_flags_ptr = self->out_s->p;
+    out_uint8s(self->out_s, 1);
+
+    if (order_flags & TS_TYPE_CHANGE)
+    {
+        out_uint8(self->out_s, order_type);
+    }
+
+    /* present, set later */
+    *present_ptr = self->out_s->p;
+    out_uint8s(self->out_s, present_size);
+
+    if ((order_flags & TS_BOUNDS) &&
+            !(order_flags & TS_ZERO_BOUNDS_DELTAS))
+    {
+        xrdp_orders_out_bounds(self, rect);
+    }
+
+    return order_flags;
+}
+
+/*****************************************************************************/
+/* write a coord field if it is not the same as the last one sent
+   returns boolean, true if the field was written */
+static int
+xrdp_orders_out_coord(struct xrdp_orders *self, int order_flags,
+                      int value, int *last_value)
+{
+    if (value == *last_value)
+    {
+        return 0;
+    }
+
+    if (order_flags & TS_DELTA_COORDINATES)
+    {
+        out_uint8(self->out_s, value - *last_value);
+    }
+    else
+    {
+        out_uint16_le(self->out_s, value);
+    }
+
+    *last_value = value;
+    return 1;
+}
+
+/*****************************************************************************/
+/* 1 or 2 byte signed value used in the delta lists, -16384 to 16383 */
+static void
+xrdp_orders_out_delta(struct stream *s, int value)
+{
+    if ((value >= -64) && (value <= 63))
+    {
+        out_uint8(s, value & 0x7f);
+    }
+    else
+    {
+        out_uint8(s, 0x80 | ((value >> 8) & 0x7f));
+        out_uint8(s, value);
+    }
+}
+
+/*****************************************************************************/
+/* DELTA_RECTS_FIELD with its 2 byte cbData, each rect's left and top are
+   deltas from the rect before it, width and height are sent when they
+   change */
+static void
+xrdp_orders_out_delta_rects(struct xrdp_orders *self,
+                            const struct xrdp_rect *rects, int num_rects)
+{
+    struct stream *s;
+    char *size_ptr;
+    char *zero_bits_ptr;
+    int index;
+    int flags;
+    int size;
+    int last_left;
+    int last_top;
+    int last_width;
+    int last_height;
+    int width;
+    int height;
+
+    s = self->out_s;
+    size_ptr = s->p;
+    out_uint8s(s, 2);
+    zero_bits_ptr = s->p;
+    out_uint8s(s, (num_rects + 1) / 2);
+    g_memset(zero_bits_ptr, 0, (num_rects + 1) / 2);
+    last_left = 0;
+    last_top = 0;
+    last_width = 0;
+    last_height = 0;
+    for (index = 0; index < num_rects; index++)
+    {
+        width = rects[index].right - rects[index].left;
+        height = rects[index].bottom - rects[index].top;
+        flags = 0;
+        if (rects[index].left == last_left)
+        {
+            flags |= 0x80;
+        }
+        else
+        {
+            xrdp_orders_out_delta(s, rects[index].left - last_left);
+        }
+        if (rects[index].top == last_top)
+        {
+            flags |= 0x40;
+        }
+        else
+        {
+            xrdp_orders_out_delta(s, rects[index].top - last_top);
+        }
+        if (width == last_width)
+        {
+            flags |= 0x20;
+        }
+        else
+        {
+            xrdp_orders_out_delta(s, width);
+        }
+        if (height == last_height)
+        {
+            flags |= 0x10;
+        }
+        else
+        {
+            xrdp_orders_out_delta(s, height);
+        }
+        /* even rects in the high nibble */
+        zero_bits_ptr[index / 2] |= flags >> ((index & 1) * 4);
+        last_left = rects[index].left;
+        last_top = rects[index].top;
+        last_width = width;
+        last_height = height;
+    }
+    size = (int)(s->p - zero_bits_ptr);
+    size_ptr[0] = size;
+    size_ptr[1] = size >> 8;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* send up to TS_MAX_DELTA_RECTS solid rects as one order */
+static int
+xrdp_orders_multi_rect_part(struct xrdp_orders *self, int color,
+                            const struct xrdp_rect *rects, int num_rects)
+{
+    struct xrdp_rect extents;
+    int order_flags;
+    int present;
+    int vals[8];
+    char *present_ptr;
+    char *order_flags_ptr;
+
+    if (xrdp_orders_check(self, 40 + num_rects * 9) != 0)
+    {
+        return 1;
+    }
+
+    xrdp_orders_rects_extents(rects, num_rects, &extents);
+    vals[0] = extents.left;
+    vals[1] = self->orders_state.multi_rect_x;
+    vals[2] = extents.top;
+    vals[3] = self->orders_state.multi_rect_y;
+    vals[4] = extents.right - extents.left;
+    vals[5] = self->orders_state.multi_rect_cx;
+    vals[6] = extents.bottom - extents.top;
+    vals[7] = self->orders_state.multi_rect_cy;
+    order_flags = xrdp_orders_start_primary(self, RDP_ORDER_MULTIOPAQUERECT,
+                                            vals, 8, &extents, NULL, 2,
+                                            &order_flags_ptr, &present_ptr);
+    present = 0;
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[0],
+                              &self->orders_state.multi_rect_x))
+    {
+        present |= 0x0001;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[2],
+                              &self->orders_state.multi_rect_y))
+    {
+        present |= 0x0002;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[4],
+                              &self->orders_state.multi_rect_cx))
+    {
+        present |= 0x0004;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[6],
+                              &self->orders_state.multi_rect_cy))
+    {
+        present |= 0x0008;
+    }
+
+    if ((color & 0xff) != (self->orders_state.multi_rect_color & 0xff))
+    {
+        present |= 0x0010;
+        out_uint8(self->out_s, color);
+    }
+
+    if ((color & 0xff00) != (self->orders_state.multi_rect_color & 0xff00))
+    {
+        present |= 0x0020;
+        out_uint8(self->out_s, color >> 8);
+    }
+
+    if ((color & 0xff0000) != (self->orders_state.multi_rect_color & 0xff0000))
+    {
+        present |= 0x0040;
+        out_uint8(self->out_s, color >> 16);
+    }
+
+    self->orders_state.multi_rect_color = color;
+    /* always send the rects */
+    present |= 0x0080 | 0x0100;
+    out_uint8(self->out_s, num_rects);
+    xrdp_orders_out_delta_rects(self, rects, num_rects);
+
+    xrdp_order_pack_small_or_tiny(self, order_flags_ptr, order_flags,
+                                  present_ptr, present, 2);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* send solid rects, one MultiOpaqueRect order for up to
+   TS_MAX_DELTA_RECTS rects, single rect orders if the client can't */
+int
+xrdp_orders_multi_rect(struct xrdp_orders *self, int color,
+                       const struct xrdp_rect *rects, int num_rects)
+{
+    int index;
+    int count;
+
+    if ((num_rects < 2) ||
+            !self->rdp_layer->client_info.orders[TS_NEG_MULTIOPAQUERECT_INDEX])
+    {
+        for (index = 0; index < num_rects; index++)
+        {
+            if (xrdp_orders_rect(self, rects[index].left, rects[index].top,
+                                 rects[index].right - rects[index].left,
+                                 rects[index].bottom - rects[index].top,
+                                 color, NULL) != 0)
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (index = 0; index < num_rects; index += count)
+    {
+        count = MIN(num_rects - index, TS_MAX_DELTA_RECTS);
+        if (xrdp_orders_multi_rect_part(self, color, rects + index,
+                                        count) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+xrdp_orders_multi_dest_blt_part(struct xrdp_orders *self, int rop,
+                                const struct xrdp_rect *rects, int num_rects)
+{
+    struct xrdp_rect extents;
+    int order_flags;
+    int present;
+    int vals[8];
+    char *present_ptr;
+    char *order_flags_ptr;
+
+    if (xrdp_orders_check(self, 40 + num_rects * 9) != 0)
+    {
+        return 1;
+    }
+
+    xrdp_orders_rects_extents(rects, num_rects, &extents);
+    vals[0] = extents.left;
+    vals[1] = self->orders_state.multi_dst_blt_x;
+    vals[2] = extents.top;
+    vals[3] = self->orders_state.multi_dst_blt_y;
+    vals[4] = extents.right - extents.left;
+    vals[5] = self->orders_state.multi_dst_blt_cx;
+    vals[6] = extents.bottom - extents.top;
+    vals[7] = self->orders_state.multi_dst_blt_cy;
+    order_flags = xrdp_orders_start_primary(self, RDP_ORDER_MULTIDSTBLT,
+                                            vals, 8, &extents, NULL, 1,
+                                            &order_flags_ptr, &present_ptr);
+    present = 0;
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[0],
+                              &self->orders_state.multi_dst_blt_x))
+    {
+        present |= 0x01;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[2],
+                              &self->orders_state.multi_dst_blt_y))
+    {
+        present |= 0x02;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[4],
+                              &self->orders_state.multi_dst_blt_cx))
+    {
+        present |= 0x04;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[6],
+                              &self->orders_state.multi_dst_blt_cy))
+    {
+        present |= 0x08;
+    }
+
+    if (rop != self->orders_state.multi_dst_blt_rop)
+    {
+        present |= 0x10;
+        out_uint8(self->out_s, rop);
+        self->orders_state.multi_dst_blt_rop = rop;
+    }
+
+    /* always send the rects */
+    present |= 0x20 | 0x40;
+    out_uint8(self->out_s, num_rects);
+    xrdp_orders_out_delta_rects(self, rects, num_rects);
+
+    xrdp_order_pack_small_or_tiny(self, order_flags_ptr, order_flags,
+                                  present_ptr, present, 1);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* dest blt the rects, MultiDstBlt orders if the client can */
+int
+xrdp_orders_multi_dest_blt(struct xrdp_orders *self, int rop,
+                           const struct xrdp_rect *rects, int num_rects)
+{
+    int index;
+    int count;
+
+    if ((num_rects < 2) ||
+            !self->rdp_layer->client_info.orders[TS_NEG_MULTIDSTBLT_INDEX])
+    {
+        for (index = 0; index < num_rects; index++)
+        {
+            if (xrdp_orders_dest_blt(self, rects[index].left,
+                                     rects[index].top,
+                                     rects[index].right - rects[index].left,
+                                     rects[index].bottom - rects[index].top,
+                                     rop, NULL) != 0)
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (index = 0; index < num_rects; index += count)
+    {
+        count = MIN(num_rects - index, TS_MAX_DELTA_RECTS);
+        if (xrdp_orders_multi_dest_blt_part(self, rop, rects + index,
+                                            count) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+xrdp_orders_multi_pat_blt_part(struct xrdp_orders *self, int rop,
+                               int bg_color, int fg_color,
+                               struct xrdp_brush *brush,
+                               const struct xrdp_rect *rects, int num_rects)
+{
+    struct xrdp_rect extents;
+    struct xrdp_brush *last_brush;
+    int order_flags;
+    int present;
+    int vals[8];
+    char *present_ptr;
+    char *order_flags_ptr;
+
+    if (xrdp_orders_check(self, 56 + num_rects * 9) != 0)
+    {
+        return 1;
+    }
+
+    xrdp_orders_rects_extents(rects, num_rects, &extents);
+    vals[0] = extents.left;
+    vals[1] = self->orders_state.multi_pat_blt_x;
+    vals[2] = extents.top;
+    vals[3] = self->orders_state.multi_pat_blt_y;
+    vals[4] = extents.right - extents.left;
+    vals[5] = self->orders_state.multi_pat_blt_cx;
+    vals[6] = extents.bottom - extents.top;
+    vals[7] = self->orders_state.multi_pat_blt_cy;
+    order_flags = xrdp_orders_start_primary(self, RDP_ORDER_MULTIPATBLT,
+                                            vals, 8, &extents, NULL, 2,
+                                            &order_flags_ptr, &present_ptr);
+    present = 0;
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[0],
+                              &self->orders_state.multi_pat_blt_x))
+    {
+        present |= 0x0001;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[2],
+                              &self->orders_state.multi_pat_blt_y))
+    {
+        present |= 0x0002;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[4],
+                              &self->orders_state.multi_pat_blt_cx))
+    {
+        present |= 0x0004;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[6],
+                              &self->orders_state.multi_pat_blt_cy))
+    {
+        present |= 0x0008;
+    }
+
+    if (rop != self->orders_state.multi_pat_blt_rop)
+    {
+        present |= 0x0010;
+        out_uint8(self->out_s, rop);
+        self->orders_state.multi_pat_blt_rop = rop;
+    }
+
+    if (bg_color != self->orders_state.multi_pat_blt_bg_color)
+    {
+        present |= 0x0020;
+        out_uint8(self->out_s, bg_color);
+        out_uint8(self->out_s, bg_color >> 8);
+        out_uint8(self->out_s, bg_color >> 16);
+        self->orders_state.multi_pat_blt_bg_color = bg_color;
+    }
+
+    if (fg_color != self->orders_state.multi_pat_blt_fg_color)
+    {
+        present |= 0x0040;
+        out_uint8(self->out_s, fg_color);
+        out_uint8(self->out_s, fg_color >> 8);
+        out_uint8(self->out_s, fg_color >> 16);
+        self->orders_state.multi_pat_blt_fg_color = fg_color;
+    }
+
+    last_brush = &(self->orders_state.multi_pat_blt_brush);
+
+    if (brush->x_origin != last_brush->x_origin)
+    {
+        present |= 0x0080;
+        out_uint8(self->out_s, brush->x_origin);
+        last_brush->x_origin = brush->x_origin;
+    }
+
+    if (brush->y_origin != last_brush->y_origin)
+    {
+        present |= 0x0100;
+        out_uint8(self->out_s, brush->y_origin);
+        last_brush->y_origin = brush->y_origin;
+    }
+
+    if (brush->style != last_brush->style)
+    {
+        present |= 0x0200;
+        out_uint8(self->out_s, brush->style);
+        last_brush->style = brush->style;
+    }
+
+    if (brush->pattern[0] != last_brush->pattern[0])
+    {
+        present |= 0x0400;
+        out_uint8(self->out_s, brush->pattern[0]);
+        last_brush->pattern[0] = brush->pattern[0];
+    }
+
+    if (g_memcmp(brush->pattern + 1, last_brush->pattern + 1, 7) != 0)
+    {
+        present |= 0x0800;
+        out_uint8a(self->out_s, brush->pattern + 1, 7);
+        g_memcpy(last_brush->pattern + 1, brush->pattern + 1, 7);
+    }
+
+    /* always send the rects */
+    present |= 0x1000 | 0x2000;
+    out_uint8(self->out_s, num_rects);
+    xrdp_orders_out_delta_rects(self, rects, num_rects);
+
+    xrdp_order_pack_small_or_tiny(self, order_flags_ptr, order_flags,
+                                  present_ptr, present, 2);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* pat blt the rects, MultiPatBlt orders if the client can */
+int
+xrdp_orders_multi_pat_blt(struct xrdp_orders *self, int rop,
+                          int bg_color, int fg_color,
+                          struct xrdp_brush *brush,
+                          const struct xrdp_rect *rects, int num_rects)
+{
+    struct xrdp_brush blank_brush;
+    int index;
+    int count;
+
+    if ((num_rects < 2) ||
+            !self->rdp_layer->client_info.orders[TS_NEG_MULTIPATBLT_INDEX])
+    {
+        for (index = 0; index < num_rects; index++)
+        {
+            if (xrdp_orders_pat_blt(self, rects[index].left,
+                                    rects[index].top,
+                                    rects[index].right - rects[index].left,
+                                    rects[index].bottom - rects[index].top,
+                                    rop, bg_color, fg_color, brush,
+                                    NULL) != 0)
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (brush == 0) /* if nil use blank one */
+    {
+        g_memset(&blank_brush, 0, sizeof(struct xrdp_brush));
+        brush = &blank_brush;
+    }
+    for (index = 0; index < num_rects; index += count)
+    {
+        count = MIN(num_rects - index, TS_MAX_DELTA_RECTS);
+        if (xrdp_orders_multi_pat_blt_part(self, rop, bg_color, fg_color,
+                                           brush, rects + index,
+                                           count) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+xrdp_orders_multi_screen_blt_part(struct xrdp_orders *self, int dx, int dy,
+                                  int rop,
+                                  const struct xrdp_rect *rects,
+                                  int num_rects)
+{
+    struct xrdp_rect extents;
+    int order_flags;
+    int present;
+    int vals[12];
+    char *present_ptr;
+    char *order_flags_ptr;
+
+    if (xrdp_orders_check(self, 44 + num_rects * 9) != 0)
+    {
+        return 1;
+    }
+
+    xrdp_orders_rects_extents(rects, num_rects, &extents);
+    vals[0] = extents.left;
+    vals[1] = self->orders_state.multi_scr_blt_x;
+    vals[2] = extents.top;
+    vals[3] = self->orders_state.multi_scr_blt_y;
+    vals[4] = extents.right - extents.left;
+    vals[5] = self->orders_state.multi_scr_blt_cx;
+    vals[6] = extents.bottom - extents.top;
+    vals[7] = self->orders_state.multi_scr_blt_cy;
+    vals[8] = extents.left + dx;
+    vals[9] = self->orders_state.multi_scr_blt_srcx;
+    vals[10] = extents.top + dy;
+    vals[11] = self->orders_state.multi_scr_blt_srcy;
+    order_flags = xrdp_orders_start_primary(self, RDP_ORDER_MULTISCRBLT,
+                                            vals, 12, &extents, NULL, 2,
+                                            &order_flags_ptr, &present_ptr);
+    present = 0;
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[0],
+                              &self->orders_state.multi_scr_blt_x))
+    {
+        present |= 0x0001;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[2],
+                              &self->orders_state.multi_scr_blt_y))
+    {
+        present |= 0x0002;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[4],
+                              &self->orders_state.multi_scr_blt_cx))
+    {
+        present |= 0x0004;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[6],
+                              &self->orders_state.multi_scr_blt_cy))
+    {
+        present |= 0x0008;
+    }
+
+    if (rop != self->orders_state.multi_scr_blt_rop)
+    {
+        present |= 0x0010;
+        out_uint8(self->out_s, rop);
+        self->orders_state.multi_scr_blt_rop = rop;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[8],
+                              &self->orders_state.multi_scr_blt_srcx))
+    {
+        present |= 0x0020;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, vals[10],
+                              &self->orders_state.multi_scr_blt_srcy))
+    {
+        present |= 0x0040;
+    }
+
+    /* always send the rects */
+    present |= 0x0080 | 0x0100;
+    out_uint8(self->out_s, num_rects);
+    xrdp_orders_out_delta_rects(self, rects, num_rects);
+
+    xrdp_order_pack_small_or_tiny(self, order_flags_ptr, order_flags,
+                                  present_ptr, present, 2);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* screen blt the rects, the source of each rect is the rect moved by dx, dy
+   the rects are copied in the order given, MultiScrBlt orders if the
+   client can */
+int
+xrdp_orders_multi_screen_blt(struct xrdp_orders *self, int dx, int dy,
+                             int rop,
+                             const struct xrdp_rect *rects, int num_rects)
+{
+    int index;
+    int count;
+
+    if ((num_rects < 2) ||
+            !self->rdp_layer->client_info.orders[TS_NEG_MULTISCRBLT_INDEX])
+    {
+        for (index = 0; index < num_rects; index++)
+        {
+            if (xrdp_orders_screen_blt(self, rects[index].left,
+                                       rects[index].top,
+                                       rects[index].right - rects[index].left,
+                                       rects[index].bottom - rects[index].top,
+                                       rects[index].left + dx,
+                                       rects[index].top + dy,
+                                       rop, NULL) != 0)
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for (index = 0; index < num_rects; index += count)
+    {
+        count = MIN(num_rects - index, TS_MAX_DELTA_RECTS);
+        if (xrdp_orders_multi_screen_blt_part(self, dx, dy, rop,
+                                              rects + index, count) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+xrdp_orders_polyline_part(struct xrdp_orders *self, int startx, int starty,
+                          const int *points, int num_points, int rop,
+                          int color, struct xrdp_rect *rect)
+{
+    struct xrdp_rect extents;
+    struct stream *s;
+    int order_flags;
+    int present;
+    int vals[4];
+    int index;
+    int flags;
+    int size;
+    int lastx;
+    int lasty;
+    char *present_ptr;
+    char *order_flags_ptr;
+    char *size_ptr;
+    char *zero_bits_ptr;
+
+    if (xrdp_orders_check(self, 30 + num_points * 5) != 0)
+    {
+        return 1;
+    }
+
+    extents.left = startx;
+    extents.top = starty;
+    extents.right = startx + 1;
+    extents.bottom = starty + 1;
+    for (index = 0; index < num_points; index++)
+    {
+        extents.left = MIN(extents.left, points[index * 2]);
+        extents.top = MIN(extents.top, points[index * 2 + 1]);
+        extents.right = MAX(extents.right, points[index * 2] + 1);
+        extents.bottom = MAX(extents.bottom, points[index * 2 + 1] + 1);
+    }
+    vals[0] = startx;
+    vals[1] = self->orders_state.polyline_x;
+    vals[2] = starty;
+    vals[3] = self->orders_state.polyline_y;
+    order_flags = xrdp_orders_start_primary(self, RDP_ORDER_POLYLINE,
+                                            vals, 4, &extents, rect, 1,
+                                            &order_flags_ptr, &present_ptr);
+    present = 0;
+
+    if (xrdp_orders_out_coord(self, order_flags, startx,
+                              &self->orders_state.polyline_x))
+    {
+        present |= 0x01;
+    }
+
+    if (xrdp_orders_out_coord(self, order_flags, starty,
+                              &self->orders_state.polyline_y))
+    {
+        present |= 0x02;
+    }
+
+    if (rop != self->orders_state.polyline_rop)
+    {
+        present |= 0x04;
+        out_uint8(self->out_s, rop);
+        self->orders_state.polyline_rop = rop;
+    }
+
+    /* brush cache entry, 0x08, is unused */
+
+    if (color != self->orders_state.polyline_color)
+    {
+        present |= 0x10;
+        out_uint8(self->out_s, color);
+        out_uint8(self->out_s, color >> 8);
+        out_uint8(self->out_s, color >> 16);
+        self->orders_state.polyline_color = color;
+    }
+
+    /* always send the points, DELTA_PTS_FIELD with a 1 byte cbData */
+    present |= 0x20 | 0x40;
+    s = self->out_s;
+    out_uint8(s, num_points);
+    size_ptr = s->p;
+    out_uint8s(s, 1);
+    zero_bits_ptr = s->p;
+    out_uint8s(s, (num_points + 3) / 4);
+    g_memset(zero_bits_ptr, 0, (num_points + 3) / 4);
+    lastx = startx;
+    lasty = starty;
+    for (index = 0; index < num_points; index++)
+    {
+        flags = 0;
+        if (points[index * 2] == lastx)
+        {
+            flags |= 0x80;
+        }
+        else
+        {
+            xrdp_orders_out_delta(s, points[index * 2] - lastx);
+        }
+        if (points[index * 2 + 1] == lasty)
+        {
+            flags |= 0x40;
+        }
+        else
+        {
+            xrdp_orders_out_delta(s, points[index * 2 + 1] - lasty);
+        }
+        zero_bits_ptr[index / 4] |= flags >> ((index & 3) * 2);
+        lastx = points[index * 2];
+        lasty = points[index * 2 + 1];
+    }
+    size = (int)(s->p - zero_bits_ptr);
+    size_ptr[0] = size;
+
+    xrdp_order_pack_small_or_tiny(self, order_flags_ptr, order_flags,
+                                  present_ptr, present, 1);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* draw connected solid 1 pixel lines from startx, starty through the
+   x, y pairs in points, PolyLine orders if the client can */
+int
+xrdp_orders_polyline(struct xrdp_orders *self, int startx, int starty,
+                     const int *points, int num_points, int rop, int color,
+                     struct xrdp_rect *rect)
+{
+    struct xrdp_pen pen;
+    int index;
+    int count;
+
+    if ((num_points < 2) ||
+            !self->rdp_layer->client_info.orders[TS_NEG_POLYLINE_INDEX])
+    {
+        pen.style = 0;
+        pen.width = 1;
+        pen.color = color;
+        for (index = 0; index < num_points; index++)
+        {
+            if (xrdp_orders_line(self, 1, startx, starty,
+                                 points[index * 2], points[index * 2 + 1],
+                                 rop, 0, &pen, rect) != 0)
+            {
+                return 1;
+            }
+            startx = points[index * 2];
+            starty = points[index * 2 + 1];
+        }
+        return 0;
+    }
+    for (index = 0; index < num_points; index += count)
+    {
+        count = MIN(num_points - index, TS_MAX_DELTA_POINTS);
+        if (xrdp_orders_polyline_part(self, startx, starty,
+                                      points + index * 2, count,
+                                      rop, color, rect) != 0)
+        {
+            return 1;
+        }
+        startx = points[(index + count - 1) * 2];
+        starty = points[(index + count - 1) * 2 + 1];
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error */
 /* when a palette gets sent, send the main palette too */
@@ -0,0 +1,648 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * primary order batching
+ *
+ * Between xrdp_orders_init() and xrdp_orders_send() the simple primary
+ * orders are queued instead of encoded. When the update is sent, or any
+ * other order is about to be encoded, the queue is encoded with orders of
+ * the same type and bounds moved next to each other, as long as the
+ * moved order does not touch the screen area of any order it is moved in
+ * front of. Runs of the same order type let the encoder drop the order
+ * type byte, reuse the last bounds and send coordinate deltas.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+#include "ms-rdpegdi.h"
+
+/*****************************************************************************/
+/* returns boolean */
+int
+xrdp_orders_batch_active(struct xrdp_orders *self)
+{
+    return (self->batch != NULL) && (self->order_level > 0) &&
+           !self->batch->replaying;
+}
+
+/*****************************************************************************/
+static void
+xrdp_orders_batch_set_rect(struct xrdp_rect *rect,
+                           int left, int top, int right, int bottom)
+{
+    rect->left = left;
+    rect->top = top;
+    rect->right = right;
+    rect->bottom = bottom;
+}
+
+/*****************************************************************************/
+/* the area an order can change is clipped by its bounds */
+static void
+xrdp_orders_batch_clip_area(struct xrdp_batched_order *order)
+{
+    if (order->has_bounds)
+    {
+        order->area.left = MAX(order->area.left, order->bounds.left);
+        order->area.top = MAX(order->area.top, order->bounds.top);
+        order->area.right = MIN(order->area.right, order->bounds.right);
+        order->area.bottom = MIN(order->area.bottom, order->bounds.bottom);
+    }
+}
+
+/*****************************************************************************/
+/* returns boolean */
+static int
+xrdp_orders_batch_overlap(const struct xrdp_rect *r1,
+                          const struct xrdp_rect *r2)
+{
+    if ((r1->left >= r1->right) || (r1->top >= r1->bottom) ||
+            (r2->left >= r2->right) || (r2->top >= r2->bottom))
+    {
+        return 0;
+    }
+    return (r1->left < r2->right) && (r2->left < r1->right) &&
+           (r1->top < r2->bottom) && (r2->top < r1->bottom);
+}
+
+/*****************************************************************************/
+/* returns a zeroed slot at the end of the queue, NULL on error */
+static struct xrdp_batched_order *
+xrdp_orders_batch_new(struct xrdp_orders *self, int type,
+                      struct xrdp_rect *rect)
+{
+    struct xrdp_orders_batch *batch;
+    struct xrdp_batched_order *order;
+
+    batch = self->batch;
+    if (batch->count >= XRDP_ORDERS_BATCH_MAX)
+    {
+        if (xrdp_orders_batch_flush(self) != 0)
+        {
+            return NULL;
+        }
+    }
+    order = batch->orders + batch->count;
+    batch->count++;
+    batch->batched++;
+    g_memset(order, 0, sizeof(struct xrdp_batched_order));
+    order->type = type;
+    if (rect != NULL)
+    {
+        order->has_bounds = 1;
+        order->bounds = *rect;
+    }
+    return order;
+}
+
+/*****************************************************************************/
+int
+xrdp_orders_batch_rect(struct xrdp_orders *self, int x, int y,
+                       int cx, int cy, int color, struct xrdp_rect *rect)
+{
+    struct xrdp_batched_order *order;
+
+    order = xrdp_orders_batch_new(self, RDP_ORDER_RECT, rect);
+    if (order == NULL)
+    {
+        return 1;
+    }
+    order->x = x;
+    order->y = y;
+    order->cx = cx;
+    order->cy = cy;
+    order->bg_color = color;
+    xrdp_orders_batch_set_rect(&(order->area), x, y, x + cx, y + cy);
+    xrdp_orders_batch_clip_area(order);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_orders_batch_screen_blt(struct xrdp_orders *self, int x, int y,
+                             int cx, int cy, int srcx, int srcy,
+                             int rop, struct xrdp_rect *rect)
+{
+    struct xrdp_batched_order *order;
+
+    order = xrdp_orders_batch_new(self, RDP_ORDER_SCREENBLT, rect);
+    if (order == NULL)
+    {
+        return 1;
+    }
+    order->x = x;
+    order->y = y;
+    order->cx = cx;
+    order->cy = cy;
+    order->srcx = srcx;
+    order->srcy = srcy;
+    order->rop = rop;
+    /* reads the source and writes the destination, the bounds only clip
+       the destination so the area is left unclipped */
+    xrdp_orders_batch_set_rect(&(order->area),
+                               MIN(x, srcx), MIN(y, srcy),
+                               MAX(x, srcx) + cx, MAX(y, srcy) + cy);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_orders_batch_pat_blt(struct xrdp_orders *self, int x, int y,
+                          int cx, int cy, int rop, int bg_color,
+                          int fg_color, struct xrdp_brush *brush,
+                          struct xrdp_rect *rect)
+{
+    struct xrdp_batched_order *order;
+
+    order = xrdp_orders_batch_new(self, RDP_ORDER_PATBLT, rect);
+    if (order == NULL)
+    {
+        return 1;
+    }
+    order->x = x;
+    order->y = y;
+    order->cx = cx;
+    order->cy = cy;
+    order->rop = rop;
+    order->bg_color = bg_color;
+    order->fg_color = fg_color;
+    if (brush != NULL)
+    {
+        order->has_brush = 1;
+        order->brush = *brush;
+    }
+    xrdp_orders_batch_set_rect(&(order->area), x, y, x + cx, y + cy);
+    xrdp_orders_batch_clip_area(order);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_orders_batch_dest_blt(struct xrdp_orders *self, int x, int y,
+                           int cx, int cy, int rop,
+                           struct xrdp_rect *rect)
+{
+    struct xrdp_batched_order *order;
+
+    order = xrdp_orders_batch_new(self, RDP_ORDER_DESTBLT, rect);
+    if (order == NULL)
+    {
+        return 1;
+    }
+    order->x = x;
+    order->y = y;
+    order->cx = cx;
+    order->cy = cy;
+    order->rop = rop;
+    xrdp_orders_batch_set_rect(&(order->area), x, y, x + cx, y + cy);
+    xrdp_orders_batch_clip_area(order);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_orders_batch_line(struct xrdp_orders *self, int mix_mode,
+                       int startx, int starty,
+                       int endx, int endy, int rop, int bg_color,
+                       struct xrdp_pen *pen,
+                       struct xrdp_rect *rect)
+{
+    struct xrdp_batched_order *order;
+    int width;
+
+    order = xrdp_orders_batch_new(self, RDP_ORDER_LINE, rect);
+    if (order == NULL)
+    {
+        return 1;
+    }
+    order->mix_mode = mix_mode;
+    order->x = startx;
+    order->y = starty;
+    order->cx = endx;
+    order->cy = endy;
+    order->rop = rop;
+    order->bg_color = bg_color;
+    width = 1;
+    if (pen != NULL)
+    {
+        order->has_pen = 1;
+        order->pen = *pen;
+        width = MAX(pen->width, 1);
+    }
+    xrdp_orders_batch_set_rect(&(order->area),
+                               MIN(startx, endx) - width,
+                               MIN(starty, endy) - width,
+                               MAX(startx, endx) + width + 1,
+                               MAX(starty, endy) + width + 1);
+    xrdp_orders_batch_clip_area(order);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_orders_batch_mem_blt(struct xrdp_orders *self, int cache_id,
+                          int color_table, int x, int y, int cx, int cy,
+                          int rop, int srcx, int srcy,
+                          int cache_idx, struct xrdp_rect *rect)
+{
+    struct xrdp_batched_order *order;
+
+    order = xrdp_orders_batch_new(self, RDP_ORDER_MEMBLT, rect);
+    if (order == NULL)
+    {
+        return 1;
+    }
+    order->cache_id = cache_id;
+    order->color_table = color_table;
+    order->x = x;
+    order->y = y;
+    order->cx = cx;
+    order->cy = cy;
+    order->rop = rop;
+    order->srcx = srcx;
+    order->srcy = srcy;
+    order->cache_idx = cache_idx;
+    xrdp_orders_batch_set_rect(&(order->area), x, y, x + cx, y + cy);
+    xrdp_orders_batch_clip_area(order);
+    return 0;
+}
+
+/*****************************************************************************/
+/* how well order encodes after last, 0 if the type changes */
+static int
+xrdp_orders_batch_score(const struct xrdp_batched_order *last,
+                        const struct xrdp_batched_order *order)
+{
+    int score;
+
+    if ((last == NULL) || (last->type != order->type))
+    {
+        return 0;
+    }
+    score = 4;
+    if (last->has_bounds == order->has_bounds)
+    {
+        if (!order->has_bounds ||
+                ((last->bounds.left == order->bounds.left) &&
+                 (last->bounds.top == order->bounds.top) &&
+                 (last->bounds.right == order->bounds.right) &&
+                 (last->bounds.bottom == order->bounds.bottom)))
+        {
+            score += 2;
+        }
+    }
+    if ((g_abs(last->x - order->x) < 128) &&
+            (g_abs(last->y - order->y) < 128) &&
+            (g_abs(last->cx - order->cx) < 128) &&
+            (g_abs(last->cy - order->cy) < 128))
+    {
+        score += 1;
+    }
+    return score;
+}
+
+/*****************************************************************************/
+/* returns boolean, true if the order at index can go in front of all the
+   unsent orders before it */
+static int
+xrdp_orders_batch_movable(struct xrdp_orders_batch *batch, int first,
+                          int index)
+{
+    const struct xrdp_rect *area;
+    int k;
+
+    area = &(batch->orders[index].area);
+    for (k = first; k < index; k++)
+    {
+        if (!batch->orders[k].sent &&
+                xrdp_orders_batch_overlap(&(batch->orders[k].area), area))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* returns the index of the next order to encode */
+static int
+xrdp_orders_batch_pick(struct xrdp_orders_batch *batch, int first,
+                       const struct xrdp_batched_order *last)
+{
+    int best;
+    int best_score;
+    int score;
+    int end;
+    int index;
+
+    best = first;
+    best_score = xrdp_orders_batch_score(last, batch->orders + first);
+    if ((last == NULL) || (best_score == 7))
+    {
+        return best;
+    }
+    end = MIN(batch->count, first + XRDP_ORDERS_BATCH_WINDOW);
+    for (index = first + 1; index < end; index++)
+    {
+        if (batch->orders[index].sent)
+        {
+            continue;
+        }
+        score = xrdp_orders_batch_score(last, batch->orders + index);
+        if ((score > best_score) &&
+                xrdp_orders_batch_movable(batch, first, index))
+        {
+            best = index;
+            best_score = score;
+            if (best_score == 7)
+            {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+/*****************************************************************************/
+static int
+xrdp_orders_batch_encode(struct xrdp_orders *self,
+                         struct xrdp_batched_order *order)
+{
+    struct xrdp_rect *bounds;
+
+    bounds = order->has_bounds ? &(order->bounds) : NULL;
+    switch (order->type)
+    {
+        case RDP_ORDER_RECT:
+            return xrdp_orders_rect(self, order->x, order->y,
+                                    order->cx, order->cy,
+                                    order->bg_color, bounds);
+        case RDP_ORDER_SCREENBLT:
+            return xrdp_orders_screen_blt(self, order->x, order->y,
+                                          order->cx, order->cy,
+                                          order->srcx, order->srcy,
+                                          order->rop, bounds);
+        case RDP_ORDER_PATBLT:
+            return xrdp_orders_pat_blt(self, order->x, order->y,
+                                       order->cx, order->cy, order->rop,
+                                       order->bg_color, order->fg_color,
+                                       order->has_brush ?
+                                       &(order->brush) : NULL,
+                                       bounds);
+        case RDP_ORDER_DESTBLT:
+            return xrdp_orders_dest_blt(self, order->x, order->y,
+                                        order->cx, order->cy,
+                                        order->rop, bounds);
+        case RDP_ORDER_LINE:
+            return xrdp_orders_line(self, order->mix_mode,
+                                    order->x, order->y,
+                                    order->cx, order->cy,
+                                    order->rop, order->bg_color,
+                                    order->has_pen ? &(order->pen) : NULL,
+                                    bounds);
+        case RDP_ORDER_MEMBLT:
+            return xrdp_orders_mem_blt(self, order->cache_id,
+                                       order->color_table,
+                                       order->x, order->y,
+                                       order->cx, order->cy, order->rop,
+                                       order->srcx, order->srcy,
+                                       order->cache_idx, bounds);
+    }
+    LOG(LOG_LEVEL_ERROR, "xrdp_orders_batch_encode: bad order type %d",
+        order->type);
+    return 1;
+}
+
+/*****************************************************************************/
+/* returns boolean, true if order is a solid 1 pixel line a PolyLine can
+   carry after last, last can be NULL for the first line */
+static int
+xrdp_orders_batch_polyline_segment(const struct xrdp_batched_order *last,
+                                   const struct xrdp_batched_order *order)
+{
+    if ((order->type != RDP_ORDER_LINE) || !order->has_pen ||
+            (order->pen.style != 0) || (order->pen.width > 1))
+    {
+        return 0;
+    }
+    if (last == NULL)
+    {
+        return 1;
+    }
+    return (order->x == last->cx) && (order->y == last->cy) &&
+           (order->rop == last->rop) &&
+           (order->pen.color == last->pen.color) &&
+           (order->has_bounds == last->has_bounds) &&
+           (!order->has_bounds ||
+            ((order->bounds.left == last->bounds.left) &&
+             (order->bounds.top == last->bounds.top) &&
+             (order->bounds.right == last->bounds.right) &&
+             (order->bounds.bottom == last->bounds.bottom)));
+}
+
+/*****************************************************************************/
+/* send the line at index and the queued lines that carry on from its end
+   point as one PolyLine order
+   returns the number of lines sent, 0 if there is no chain */
+static int
+xrdp_orders_batch_polyline(struct xrdp_orders *self, int first, int index,
+                           int *rv)
+{
+    struct xrdp_orders_batch *batch;
+    struct xrdp_batched_order *order;
+    struct xrdp_batched_order *last;
+    int points[TS_MAX_DELTA_POINTS * 2];
+    int num_points;
+    int end;
+    int k;
+
+    batch = self->batch;
+    order = batch->orders + index;
+    if (!self->rdp_layer->client_info.orders[TS_NEG_POLYLINE_INDEX] ||
+            !xrdp_orders_batch_polyline_segment(NULL, order))
+    {
+        return 0;
+    }
+    /* mark as we go so the movable check skips lines in the chain */
+    order->sent = 1;
+    last = order;
+    points[0] = order->cx;
+    points[1] = order->cy;
+    num_points = 1;
+    end = MIN(batch->count, index + XRDP_ORDERS_BATCH_WINDOW);
+    for (k = index + 1; (k < end) && (num_points < TS_MAX_DELTA_POINTS); k++)
+    {
+        if (batch->orders[k].sent ||
+                !xrdp_orders_batch_polyline_segment(last, batch->orders + k) ||
+                !xrdp_orders_batch_movable(batch, first, k))
+        {
+            continue;
+        }
+        last = batch->orders + k;
+        last->sent = 1;
+        points[num_points * 2] = last->cx;
+        points[num_points * 2 + 1] = last->cy;
+        num_points++;
+    }
+    if (num_points < 2)
+    {
+        order->sent = 0;
+        return 0;
+    }
+    if (xrdp_orders_polyline(self, order->x, order->y, points, num_points,
+                             order->rop, order->pen.color,
+                             order->has_bounds ? &(order->bounds) : NULL) != 0)
+    {
+        *rv = 1;
+    }
+    return num_points;
+}
+
+/*****************************************************************************/
+/* encode all queued orders into the orders stream */
+/* returns error */
+int
+xrdp_orders_batch_flush(struct xrdp_orders *self)
+{
+    struct xrdp_orders_batch *batch;
+    struct xrdp_batched_order *last;
+    int first;
+    int index;
+    int rv;
+
+    batch = self->batch;
+    if ((batch == NULL) || batch->replaying || (batch->count < 1))
+    {
+        return 0;
+    }
+    batch->replaying = 1;
+    batch->flushes++;
+    rv = 0;
+    last = NULL;
+    first = 0;
+    while (first < batch->count)
+    {
+        index = xrdp_orders_batch_pick(batch, first, last);
+        if (index != first)
+        {
+            batch->moved++;
+        }
+        last = batch->orders + index;
+        if (xrdp_orders_batch_polyline(self, first, index, &rv) > 0)
+        {
+            /* the lines are marked sent, nothing queued is a PolyLine */
+            last = NULL;
+        }
+        else
+        {
+            if (xrdp_orders_batch_encode(self, last) != 0)
+            {
+                rv = 1;
+            }
+            last->sent = 1;
+        }
+        while ((first < batch->count) && batch->orders[first].sent)
+        {
+            first++;
+        }
+    }
+    batch->count = 0;
+    batch->replaying = 0;
+    return rv;
+}
+
+/*****************************************************************************/
+/* called when a primary order has been encoded at order_start */
+void
+xrdp_orders_stats_add(struct xrdp_orders *self, int order_type,
+                      const char *order_start)
+{
+    if (self->stats == NULL)
+    {
+        return;
+    }
+    order_type &= 63;
+    self->stats->bytes[order_type] += (int) (self->out_s->p - order_start);
+    self->stats->count[order_type]++;
+}
+
+/*****************************************************************************/
+static const char *
+xrdp_orders_stats_name(int order_type)
+{
+    switch (order_type)
+    {
+        case RDP_ORDER_DESTBLT:
+            return "dest_blt";
+        case RDP_ORDER_PATBLT:
+            return "pat_blt";
+        case RDP_ORDER_SCREENBLT:
+            return "screen_blt";
+        case RDP_ORDER_LINE:
+            return "line";
+        case RDP_ORDER_RECT:
+            return "rect";
+        case RDP_ORDER_MEMBLT:
+            return "mem_blt";
+        case RDP_ORDER_MULTIDSTBLT:
+            return "multi_dest_blt";
+        case RDP_ORDER_MULTIPATBLT:
+            return "multi_pat_blt";
+        case RDP_ORDER_MULTISCRBLT:
+            return "multi_scr_blt";
+        case RDP_ORDER_MULTIOPAQUERECT:
+            return "multi_rect";
+        case RDP_ORDER_POLYLINE:
+            return "polyline";
+        case RDP_ORDER_TEXT2:
+            return "text2";
+        case RDP_ORDER_COMPOSITE:
+            return "composite";
+    }
+    return "other";
+}
+
+/*****************************************************************************/
+void
+xrdp_orders_stats_log(struct xrdp_orders *self)
+{
+    int index;
+
+    if (self->stats == NULL)
+    {
+        return;
+    }
+    for (index = 0; index < 64; index++)
+    {
+        if (self->stats->count[index] > 0)
+        {
+            LOG(LOG_LEVEL_INFO, "order stats: %-14s type %2d count %9d "
+                "bytes %11lld avg %6.2f", xrdp_orders_stats_name(index),
+                index, self->stats->count[index], self->stats->bytes[index],
+                (double) self->stats->bytes[index] /
+                self->stats->count[index]);
+        }
+    }
+    if (self->batch != NULL)
+    {
+        LOG(LOG_LEVEL_INFO, "order stats: batched %d orders in %d flushes, "
+            "%d moved", self->batch->batched, self->batch->flushes,
+            self->batch->moved);
+    }
+}
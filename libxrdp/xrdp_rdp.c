@@ -53,6 +53,8 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
     client_info->xrdp_keyboard_overrides.type = -1;
     client_info->xrdp_keyboard_overrides.subtype = -1;
     client_info->xrdp_keyboard_overrides.layout = -1;
+    client_info->channel_qos_max_queued_kb = 64;
+    client_info->vc_chunk_size = CHANNEL_CHUNK_MAX_LENGTH;
 
     /* initialize (zero out) local variables: */
     items = list_create();
@@ -133,6 +135,43 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
         {
             client_info->rfx_min_pixel = g_atoi(value);
         }
+        else if (g_strcasecmp(item, "order_batching") == 0)
+        {
+            client_info->order_batching = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "order_stats") == 0)
+        {
+            client_info->order_stats = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "channel_qos") == 0)
+        {
+            client_info->channel_qos = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "channel_qos_max_queued_kb") == 0)
+        {
+            client_info->channel_qos_max_queued_kb = g_atoi(value);
+        }
+        else if (g_strcasecmp(item, "channel_qos_audio_rate_kb") == 0)
+        {
+            client_info->channel_qos_rate[XRDP_CHAN_CLASS_AUDIO] =
+                MAX(g_atoi(value), 0) * 1024;
+        }
+        else if (g_strcasecmp(item, "channel_qos_bulk_rate_kb") == 0)
+        {
+            client_info->channel_qos_rate[XRDP_CHAN_CLASS_BULK] =
+                MAX(g_atoi(value), 0) * 1024;
+        }
+        else if (g_strcasecmp(item, "vc_chunk_size") == 0)
+        {
+            client_info->vc_chunk_size = g_atoi(value);
+            if (client_info->vc_chunk_size < CHANNEL_CHUNK_LENGTH ||
+                    client_info->vc_chunk_size > CHANNEL_CHUNK_MAX_LENGTH)
+            {
+                LOG(LOG_LEVEL_WARNING, "vc_chunk_size %s out of range, "
+                    "using %d", value, CHANNEL_CHUNK_MAX_LENGTH);
+                client_info->vc_chunk_size = CHANNEL_CHUNK_MAX_LENGTH;
+            }
+        }
         else if (g_strcasecmp(item, "new_cursors") == 0)
         {
             client_info->pointer_flags = g_text2bool(value) == 0 ? 2 : 0;
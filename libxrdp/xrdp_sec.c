@@ -183,6 +183,7 @@ xrdp_sec_delete(struct xrdp_sec *self)
         return;
     }
 
+    xrdp_autodetect_delete(self->autodetect);
     xrdp_channel_delete(self->chan_layer);
     xrdp_mcs_delete(self->mcs_layer);
     xrdp_fastpath_delete(self->fastpath_layer);
@@ -1079,6 +1080,32 @@ xrdp_sec_recv(struct xrdp_sec *self, struct stream *s, int *chan)
         return 1;
     }
 
+    if (*chan != 0 && *chan == self->mcs_layer->msg_chanid)
+    {
+        /* the message channel always has a TS_SECURITY_HEADER */
+        if (!s_check_rem_and_log(s, 4, "Parsing [MS-RDPBCGR] "
+                                 "TS_SECURITY_HEADER"))
+        {
+            return 1;
+        }
+        in_uint32_le(s, flags);
+        if ((flags & SEC_AUTODETECT_RSP) && self->autodetect != NULL)
+        {
+            if (xrdp_autodetect_process(self->autodetect, s, g_time3()) != 0)
+            {
+                LOG(LOG_LEVEL_WARNING, "xrdp_sec_recv: "
+                    "xrdp_autodetect_process failed");
+            }
+        }
+        else
+        {
+            LOG(LOG_LEVEL_DEBUG, "xrdp_sec_recv: message channel PDU with "
+                "flags 0x%8.8x (ignored)", flags);
+        }
+        *chan = 1; /* just set a non existing channel and exit */
+        return 0;
+    }
+
     /* TODO: check if moving this check until after the is_security_header_present
     causes any issues.
     the security header is optional (eg. TLS connections), so this
@@ -1332,6 +1359,44 @@ xrdp_sec_send(struct xrdp_sec *self, struct stream *s, int chan)
     return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_sec_init_msg_channel(struct xrdp_sec *self, struct stream *s)
+{
+    if (self->mcs_layer->msg_chanid == 0)
+    {
+        return 1;
+    }
+    if (xrdp_mcs_init(self->mcs_layer, s) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_sec_init_msg_channel: xrdp_mcs_init failed");
+        return 1;
+    }
+    /* only TLS connections have a message channel, so this is always a
+       plain TS_SECURITY_HEADER */
+    s_push_layer(s, sec_hdr, 4);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_sec_send_msg_channel(struct xrdp_sec *self, struct stream *s, int flags)
+{
+    s_pop_layer(s, sec_hdr);
+    out_uint32_le(s, flags);
+    LOG_DEVEL(LOG_LEVEL_TRACE, "Adding header [MS-RDPBCGR] TS_SECURITY_HEADER "
+              "flags 0x%4.4x, flagsHi 0x%4.4x", flags & 0xffff,
+              (flags & 0xffff0000) >> 16);
+    if (xrdp_mcs_send(self->mcs_layer, s, self->mcs_layer->msg_chanid) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_sec_send_msg_channel: xrdp_mcs_send failed");
+        return 1;
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns the fastpath sec byte count */
 int
@@ -2067,6 +2132,7 @@ xrdp_sec_process_mcs_data(struct xrdp_sec *self)
     char *hold_p = (char *)NULL;
     int tag = 0;
     int size = 0;
+    int msg_channel = 0;
     struct xrdp_client_info *client_info = &self->rdp_layer->client_info;
 
     s = &(self->client_mcs_data);
@@ -2144,8 +2210,18 @@ xrdp_sec_process_mcs_data(struct xrdp_sec *self)
                     return 1;
                 }
                 break;
-            /* CS_MCS_MSGCHANNEL 0xC006
-               CS_MULTITRANSPORT 0xC00A
+            case SEC_TAG_CLI_MSGCHANNEL:  /* CS_MCS_MSGCHANNEL 0xC006 */
+                if (!s_check_rem_and_log(s, 4, "Parsing [MS-RDPBCGR] "
+                                         "TS_UD_CS_MCS_MSGCHANNEL"))
+                {
+                    return 1;
+                }
+                in_uint8s(s, 4); /* flags, unused */
+                LOG_DEVEL(LOG_LEVEL_TRACE, "Received [MS-RDPBCGR] "
+                          "TS_UD_CS_MCS_MSGCHANNEL");
+                msg_channel = 1;
+                break;
+            /* CS_MULTITRANSPORT 0xC00A
                SC_CORE           0x0C01
                SC_SECURITY       0x0C02
                SC_NET            0x0C03
@@ -2175,6 +2251,22 @@ xrdp_sec_process_mcs_data(struct xrdp_sec *self)
         }
     }
 
+    /* The message channel is only used for network auto-detect after
+       the connection is up. That needs no more than the basic security
+       header, so it is only offered on TLS connections */
+    if (msg_channel &&
+            client_info->mcs_connection_type == CONNECTION_TYPE_AUTODETECT &&
+            (client_info->mcs_early_capability_flags &
+             RNS_UD_CS_SUPPORT_NETCHAR_AUTODETECT) &&
+            self->mcs_layer->iso_layer->selectedProtocol > PROTOCOL_RDP)
+    {
+        self->mcs_layer->msg_chanid = MCS_GLOBAL_CHANNEL +
+                                      self->mcs_layer->channel_list->count + 1;
+        self->autodetect = xrdp_autodetect_create(self);
+        LOG(LOG_LEVEL_INFO, "Network auto-detect on MCS channel %d",
+            self->mcs_layer->msg_chanid);
+    }
+
     /* set p to beginning */
     s->p = s->data;
     return 0;
@@ -33,6 +33,17 @@
 #include "xrdp_constants.h"
 #include "fifo.h"
 #include "audin.h"
+#include "chansrv_config.h"
+
+#if defined(XRDP_OPUS)
+#include <opus/opus.h>
+static OpusDecoder *g_opus_decoder = NULL;
+#endif
+
+#if defined(XRDP_FDK_AAC)
+#include <fdk-aac/aacdecoder_lib.h>
+static HANDLE_AACDECODER g_aac_decoder = NULL;
+#endif
 
 #define MSG_SNDIN_VERSION       1
 #define MSG_SNDIN_FORMATS       2
@@ -47,8 +58,14 @@
 #define AUDIN_NAME "AUDIO_INPUT"
 #define AUDIN_FLAGS  1 /* WTS_CHANNEL_OPTION_DYNAMIC */
 
+/* the session's source takes 44.1 kHz, stereo, 16 bit */
+#define AUDIN_OUT_RATE 44100
+#define AUDIN_OUT_BYTES_PER_SEC (AUDIN_OUT_RATE * 4)
+#define AUDIN_DEFAULT_FRAMES_PER_PACKET 2048
+
 extern struct fifo *g_in_fifo; /* in sound.c */
 extern int g_bytes_in_fifo; /* in sound.c */
+extern struct config_chansrv *g_cfg; /* in chansrv.c */
 
 struct xr_wave_format_ex
 {
@@ -75,16 +92,63 @@ static struct xr_wave_format_ex g_pcm_44100 =
     g_pcm_44100_data /* data */
 };
 
+#if defined(XRDP_OPUS)
+/* Opus only runs at 48 kHz here, we resample to 44.1 kHz after */
+static uint8_t g_opus_48000_data[] = { 0 };
+static struct xr_wave_format_ex g_opus_48000 =
+{
+    WAVE_FORMAT_OPUS,  /* wFormatTag */
+    2,                 /* num of channels */
+    48000,             /* samples per sec */
+    192000,            /* avg bytes per sec */
+    4,                 /* block align */
+    16,                /* bits per sample */
+    0,                 /* data size */
+    g_opus_48000_data  /* data */
+};
+#endif
+
+#if defined(XRDP_FDK_AAC)
+/* AAC-LC in raw frames, the same as we send for playback */
+static uint8_t g_aac_44100_data[] = { 0 };
+static struct xr_wave_format_ex g_aac_44100 =
+{
+    WAVE_FORMAT_AAC,   /* wFormatTag */
+    2,                 /* num of channels */
+    44100,             /* samples per sec */
+    12000,             /* avg bytes per sec */
+    4,                 /* block align */
+    16,                /* bits per sample */
+    0,                 /* data size */
+    g_aac_44100_data   /* data */
+};
+/* AudioSpecificConfig, AAC-LC, 44.1 kHz, 2 channels */
+static UCHAR g_aac_44100_asc[] = { 0x12, 0x10 };
+#endif
+
 static struct chansrv_drdynvc_procs g_audin_info;
 static int g_audin_chanid;
 static struct stream *g_in_s;
 
+/* compressed formats first, they are left out if not enabled */
 static struct xr_wave_format_ex *g_server_formats[] =
 {
+#if defined(XRDP_OPUS)
+    &g_opus_48000,
+#endif
+#if defined(XRDP_FDK_AAC)
+    &g_aac_44100,
+#endif
     &g_pcm_44100,
     NULL
 };
 
+/* 48 kHz to 44.1 kHz for Opus. Output samples are 160/147 of an input
+   sample apart, 'phase' is the position of the next one in 147ths past
+   'prev', the last input sample of the previous packet */
+static int g_resample_phase = 0;
+static short g_resample_prev[2];
+
 static struct xr_wave_format_ex **g_client_formats = NULL;
 
 static int g_current_format = 0; /* index in g_client_formats */
@@ -132,6 +196,274 @@ cleanup_client_formats(void)
     return 0;
 }
 
+/*****************************************************************************/
+static int
+audin_is_compressed(int wFormatTag)
+{
+    return (wFormatTag == WAVE_FORMAT_OPUS) || (wFormatTag == WAVE_FORMAT_AAC);
+}
+
+/*****************************************************************************/
+/* free the decoders, a new one is made for the next format */
+static void
+audin_decoders_reset(void)
+{
+#if defined(XRDP_OPUS)
+    if (g_opus_decoder != NULL)
+    {
+        opus_decoder_destroy(g_opus_decoder);
+        g_opus_decoder = NULL;
+    }
+#endif
+#if defined(XRDP_FDK_AAC)
+    if (g_aac_decoder != NULL)
+    {
+        aacDecoder_Close(g_aac_decoder);
+        g_aac_decoder = NULL;
+    }
+#endif
+    g_resample_phase = 0;
+    g_resample_prev[0] = 0;
+    g_resample_prev[1] = 0;
+}
+
+/*****************************************************************************/
+/* hand PCM to sound.c for the session, dropping the oldest if too much
+   is waiting */
+static int
+audin_queue_pcm(const char *data, int data_bytes)
+{
+    struct stream *ls;
+    int max_bytes;
+
+    if (data_bytes < 1)
+    {
+        return 0;
+    }
+    xstream_new(ls, data_bytes);
+    g_memcpy(ls->data, data, data_bytes);
+    ls->p += data_bytes;
+    s_mark_end(ls);
+    fifo_add_item(g_in_fifo, (void *) ls);
+    g_bytes_in_fifo += data_bytes;
+
+    if (g_cfg->audin_max_buffer_ms > 0)
+    {
+        max_bytes = g_cfg->audin_max_buffer_ms * AUDIN_OUT_BYTES_PER_SEC / 1000;
+        /* never drop what was just added */
+        while ((g_bytes_in_fifo > max_bytes) && (g_bytes_in_fifo > data_bytes))
+        {
+            ls = (struct stream *) fifo_remove_item(g_in_fifo);
+            g_bytes_in_fifo -= ls->size;
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "audin_queue_pcm: dropped %d bytes",
+                      ls->size);
+            xstream_free(ls);
+        }
+    }
+    return 0;
+}
+
+#if defined(XRDP_OPUS)
+
+/*****************************************************************************/
+/* linear resample 48 kHz stereo to 44.1 kHz stereo
+   returns number of stereo samples written to out */
+static int
+audin_resample_48000(const short *in, int in_samples, short *out)
+{
+    const short *x0;
+    const short *x1;
+    int out_samples;
+    int index;
+    int frac;
+    int chan;
+
+    out_samples = 0;
+    while (g_resample_phase < in_samples * 147)
+    {
+        index = g_resample_phase / 147;
+        frac = g_resample_phase % 147;
+        /* x0 is input sample index - 1, i.e. g_resample_prev for 0 */
+        x0 = (index == 0) ? g_resample_prev : in + (index - 1) * 2;
+        x1 = in + index * 2;
+        for (chan = 0; chan < 2; chan++)
+        {
+            out[out_samples * 2 + chan] =
+                (short) ((x0[chan] * (147 - frac) + x1[chan] * frac) / 147);
+        }
+        out_samples++;
+        g_resample_phase += 160;
+    }
+    if (in_samples > 0)
+    {
+        g_resample_phase -= in_samples * 147;
+        g_resample_prev[0] = in[(in_samples - 1) * 2];
+        g_resample_prev[1] = in[(in_samples - 1) * 2 + 1];
+    }
+    return out_samples;
+}
+
+/*****************************************************************************/
+static int
+audin_decode_opus(const char *data, int data_bytes)
+{
+    /* the longest Opus packet is 120 ms */
+    short pcm48[5760 * 2];
+    short pcm44[5760 * 2];
+    int error;
+    int samples;
+
+    if (g_opus_decoder == NULL)
+    {
+        /* a mono stream is decoded to stereo */
+        g_opus_decoder = opus_decoder_create(48000, 2, &error);
+        if (g_opus_decoder == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "audin_decode_opus: opus_decoder_create "
+                "failed %d", error);
+            return 1;
+        }
+    }
+    samples = opus_decode(g_opus_decoder, (const unsigned char *) data,
+                          data_bytes, pcm48, 5760, 0);
+    if (samples < 0)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "audin_decode_opus: opus_decode failed %d",
+                  samples);
+        return 1;
+    }
+    samples = audin_resample_48000(pcm48, samples, pcm44);
+    return audin_queue_pcm((const char *) pcm44, samples * 4);
+}
+
+#endif
+
+#if defined(XRDP_FDK_AAC)
+
+/*****************************************************************************/
+static int
+audin_decode_aac(const char *data, int data_bytes)
+{
+    /* 2048 is the longest AAC frame, per channel */
+    INT_PCM pcm[2048 * 2];
+    UCHAR *in_buffer;
+    UCHAR *asc;
+    UINT in_size;
+    UINT valid;
+    UINT asc_size;
+    AAC_DECODER_ERROR error;
+    CStreamInfo *info;
+
+    if (g_aac_decoder == NULL)
+    {
+        g_aac_decoder = aacDecoder_Open(TT_MP4_RAW, 1);
+        if (g_aac_decoder == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "audin_decode_aac: aacDecoder_Open failed");
+            return 1;
+        }
+        asc = g_aac_44100_asc;
+        asc_size = sizeof(g_aac_44100_asc);
+        if (aacDecoder_ConfigRaw(g_aac_decoder, &asc, &asc_size) != AAC_DEC_OK)
+        {
+            LOG(LOG_LEVEL_ERROR, "audin_decode_aac: aacDecoder_ConfigRaw failed");
+            aacDecoder_Close(g_aac_decoder);
+            g_aac_decoder = NULL;
+            return 1;
+        }
+    }
+    in_buffer = (UCHAR *) data;
+    in_size = data_bytes;
+    valid = data_bytes;
+    if (aacDecoder_Fill(g_aac_decoder, &in_buffer, &in_size, &valid) != AAC_DEC_OK)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "audin_decode_aac: aacDecoder_Fill failed");
+        return 1;
+    }
+    for (;;)
+    {
+        error = aacDecoder_DecodeFrame(g_aac_decoder, pcm,
+                                       sizeof(pcm) / sizeof(pcm[0]), 0);
+        if (error == AAC_DEC_NOT_ENOUGH_BITS)
+        {
+            break;
+        }
+        if (error != AAC_DEC_OK)
+        {
+            LOG_DEVEL(LOG_LEVEL_ERROR, "audin_decode_aac: "
+                      "aacDecoder_DecodeFrame failed 0x%x", error);
+            return 1;
+        }
+        info = aacDecoder_GetStreamInfo(g_aac_decoder);
+        if ((info == NULL) || (info->numChannels != 2))
+        {
+            return 1;
+        }
+        audin_queue_pcm((const char *) pcm,
+                        info->frameSize * info->numChannels * sizeof(INT_PCM));
+    }
+    return 0;
+}
+
+#endif
+
+/*****************************************************************************/
+/* returns non zero if we can turn this client format into our PCM */
+static int
+audin_can_decode(const struct xr_wave_format_ex *wf)
+{
+    if (wf->wFormatTag == WAVE_FORMAT_PCM)
+    {
+        return 1;
+    }
+    if (!g_cfg->audin_compressed)
+    {
+        return 0;
+    }
+#if defined(XRDP_OPUS)
+    if ((wf->wFormatTag == WAVE_FORMAT_OPUS) && (wf->nSamplesPerSec == 48000) &&
+            (wf->nChannels >= 1) && (wf->nChannels <= 2))
+    {
+        return 1;
+    }
+#endif
+#if defined(XRDP_FDK_AAC)
+    if ((wf->wFormatTag == WAVE_FORMAT_AAC) && (wf->nSamplesPerSec == 44100) &&
+            (wf->nChannels == 2))
+    {
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+/*****************************************************************************/
+/* pick the client format to open, Opus, then AAC, then PCM */
+static int
+audin_select_format(void)
+{
+    static const int preferred[] =
+    {
+        WAVE_FORMAT_OPUS, WAVE_FORMAT_AAC, WAVE_FORMAT_PCM
+    };
+    int pref;
+    int index;
+    struct xr_wave_format_ex *wf;
+
+    for (pref = 0; pref < (int) (sizeof(preferred) / sizeof(preferred[0])); pref++)
+    {
+        for (index = 0; g_client_formats[index] != NULL; index++)
+        {
+            wf = g_client_formats[index];
+            if ((wf->wFormatTag == preferred[pref]) && audin_can_decode(wf))
+            {
+                return index;
+            }
+        }
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 static int
 audin_send_version(int chan_id)
@@ -164,16 +496,27 @@ audin_send_formats(int chan_id)
     struct xr_wave_format_ex *wf;
 
     LOG_DEVEL(LOG_LEVEL_INFO, "audin_send_formats:");
-    num_formats = sizeof(g_server_formats) /
-                  sizeof(g_server_formats[0]) - 1;
+    num_formats = 0;
+    for (index = 0; g_server_formats[index] != NULL; index++)
+    {
+        if (g_cfg->audin_compressed ||
+                !audin_is_compressed(g_server_formats[index]->wFormatTag))
+        {
+            num_formats++;
+        }
+    }
     make_stream(s);
     init_stream(s, 8192 * num_formats);
     out_uint8(s, MSG_SNDIN_FORMATS);
     out_uint32_le(s, num_formats);
     out_uint32_le(s, 0); /* cbSizeFormatsPacket */
-    for (index = 0; index < num_formats; index++)
+    for (index = 0; g_server_formats[index] != NULL; index++)
     {
         wf = g_server_formats[index];
+        if (!g_cfg->audin_compressed && audin_is_compressed(wf->wFormatTag))
+        {
+            continue;
+        }
         LOG_DEVEL(LOG_LEVEL_INFO, "audin_send_formats: sending format wFormatTag 0x%4.4x "
                   "nChannels %d nSamplesPerSec %d",
                   wf->wFormatTag, wf->nChannels, wf->nSamplesPerSec);
@@ -202,16 +545,24 @@ audin_send_open(int chan_id)
 {
     int error;
     int bytes;
+    int frames_per_packet;
     struct stream *s;
     struct xr_wave_format_ex *wf = g_client_formats[g_current_format];
 
     LOG_DEVEL(LOG_LEVEL_INFO, "audin_send_open:");
+    frames_per_packet = AUDIN_DEFAULT_FRAMES_PER_PACKET;
+    if (g_cfg->audin_packet_ms > 0)
+    {
+        frames_per_packet = wf->nSamplesPerSec * g_cfg->audin_packet_ms / 1000;
+    }
+    LOG(LOG_LEVEL_INFO, "audin_send_open: %s, %d frames per packet",
+        audin_wave_format_tag_to_str(wf->wFormatTag), frames_per_packet);
     make_stream(s);
     /* wf->cbSize was checked when the format was received */
     init_stream(s, wf->cbSize + 64);
 
     out_uint8(s, MSG_SNDIN_OPEN);
-    out_uint32_le(s, 2048); /* FramesPerPacket */
+    out_uint32_le(s, frames_per_packet); /* FramesPerPacket */
     out_uint32_le(s, g_current_format); /* initialFormat */
     out_uint16_le(s, wf->wFormatTag);
     out_uint16_le(s, wf->nChannels);
@@ -305,6 +656,13 @@ audin_process_formats(int chan_id, struct stream *s)
             in_uint8a(s, wf->data, wf->cbSize);
         }
     }
+    if (num_formats < 1)
+    {
+        LOG(LOG_LEVEL_ERROR, "audin_process_formats: no formats in common");
+        return 1;
+    }
+    g_current_format = audin_select_format();
+    audin_decoders_reset();
     audin_send_open(chan_id);
     return 0;
 }
@@ -338,25 +696,38 @@ static int
 audin_process_data(int chan_id, struct stream *s)
 {
     int data_bytes;
-    struct stream *ls;
+    int format_tag;
 
     data_bytes = (int) (s->end - s->p);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "audin_process_data: data_bytes %d", data_bytes);
 
-    xstream_new(ls, data_bytes);
-    g_memcpy(ls->data, s->p, data_bytes);
-    ls->p += data_bytes;
-    s_mark_end(ls);
-    fifo_add_item(g_in_fifo, (void *) ls);
-    g_bytes_in_fifo += data_bytes;
-
-    return 0;
+    format_tag = WAVE_FORMAT_PCM;
+    if (g_client_formats != NULL)
+    {
+        format_tag = g_client_formats[g_current_format]->wFormatTag;
+    }
+    switch (format_tag)
+    {
+#if defined(XRDP_OPUS)
+        case WAVE_FORMAT_OPUS:
+            return audin_decode_opus(s->p, data_bytes);
+#endif
+#if defined(XRDP_FDK_AAC)
+        case WAVE_FORMAT_AAC:
+            return audin_decode_aac(s->p, data_bytes);
+#endif
+        default:
+            break;
+    }
+    return audin_queue_pcm(s->p, data_bytes);
 }
 
 /*****************************************************************************/
 static int
 audin_process_format_change(int chan_id, struct stream *s)
 {
+    int index;
+
     LOG_DEVEL(LOG_LEVEL_INFO, "audin_process_format_change:");
     if (!s_check_rem(s, 4))
     {
@@ -366,6 +737,22 @@ audin_process_format_change(int chan_id, struct stream *s)
     in_uint32_le(s, g_current_format);
     LOG_DEVEL(LOG_LEVEL_INFO, "audin_process_format_change: g_current_format %d",
               g_current_format);
+    if ((g_client_formats == NULL) || (g_current_format < 0))
+    {
+        g_current_format = 0;
+        return 1;
+    }
+    for (index = 0; index <= g_current_format; index++)
+    {
+        if (g_client_formats[index] == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "audin_process_format_change: bad format %d",
+                g_current_format);
+            g_current_format = 0;
+            return 1;
+        }
+    }
+    audin_decoders_reset();
     return 0;
 }
 
@@ -423,6 +810,7 @@ audin_close_response(int chan_id)
     LOG_DEVEL(LOG_LEVEL_INFO, "audin_close_response:");
     g_audin_chanid = 0;
     cleanup_client_formats();
+    audin_decoders_reset();
     free_stream(g_in_s);
     g_in_s = NULL;
     return 0;
@@ -507,6 +895,7 @@ int
 audin_deinit(void)
 {
     LOG_DEVEL(LOG_LEVEL_INFO, "audin_deinit:");
+    audin_decoders_reset();
     return 0;
 }
 
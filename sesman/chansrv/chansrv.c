@@ -37,6 +37,7 @@
 #include "devredir.h"
 #include "list.h"
 #include "file.h"
+#include "timer_heap.h"
 #include "log.h"
 #include "rail.h"
 #include "xcommon.h"
@@ -81,7 +82,9 @@ int g_exec_pid = 0;
 #define ARRAYSIZE(x) (sizeof(x)/sizeof(*(x)))
 /* max total channel bytes size */
 #define MAX_CHANNEL_BYTES (1 * 1024 * 1024 * 1024) /* 1 GB */
-#define MAX_CHANNEL_FRAG_BYTES 1600
+/* xrdp splits these into chunks the client takes, bigger pieces here mean
+   fewer messages and wakeups on both sides */
+#define MAX_CHANNEL_FRAG_BYTES (16 * 1024)
 
 #define CHANSRV_DRDYNVC_STATUS_CLOSED       0
 #define CHANSRV_DRDYNVC_STATUS_OPEN_SENT    1
@@ -110,86 +113,43 @@ struct xrdp_api_data
     int chan_id;
 };
 
-struct timeout_obj
-{
-    tui32 mstime;
-    void *data;
-    void (*callback)(void *data);
-    struct timeout_obj *next;
-};
-
-static struct timeout_obj *g_timeout_head = 0;
-static struct timeout_obj *g_timeout_tail = 0;
+/* one shot timers for the channel thread, see add_timeout() */
+static struct timer_heap *g_timers = NULL;
 
 /*****************************************************************************/
+/* returns a handle for remove_timeout(), 0 on error */
 int
 add_timeout(int msoffset, void (*callback)(void *data), void *data)
 {
-    struct timeout_obj *tobj;
-    tui32 now;
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "add_timeout:");
-    now = g_time3();
-    tobj = g_new0(struct timeout_obj, 1);
-    tobj->mstime = now + msoffset;
-    tobj->callback = callback;
-    tobj->data = data;
-    if (g_timeout_tail == 0)
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "add_timeout: msoffset %d", msoffset);
+    if (g_timers == NULL)
     {
-        g_timeout_head = tobj;
-        g_timeout_tail = tobj;
+        g_timers = timer_heap_create();
+        if (g_timers == NULL)
+        {
+            return 0;
+        }
     }
-    else
+    return timer_heap_add(g_timers, msoffset, callback, data);
+}
+
+/*****************************************************************************/
+/* returns 1 if the timeout was pending */
+int
+remove_timeout(int handle)
+{
+    if (g_timers == NULL)
     {
-        g_timeout_tail->next = tobj;
-        g_timeout_tail = tobj;
+        return 0;
     }
-    return 0;
+    return timer_heap_cancel(g_timers, handle);
 }
 
 /*****************************************************************************/
 static int
 get_timeout(int *timeout)
 {
-    struct timeout_obj *tobj;
-    tui32 now;
-    int ltimeout;
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "get_timeout:");
-    ltimeout = *timeout;
-    if (ltimeout < 1)
-    {
-        ltimeout = 0;
-    }
-    tobj = g_timeout_head;
-    if (tobj != 0)
-    {
-        now = g_time3();
-        while (tobj != 0)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "  now %u tobj->mstime %u", now, tobj->mstime);
-            if (now < tobj->mstime)
-            {
-                ltimeout = tobj->mstime - now;
-            }
-            tobj = tobj->next;
-        }
-    }
-    if (ltimeout > 0)
-    {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "  ltimeout %d", ltimeout);
-        if (*timeout < 1)
-        {
-            *timeout = ltimeout;
-        }
-        else
-        {
-            if (*timeout > ltimeout)
-            {
-                *timeout = ltimeout;
-            }
-        }
-    }
+    timer_heap_get_timeout(g_timers, timeout);
     return 0;
 }
 
@@ -197,53 +157,7 @@ get_timeout(int *timeout)
 static int
 check_timeout(void)
 {
-    struct timeout_obj *tobj;
-    struct timeout_obj *last_tobj;
-    struct timeout_obj *temp_tobj;
-    int count;
-    tui32 now;
-    UNUSED_VAR(count);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "check_timeout:");
-    count = 0;
-    tobj = g_timeout_head;
-    if (tobj != 0)
-    {
-        last_tobj = 0;
-        while (tobj != 0)
-        {
-            count++;
-            now = g_time3();
-            if (now >= tobj->mstime)
-            {
-                tobj->callback(tobj->data);
-                if (last_tobj == 0)
-                {
-                    g_timeout_head = tobj->next;
-                    if (g_timeout_head == 0)
-                    {
-                        g_timeout_tail = 0;
-                    }
-                }
-                else
-                {
-                    last_tobj->next = tobj->next;
-                    if (g_timeout_tail == tobj)
-                    {
-                        g_timeout_tail = last_tobj;
-                    }
-                }
-                temp_tobj = tobj;
-                tobj = tobj->next;
-                g_free(temp_tobj);
-            }
-            else
-            {
-                last_tobj = tobj;
-                tobj = tobj->next;
-            }
-        }
-    }
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "  count %d", count);
+    timer_heap_check(g_timers);
     return 0;
 }
 
@@ -1345,7 +1259,8 @@ setup_listen(void)
         trans_delete(g_lis_trans);
     }
 
-    g_lis_trans = trans_create(TRANS_MODE_UNIX, 8192, 8192);
+    /* client chunks from xrdp can be up to 16256 bytes */
+    g_lis_trans = trans_create(TRANS_MODE_UNIX, 8192 * 4, 8192);
     g_lis_trans->is_term = g_is_term;
     g_snprintf(port, sizeof(port), XRDP_CHANSRV_STR, g_getuid(), g_display_num);
 
@@ -1593,6 +1508,8 @@ channel_thread_loop(void *in_val)
     g_api_lis_trans = 0;
     api_con_trans_list_remove_all();
     list_delete(g_api_con_trans_list);
+    timer_heap_delete(g_timers);
+    g_timers = NULL;
     LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: thread stop");
     g_set_wait_obj(g_thread_done_event);
     return rv;
@@ -41,10 +41,16 @@
 #define DEFAULT_ENABLE_FUSE_MOUNT           1
 #define DEFAULT_FUSE_MOUNT_NAME             "xrdp-client"
 #define DEFAULT_FILE_UMASK                  077
+#define DEFAULT_FUSE_READ_AHEAD_KB          1024
+#define DEFAULT_FUSE_WRITE_BEHIND_KB        256
 #define DEFAULT_USE_NAUTILUS3_FLIST_FORMAT  0
 #define DEFAULT_NUM_SILENT_FRAMES_AAC       4
 #define DEFAULT_NUM_SILENT_FRAMES_MP3       2
 #define DEFAULT_MSEC_DO_NOT_SEND            1000
+#define DEFAULT_PLAYBACK_DVC                0
+#define DEFAULT_AUDIN_COMPRESSED            1
+#define DEFAULT_AUDIN_PACKET_MS             0
+#define DEFAULT_AUDIN_MAX_BUFFER_MS         0
 /**
  * Type used for passing a logging function about
  */
@@ -167,6 +173,14 @@ read_config_chansrv(log_func_t logmsg,
         {
             cfg->file_umask = strtol(value, NULL, 0);
         }
+        else if (g_strcasecmp(name, "FuseReadAheadKB") == 0)
+        {
+            cfg->fuse_read_ahead_kb = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "FuseWriteBehindKB") == 0)
+        {
+            cfg->fuse_write_behind_kb = strtoul(value, NULL, 0);
+        }
         else if (g_strcasecmp(name, "UseNautilus3FlistFormat") == 0)
         {
             cfg->use_nautilus3_flist_format = g_text2bool(value);
@@ -183,6 +197,22 @@ read_config_chansrv(log_func_t logmsg,
         {
             cfg->msec_do_not_send = strtoul(value, NULL, 0);
         }
+        else if (g_strcasecmp(name, "SoundPlaybackDVC") == 0)
+        {
+            cfg->playback_dvc = g_text2bool(value);
+        }
+        else if (g_strcasecmp(name, "MicrophoneCompressed") == 0)
+        {
+            cfg->audin_compressed = g_text2bool(value);
+        }
+        else if (g_strcasecmp(name, "MicrophonePacketMs") == 0)
+        {
+            cfg->audin_packet_ms = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "MicrophoneMaxBufferMs") == 0)
+        {
+            cfg->audin_max_buffer_ms = strtoul(value, NULL, 0);
+        }
     }
 
     return error;
@@ -213,10 +243,16 @@ new_config(void)
         cfg->restrict_inbound_clipboard = DEFAULT_RESTRICT_INBOUND_CLIPBOARD;
         cfg->fuse_mount_name = fuse_mount_name;
         cfg->file_umask = DEFAULT_FILE_UMASK;
+        cfg->fuse_read_ahead_kb = DEFAULT_FUSE_READ_AHEAD_KB;
+        cfg->fuse_write_behind_kb = DEFAULT_FUSE_WRITE_BEHIND_KB;
         cfg->use_nautilus3_flist_format = DEFAULT_USE_NAUTILUS3_FLIST_FORMAT;
         cfg->num_silent_frames_aac = DEFAULT_NUM_SILENT_FRAMES_AAC;
         cfg->num_silent_frames_mp3 = DEFAULT_NUM_SILENT_FRAMES_MP3;
         cfg->msec_do_not_send = DEFAULT_MSEC_DO_NOT_SEND;
+        cfg->playback_dvc = DEFAULT_PLAYBACK_DVC;
+        cfg->audin_compressed = DEFAULT_AUDIN_COMPRESSED;
+        cfg->audin_packet_ms = DEFAULT_AUDIN_PACKET_MS;
+        cfg->audin_max_buffer_ms = DEFAULT_AUDIN_MAX_BUFFER_MS;
     }
 
     return cfg;
@@ -301,6 +337,9 @@ config_dump(struct config_chansrv *config)
               g_bool2text(config->enable_fuse_mount));
     g_writeln("    FuseMountName:             %s", config->fuse_mount_name);
     g_writeln("    FileMask:                  0%o", config->file_umask);
+    g_writeln("    FuseReadAheadKB:           %u", config->fuse_read_ahead_kb);
+    g_writeln("    FuseWriteBehindKB:         %u",
+              config->fuse_write_behind_kb);
     g_writeln("    Nautilus 3 Flist Format:   %s",
               g_bool2text(config->use_nautilus3_flist_format));
 }
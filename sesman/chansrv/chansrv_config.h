@@ -35,6 +35,10 @@ struct config_chansrv
     char *fuse_mount_name;
     /** FileUmask from sesman.ini */
     mode_t file_umask;
+    /** Largest read ahead for a redirected file in KB, 0 for none */
+    unsigned int fuse_read_ahead_kb;
+    /** Write behind buffer for a redirected file in KB, 0 for none */
+    unsigned int fuse_write_behind_kb;
 
     /** Whether to use nautilus3-compatible file lists for the clipboard */
     int use_nautilus3_flist_format;
@@ -44,6 +48,15 @@ struct config_chansrv
     unsigned int num_silent_frames_mp3;
     /** Do net send sound data afer SNDC_CLOSE is sent. unit is millisecond, setting from sesman.ini */
     unsigned int msec_do_not_send;
+    /** Play sound over the AUDIO_PLAYBACK_DVC dynamic channel if the client has it */
+    int playback_dvc;
+
+    /** Let the client send the microphone compressed, if we can decode it */
+    int audin_compressed;
+    /** Microphone packet length in ms, 0 for the client default */
+    unsigned int audin_packet_ms;
+    /** Most microphone audio to hold for the session in ms, 0 for no limit */
+    unsigned int audin_max_buffer_ms;
 };
 
 
@@ -0,0 +1,833 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Data cache for files opened on a redirected drive.
+ *
+ * The read side is a list of extents sorted by offset. Each extent is
+ * either waiting for its read IRP, holds the data read, or has failed.
+ * Application reads wait in arrival order until extents cover them.
+ *
+ * A write empties the read side. Extents still waiting for an IRP are
+ * moved to a list of stale extents, and their data is thrown away when
+ * it arrives. No reads are sent while write IRPs are in flight, so a
+ * read sent after a write always sees it.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <errno.h>
+
+#include "arch.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "list.h"
+#include "chansrv_fcache.h"
+
+#define DEFAULT_READ_PIECE (64 * 1024)
+#define DEFAULT_READ_AHEAD_MAX (1024 * 1024)
+#define DEFAULT_MAX_READS 8
+#define DEFAULT_WRITE_BUFFER (256 * 1024)
+
+enum extent_state
+{
+    EXTENT_PENDING,
+    EXTENT_READY,
+    EXTENT_FAILED
+};
+
+struct extent
+{
+    tui64 offset;
+    tui32 length; /* asked for while pending, then the length read */
+    enum extent_state state;
+    int is_stale;
+    char *data;
+};
+
+struct waiter
+{
+    void *req;
+    tui64 offset;
+    tui32 size;
+};
+
+struct flush_waiter
+{
+    fcache_flush_cb cb;
+    void *arg;
+};
+
+struct fcache
+{
+    struct fcache_params params;
+    const struct fcache_ops *ops;
+    void *data;
+
+    struct list *extents;     /* struct extent *, sorted by offset */
+    struct list *stale;       /* struct extent *, written over */
+    struct list *waiters;     /* struct waiter * */
+    int reads_in_flight;      /* including stale ones */
+    int reads_pending;        /* extents in EXTENT_PENDING */
+    tui32 cached_bytes;
+    tui64 next_seq_offset;    /* where a sequential read would start */
+    tui32 window;             /* read ahead beyond next_seq_offset */
+    int eof_known;
+    tui64 eof;
+
+    char *wbuf;
+    tui64 wbuf_offset;
+    tui32 wbuf_len;
+    int writes_in_flight;
+    int write_error;
+    struct list *flushes;     /* struct flush_waiter * */
+
+    int in_service;
+    int need_service;
+    int closing;
+};
+
+/*****************************************************************************/
+void
+fcache_params_default(struct fcache_params *params)
+{
+    params->read_piece = DEFAULT_READ_PIECE;
+    params->read_ahead_max = DEFAULT_READ_AHEAD_MAX;
+    params->max_reads = DEFAULT_MAX_READS;
+    params->write_buffer = DEFAULT_WRITE_BUFFER;
+}
+
+/*****************************************************************************/
+struct fcache *
+fcache_create(const struct fcache_params *params,
+              const struct fcache_ops *ops, void *data)
+{
+    struct fcache *self;
+
+    self = g_new0(struct fcache, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->params = *params;
+    if (self->params.read_piece == 0)
+    {
+        self->params.read_piece = DEFAULT_READ_PIECE;
+    }
+    if (self->params.max_reads < 1)
+    {
+        self->params.max_reads = 1;
+    }
+    self->ops = ops;
+    self->data = data;
+    self->extents = list_create();
+    self->stale = list_create();
+    self->waiters = list_create();
+    self->flushes = list_create();
+    if (self->extents == NULL || self->stale == NULL ||
+            self->waiters == NULL || self->flushes == NULL)
+    {
+        list_delete(self->extents);
+        list_delete(self->stale);
+        list_delete(self->waiters);
+        list_delete(self->flushes);
+        g_free(self);
+        return NULL;
+    }
+    self->waiters->auto_free = 1;
+    self->flushes->auto_free = 1;
+    return self;
+}
+
+/*****************************************************************************/
+static void
+extent_free(struct extent *e)
+{
+    g_free(e->data);
+    g_free(e);
+}
+
+/*****************************************************************************/
+static void
+fcache_free(struct fcache *self)
+{
+    int index;
+
+    for (index = 0; index < self->extents->count; index++)
+    {
+        extent_free((struct extent *)list_get_item(self->extents, index));
+    }
+    for (index = 0; index < self->stale->count; index++)
+    {
+        extent_free((struct extent *)list_get_item(self->stale, index));
+    }
+    list_delete(self->extents);
+    list_delete(self->stale);
+    list_delete(self->waiters);
+    list_delete(self->flushes);
+    g_free(self->wbuf);
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* returns 1 if the cache has been freed */
+static int
+fcache_free_if_idle(struct fcache *self)
+{
+    if (self->closing && self->reads_in_flight == 0 &&
+            self->writes_in_flight == 0)
+    {
+        fcache_free(self);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* throws away all read data. Extents still in flight are kept on the
+   stale list until their IRP completes */
+static void
+fcache_drop_reads(struct fcache *self)
+{
+    struct extent *e;
+    int index;
+
+    for (index = 0; index < self->extents->count; index++)
+    {
+        e = (struct extent *)list_get_item(self->extents, index);
+        if (e->state == EXTENT_PENDING)
+        {
+            e->is_stale = 1;
+            list_add_item(self->stale, (tintptr)e);
+        }
+        else
+        {
+            extent_free(e);
+        }
+    }
+    list_clear(self->extents);
+    self->reads_pending = 0;
+    self->cached_bytes = 0;
+    self->eof_known = 0;
+}
+
+/*****************************************************************************/
+void
+fcache_delete(struct fcache *self)
+{
+    if (self != NULL)
+    {
+        self->closing = 1;
+        fcache_drop_reads(self);
+        fcache_free_if_idle(self);
+    }
+}
+
+/*****************************************************************************/
+/* returns the extent holding offset, or NULL */
+static struct extent *
+fcache_extent_at(struct fcache *self, tui64 offset)
+{
+    struct extent *e;
+    int index;
+
+    for (index = 0; index < self->extents->count; index++)
+    {
+        e = (struct extent *)list_get_item(self->extents, index);
+        if (e->offset > offset)
+        {
+            break;
+        }
+        if (offset < e->offset + e->length)
+        {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+/* returns the offset of the first extent starting after offset, or end */
+static tui64
+fcache_next_extent(struct fcache *self, tui64 offset, tui64 end)
+{
+    struct extent *e;
+    int index;
+
+    for (index = 0; index < self->extents->count; index++)
+    {
+        e = (struct extent *)list_get_item(self->extents, index);
+        if (e->offset > offset)
+        {
+            return MIN(e->offset, end);
+        }
+    }
+    return end;
+}
+
+/*****************************************************************************/
+static void
+fcache_start_read(struct fcache *self, tui64 offset, tui32 length)
+{
+    struct extent *e;
+    struct extent *other;
+    int index;
+
+    e = g_new0(struct extent, 1);
+    if (e == NULL)
+    {
+        return;
+    }
+    e->offset = offset;
+    e->length = length;
+    e->state = EXTENT_PENDING;
+    for (index = 0; index < self->extents->count; index++)
+    {
+        other = (struct extent *)list_get_item(self->extents, index);
+        if (other->offset > offset)
+        {
+            break;
+        }
+    }
+    list_insert_item(self->extents, index, (tintptr)e);
+    self->reads_in_flight++;
+    self->reads_pending++;
+    if (self->ops->start_read(self->data, self, e, offset, length) != 0)
+    {
+        fcache_read_done(self, e, 1, NULL, 0);
+    }
+}
+
+/*****************************************************************************/
+/* sends reads for the parts of [offset, end) nothing covers. max is the
+   most reads to have pending, or 0 for no limit */
+static void
+fcache_fill(struct fcache *self, tui64 offset, tui64 end, int max)
+{
+    struct extent *e;
+    tui64 gap_end;
+    tui32 length;
+
+    if (self->eof_known && end > self->eof)
+    {
+        end = self->eof;
+    }
+    while (offset < end)
+    {
+        if (max > 0 && self->reads_pending >= max)
+        {
+            break;
+        }
+        e = fcache_extent_at(self, offset);
+        if (e != NULL)
+        {
+            offset = e->offset + e->length;
+            continue;
+        }
+        gap_end = fcache_next_extent(self, offset, end);
+        length = (tui32)MIN(gap_end - offset, self->params.read_piece);
+        fcache_start_read(self, offset, length);
+        offset += length;
+        if (self->need_service)
+        {
+            /* a read failed at once, let the caller look at it */
+            break;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* answers a waiter if it can be. returns 1 if it was */
+static int
+fcache_answer(struct fcache *self, struct waiter *w)
+{
+    struct extent *e;
+    tui64 offset;
+    tui64 end;
+    char *buf;
+    tui32 length;
+
+    end = w->offset + w->size;
+    if (self->eof_known && end > self->eof)
+    {
+        end = MAX(self->eof, w->offset);
+    }
+    /* failures first, so a waiter stuck behind a pending extent still
+       gets its error */
+    for (offset = w->offset; offset < end; offset = e->offset + e->length)
+    {
+        e = fcache_extent_at(self, offset);
+        if (e == NULL)
+        {
+            break;
+        }
+        if (e->state == EXTENT_FAILED)
+        {
+            self->ops->read_reply(self->data, w->req, EIO, NULL, 0);
+            return 1;
+        }
+    }
+    for (offset = w->offset; offset < end; offset = e->offset + e->length)
+    {
+        e = fcache_extent_at(self, offset);
+        if (e == NULL || e->state != EXTENT_READY)
+        {
+            return 0;
+        }
+    }
+    length = (tui32)(end - w->offset);
+    e = fcache_extent_at(self, w->offset);
+    if (length == 0)
+    {
+        self->ops->read_reply(self->data, w->req, 0, NULL, 0);
+    }
+    else if (w->offset + length <= e->offset + e->length)
+    {
+        /* all in one extent, no need to copy */
+        self->ops->read_reply(self->data, w->req, 0,
+                              e->data + (w->offset - e->offset), length);
+    }
+    else
+    {
+        buf = (char *)g_malloc(length, 0);
+        if (buf == NULL)
+        {
+            self->ops->read_reply(self->data, w->req, ENOMEM, NULL, 0);
+            return 1;
+        }
+        for (offset = w->offset; offset < end; offset = e->offset + e->length)
+        {
+            e = fcache_extent_at(self, offset);
+            g_memcpy(buf + (offset - w->offset),
+                     e->data + (offset - e->offset),
+                     (int)(MIN(end, e->offset + e->length) - offset));
+        }
+        self->ops->read_reply(self->data, w->req, 0, buf, length);
+        g_free(buf);
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+fcache_drop_failed(struct fcache *self)
+{
+    struct extent *e;
+    int index;
+
+    index = 0;
+    while (index < self->extents->count)
+    {
+        e = (struct extent *)list_get_item(self->extents, index);
+        if (e->state == EXTENT_FAILED)
+        {
+            list_remove_item(self->extents, index);
+            extent_free(e);
+        }
+        else
+        {
+            index++;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* returns 1 if a waiter needs part of [offset, end) */
+static int
+fcache_is_waited_on(struct fcache *self, tui64 offset, tui64 end)
+{
+    struct waiter *w;
+    int index;
+
+    for (index = 0; index < self->waiters->count; index++)
+    {
+        w = (struct waiter *)list_get_item(self->waiters, index);
+        if (w->offset < end && offset < w->offset + w->size)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* frees read data behind the reader, and the oldest data if the cache
+   has grown beyond twice the read ahead window */
+static void
+fcache_evict(struct fcache *self)
+{
+    struct extent *e;
+    tui64 keep_from;
+    tui32 max_bytes;
+    int index;
+
+    keep_from = self->next_seq_offset;
+    keep_from -= MIN(keep_from, self->params.read_ahead_max);
+    max_bytes = self->params.read_ahead_max * 2 + self->params.read_piece;
+    index = 0;
+    while (index < self->extents->count)
+    {
+        e = (struct extent *)list_get_item(self->extents, index);
+        if (e->state == EXTENT_READY &&
+                (e->offset + e->length <= keep_from ||
+                 self->cached_bytes > max_bytes) &&
+                !fcache_is_waited_on(self, e->offset, e->offset + e->length))
+        {
+            list_remove_item(self->extents, index);
+            self->cached_bytes -= e->length;
+            extent_free(e);
+        }
+        else
+        {
+            index++;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* answers what waiters it can, and sends the reads the rest need plus
+   those for the read ahead window */
+static void
+fcache_service(struct fcache *self)
+{
+    struct waiter *w;
+    int index;
+
+    if (self->in_service)
+    {
+        self->need_service = 1;
+        return;
+    }
+    self->in_service = 1;
+    do
+    {
+        self->need_service = 0;
+        if (self->writes_in_flight > 0)
+        {
+            break;
+        }
+        index = 0;
+        while (index < self->waiters->count)
+        {
+            w = (struct waiter *)list_get_item(self->waiters, index);
+            if (fcache_answer(self, w))
+            {
+                list_remove_item(self->waiters, index);
+            }
+            else
+            {
+                index++;
+            }
+        }
+        fcache_drop_failed(self);
+        for (index = 0; index < self->waiters->count; index++)
+        {
+            w = (struct waiter *)list_get_item(self->waiters, index);
+            fcache_fill(self, w->offset, w->offset + w->size, 0);
+        }
+        if (self->window > 0 && !self->need_service)
+        {
+            fcache_fill(self, self->next_seq_offset,
+                        self->next_seq_offset + self->window,
+                        self->params.max_reads);
+        }
+        fcache_evict(self);
+    }
+    while (self->need_service);
+    self->in_service = 0;
+}
+
+/*****************************************************************************/
+static void
+fcache_send_write(struct fcache *self, void *req, const char *buf,
+                  tui32 length, tui64 offset)
+{
+    self->writes_in_flight++;
+    if (self->ops->start_write(self->data, self, req, buf,
+                               length, offset) != 0)
+    {
+        fcache_write_done(self, req, 1, offset, length);
+    }
+}
+
+/*****************************************************************************/
+static void
+fcache_send_buffer(struct fcache *self)
+{
+    tui32 length;
+
+    if (self->wbuf_len > 0)
+    {
+        length = self->wbuf_len;
+        self->wbuf_len = 0;
+        fcache_send_write(self, NULL, self->wbuf, length, self->wbuf_offset);
+    }
+}
+
+/*****************************************************************************/
+void
+fcache_read(struct fcache *self, void *req, tui64 offset, tui32 size)
+{
+    struct waiter *w;
+    tui32 max;
+
+    w = g_new0(struct waiter, 1);
+    if (w == NULL)
+    {
+        self->ops->read_reply(self->data, req, ENOMEM, NULL, 0);
+        return;
+    }
+    w->req = req;
+    w->offset = offset;
+    w->size = size;
+
+    /* the window doubles while the reads follow on from each other.
+       Reads landing a little out of order, as the kernel's own read
+       ahead can, still count */
+    max = self->params.read_ahead_max;
+    if (max > 0 && (offset == self->next_seq_offset ||
+                    (self->window > 0 &&
+                     offset + self->window >= self->next_seq_offset &&
+                     offset <= self->next_seq_offset + self->window)))
+    {
+        self->window = MIN(MAX(self->window * 2, self->params.read_piece),
+                           max);
+        self->next_seq_offset = MAX(self->next_seq_offset, offset + size);
+    }
+    else
+    {
+        self->window = 0;
+        self->next_seq_offset = offset + size;
+    }
+
+    list_add_item(self->waiters, (tintptr)w);
+    fcache_send_buffer(self);
+    fcache_service(self);
+}
+
+/*****************************************************************************/
+void
+fcache_read_done(struct fcache *self, void *tag, int status,
+                 const char *buf, tui32 length)
+{
+    struct extent *e;
+    int index;
+
+    e = (struct extent *)tag;
+    self->reads_in_flight--;
+    if (e->is_stale)
+    {
+        index = list_index_of(self->stale, (tintptr)e);
+        list_remove_item(self->stale, index);
+        extent_free(e);
+        if (!fcache_free_if_idle(self) && !self->closing)
+        {
+            /* the waiters it was meant for still need reading */
+            fcache_service(self);
+        }
+        return;
+    }
+    self->reads_pending--;
+    if (status != 0)
+    {
+        e->state = EXTENT_FAILED;
+        /* stop reading ahead, or a failing read would be sent again */
+        self->window = 0;
+    }
+    else
+    {
+        length = MIN(length, e->length);
+        if (length < e->length)
+        {
+            /* short read, the file ends here */
+            if (!self->eof_known || e->offset + length < self->eof)
+            {
+                self->eof = e->offset + length;
+                self->eof_known = 1;
+            }
+        }
+        e->data = (length == 0) ? NULL : (char *)g_malloc(length, 0);
+        if (length > 0 && e->data == NULL)
+        {
+            e->state = EXTENT_FAILED;
+        }
+        else if (length == 0)
+        {
+            index = list_index_of(self->extents, (tintptr)e);
+            list_remove_item(self->extents, index);
+            extent_free(e);
+        }
+        else
+        {
+            g_memcpy(e->data, buf, length);
+            e->length = length;
+            e->state = EXTENT_READY;
+            self->cached_bytes += length;
+        }
+    }
+    fcache_service(self);
+}
+
+/*****************************************************************************/
+void
+fcache_write(struct fcache *self, void *req, const char *buf,
+             tui32 size, tui64 offset)
+{
+    int error;
+
+    if (self->write_error != 0)
+    {
+        /* an earlier buffered write failed */
+        error = self->write_error;
+        self->write_error = 0;
+        self->ops->write_reply(self->data, req, error, offset, 0);
+        return;
+    }
+    fcache_drop_reads(self);
+
+    if (self->wbuf_len > 0 &&
+            (offset != self->wbuf_offset + self->wbuf_len ||
+             self->wbuf_len + size > self->params.write_buffer))
+    {
+        fcache_send_buffer(self);
+    }
+    if (size >= self->params.write_buffer)
+    {
+        fcache_send_buffer(self);
+        fcache_send_write(self, req, buf, size, offset);
+        return;
+    }
+    if (self->wbuf == NULL)
+    {
+        self->wbuf = (char *)g_malloc(self->params.write_buffer, 0);
+        if (self->wbuf == NULL)
+        {
+            fcache_send_write(self, req, buf, size, offset);
+            return;
+        }
+    }
+    if (self->wbuf_len == 0)
+    {
+        self->wbuf_offset = offset;
+    }
+    g_memcpy(self->wbuf + self->wbuf_len, buf, size);
+    self->wbuf_len += size;
+    self->ops->write_reply(self->data, req, 0, offset, size);
+    if (self->wbuf_len == self->params.write_buffer ||
+            self->waiters->count > 0)
+    {
+        /* reads dropped above still have waiters, and their new reads
+           must see this write. They go once it completes */
+        fcache_send_buffer(self);
+    }
+}
+
+/*****************************************************************************/
+void
+fcache_write_done(struct fcache *self, void *req, int status,
+                  tui64 offset, tui32 length)
+{
+    struct list *flushes;
+    struct flush_waiter *f;
+    int error;
+    int index;
+
+    self->writes_in_flight--;
+    if (fcache_free_if_idle(self) || self->closing)
+    {
+        return;
+    }
+    if (req != NULL)
+    {
+        self->ops->write_reply(self->data, req, (status == 0) ? 0 : EIO,
+                               offset, length);
+    }
+    else if (status != 0)
+    {
+        self->write_error = EIO;
+    }
+    if (self->writes_in_flight > 0)
+    {
+        return;
+    }
+
+    /* reads held back by the writes can go now */
+    fcache_service(self);
+
+    if (self->flushes->count > 0)
+    {
+        /* a flush callback may well delete the cache, so don't touch
+           self once they start */
+        flushes = list_create();
+        if (flushes == NULL)
+        {
+            return;
+        }
+        flushes->auto_free = 1;
+        for (index = 0; index < self->flushes->count; index++)
+        {
+            list_add_item(flushes, list_get_item(self->flushes, index));
+        }
+        self->flushes->auto_free = 0;
+        list_clear(self->flushes);
+        self->flushes->auto_free = 1;
+        error = self->write_error;
+        self->write_error = 0;
+        for (index = 0; index < flushes->count; index++)
+        {
+            f = (struct flush_waiter *)list_get_item(flushes, index);
+            f->cb(f->arg, error);
+        }
+        list_delete(flushes);
+    }
+}
+
+/*****************************************************************************/
+void
+fcache_flush(struct fcache *self, fcache_flush_cb cb, void *arg)
+{
+    struct flush_waiter *f;
+    int error;
+
+    fcache_send_buffer(self);
+    if (self->writes_in_flight == 0)
+    {
+        error = self->write_error;
+        self->write_error = 0;
+        cb(arg, error);
+        return;
+    }
+    f = g_new0(struct flush_waiter, 1);
+    if (f == NULL)
+    {
+        cb(arg, ENOMEM);
+        return;
+    }
+    f->cb = cb;
+    f->arg = arg;
+    list_add_item(self->flushes, (tintptr)f);
+}
+
+/*****************************************************************************/
+void
+fcache_invalidate(struct fcache *self)
+{
+    fcache_drop_reads(self);
+    if (self->waiters->count > 0)
+    {
+        fcache_service(self);
+    }
+}
@@ -0,0 +1,146 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file is the interface to the data cache kept for each file
+ * opened on a redirected drive.
+ *
+ * Reads are served from blocks already fetched where possible. When the
+ * application reads sequentially, blocks ahead of it are fetched with
+ * several read IRPs in flight at once, the window doubling on each
+ * sequential read. Writes are copied into a buffer and answered at once,
+ * runs of contiguous writes going to the client as one write IRP. The
+ * buffer is flushed when a write isn't contiguous, when it fills, and
+ * on fsync and release. A failed buffered write is reported on the
+ * next write or flush.
+ *
+ * The module knows nothing of FUSE or devredir. The caller sends the
+ * IRPs and answers the application through struct fcache_ops, so it can
+ * be driven by a test with a fake client.
+ */
+
+#ifndef _CHANSRV_FCACHE_H
+#define _CHANSRV_FCACHE_H
+
+#include "arch.h"
+
+struct fcache;
+
+struct fcache_params
+{
+    tui32 read_piece;      /* bytes in one read IRP */
+    tui32 read_ahead_max;  /* largest read ahead window, 0 for none */
+    int max_reads;         /* read ahead IRPs in flight at once */
+    tui32 write_buffer;    /* write behind buffer, 0 to write through */
+};
+
+struct fcache_ops
+{
+    /* Send a read IRP. The result comes back with fcache_read_done(),
+       passing back tag. That may happen before this returns.
+       returns error, in which case fcache_read_done() isn't called */
+    int (*start_read)(void *data, struct fcache *cache, void *tag,
+                      tui64 offset, tui32 length);
+    /* Send a write IRP. The result comes back with fcache_write_done(),
+       passing back req. As for start_read, this may complete at once.
+       buf is only valid during the call. returns error */
+    int (*start_write)(void *data, struct fcache *cache, void *req,
+                       const char *buf, tui32 length, tui64 offset);
+    /* Answer an application read. error is 0 or an errno value */
+    void (*read_reply)(void *data, void *req, int error,
+                       const char *buf, tui32 length);
+    /* Answer an application write */
+    void (*write_reply)(void *data, void *req, int error,
+                        tui64 offset, tui32 length);
+};
+
+/* called when a flush has finished, error is 0 or an errno value */
+typedef void (*fcache_flush_cb)(void *arg, int error);
+
+/**
+ * Fill in default parameters
+ */
+void
+fcache_params_default(struct fcache_params *params);
+
+/**
+ * Create the cache for an open file
+ *
+ * @param params Sizes to use, copied
+ * @param ops IRP and reply functions, must outlive the cache
+ * @param data Passed to each of ops
+ * @return cache, or NULL for no memory
+ */
+struct fcache *
+fcache_create(const struct fcache_params *params,
+              const struct fcache_ops *ops, void *data);
+
+/**
+ * Delete the cache when the file is closed
+ *
+ * Flush first. ops are not called after this. If IRPs are still in
+ * flight, the memory is freed when the last of them completes.
+ */
+void
+fcache_delete(struct fcache *self);
+
+/**
+ * An application read, answered with ops->read_reply(), maybe at once
+ */
+void
+fcache_read(struct fcache *self, void *req, tui64 offset, tui32 size);
+
+/**
+ * The result of a read IRP
+ *
+ * @param tag As passed to ops->start_read()
+ * @param status 0 for success
+ * @param buf Data read, length may be short at end of file
+ */
+void
+fcache_read_done(struct fcache *self, void *tag, int status,
+                 const char *buf, tui32 length);
+
+/**
+ * An application write, answered with ops->write_reply(), at once if
+ * it is buffered. req must not be NULL
+ */
+void
+fcache_write(struct fcache *self, void *req, const char *buf,
+             tui32 size, tui64 offset);
+
+/**
+ * The result of a write IRP
+ *
+ * @param req As passed to ops->start_write()
+ * @param status 0 for success
+ */
+void
+fcache_write_done(struct fcache *self, void *req, int status,
+                  tui64 offset, tui32 length);
+
+/**
+ * Send the write buffer and call cb when all writes have completed
+ */
+void
+fcache_flush(struct fcache *self, fcache_flush_cb cb, void *arg);
+
+/**
+ * Throw away what has been read, when the file is changed other than
+ * by a write through this cache, such as a truncate. Flush first
+ */
+void
+fcache_invalidate(struct fcache *self);
+
+#endif
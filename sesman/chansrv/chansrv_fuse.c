@@ -165,6 +165,7 @@ int xfuse_path_in_xfuse_fs(const char *path)
 #include "chansrv_xfs.h"
 #include "chansrv.h"
 #include "chansrv_config.h"
+#include "chansrv_fcache.h"
 #include "devredir.h"
 #include "list.h"
 #include "file.h"
@@ -219,6 +220,9 @@ struct state_setattr
     fuse_ino_t        inum;       /* inum of entry                      */
     struct file_attr  fattr;      /* File attributes to set             */
     tui32             change_mask; /* Attributes to set in fattr        */
+    char             *full_path;  /* Path of entry                      */
+    int               flushes;    /* Caches still flushing first        */
+    int               flush_error; /* First error from those flushes    */
 };
 
 
@@ -251,7 +255,8 @@ struct state_create
  */
 struct state_read
 {
-    fuse_req_t        req;        /* Original FUSE request from lookup  */
+    struct fcache     *cache;     /* Cache of the file being read       */
+    void              *tag;       /* Passed back to the cache           */
 };
 
 /*
@@ -259,8 +264,8 @@ struct state_read
  */
 struct state_write
 {
-    fuse_req_t        req;        /* Original FUSE request from lookup  */
-    fuse_ino_t        inum;       /* inum of file we're writing         */
+    struct fcache     *cache;     /* Cache of the file being written    */
+    void              *req;       /* Passed back to the cache           */
 };
 
 /*
@@ -307,6 +312,11 @@ struct xfuse_handle
      *       fields of this structure contain invalid values.
      */
     struct xfs_dir_handle *dir_handle;
+
+    /* read ahead and write behind for a redirected file, created on
+     * the first read or write */
+    struct fcache *cache;
+    fuse_ino_t inum;
 };
 typedef struct xfuse_handle XFUSE_HANDLE;
 
@@ -323,6 +333,7 @@ struct req_list_item
 extern struct config_chansrv *g_cfg; /* in chansrv.c */
 
 static struct list *g_req_list = 0;
+static struct list *g_cached_handles = 0;    /* XFUSE_HANDLEs with a cache  */
 static struct xfs_fs *g_xfs;                 /* an inst of xrdp file system */
 static ino_t g_clipboard_inum;               /* inode of clipboard dir      */
 static char *g_mount_point = 0;              /* our FUSE mount point        */
@@ -386,10 +397,11 @@ static void xfuse_cb_create(fuse_req_t req, fuse_ino_t parent,
                             const char *name, mode_t mode,
                             struct fuse_file_info *fi);
 
-#if 0
+static void xfuse_cb_flush(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info *fi);
+
 static void xfuse_cb_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
                            struct fuse_file_info *fi);
-#endif
 
 static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
                              int to_set, struct fuse_file_info *fi);
@@ -439,6 +451,12 @@ xfuse_handle_delete(XFUSE_HANDLE *self)
     {
         free(self->dir_handle);
     }
+    if (self->cache != NULL && g_cached_handles != 0)
+    {
+        list_remove_item(g_cached_handles,
+                         list_index_of(g_cached_handles, (tintptr)self));
+    }
+    fcache_delete(self->cache);
     free(self);
 }
 
@@ -456,6 +474,127 @@ xfuse_handle_from_fuse_handle(uint64_t handle)
     return (XFUSE_HANDLE *) (tintptr) handle;
 }
 
+/*****************************************************************************/
+static int
+xfuse_cache_start_read(void *data, struct fcache *cache, void *tag,
+                       tui64 offset, tui32 length)
+{
+    XFUSE_HANDLE *fh = (XFUSE_HANDLE *) data;
+    struct state_read *fusep;
+
+    fusep = g_new0(struct state_read, 1);
+    if (fusep == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        return 1;
+    }
+    fusep->cache = cache;
+    fusep->tag = tag;
+
+    /* The result comes back in xfuse_devredir_cb_read_file() */
+    devredir_file_read(fusep, fh->DeviceId, fh->FileId, length, offset);
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+xfuse_cache_start_write(void *data, struct fcache *cache, void *req,
+                        const char *buf, tui32 length, tui64 offset)
+{
+    XFUSE_HANDLE *fh = (XFUSE_HANDLE *) data;
+    struct state_write *fusep;
+
+    fusep = g_new0(struct state_write, 1);
+    if (fusep == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        return 1;
+    }
+    fusep->cache = cache;
+    fusep->req = req;
+
+    /* The result comes back in xfuse_devredir_cb_write_file() */
+    devredir_file_write(fusep, fh->DeviceId, fh->FileId, buf, length, offset);
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+xfuse_cache_read_reply(void *data, void *req, int error,
+                       const char *buf, tui32 length)
+{
+    if (error != 0)
+    {
+        fuse_reply_err((fuse_req_t) req, error);
+    }
+    else
+    {
+        fuse_reply_buf((fuse_req_t) req, buf, length);
+    }
+}
+
+/*****************************************************************************/
+static void
+xfuse_cache_write_reply(void *data, void *req, int error,
+                        tui64 offset, tui32 length)
+{
+    XFUSE_HANDLE *fh = (XFUSE_HANDLE *) data;
+    XFS_INODE    *xinode;
+    off_t         new_size;
+
+    if (error != 0)
+    {
+        fuse_reply_err((fuse_req_t) req, error);
+        return;
+    }
+    fuse_reply_write((fuse_req_t) req, length);
+
+    /* update file size */
+    new_size = offset + length;
+    if ((xinode = xfs_get(g_xfs, fh->inum)) != NULL)
+    {
+        if (new_size > xinode->size)
+        {
+            xinode->size = new_size;
+        }
+    }
+    else
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "inode %ld is invalid", fh->inum);
+    }
+}
+
+static const struct fcache_ops g_xfuse_cache_ops =
+{
+    xfuse_cache_start_read,
+    xfuse_cache_start_write,
+    xfuse_cache_read_reply,
+    xfuse_cache_write_reply
+};
+
+/*****************************************************************************/
+static struct fcache *
+xfuse_handle_get_cache(XFUSE_HANDLE *self, fuse_ino_t ino)
+{
+    struct fcache_params params;
+
+    if (self->cache == NULL)
+    {
+        fcache_params_default(&params);
+        params.read_ahead_max = g_cfg->fuse_read_ahead_kb * 1024;
+        params.write_buffer = g_cfg->fuse_write_behind_kb * 1024;
+        self->inum = ino;
+        self->cache = fcache_create(&params, &g_xfuse_cache_ops, self);
+        if (self->cache != NULL &&
+                !list_add_item(g_cached_handles, (tintptr)self))
+        {
+            fcache_delete(self->cache);
+            self->cache = NULL;
+        }
+    }
+    return self->cache;
+}
+
 /*****************************************************************************
 **                                                                          **
 **         public functions - can be called from any code path              **
@@ -597,7 +736,8 @@ xfuse_init(void)
     g_xfuse_ops.read        = xfuse_cb_read;
     g_xfuse_ops.write       = xfuse_cb_write;
     g_xfuse_ops.create      = xfuse_cb_create;
-    //g_xfuse_ops.fsync     = xfuse_cb_fsync; /* LK_TODO delete this */
+    g_xfuse_ops.flush       = xfuse_cb_flush;
+    g_xfuse_ops.fsync       = xfuse_cb_fsync;
     g_xfuse_ops.getattr     = xfuse_cb_getattr;
     g_xfuse_ops.setattr     = xfuse_cb_setattr;
     g_xfuse_ops.opendir     = xfuse_cb_opendir;
@@ -652,6 +792,12 @@ xfuse_deinit(void)
         g_req_list = 0;
     }
 
+    if (g_cached_handles != 0)
+    {
+        list_delete(g_cached_handles);
+        g_cached_handles = 0;
+    }
+
     xfuse_deinit_xrdp_fs();
 
     g_xfuse_inited = 0;
@@ -937,6 +1083,7 @@ static int xfuse_init_lib(struct fuse_args *args)
 
     g_req_list = list_create();
     g_req_list->auto_free = 1;
+    g_cached_handles = list_create();
 
     return 0;
 }
@@ -1450,12 +1597,9 @@ void xfuse_devredir_cb_read_file(struct state_read *fip,
     if (IoStatus != STATUS_SUCCESS)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "Read NTSTATUS is %d", (int) IoStatus);
-        fuse_reply_err(fip->req, EIO);
-    }
-    else
-    {
-        fuse_reply_buf(fip->req, buf, length);
     }
+    fcache_read_done(fip->cache, fip->tag, IoStatus != STATUS_SUCCESS,
+                     buf, length);
     free(fip);
 }
 
@@ -1465,32 +1609,12 @@ void xfuse_devredir_cb_write_file(
     off_t offset,
     size_t length)
 {
-    XFS_INODE   *xinode;
-
     if (IoStatus != STATUS_SUCCESS)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "Write NTSTATUS is %d", (int) IoStatus);
-        fuse_reply_err(fip->req, EIO);
-    }
-    else
-    {
-        off_t new_size = offset + length;
-        fuse_reply_write(fip->req, length);
-
-        /* update file size */
-        if ((xinode = xfs_get(g_xfs, fip->inum)) != NULL)
-        {
-            if (new_size > xinode->size)
-            {
-                xinode->size = new_size;
-            }
-        }
-        else
-        {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "inode %ld is invalid", fip->inum);
-        }
     }
-
+    fcache_write_done(fip->cache, fip->req, IoStatus != STATUS_SUCCESS,
+                      offset, length);
     free(fip);
 }
 
@@ -2223,6 +2347,35 @@ static void xfuse_cb_open(fuse_req_t req, fuse_ino_t ino,
     }
 }
 
+/**
+ * Closes a redirected file once its cache has written everything out
+ *****************************************************************************/
+
+static void xfuse_release_flushed(void *arg, int error)
+{
+    struct state_close *fip = (struct state_close *) arg;
+    XFUSE_HANDLE *handle = xfuse_handle_from_fuse_handle(fip->fi.fh);
+
+    if (error != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "Lost buffered writes to inode %ld on close",
+            fip->inum);
+    }
+
+    /*
+     * If this call succeeds, further request processing happens in
+     * xfuse_devredir_cb_file_close()
+     */
+    if (devredir_file_close(fip, handle->DeviceId, handle->FileId))
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "failed to send devredir_close_file() cmd");
+        fuse_reply_err(fip->req, EREMOTEIO);
+        free(fip);
+    }
+
+    xfuse_handle_delete(handle);
+}
+
 /*
  * GOTCHA : For FUSE 2.9 at least, the 'fi' parameter is allocated on the
  *          stack by the caller, so must be copied if we're not using it
@@ -2266,18 +2419,15 @@ static void xfuse_cb_release(fuse_req_t req, fuse_ino_t ino, struct
 
         fi->fh = xfuse_handle_to_fuse_handle(NULL);
 
-        /*
-         * If this call succeeds, further request processing happens in
-         * xfuse_devredir_cb_file_close()
-         */
-        if (devredir_file_close(fip, xinode->device_id, handle->FileId))
+        if (handle->cache == NULL)
         {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "failed to send devredir_close_file() cmd");
-            fuse_reply_err(req, EREMOTEIO);
-            free(fip);
+            xfuse_release_flushed(fip, 0);
+        }
+        else
+        {
+            /* Anything left in the write buffer goes before the close */
+            fcache_flush(handle->cache, xfuse_release_flushed, fip);
         }
-
-        xfuse_handle_delete(handle);
     }
 }
 
@@ -2291,7 +2441,7 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
                           off_t off, struct fuse_file_info *fi)
 {
     XFUSE_HANDLE          *fh;
-    struct state_read *fusep;
+    struct fcache         *cache;
     XFS_INODE            *xinode;
     struct req_list_item  *rli;
 
@@ -2332,26 +2482,16 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
                                         (int) off, (int) size);
         }
     }
+    else if ((cache = xfuse_handle_get_cache(fh, ino)) == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        fuse_reply_err(req, ENOMEM);
+    }
     else
     {
-        /* target file is on a remote device */
-
-        fusep = g_new0(struct state_read, 1);
-        if (fusep == NULL)
-        {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
-            fuse_reply_err(req, ENOMEM);
-        }
-        else
-        {
-            fusep->req = req;
-
-            /*
-             * If this call succeeds, further request processing happens in
-             * xfuse_devredir_cb_read_file()
-             */
-            devredir_file_read(fusep, fh->DeviceId, fh->FileId, size, off);
-        }
+        /* target file is on a remote device. The cache replies, at
+         * once if it already holds the data */
+        fcache_read(cache, req, off, size);
     }
 }
 
@@ -2365,7 +2505,7 @@ static void xfuse_cb_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
                            size_t size, off_t off, struct fuse_file_info *fi)
 {
     XFUSE_HANDLE *fh;
-    struct state_write *fusep;
+    struct fcache *cache;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "write %zd bytes at off %lld to inode=%ld",
               size, (long long) off, ino);
@@ -2381,28 +2521,16 @@ static void xfuse_cb_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
         LOG_DEVEL(LOG_LEVEL_DEBUG, "THIS IS STILL A TODO!");
         fuse_reply_err(req, EROFS);
     }
+    else if ((cache = xfuse_handle_get_cache(fh, ino)) == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        fuse_reply_err(req, ENOMEM);
+    }
     else
     {
-        /* target file is on a remote device */
-
-        fusep = g_new0(struct state_write, 1);
-        if (fusep == NULL)
-        {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
-            fuse_reply_err(req, ENOMEM);
-        }
-        else
-        {
-            fusep->req = req;
-            fusep->inum = ino;
-
-            /*
-             * If this call succeeds, further request processing happens in
-             * xfuse_devredir_cb_write_file()
-             */
-            devredir_file_write(fusep, fh->DeviceId, fh->FileId, buf,
-                                size, off);
-        }
+        /* target file is on a remote device. The cache replies, at
+         * once if the write fits in its buffer */
+        fcache_write(cache, req, buf, size, off);
     }
 }
 
@@ -2427,15 +2555,116 @@ static void xfuse_cb_create(fuse_req_t req, fuse_ino_t parent,
 /**
  *****************************************************************************/
 
-#if 0
+static void xfuse_flushed(void *arg, int error)
+{
+    fuse_reply_err((fuse_req_t) arg, error);
+}
+
+/**
+ * Called on each close() of a file. Buffered writes are sent, so an
+ * error writing them can be returned to close()
+ *****************************************************************************/
+
+static void xfuse_cb_flush(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info *fi)
+{
+    XFUSE_HANDLE *fh = xfuse_handle_from_fuse_handle(fi->fh);
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: ino=%ld", ino);
+
+    if (fh == NULL || fh->cache == NULL)
+    {
+        fuse_reply_err(req, 0);
+    }
+    else
+    {
+        fcache_flush(fh->cache, xfuse_flushed, req);
+    }
+}
+
+/**
+ *****************************************************************************/
+
 static void xfuse_cb_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
                            struct fuse_file_info *fi)
 {
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "#################### entered: ino=%ld datasync=%d", ino, datasync);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "function not required");
-    fuse_reply_err(req, EINVAL);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: ino=%ld datasync=%d", ino, datasync);
+
+    /* A write is on the client once it has been acknowledged */
+    xfuse_cb_flush(req, ino, fi);
+}
+
+/**
+ * Sends a setattr to the client, once the caches of the file have
+ * written out their buffers
+ *****************************************************************************/
+
+static void xfuse_setattr_send(struct state_setattr *fip)
+{
+    XFS_INODE *xinode;
+    XFUSE_HANDLE *fh;
+    char *full_path = fip->full_path;
+    int index;
+
+    fip->full_path = NULL;
+    if (fip->flush_error != 0)
+    {
+        fuse_reply_err(fip->req, fip->flush_error);
+        free(fip);
+    }
+    else if ((xinode = xfs_get(g_xfs, fip->inum)) == NULL)
+    {
+        fuse_reply_err(fip->req, ENOENT);
+        free(fip);
+    }
+    else
+    {
+        if (fip->change_mask & TO_SET_SIZE)
+        {
+            /* what was read before the size changes may not be there
+             * after it */
+            for (index = 0; index < g_cached_handles->count; index++)
+            {
+                fh = (XFUSE_HANDLE *) list_get_item(g_cached_handles, index);
+                if (fh->inum == fip->inum)
+                {
+                    fcache_invalidate(fh->cache);
+                }
+            }
+        }
+
+        /*
+         * If this call succeeds, further request processing happens
+         * in xfuse_devredir_cb_setattr(). We want the path minus the
+         * 'root node of the share'
+         */
+        if (devredir_setattr_for_entry(fip, xinode->device_id,
+                                       filename_on_device(full_path),
+                                       &fip->fattr, fip->change_mask) < 0)
+        {
+            fuse_reply_err(fip->req, EIO);
+            free(fip);
+        }
+    }
+    free(full_path);
+}
+
+/**
+ *****************************************************************************/
+
+static void xfuse_setattr_flushed(void *arg, int error)
+{
+    struct state_setattr *fip = (struct state_setattr *) arg;
+
+    if (fip->flush_error == 0)
+    {
+        fip->flush_error = error;
+    }
+    if (--fip->flushes == 0)
+    {
+        xfuse_setattr_send(fip);
+    }
 }
-#endif
 
 /**
  * Sets attributes for a directory entry.
@@ -2445,6 +2674,9 @@ static void xfuse_cb_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
  * callbacks:-
  * - xfuse_devredir_cb_setattr() to update our copy and return status
  *
+ * A change of size waits for the caches of the file to be flushed, and
+ * empties them before it is sent.
+ *
  * GOTCHA : For FUSE 2.9 at least, the 'fi' parameter is allocated on the
  *          stack by the caller, so must be copied if we're not using it
  *          to reply to FUSE immediately
@@ -2528,29 +2760,33 @@ static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
             }
             else
             {
-                const char *cptr;
+                XFUSE_HANDLE *fh;
+                int index;
+
                 fip->req = req;
                 fip->inum = ino;
                 /* Save the important stuff so we can update our node if the
                  * remote update is successful */
                 fip->fattr = attrs;
                 fip->change_mask = change_mask;
-
-                /* we want path minus 'root node of the share' */
-                cptr = filename_on_device(full_path);
-
-                /*
-                 * If this call succeeds, further request processing happens
-                 * in xfuse_devredir_cb_setattr()
-                 */
-                if (devredir_setattr_for_entry(fip, xinode->device_id,
-                                               cptr, &attrs, change_mask) < 0)
+                fip->full_path = full_path;
+
+                /* Buffered writes must reach the client before the size
+                 * changes. One count is held until the flushes have all
+                 * been started, as they can finish at once */
+                fip->flushes = 1;
+                for (index = 0; (change_mask & TO_SET_SIZE) &&
+                        index < g_cached_handles->count; index++)
                 {
-                    fuse_reply_err(req, EIO);
-                    free(fip);
+                    fh = (XFUSE_HANDLE *)
+                         list_get_item(g_cached_handles, index);
+                    if (fh->inum == ino)
+                    {
+                        fip->flushes++;
+                        fcache_flush(fh->cache, xfuse_setattr_flushed, fip);
+                    }
                 }
-
-                free(full_path);
+                xfuse_setattr_flushed(fip, 0);
             }
         }
     }
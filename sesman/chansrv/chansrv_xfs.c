@@ -41,6 +41,9 @@
 #define INODE_TABLE_ALLOCATION_INITIAL     4096
 #define INODE_TABLE_ALLOCATION_GRANULARITY 100
 
+/* Initial size of the name table. Must be a power of 2 */
+#define NAME_TABLE_SIZE_INITIAL            1024
+
 /* inum of the delete pending directory */
 #define DELETE_PENDING_ID 2
 
@@ -75,6 +78,7 @@ typedef struct xfs_inode_all
     struct xfs_inode_all *next;        /* Next entry in parent             */
     struct xfs_inode_all *previous;    /* Previous entry in parent         */
     XFS_LIST             dir;          /* Directory only - children        */
+    struct xfs_inode_all *name_next;   /* Next entry in name_table chain   */
     /*
      * Other private elements
      */
@@ -93,6 +97,9 @@ typedef struct xfs_inode_all
  *                  deleted.
  * free_list      List of free inode numbers. Allows for O(1) access to
  *                a free node, provided the free list is not empty.
+ * name_table     Hash table of all entries in a directory, keyed by the
+ *                parent inum and the name. Allows for O(1) lookups of
+ *                a name in a directory, however many entries it has.
  */
 struct xfs_fs
 {
@@ -101,6 +108,9 @@ struct xfs_fs
     unsigned int inode_count;        /* Current number of inodes             */
     unsigned int free_count;         /* Size of free_list                    */
     unsigned int generation;         /* Changes when an inode is deleted     */
+    XFS_INODE_ALL    **name_table;   /* Chains of entries, by parent & name  */
+    unsigned int name_table_size;    /* A power of 2                         */
+    unsigned int name_count;         /* Entries in name_table                */
 };
 
 /* A directory handle
@@ -238,18 +248,96 @@ remove_inode_from_list(XFS_LIST *list, XFS_INODE_ALL *xino)
 
 }
 
+/*  ------------------------------------------------------------------------ */
+static unsigned int
+name_hash(fuse_ino_t parent_inum, const char *name)
+{
+    /* FNV-1a, starting from the parent inum */
+    unsigned int hash = 2166136261U ^ (unsigned int)parent_inum;
+    while (*name != '\0')
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+add_inode_to_name_table(struct xfs_fs *xfs, XFS_INODE_ALL *xino)
+{
+    unsigned int index = name_hash(xino->parent->pub.inum, xino->pub.name) &
+                         (xfs->name_table_size - 1);
+    xino->name_next = xfs->name_table[index];
+    xfs->name_table[index] = xino;
+    ++xfs->name_count;
+}
+
 /*  ------------------------------------------------------------------------ */
 static void
-link_inode_into_directory_node(XFS_INODE_ALL *dinode, XFS_INODE_ALL *xino)
+remove_inode_from_name_table(struct xfs_fs *xfs, XFS_INODE_ALL *xino)
+{
+    unsigned int index = name_hash(xino->parent->pub.inum, xino->pub.name) &
+                         (xfs->name_table_size - 1);
+    XFS_INODE_ALL **pp = &xfs->name_table[index];
+    while (*pp != NULL && *pp != xino)
+    {
+        pp = &(*pp)->name_next;
+    }
+    if (*pp != NULL)
+    {
+        *pp = xino->name_next;
+        --xfs->name_count;
+    }
+    xino->name_next = NULL;
+}
+
+/*  ------------------------------------------------------------------------ */
+/* Doubles the name table when it gets full. If there's no memory, the
+ * old table is kept, with longer chains */
+static void
+grow_name_table(struct xfs_fs *xfs)
+{
+    unsigned int new_size = xfs->name_table_size * 2;
+    XFS_INODE_ALL **new_table = g_new0(XFS_INODE_ALL *, new_size);
+    XFS_INODE_ALL *xino;
+    unsigned int i;
+
+    if (new_table != NULL)
+    {
+        free(xfs->name_table);
+        xfs->name_table = new_table;
+        xfs->name_table_size = new_size;
+        xfs->name_count = 0;
+        for (i = 0 ; i < xfs->inode_count ; ++i)
+        {
+            if ((xino = xfs->inode_table[i]) != NULL && xino->parent != NULL)
+            {
+                add_inode_to_name_table(xfs, xino);
+            }
+        }
+    }
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+link_inode_into_directory_node(struct xfs_fs *xfs,
+                               XFS_INODE_ALL *dinode, XFS_INODE_ALL *xino)
 {
     xino->parent = dinode;
     add_inode_to_list(&dinode->dir, xino);
+    add_inode_to_name_table(xfs, xino);
+    if (xfs->name_count > xfs->name_table_size)
+    {
+        grow_name_table(xfs);
+    }
 }
 
 /*  ------------------------------------------------------------------------ */
 static void
-unlink_inode_from_parent(XFS_INODE_ALL *xino)
+unlink_inode_from_parent(struct xfs_fs *xfs, XFS_INODE_ALL *xino)
 {
+    remove_inode_from_name_table(xfs, xino);
     remove_inode_from_list(&xino->parent->dir, xino);
 
     xino->next = NULL;
@@ -274,11 +362,14 @@ xfs_create_xfs_fs(mode_t umask, uid_t uid, gid_t gid)
         xfs->inode_table = NULL;
         xfs->free_list   = NULL;
         xfs->generation = 1;
+        xfs->name_table_size = NAME_TABLE_SIZE_INITIAL;
+        xfs->name_table = g_new0(XFS_INODE_ALL *, xfs->name_table_size);
 
         /* xfs->inode_table check should be superfluous here, but it
          * prevents cppcheck 2.2/2.3 generating a false positive nullPointer
          * report */
-        if (!grow_xfs(xfs, INODE_TABLE_ALLOCATION_INITIAL) ||
+        if (xfs->name_table == NULL ||
+                !grow_xfs(xfs, INODE_TABLE_ALLOCATION_INITIAL) ||
                 xfs->inode_table == NULL ||
                 (xino1 = g_new0(XFS_INODE_ALL, 1)) == NULL ||
                 (xino2 = g_new0(XFS_INODE_ALL, 1)) == NULL ||
@@ -325,6 +416,7 @@ xfs_create_xfs_fs(mode_t umask, uid_t uid, gid_t gid)
             xino1->previous = NULL;
             xino1->dir.begin = NULL;
             xino1->dir.end = NULL;
+            xino1->name_next = NULL;
 
             xino2->pub.inum = DELETE_PENDING_ID;
             xino2->pub.mode = (S_IFDIR | 0777) & ~umask;
@@ -344,11 +436,12 @@ xfs_create_xfs_fs(mode_t umask, uid_t uid, gid_t gid)
             xino2->previous = NULL;
             xino2->dir.begin = NULL;
             xino2->dir.end = NULL;
+            xino2->name_next = NULL;
             /*
              * Uncomment this line to make the .delete-pending
              * directory visible to the user in the root
              */
-            /* link_inode_into_directory_node(xino1, xino2); */
+            /* link_inode_into_directory_node(xfs, xino1, xino2); */
         }
     }
 
@@ -385,6 +478,7 @@ xfs_delete_xfs_fs(struct xfs_fs *xfs)
     }
     free(xfs->inode_table);
     free(xfs->free_list);
+    free(xfs->name_table);
     free(xfs);
 }
 
@@ -464,7 +558,8 @@ xfs_add_entry(struct xfs_fs *xfs, fuse_ino_t parent_inum,
                 xino->parent = NULL;
                 xino->next = NULL;
                 xino->previous = NULL;
-                link_inode_into_directory_node(parent, xino);
+                xino->name_next = NULL;
+                link_inode_into_directory_node(xfs, parent, xino);
                 result = &xino->pub;
             }
         }
@@ -505,11 +600,11 @@ xfs_remove_entry(struct xfs_fs *xfs, fuse_ino_t inum)
             xfs_remove_directory_contents(xfs, inum);
         }
 
-        unlink_inode_from_parent(xino);
+        unlink_inode_from_parent(xfs, xino);
         if ((xino->pub.mode & S_IFREG) != 0 && xino->open_count > 0)
         {
             link_inode_into_directory_node(
-                xfs->inode_table[DELETE_PENDING_ID], xino);
+                xfs, xfs->inode_table[DELETE_PENDING_ID], xino);
         }
         else
         {
@@ -592,9 +687,11 @@ xfs_lookup_in_dir(struct xfs_fs *xfs, fuse_ino_t inum, const char *name)
             (xino->pub.mode & S_IFDIR) != 0)
     {
         XFS_INODE_ALL *p;
-        for (p = xino->dir.begin ; p != NULL; p = p->next)
+        unsigned int index = name_hash(inum, name) &
+                             (xfs->name_table_size - 1);
+        for (p = xfs->name_table[index] ; p != NULL; p = p->name_next)
         {
-            if (strcmp(p->pub.name, name) == 0)
+            if (p->parent == xino && strcmp(p->pub.name, name) == 0)
             {
                 result = &p->pub;
                 break;
@@ -889,14 +986,15 @@ xfs_move_entry(struct xfs_fs *xfs, fuse_ino_t inum,
                 xfs_remove_entry(xfs, dest->inum);
             }
 
-            unlink_inode_from_parent(xino);
-            link_inode_into_directory_node(parent, xino);
+            unlink_inode_from_parent(xfs, xino);
 
             /* Swap the copy name and the inode name so we end up with the
              * right name, and the old one gets freed */
             char *t = xino->pub.name;
             xino->pub.name = cpyname;
             cpyname = t;
+
+            link_inode_into_directory_node(xfs, parent, xino);
         }
         else if (strcmp(xino->pub.name, name) != 0)
         {
@@ -908,10 +1006,13 @@ xfs_move_entry(struct xfs_fs *xfs, fuse_ino_t inum,
             }
 
             /* Swap the copy name and the inode name so we end up with the
-             * right name, and the old one gets freed */
+             * right name, and the old one gets freed. The entry is
+             * filed under its name, so it's taken out while it changes */
+            remove_inode_from_name_table(xfs, xino);
             char *t = xino->pub.name;
             xino->pub.name = cpyname;
             cpyname = t;
+            add_inode_to_name_table(xfs, xino);
         }
         result = 0;
     }
@@ -1034,6 +1034,7 @@ devredir_proc_device_iocompletion(struct stream *s)
     tui32      CompletionId;
     tui32      IoStatus32;
     tui32      Length;
+    tui32      FileId;
     enum COMPLETION_TYPE comp_type;
 
     if (!s_check_rem_and_log(s, 12, "Parsing [MS-RDPEFS] DR_DEVICE_IOCOMPLETION"))
@@ -1089,7 +1090,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                     {
                         return -1;
                     }
-                    xstream_rd_u32_le(s, irp->FileId);
+                    xstream_rd_u32_le(s, FileId);
+                    devredir_irp_set_file_id(irp, FileId);
                     devredir_send_drive_dir_request(irp, DeviceId,
                                                     1, irp->pathname);
                 }
@@ -1100,7 +1102,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                 {
                     return -1;
                 }
-                xstream_rd_u32_le(s, irp->FileId);
+                xstream_rd_u32_le(s, FileId);
+                devredir_irp_set_file_id(irp, FileId);
 
                 xfuse_devredir_cb_create_file(
                     (struct state_create *) irp->fuse_info,
@@ -1116,7 +1119,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                 {
                     return -1;
                 }
-                xstream_rd_u32_le(s, irp->FileId);
+                xstream_rd_u32_le(s, FileId);
+                devredir_irp_set_file_id(irp, FileId);
 
                 xfuse_devredir_cb_open_file((struct state_open *) irp->fuse_info,
                                             IoStatus, DeviceId, irp->FileId);
@@ -1177,7 +1181,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                 {
                     return -1;
                 }
-                xstream_rd_u32_le(s, irp->FileId);
+                xstream_rd_u32_le(s, FileId);
+                devredir_irp_set_file_id(irp, FileId);
                 devredir_proc_cid_rmdir_or_file(irp, IoStatus);
                 break;
 
@@ -1190,7 +1195,8 @@ devredir_proc_device_iocompletion(struct stream *s)
                 {
                     return -1;
                 }
-                xstream_rd_u32_le(s, irp->FileId);
+                xstream_rd_u32_le(s, FileId);
+                devredir_irp_set_file_id(irp, FileId);
                 devredir_proc_cid_rename_file(irp, IoStatus);
                 break;
 
@@ -1388,7 +1394,7 @@ devredir_get_dir_listing(struct state_dirscan *fusep, tui32 device_id,
         strcpy(irp->pathname, path);
         devredir_cvt_slash(irp->pathname);
 
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->completion_type = CID_CREATE_DIR_REQ;
         irp->DeviceId = device_id;
         irp->fuse_info = fusep;
@@ -1452,7 +1458,7 @@ devredir_lookup_entry(struct state_lookup *fusep, tui32 device_id,
          * Allocate an IRP to open the file, read the basic attributes,
          * read the standard attributes, and then close the file
          */
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->completion_type = CID_LOOKUP;
         irp->DeviceId = device_id;
         irp->gen.lookup.state = E_LOOKUP_GET_FH;
@@ -1510,7 +1516,7 @@ devredir_setattr_for_entry(struct state_setattr *fusep, tui32 device_id,
          * Allocate an IRP to open the file, update the attributes
          * and close the file.
          */
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->completion_type = CID_SETATTR;
         irp->DeviceId = device_id;
         irp->fuse_info = fusep;
@@ -1563,7 +1569,7 @@ devredir_file_create(struct state_create *fusep, tui32 device_id,
         devredir_cvt_slash(irp->pathname);
 
         irp->completion_type = CID_CREATE_REQ;
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->DeviceId = device_id;
         irp->fuse_info = fusep;
 
@@ -1616,7 +1622,7 @@ devredir_file_open(struct state_open *fusep, tui32 device_id,
         devredir_cvt_slash(irp->pathname);
 
         irp->completion_type = CID_OPEN_REQ;
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->DeviceId = device_id;
 
         irp->fuse_info = fusep;
@@ -1672,7 +1678,7 @@ int devredir_file_close(struct state_close *fusep, tui32 device_id,
         return -1;
     }
 
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
 #else
     if ((irp = devredir_irp_find_by_fileid(FileId)) == NULL)
     {
@@ -1712,7 +1718,7 @@ devredir_rmdir_or_file(struct state_remove *fusep, tui32 device_id,
         /* convert / to windows compatible \ */
         devredir_cvt_slash(irp->pathname);
 
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->completion_type = CID_RMDIR_OR_FILE;
         irp->DeviceId = device_id;
 
@@ -1771,9 +1777,9 @@ devredir_file_read(struct state_read *fusep, tui32 DeviceId, tui32 FileId,
     else
     {
         new_irp->DeviceId = DeviceId;
-        new_irp->FileId = FileId;
+        devredir_irp_set_file_id(new_irp, FileId);
         new_irp->completion_type = CID_READ;
-        new_irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(new_irp, g_completion_id++);
         new_irp->fuse_info = fusep;
 
         devredir_insert_DeviceIoRequest(s,
@@ -1830,9 +1836,9 @@ devredir_file_write(struct state_write *fusep, tui32 DeviceId, tui32 FileId,
     else
     {
         new_irp->DeviceId = DeviceId;
-        new_irp->FileId = FileId;
+        devredir_irp_set_file_id(new_irp, FileId);
         new_irp->completion_type = CID_WRITE;
-        new_irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(new_irp, g_completion_id++);
         new_irp->fuse_info = fusep;
         /* Offset needed after write to calculate new EOF */
         new_irp->gen.write.offset = Offset;
@@ -1897,7 +1903,7 @@ int devredir_file_rename(struct state_rename *fusep, tui32 device_id,
         devredir_cvt_slash(irp->gen.rename.new_name);
 
         irp->completion_type = CID_RENAME_FILE;
-        irp->CompletionId = g_completion_id++;
+        devredir_irp_set_completion_id(irp, g_completion_id++);
         irp->DeviceId = device_id;
 
         irp->fuse_info = fusep;
@@ -2219,6 +2225,7 @@ devredir_proc_cid_lookup(IRP *irp,
                          enum NTSTATUS IoStatus)
 {
     tui32 Length;
+    tui32 FileId;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entry state is %d", irp->gen.lookup.state);
     if (IoStatus != STATUS_SUCCESS)
@@ -2234,7 +2241,8 @@ devredir_proc_cid_lookup(IRP *irp,
         {
             case E_LOOKUP_GET_FH:
                 /* We've been sent the file ID */
-                xstream_rd_u32_le(s_in, irp->FileId);
+                xstream_rd_u32_le(s_in, FileId);
+                devredir_irp_set_file_id(irp, FileId);
                 issue_lookup(irp, FileBasicInformation);
                 irp->gen.lookup.state = E_LOOKUP_CHECK_BASIC;
                 break;
@@ -2397,6 +2405,7 @@ devredir_proc_cid_setattr(IRP *irp,
 #define TO_SET_BASIC_ATTRS (TO_SET_MODE | \
                             TO_SET_ATIME | TO_SET_MTIME)
     tui32 Length;
+    tui32 FileId;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entry state is %d", irp->gen.setattr.state);
     if (IoStatus != STATUS_SUCCESS)
@@ -2412,7 +2421,8 @@ devredir_proc_cid_setattr(IRP *irp,
         {
             case E_SETATTR_GET_FH:
                 /* We've been sent the file ID */
-                xstream_rd_u32_le(s_in, irp->FileId);
+                xstream_rd_u32_le(s_in, FileId);
+                devredir_irp_set_file_id(irp, FileId);
                 break;
 
             case E_SETATTR_CHECK_BASIC:
@@ -19,6 +19,15 @@
 
 /*
  * manage I/O for redirected file system and devices
+ *
+ * IRPs are kept in a linked list in the order they are made, and in two
+ * hash tables, one by CompletionId and one by FileId, so that a
+ * completion can find its IRP without a scan.
+ *
+ * An IRP is filed when it is made, and filed again when its
+ * CompletionId or FileId is set with devredir_irp_set_completion_id()
+ * or devredir_irp_set_file_id(). Those fields must not be assigned
+ * directly.
  */
 
 #if defined(HAVE_CONFIG_H)
@@ -31,7 +40,141 @@
 #include "string_calls.h"
 #include "irp.h"
 
+#define IRP_TABLE_BITS_INITIAL 6
+
 IRP *g_irp_head = NULL;
+static IRP *g_irp_tail = NULL;
+static unsigned int g_irp_count = 0;
+static tui32 g_irp_serial = 0;
+
+static IRP **g_cid_table = NULL;
+static IRP **g_fid_table = NULL;
+static unsigned int g_table_bits = 0;
+
+/*****************************************************************************/
+static unsigned int
+irp_hash(tui32 key)
+{
+    return (unsigned int)((key * 0x9e3779b1u) >> (32 - g_table_bits));
+}
+
+/*****************************************************************************/
+static void
+irp_unfile(IRP *irp)
+{
+    IRP **pp;
+
+    if (!irp->is_filed)
+    {
+        return;
+    }
+
+    pp = &g_cid_table[irp_hash(irp->cid_key)];
+    while (*pp != irp)
+    {
+        pp = &(*pp)->cid_next;
+    }
+    *pp = irp->cid_next;
+
+    pp = &g_fid_table[irp_hash(irp->fid_key)];
+    while (*pp != irp)
+    {
+        pp = &(*pp)->fid_next;
+    }
+    *pp = irp->fid_next;
+
+    irp->is_filed = 0;
+}
+
+/*****************************************************************************/
+static void
+irp_file(IRP *irp)
+{
+    unsigned int index;
+
+    if (g_cid_table == NULL ||
+            (irp->is_filed && irp->cid_key == irp->CompletionId &&
+             irp->fid_key == irp->FileId))
+    {
+        return;
+    }
+
+    irp_unfile(irp);
+
+    irp->cid_key = irp->CompletionId;
+    index = irp_hash(irp->cid_key);
+    irp->cid_next = g_cid_table[index];
+    g_cid_table[index] = irp;
+
+    irp->fid_key = irp->FileId;
+    index = irp_hash(irp->fid_key);
+    irp->fid_next = g_fid_table[index];
+    g_fid_table[index] = irp;
+
+    irp->is_filed = 1;
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/* Sizes the tables to the number of IRPs. If there's no memory to grow
+ * them, the old ones are kept, and just have longer chains */
+static void
+irp_resize_tables(void)
+{
+    unsigned int bits;
+    IRP **cid_table;
+    IRP **fid_table;
+    IRP *irp;
+
+    bits = (g_table_bits == 0) ? IRP_TABLE_BITS_INITIAL : g_table_bits + 1;
+    cid_table = g_new0(IRP *, 1U << bits);
+    fid_table = g_new0(IRP *, 1U << bits);
+    if (cid_table == NULL || fid_table == NULL)
+    {
+        g_free(cid_table);
+        g_free(fid_table);
+        return;
+    }
+
+    g_free(g_cid_table);
+    g_free(g_fid_table);
+    g_cid_table = cid_table;
+    g_fid_table = fid_table;
+    g_table_bits = bits;
+    for (irp = g_irp_head; irp != NULL; irp = irp->next)
+    {
+        irp->is_filed = 0;
+    }
+    for (irp = g_irp_head; irp != NULL; irp = irp->next)
+    {
+        irp_file(irp);
+    }
+}
+
+/*****************************************************************************/
+/* Adds a new IRP to the end of the list, and files it */
+static void
+irp_append(IRP *irp)
+{
+    if (g_irp_tail == NULL)
+    {
+        /* list is empty, this is the first entry */
+        g_irp_head = irp;
+    }
+    else
+    {
+        g_irp_tail->next = irp;
+        irp->prev = g_irp_tail;
+    }
+    g_irp_tail = irp;
+    irp->serial = g_irp_serial++;
+
+    if (++g_irp_count > (2U << g_table_bits))
+    {
+        irp_resize_tables();
+    }
+    irp_file(irp);
+}
 
 /**
  * Create a new IRP and append to linked list
@@ -42,7 +185,6 @@ IRP *g_irp_head = NULL;
 IRP *devredir_irp_new(void)
 {
     IRP *irp;
-    IRP *irp_last;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entered");
 
@@ -55,16 +197,7 @@ IRP *devredir_irp_new(void)
     }
 
     /* insert at end of linked list */
-    if ((irp_last = devredir_irp_get_last()) == NULL)
-    {
-        /* list is empty, this is the first entry */
-        g_irp_head = irp;
-    }
-    else
-    {
-        irp_last->next = irp;
-        irp->prev = irp_last;
-    }
+    irp_append(irp);
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "new IRP=%p", irp);
     return irp;
@@ -104,7 +237,6 @@ IRP *devredir_irp_with_pathname_new(const char *pathname)
 IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen)
 {
     IRP *irp;
-    IRP *irp_last;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entered");
 
@@ -119,16 +251,7 @@ IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen)
     irp->pathname = (char *)irp + sizeof(IRP); /* Initialise pathname pointer */
 
     /* insert at end of linked list */
-    if ((irp_last = devredir_irp_get_last()) == NULL)
-    {
-        /* list is empty, this is the first entry */
-        g_irp_head = irp;
-    }
-    else
-    {
-        irp_last->next = irp;
-        irp->prev = irp_last;
-    }
+    irp_append(irp);
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "new IRP=%p", irp);
     return irp;
@@ -142,9 +265,7 @@ IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen)
 
 int devredir_irp_delete(IRP *irp)
 {
-    IRP *lirp = g_irp_head;
-
-    if ((irp == NULL) || (lirp == NULL))
+    if ((irp == NULL) || (g_irp_head == NULL))
     {
         return -1;
     }
@@ -152,124 +273,152 @@ int devredir_irp_delete(IRP *irp)
     LOG_DEVEL(LOG_LEVEL_DEBUG, "irp=%p completion_id=%d type=%d",
               irp, irp->CompletionId, irp->completion_type);
 
-    devredir_irp_dump(); // LK_TODO
+    irp_unfile(irp);
 
-    while (lirp)
+    if (irp->prev == NULL)
     {
-        if (lirp == irp)
-        {
-            break;
-        }
-
-        lirp = lirp->next;
+        /* we are at head of linked list */
+        g_irp_head = irp->next;
     }
-
-    if (lirp == NULL)
+    else
     {
-        return -1;    /* did not find specified irp */
+        irp->prev->next = irp->next;
     }
 
-    if (lirp->prev == NULL)
-    {
-        /* we are at head of linked list */
-        if (lirp->next == NULL)
-        {
-            /* only one element in list */
-            g_free(lirp);
-            g_irp_head = NULL;
-            devredir_irp_dump(); // LK_TODO
-            return 0;
-        }
-
-        lirp->next->prev = NULL;
-        g_irp_head = lirp->next;
-        g_free(lirp);
-    }
-    else if (lirp->next == NULL)
+    if (irp->next == NULL)
     {
         /* we are at tail of linked list */
-        lirp->prev->next = NULL;
-        g_free(lirp);
+        g_irp_tail = irp->prev;
     }
     else
     {
-        /* we are in between */
-        lirp->prev->next = lirp->next;
-        lirp->next->prev = lirp->prev;
-        g_free(lirp);
+        irp->next->prev = irp->prev;
     }
 
+    g_irp_count--;
+    g_free(irp);
+
     devredir_irp_dump(); // LK_TODO
 
     return 0;
 }
 
-/**
- * Return IRP containing specified completion_id
- *****************************************************************************/
-
-IRP *devredir_irp_find(tui32 completion_id)
+/*****************************************************************************/
+static IRP *
+irp_lookup_cid(tui32 completion_id)
 {
-    IRP *irp = g_irp_head;
+    IRP *irp;
 
-    while (irp)
+    if (g_cid_table == NULL)
     {
-        if (irp->CompletionId == completion_id)
+        /* No memory for the tables, fall back to the list */
+        for (irp = g_irp_head; irp != NULL; irp = irp->next)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
-            return irp;
+            if (irp->CompletionId == completion_id)
+            {
+                return irp;
+            }
         }
-
-        irp = irp->next;
+        return NULL;
     }
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=NULL");
+    for (irp = g_cid_table[irp_hash(completion_id)];
+            irp != NULL; irp = irp->cid_next)
+    {
+        if (irp->cid_key == completion_id &&
+                irp->CompletionId == completion_id)
+        {
+            return irp;
+        }
+    }
     return NULL;
 }
 
-IRP *devredir_irp_find_by_fileid(tui32 FileId)
+/*****************************************************************************/
+/* Several IRPs can share a FileId. Return the oldest, as a scan of the
+ * list would, which is the one which opened the file */
+static IRP *
+irp_lookup_fid(tui32 FileId)
 {
-    IRP *irp = g_irp_head;
+    IRP *irp;
+    IRP *result = NULL;
 
-    while (irp)
+    if (g_fid_table == NULL)
     {
-        if (irp->FileId == FileId)
+        for (irp = g_irp_head; irp != NULL; irp = irp->next)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
-            return irp;
+            if (irp->FileId == FileId)
+            {
+                return irp;
+            }
         }
-
-        irp = irp->next;
+        return NULL;
     }
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=NULL");
-    return NULL;
+    for (irp = g_fid_table[irp_hash(FileId)]; irp != NULL; irp = irp->fid_next)
+    {
+        if (irp->fid_key == FileId && irp->FileId == FileId &&
+                (result == NULL || irp->serial < result->serial))
+        {
+            result = irp;
+        }
+    }
+    return result;
 }
 
 /**
- * Return last IRP in linked list
+ * Return IRP containing specified completion_id
  *****************************************************************************/
 
-IRP *devredir_irp_get_last(void)
+IRP *devredir_irp_find(tui32 completion_id)
 {
-    IRP *irp = g_irp_head;
+    IRP *irp = irp_lookup_cid(completion_id);
 
-    while (irp)
-    {
-        if (irp->next == NULL)
-        {
-            break;
-        }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
+    return irp;
+}
 
-        irp = irp->next;
-    }
+IRP *devredir_irp_find_by_fileid(tui32 FileId)
+{
+    IRP *irp = irp_lookup_fid(FileId);
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
     return irp;
 }
 
+/**
+ * Set the CompletionId of an IRP, and file it under the new value
+ *****************************************************************************/
+
+void devredir_irp_set_completion_id(IRP *irp, tui32 CompletionId)
+{
+    irp->CompletionId = CompletionId;
+    irp_file(irp);
+}
+
+/**
+ * Set the FileId of an IRP, and file it under the new value
+ *****************************************************************************/
+
+void devredir_irp_set_file_id(IRP *irp, tui32 FileId)
+{
+    irp->FileId = FileId;
+    irp_file(irp);
+}
+
+/**
+ * Return last IRP in linked list
+ *****************************************************************************/
+
+IRP *devredir_irp_get_last(void)
+{
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", g_irp_tail);
+    return g_irp_tail;
+}
+
 void devredir_irp_dump(void)
 {
+#ifdef USE_DEVEL_LOGGING
     IRP *irp = g_irp_head;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "------- dumping IRPs --------");
@@ -281,4 +430,5 @@ void devredir_irp_dump(void)
         irp = irp->next;
     }
     LOG_DEVEL(LOG_LEVEL_DEBUG, "------- dumping IRPs done ---");
+#endif
 }
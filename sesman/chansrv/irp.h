@@ -98,6 +98,12 @@ struct irp
     void      *fuse_info;           /* Fuse info pointer for FUSE calls  */
     IRP       *next;                /* point to next IRP                 */
     IRP       *prev;                /* point to previous IRP             */
+    IRP       *cid_next;            /* private to irp.c, hash chains and */
+    IRP       *fid_next;            /* the keys the IRP is filed under   */
+    tui32      cid_key;
+    tui32      fid_key;
+    tui32      serial;
+    int        is_filed;
     int        scard_index;         /* used to smart card to locate dev  */
 
     void     (*callback)(struct stream *s, IRP *irp, tui32 DeviceId,
@@ -116,6 +122,10 @@ IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen);
 int   devredir_irp_delete(IRP *irp);
 IRP *devredir_irp_find(tui32 completion_id);
 IRP *devredir_irp_find_by_fileid(tui32 FileId);
+/* CompletionId and FileId are set with these, which keep the lookup
+ * tables up to date */
+void devredir_irp_set_completion_id(IRP *irp, tui32 CompletionId);
+void devredir_irp_set_file_id(IRP *irp, tui32 FileId);
 IRP *devredir_irp_get_last(void);
 void  devredir_irp_dump(void);
 
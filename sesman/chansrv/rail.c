@@ -69,7 +69,7 @@ static int g_rail_running = 1;
 static struct list *g_window_list = 0;
 
 static int g_got_focus = 0;
-static int g_focus_counter = 0;
+static int g_focus_timer = 0; /* popdown after focus is lost */
 static Window g_focus_win = 0;
 
 static int g_xrr_event_base = 0; /* non zero means we got extension */
@@ -348,6 +348,8 @@ rail_init(void)
 int
 rail_deinit(void)
 {
+    remove_timeout(g_focus_timer);
+    g_focus_timer = 0;
     if (g_rail_up)
     {
         list_delete(g_window_list);
@@ -569,11 +571,8 @@ static void
 my_timeout(void *data)
 {
     LOG_DEVEL(LOG_LEVEL_DEBUG, "my_timeout: g_got_focus %d", g_got_focus);
-    if (g_focus_counter == (int)(long)data)
-    {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "my_timeout: g_focus_counter %d", g_focus_counter);
-        rail_win_popdown();
-    }
+    g_focus_timer = 0;
+    rail_win_popdown();
 }
 
 /*****************************************************************************/
@@ -598,7 +597,8 @@ rail_process_activate(struct stream *s, int size)
         return 0;
     }
 
-    g_focus_counter++;
+    remove_timeout(g_focus_timer);
+    g_focus_timer = 0;
     g_got_focus = enabled;
     LOG_DEVEL(LOG_LEVEL_DEBUG, "  window_id 0x%8.8x enabled %d", window_id, enabled);
 
@@ -639,7 +639,7 @@ rail_process_activate(struct stream *s, int size)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "  window attributes: override_redirect %d",
                   window_attributes.override_redirect);
-        add_timeout(200, my_timeout, (void *)(long)g_focus_counter);
+        g_focus_timer = add_timeout(200, my_timeout, NULL);
     }
     return 0;
 }
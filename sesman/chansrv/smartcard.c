@@ -355,7 +355,7 @@ scard_send_establish_context(void *user_data, int scope)
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_EstablishContext_Return;
     irp->user_data = user_data;
@@ -383,7 +383,7 @@ scard_send_release_context(void *user_data,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_ReleaseContext_Return;
     irp->user_data = user_data;
@@ -410,7 +410,7 @@ scard_send_is_valid_context(void *user_data, char *context, int context_bytes)
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_IsContextValid_Return;
     irp->user_data = user_data;
@@ -437,7 +437,7 @@ scard_send_list_readers(void *user_data, char *context, int context_bytes,
         return 1;
     }
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_ListReaders_Return;
     irp->user_data = user_data;
@@ -473,7 +473,7 @@ scard_send_get_status_change(void *user_data, char *context, int context_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_GetStatusChange_Return;
     irp->user_data = user_data;
@@ -505,7 +505,7 @@ scard_send_connect(void *user_data, char *context, int context_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_Connect_Return;
     irp->user_data = user_data;
@@ -541,7 +541,7 @@ scard_send_reconnect(void *user_data, char *context, int context_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_Reconnect_Return;
     irp->user_data = user_data;
@@ -572,7 +572,7 @@ scard_send_begin_transaction(void *user_data, char *context, int context_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_BeginTransaction_Return;
     irp->user_data = user_data;
@@ -605,7 +605,7 @@ scard_send_end_transaction(void *user_data, char *context, int context_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_EndTransaction_Return;
     irp->user_data = user_data;
@@ -638,7 +638,7 @@ scard_send_status(void *user_data, int wide, char *context, int context_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_Status_Return;
     irp->user_data = user_data;
@@ -670,7 +670,7 @@ scard_send_disconnect(void *user_data, char *context, int context_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_Disconnect_Return;
     irp->user_data = user_data;
@@ -703,7 +703,7 @@ scard_send_transmit(void *user_data, char *context, int context_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_Transmit_Return;
     irp->user_data = user_data;
@@ -735,7 +735,7 @@ scard_send_control(void *user_data, char *context, int context_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_Control_Return;
     irp->user_data = user_data;
@@ -765,7 +765,7 @@ scard_send_cancel(void *user_data, char *context, int context_bytes)
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_Cancel_Return;
     irp->user_data = user_data;
@@ -793,7 +793,7 @@ scard_send_get_attrib(void *user_data, char *card, int card_bytes,
     }
 
     irp->scard_index = g_scard_index;
-    irp->CompletionId = g_completion_id++;
+    devredir_irp_set_completion_id(irp, g_completion_id++);
     irp->DeviceId = g_device_id;
     irp->callback = scard_handle_GetAttrib_Return;
     irp->user_data = user_data;
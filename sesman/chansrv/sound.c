@@ -37,6 +37,7 @@
 #include "chansrv_config.h"
 #include "list.h"
 #include "audin.h"
+#include "spsc_ring.h"
 
 #if defined(XRDP_FDK_AAC)
 #include <fdk-aac/aacenc_lib.h>
@@ -92,6 +93,84 @@ static int g_bbuf_size = 1024 * 8; /* may change later */
 
 static struct list *g_ack_time_diff = 0;
 
+/* playback over the AUDIO_PLAYBACK_DVC dynamic channel, [MS-RDPEA] 2.1 */
+#define SOUND_DVC_NAME "AUDIO_PLAYBACK_DVC"
+#define SOUND_DVC_FLAGS 1 /* WTS_CHANNEL_OPTION_DYNAMIC */
+#define SOUND_DVC_OPEN_TIMEOUT 2000 /* ms before falling back to rdpsnd */
+#define SOUND_STATIC_VERSION 5
+#define SOUND_DVC_VERSION 8 /* 8 and up can use SNDC_WAVE2 */
+
+static struct chansrv_drdynvc_procs g_sound_dvc_procs;
+static int g_sound_dvc_chan_id = 0; /* non zero while opening or open */
+static int g_sound_dvc_up = 0;
+static int g_sound_dvc_timer = 0;
+static struct stream *g_sound_dvc_in_s = NULL;
+static int g_client_version = 0;
+static int g_buf_start_time = 0; /* when the first sample in g_buffer came */
+
+/* Opus frames at 48 kHz stereo of 2.5, 5, 10 and 20 ms. Over the DVC the
+   frame size follows the client buffer depth seen in wave confirms */
+static const int g_opus_frame_bytes[] = { 480, 960, 1920, 3840 };
+#define NUM_OPUS_FRAME_SIZES 4
+static int g_opus_frame_index = NUM_OPUS_FRAME_SIZES - 1;
+static int g_depth_avg = 0; /* buffer depth in ms, times 8 */
+static int g_depth_floor = 0; /* smallest confirm time, the round trip */
+static int g_depth_samples = 0;
+
+/* The channel thread reads PCM from the sink socket and passes it
+   through g_pcm_ring to the encoder thread. That cuts it into frames,
+   compresses them and passes the packets back through g_pkt_ring, then
+   sets g_pkt_event so the channel thread sends them. The g_buf*
+   globals, the encoders and g_encoder_codec belong to the encoder
+   thread. If it can't be started, the channel thread encodes each
+   message as it is queued */
+#define SOUND_PCM_RING_SIZE 64
+#define SOUND_PKT_RING_SIZE 1024
+
+enum sound_msg_type
+{
+    SOUND_MSG_PCM,   /* channel -> encoder, PCM from the sink */
+    SOUND_MSG_CLOSE, /* both ways, playback has stopped */
+    SOUND_MSG_QUIT,  /* channel -> encoder, end the thread */
+    SOUND_MSG_WAVE   /* encoder -> channel, a frame to send */
+};
+
+/* what the client can take, copied into each message so the encoder
+   thread never reads the channel thread's globals */
+struct sound_codec
+{
+    int format_index;
+    int does_fdk_aac;
+    int fdk_aac_index;
+    int does_opus;
+    int opus_index;
+    int does_mp3lame;
+    int mp3lame_index;
+    int opus_frame_bytes; /* 0 for the default */
+    int num_silent_frames; /* to send before a close */
+};
+
+struct sound_msg
+{
+    enum sound_msg_type type;
+    struct sound_codec codec;
+    int format_index; /* wFormatNo of a wave */
+    int start_time; /* dwAudioTimeStamp of a wave */
+    int bytes;
+    char *data; /* follows this struct */
+};
+
+static struct spsc_ring *g_pcm_ring = NULL;
+static struct spsc_ring *g_pkt_ring = NULL;
+static tbus g_pcm_sem = 0;
+static tbus g_encoder_done = 0;
+static tbus g_pkt_event = 0;
+static int g_encoder_running = 0;
+static int g_encoder_inline = 0; /* no encoder thread, encode on this one */
+static struct sound_codec g_encoder_codec;
+
+static int sound_encode_msg(struct sound_msg *msg);
+
 struct xr_wave_format_ex
 {
     int wFormatTag;
@@ -262,6 +341,18 @@ static int sound_sndsrvr_source_data_in(struct trans *trans);
 static int sound_start_source_listener(void);
 static int sound_start_sink_listener(void);
 
+/*****************************************************************************/
+/* send a playback PDU on the DVC if it's up, else on rdpsnd */
+static int
+sound_send_pdu(const char *data, int bytes)
+{
+    if (g_sound_dvc_up)
+    {
+        return chansrv_drdynvc_send_data(g_sound_dvc_chan_id, data, bytes);
+    }
+    return send_channel_data(g_rdpsnd_chan_id, data, bytes);
+}
+
 /*****************************************************************************/
 static int
 sound_send_server_output_formats(void)
@@ -287,7 +378,8 @@ sound_send_server_output_formats(void)
     out_uint16_le(s, 0);                    /* wDGramPort */
     out_uint16_le(s, num_formats);          /* wNumberOfFormats */
     out_uint8(s, g_cBlockNo);               /* cLastBlockConfirmed */
-    out_uint16_le(s, 5);                    /* wVersion */
+    out_uint16_le(s, g_sound_dvc_up ? SOUND_DVC_VERSION :
+                  SOUND_STATIC_VERSION);    /* wVersion */
     out_uint8(s, 0);                        /* bPad */
 
     /* sndFormats */
@@ -330,7 +422,7 @@ sound_send_server_output_formats(void)
     size_ptr[0] = bytes;
     size_ptr[1] = bytes >> 8;
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_pdu(s->data, bytes);
     free_stream(s);
     return 0;
 }
@@ -359,7 +451,7 @@ sound_send_training(void)
     size_ptr[0] = bytes;
     size_ptr[1] = bytes >> 8;
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_pdu(s->data, bytes);
     free_stream(s);
     return 0;
 }
@@ -460,7 +552,12 @@ sound_process_output_formats(struct stream *s, int size)
 
     in_uint8s(s, 14);
     in_uint16_le(s, num_formats);
-    in_uint8s(s, 4);
+    in_uint8s(s, 1);                        /* cLastBlockConfirmed */
+    in_uint16_le(s, g_client_version);      /* wVersion */
+    in_uint8s(s, 1);                        /* bPad */
+    LOG(LOG_LEVEL_INFO, "sound_process_output_formats: client version %d, "
+        "playback over %s", g_client_version,
+        g_sound_dvc_up ? SOUND_DVC_NAME : "rdpsnd");
 
     if (num_formats > 0)
     {
@@ -517,7 +614,7 @@ sound_wave_compress_fdk_aac(char *data, int data_bytes, int *format_index)
 
     rv = data_bytes;
 
-    if (g_client_does_fdk_aac == 0)
+    if (g_encoder_codec.does_fdk_aac == 0)
     {
         return rv;
     }
@@ -629,11 +726,6 @@ sound_wave_compress_fdk_aac(char *data, int data_bytes, int *format_index)
     rv = data_bytes;
     cdata_bytes = data_bytes;
     cdata = (char *) g_malloc(cdata_bytes, 0);
-    if (data_bytes < g_bbuf_size)
-    {
-        g_memset(data + data_bytes, 0, g_bbuf_size - data_bytes);
-        data_bytes = g_bbuf_size;
-    }
 
     in_buffer = data;
     in_identifier = IN_AUDIO_DATA;
@@ -669,7 +761,7 @@ sound_wave_compress_fdk_aac(char *data, int data_bytes, int *format_index)
         cdata_bytes = out_args.numOutBytes;
         LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_wave_compress_fdk_aac: aacEncEncode ok "
                   "cdata_bytes %d", cdata_bytes);
-        *format_index = g_client_fdk_aac_index;
+        *format_index = g_encoder_codec.fdk_aac_index;
         g_memcpy(data, cdata, cdata_bytes);
         rv = cdata_bytes;
     }
@@ -706,7 +798,7 @@ sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
     int data_bytes_org;
     opus_int16 *os16;
 
-    if (g_client_does_opus == 0)
+    if (g_encoder_codec.does_opus == 0)
     {
         return data_bytes;
     }
@@ -738,16 +830,11 @@ sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
        20  ms  3840
        40  ms  7680
        60  ms 11520 */
-    if (data_bytes < g_bbuf_size)
-    {
-        g_memset(data + data_bytes, 0, g_bbuf_size - data_bytes);
-        data_bytes = g_bbuf_size;
-    }
     cdata_bytes = opus_encode(g_opus_encoder, os16, data_bytes / 4,
                               cdata, cdata_bytes);
     if ((cdata_bytes > 0) && (cdata_bytes < data_bytes_org))
     {
-        *format_index = g_client_opus_index;
+        *format_index = g_encoder_codec.opus_index;
         g_memcpy(data, cdata, cdata_bytes);
         rv = cdata_bytes;
     }
@@ -780,7 +867,7 @@ sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
     cdata = NULL;
     rv = data_bytes;
 
-    if (g_client_does_mp3lame == 0)
+    if (g_encoder_codec.does_mp3lame == 0)
     {
         return rv;
     }
@@ -818,11 +905,6 @@ sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
     odata_bytes = data_bytes;
     cdata_bytes = data_bytes;
     cdata = (unsigned char *) g_malloc(cdata_bytes, 0);
-    if (data_bytes < g_bbuf_size)
-    {
-        g_memset(data + data_bytes, 0, g_bbuf_size - data_bytes);
-        data_bytes = g_bbuf_size;
-    }
     cdata_bytes = lame_encode_buffer_interleaved(g_lame_encoder,
                   (short int *) data,
                   data_bytes / 4,
@@ -836,7 +918,7 @@ sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
     }
     if ((cdata_bytes > 0) && (cdata_bytes < odata_bytes))
     {
-        *format_index = g_client_mp3lame_index;
+        *format_index = g_encoder_codec.mp3lame_index;
         g_memcpy(data, cdata, cdata_bytes);
         rv = cdata_bytes;
     }
@@ -857,49 +939,93 @@ sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
 #endif
 
 /*****************************************************************************/
+/* encoder thread, the frame size for the client's codec, only changed
+   when g_buffer is empty so a frame is never padded or cut */
+static int
+sound_frame_bytes(void)
+{
+    if (g_encoder_codec.does_fdk_aac)
+    {
+        return 4096;
+    }
+    if (g_encoder_codec.does_opus)
+    {
+        if (g_encoder_codec.opus_frame_bytes > 0)
+        {
+            return g_encoder_codec.opus_frame_bytes;
+        }
+        return 11520;
+    }
+    if (g_encoder_codec.does_mp3lame)
+    {
+        return 11520;
+    }
+    return g_bbuf_size;
+}
+
+/*****************************************************************************/
+/* encoder thread, data_bytes is a whole frame of sound_frame_bytes() */
 static int
 sound_wave_compress(char *data, int data_bytes, int *format_index)
 {
-    if (g_client_does_fdk_aac)
+    if (g_encoder_codec.does_fdk_aac)
     {
-        g_bbuf_size = 4096;
         return sound_wave_compress_fdk_aac(data, data_bytes, format_index);
     }
-    else if (g_client_does_opus)
+    else if (g_encoder_codec.does_opus)
     {
-        g_bbuf_size = 11520;
         return sound_wave_compress_opus(data, data_bytes, format_index);
     }
-    else if (g_client_does_mp3lame)
+    else if (g_encoder_codec.does_mp3lame)
     {
-        g_bbuf_size = 11520;
         return sound_wave_compress_mp3lame(data, data_bytes, format_index);
     }
     return data_bytes;
 }
 
 /*****************************************************************************/
-/* send wave message to client */
+/* send a timestamped wave in one PDU, when the client can take it */
 static int
-sound_send_wave_data_chunk(char *data, int data_bytes)
+sound_send_wave2(const char *data, int data_bytes, int format_index,
+                 int start_time)
 {
     struct stream *s;
-    int bytes;
     int time;
-    int format_index;
-    char *size_ptr;
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data_chunk: data_bytes %d", data_bytes);
+    int error;
 
-    if ((data_bytes < 4) || (data_bytes > 128 * 1024))
-    {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_send_wave_data_chunk: bad data_bytes %d", data_bytes);
-        return 1;
-    }
+    make_stream(s);
+    init_stream(s, 16 + data_bytes);
+    out_uint8(s, SNDC_WAVE2);
+    out_uint8(s, 0);                        /* bPad */
+    out_uint16_le(s, 12 + data_bytes);      /* BodySize */
+    time = g_time3();
+    out_uint16_le(s, time);                 /* wTimeStamp */
+    out_uint16_le(s, format_index);         /* wFormatNo */
+    g_cBlockNo++;
+    out_uint8(s, g_cBlockNo);               /* cBlockNo */
+    g_sent_time[g_cBlockNo & 0xff] = time;
+    out_uint8s(s, 3);                       /* bPad */
+    out_uint32_le(s, start_time);           /* dwAudioTimeStamp */
+    out_uint8a(s, data, data_bytes);
+    s_mark_end(s);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave2: cBlockNo %d, "
+              "dwAudioTimeStamp %u", g_cBlockNo & 0xff,
+              (unsigned int)start_time);
+    error = sound_send_pdu(s->data, (int)(s->end - s->data));
+    free_stream(s);
+    return error;
+}
 
-    /* compress, if available */
-    format_index = g_current_client_format_index;
-    data_bytes = sound_wave_compress(data, data_bytes, &format_index);
+/*****************************************************************************/
+/* send an encoded wave message to client */
+static int
+sound_send_wave_data_chunk(const char *data, int data_bytes, int format_index,
+                           int start_time)
+{
+    struct stream *s;
+    int bytes;
+    int time;
+    char *size_ptr;
 
     LOG(LOG_LEVEL_TRACE, "sound_send_wave_data_chunk: wFormatNo %d", format_index);
 
@@ -907,6 +1033,11 @@ sound_send_wave_data_chunk(char *data, int data_bytes)
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data_chunk: sending %d bytes", data_bytes);
 
+    if (g_sound_dvc_up && (g_client_version >= SOUND_DVC_VERSION))
+    {
+        return sound_send_wave2(data, data_bytes, format_index, start_time);
+    }
+
     make_stream(s);
     init_stream(s, 16 + data_bytes); /* some extra space */
     out_uint16_le(s, SNDC_WAVE);
@@ -931,7 +1062,7 @@ sound_send_wave_data_chunk(char *data, int data_bytes)
     size_ptr[0] = bytes;
     size_ptr[1] = bytes >> 8;
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_pdu(s->data, bytes);
 
     /* part two of 2 PDU wave info
        even is zero, we have to send this */
@@ -940,40 +1071,146 @@ sound_send_wave_data_chunk(char *data, int data_bytes)
     out_uint8a(s, data + 4, data_bytes - 4);
     s_mark_end(s);
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_pdu(s->data, bytes);
 
     free_stream(s);
     return 0;
 }
 
 /*****************************************************************************/
-/* send wave message to client, buffer first */
+static struct sound_msg *
+sound_msg_create(enum sound_msg_type type, const char *data, int bytes)
+{
+    struct sound_msg *msg;
+
+    msg = (struct sound_msg *) g_malloc(sizeof(struct sound_msg) + bytes, 1);
+    if (msg != NULL)
+    {
+        msg->type = type;
+        msg->bytes = bytes;
+        msg->data = (char *) (msg + 1);
+        if (bytes > 0)
+        {
+            g_memcpy(msg->data, data, bytes);
+        }
+    }
+    return msg;
+}
+
+/*****************************************************************************/
+/* channel thread, snapshot what the encoder needs to know */
+static void
+sound_get_codec(struct sound_codec *codec)
+{
+    codec->format_index = g_current_client_format_index;
+    codec->does_fdk_aac = g_client_does_fdk_aac;
+    codec->fdk_aac_index = g_client_fdk_aac_index;
+    codec->does_opus = g_client_does_opus;
+    codec->opus_index = g_client_opus_index;
+    codec->does_mp3lame = g_client_does_mp3lame;
+    codec->mp3lame_index = g_client_mp3lame_index;
+    codec->opus_frame_bytes = 0;
+    if (g_sound_dvc_up)
+    {
+        codec->opus_frame_bytes = g_opus_frame_bytes[g_opus_frame_index];
+    }
+    codec->num_silent_frames = 0;
+}
+
+/*****************************************************************************/
+/* channel thread, hand a message to the encoder thread
+   returns error, 2 if there is no room */
 static int
-sound_send_wave_data(char *data, int data_bytes)
+sound_queue_to_encoder(struct sound_msg *msg)
+{
+    if (msg == NULL)
+    {
+        return 1;
+    }
+    if (g_encoder_inline)
+    {
+        sound_encode_msg(msg);
+        g_free(msg);
+        return 0;
+    }
+    if (!g_encoder_running || (spsc_ring_push(g_pcm_ring, msg) != 0))
+    {
+        g_free(msg);
+        return 2;
+    }
+    tc_sem_inc(g_pcm_sem);
+    return 0;
+}
+
+/*****************************************************************************/
+/* encoder thread, hand a message to the channel thread */
+static void
+sound_queue_to_channel(enum sound_msg_type type, const char *data, int bytes,
+                       int format_index, int start_time)
+{
+    struct sound_msg *msg;
+
+    msg = sound_msg_create(type, data, bytes);
+    if (msg == NULL)
+    {
+        return;
+    }
+    msg->format_index = format_index;
+    msg->start_time = start_time;
+    if (spsc_ring_push(g_pkt_ring, msg) != 0)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_queue_to_channel: dropped, no room");
+        g_free(msg);
+        return;
+    }
+    g_set_wait_obj(g_pkt_event);
+}
+
+/*****************************************************************************/
+/* encoder thread, compress a frame and queue it for sending */
+static int
+sound_encode_frame(char *data, int data_bytes)
+{
+    int format_index;
+
+    if ((data_bytes < 4) || (data_bytes > 128 * 1024))
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_encode_frame: bad data_bytes %d", data_bytes);
+        return 1;
+    }
+
+    /* compress, if available */
+    format_index = g_encoder_codec.format_index;
+    data_bytes = sound_wave_compress(data, data_bytes, &format_index);
+    sound_queue_to_channel(SOUND_MSG_WAVE, data, data_bytes, format_index,
+                           g_buf_start_time);
+    return 0;
+}
+
+/*****************************************************************************/
+/* encoder thread, buffer PCM and encode each full frame */
+static int
+sound_encode_pcm(char *data, int data_bytes)
 {
     int space_left;
     int chunk_bytes;
     int data_index;
     int error;
-    int res;
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data: sending %d bytes", data_bytes);
-    if (g_time_diff > g_best_time_diff + 250)
-    {
-        data_bytes = data_bytes / 4;
-        data_bytes = data_bytes & ~3;
-        g_memset(data, 0, data_bytes);
-        g_time_diff = 0;
-    }
     data_index = 0;
     error = 0;
     while (data_bytes > 0)
     {
+        if (g_buf_index == 0)
+        {
+            g_bbuf_size = sound_frame_bytes();
+            g_buf_start_time = g_time4();
+        }
         space_left = g_bbuf_size - g_buf_index;
         chunk_bytes = MIN(space_left, data_bytes);
         if (chunk_bytes < 1)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data: error");
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_encode_pcm: error");
             error = 1;
             break;
         }
@@ -982,16 +1219,8 @@ sound_send_wave_data(char *data, int data_bytes)
         if (g_buf_index >= g_bbuf_size)
         {
             g_buf_index = 0;
-            res = sound_send_wave_data_chunk(g_buffer, g_bbuf_size);
-            if (res == 2)
-            {
-                /* don't need to error on this */
-                LOG_DEVEL(LOG_LEVEL_ERROR, "sound_send_wave_data: dropped, no room");
-                break;
-            }
-            else if (res != 0)
+            if (sound_encode_frame(g_buffer, g_bbuf_size) != 0)
             {
-                LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data: error");
                 error = 1;
                 break;
             }
@@ -1003,6 +1232,115 @@ sound_send_wave_data(char *data, int data_bytes)
     return error;
 }
 
+/*****************************************************************************/
+/* encoder thread, playback stopped */
+static void
+sound_encode_close(int num_silent_frames)
+{
+    char *buf;
+    int index;
+
+    /* anything part buffered is dropped, so the silent frames can use
+       the size for the codec they are going out with */
+    g_buf_index = 0;
+    g_bbuf_size = sound_frame_bytes();
+
+    /* workaround for mstsc.exe. send silence data before send close */
+    if (num_silent_frames > 0)
+    {
+        buf = (char *) g_malloc(g_bbuf_size, 0);
+        if (buf != NULL)
+        {
+            g_buf_start_time = g_time4();
+            for (index = 0; index < num_silent_frames; index++)
+            {
+                g_memset(buf, 0, g_bbuf_size);
+                sound_encode_frame(buf, g_bbuf_size);
+            }
+            g_free(buf);
+        }
+    }
+    sound_queue_to_channel(SOUND_MSG_CLOSE, NULL, 0, 0, 0);
+}
+
+/*****************************************************************************/
+/* encoder thread, or the channel thread when encoding inline
+   returns 0 when the message says to stop */
+static int
+sound_encode_msg(struct sound_msg *msg)
+{
+    switch (msg->type)
+    {
+        case SOUND_MSG_PCM:
+            g_encoder_codec = msg->codec;
+            sound_encode_pcm(msg->data, msg->bytes);
+            break;
+        case SOUND_MSG_CLOSE:
+            g_encoder_codec = msg->codec;
+            sound_encode_close(msg->codec.num_silent_frames);
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+static THREAD_RV THREAD_CC
+sound_encoder_thread(void *arg)
+{
+    struct sound_msg *msg;
+    int running;
+
+    LOG_DEVEL(LOG_LEVEL_INFO, "sound_encoder_thread: started");
+    running = 1;
+    while (running)
+    {
+        tc_sem_dec(g_pcm_sem);
+        msg = (struct sound_msg *) spsc_ring_pop(g_pcm_ring);
+        if (msg == NULL)
+        {
+            continue;
+        }
+        running = sound_encode_msg(msg);
+        g_free(msg);
+    }
+    LOG_DEVEL(LOG_LEVEL_INFO, "sound_encoder_thread: done");
+    tc_sem_inc(g_encoder_done);
+    return 0;
+}
+
+/*****************************************************************************/
+/* send wave message to client, via the encoder thread */
+static int
+sound_send_wave_data(char *data, int data_bytes)
+{
+    struct sound_msg *msg;
+    int error;
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data: sending %d bytes", data_bytes);
+    if (g_time_diff > g_best_time_diff + 250)
+    {
+        data_bytes = data_bytes / 4;
+        data_bytes = data_bytes & ~3;
+        g_memset(data, 0, data_bytes);
+        g_time_diff = 0;
+    }
+    msg = sound_msg_create(SOUND_MSG_PCM, data, data_bytes);
+    if (msg != NULL)
+    {
+        sound_get_codec(&msg->codec);
+    }
+    error = sound_queue_to_encoder(msg);
+    if (error == 2)
+    {
+        /* don't need to error on this */
+        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_send_wave_data: dropped, no room");
+        error = 0;
+    }
+    return error;
+}
+
 /*****************************************************************************/
 /* send close message to client */
 static int
@@ -1015,7 +1353,6 @@ sound_send_close(void)
     LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_close:");
 
     g_best_time_diff = 0;
-    g_buf_index = 0;
 
     /* send close msg */
     make_stream(s);
@@ -1028,7 +1365,7 @@ sound_send_close(void)
     size_ptr[0] = bytes;
     size_ptr[1] = bytes >> 8;
     bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    sound_send_pdu(s->data, bytes);
     free_stream(s);
     return 0;
 }
@@ -1045,6 +1382,54 @@ sound_process_training(struct stream *s, int size)
     return 0;
 }
 
+/*****************************************************************************/
+/* The time from sending a wave to its confirm is the round trip plus
+   what the client had buffered ahead of it. Keep the smallest time seen,
+   slowly forgotten, as the round trip and average what is left as the
+   buffer depth. A deep or jittery buffer gets bigger Opus frames, fewer
+   PDUs and less overhead, a shallow one smaller frames, less latency */
+static void
+sound_update_buffer_depth(int time_diff)
+{
+    int depth;
+    int frame_ms;
+    int index;
+
+    if ((g_depth_samples == 0) || (time_diff < g_depth_floor))
+    {
+        g_depth_floor = time_diff;
+    }
+    else if ((g_depth_samples & 15) == 0)
+    {
+        g_depth_floor++;
+    }
+    depth = time_diff - g_depth_floor;
+    g_depth_avg += depth - g_depth_avg / 8;
+    g_depth_samples++;
+    if ((g_depth_samples & 31) != 0)
+    {
+        return;
+    }
+    index = g_opus_frame_index;
+    frame_ms = g_opus_frame_bytes[index] / 192; /* 48 kHz * 4 bytes */
+    depth = g_depth_avg / 8;
+    if ((depth > frame_ms * 4 + 20) && (index < NUM_OPUS_FRAME_SIZES - 1))
+    {
+        index++;
+    }
+    else if ((depth < frame_ms * 2) && (index > 0))
+    {
+        index--;
+    }
+    if (index != g_opus_frame_index)
+    {
+        LOG(LOG_LEVEL_DEBUG, "sound_update_buffer_depth: depth %d ms, "
+            "round trip %d ms, opus frame %d bytes", depth, g_depth_floor,
+            g_opus_frame_bytes[index]);
+    }
+    g_opus_frame_index = index;
+}
+
 /*****************************************************************************/
 /* from client */
 static int
@@ -1085,6 +1470,10 @@ sound_process_wave_confirm(struct stream *s, int size)
         }
     }
     g_time_diff = acc;
+    if (g_sound_dvc_up)
+    {
+        sound_update_buffer_depth(time_diff);
+    }
     return 0;
 }
 
@@ -1096,6 +1485,8 @@ process_pcm_message(int id, int size, struct stream *s)
 {
     static int sending_silence = 0;
     static int silence_start_time = 0;
+    struct sound_msg *msg;
+
     switch (id)
     {
         case 0:
@@ -1111,26 +1502,22 @@ process_pcm_message(int id, int size, struct stream *s)
             return sound_send_wave_data(s->p, size);
             break;
         case 1:
+            msg = sound_msg_create(SOUND_MSG_CLOSE, NULL, 0);
+            if (msg == NULL)
+            {
+                return 1;
+            }
+            sound_get_codec(&msg->codec);
             if ((g_client_does_fdk_aac || g_client_does_mp3lame) && sending_silence == 0)
             {
                 /* workaround for mstsc.exe. send silence data before send close */
-                int send_silence_times = g_client_does_fdk_aac ? g_cfg->num_silent_frames_aac : g_cfg->num_silent_frames_mp3;  /* setting from sesman.ini */
-                char *buf = (char *) g_malloc(g_bbuf_size, 0);
-                if (buf != NULL)
-                {
-                    int i;
-                    silence_start_time = g_time3();
-                    sending_silence = 1;
-                    for (i = 0; i < send_silence_times; i++)
-                    {
-                        g_memset(buf, 0, g_bbuf_size);
-                        sound_send_wave_data_chunk(buf, g_bbuf_size);
-                    }
-                    free(buf);
-                    g_time_diff = 0;
-                }
+                msg->codec.num_silent_frames = g_client_does_fdk_aac ? g_cfg->num_silent_frames_aac : g_cfg->num_silent_frames_mp3;  /* setting from sesman.ini */
+                silence_start_time = g_time3();
+                sending_silence = 1;
+                g_time_diff = 0;
             }
-            return sound_send_close();
+            /* the close is sent when the encoder thread passes it back */
+            return (sound_queue_to_encoder(msg) == 0) ? 0 : 1;
             break;
         default:
             LOG_DEVEL(LOG_LEVEL_ERROR, "process_pcm_message: unknown id %d", id);
@@ -1269,6 +1656,297 @@ in_fifo_item_destructor(void *item, void *closure)
     xstream_free((struct stream *)item);
 }
 
+/*****************************************************************************/
+/* a PDU for playback, from rdpsnd or the DVC, returns error */
+static int
+sound_process_playback_pdu(struct stream *s, int code, int size)
+{
+    switch (code)
+    {
+        case SNDC_WAVECONFIRM:
+            return sound_process_wave_confirm(s, size);
+
+        case SNDC_TRAINING:
+            return sound_process_training(s, size);
+
+        case SNDC_FORMATS:
+            return sound_process_output_formats(s, size);
+
+        case SNDC_QUALITYMODE:
+            /* we pick the quality from the formats, nothing to do */
+            return 0;
+
+        default:
+            LOG_DEVEL(LOG_LEVEL_ERROR, "sound_process_playback_pdu: "
+                      "unknown code %d size %d", code, size);
+            break;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_process_pdu(struct stream *s)
+{
+    int code;
+    int size;
+
+    if (!s_check_rem(s, 4))
+    {
+        return 1;
+    }
+    in_uint8(s, code);
+    in_uint8s(s, 1);
+    in_uint16_le(s, size);
+    return sound_process_playback_pdu(s, code, size);
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_open_response(int chan_id, int creation_status)
+{
+    LOG(LOG_LEVEL_INFO, "sound_dvc_open_response: chan_id %d "
+        "creation_status 0x%8.8x", chan_id, creation_status);
+    if (chan_id != g_sound_dvc_chan_id)
+    {
+        return 0;
+    }
+    if (g_sound_dvc_timer == 0)
+    {
+        /* too late, rdpsnd is already in use */
+        chansrv_drdynvc_close(chan_id);
+        return 0;
+    }
+    remove_timeout(g_sound_dvc_timer);
+    g_sound_dvc_timer = 0;
+    if (creation_status < 0)
+    {
+        g_sound_dvc_chan_id = 0;
+    }
+    else
+    {
+        g_sound_dvc_up = 1;
+    }
+    return sound_send_server_output_formats();
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_close_response(int chan_id)
+{
+    LOG(LOG_LEVEL_INFO, "sound_dvc_close_response: chan_id %d", chan_id);
+    if (chan_id == g_sound_dvc_chan_id)
+    {
+        g_sound_dvc_chan_id = 0;
+        g_sound_dvc_up = 0;
+        free_stream(g_sound_dvc_in_s);
+        g_sound_dvc_in_s = NULL;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_data_first(int chan_id, char *data, int bytes, int total_bytes)
+{
+    struct stream *ls;
+
+    if (chan_id != g_sound_dvc_chan_id)
+    {
+        return 0;
+    }
+    free_stream(g_sound_dvc_in_s);
+    make_stream(ls);
+    init_stream(ls, total_bytes);
+    out_uint8a(ls, data, bytes);
+    g_sound_dvc_in_s = ls;
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+sound_dvc_data(int chan_id, char *data, int bytes)
+{
+    struct stream *ls;
+    struct stream ls_in;
+    int error;
+
+    if (chan_id != g_sound_dvc_chan_id)
+    {
+        return 0;
+    }
+    ls = g_sound_dvc_in_s;
+    if (ls == NULL)
+    {
+        g_memset(&ls_in, 0, sizeof(ls_in));
+        ls_in.data = data;
+        ls_in.p = data;
+        ls_in.end = data + bytes;
+        return sound_dvc_process_pdu(&ls_in);
+    }
+    if (!s_check_rem_out(ls, bytes))
+    {
+        return 1;
+    }
+    out_uint8a(ls, data, bytes);
+    if (ls->p < ls->data + ls->size)
+    {
+        /* more fragments to come */
+        return 0;
+    }
+    s_mark_end(ls);
+    ls->p = ls->data;
+    error = sound_dvc_process_pdu(ls);
+    free_stream(ls);
+    g_sound_dvc_in_s = NULL;
+    return error;
+}
+
+/*****************************************************************************/
+/* the client didn't answer the DVC open, use rdpsnd */
+static void
+sound_dvc_open_timeout(void *data)
+{
+    LOG(LOG_LEVEL_INFO, "sound_dvc_open_timeout: no response for %s, "
+        "using rdpsnd", SOUND_DVC_NAME);
+    g_sound_dvc_timer = 0;
+    sound_send_server_output_formats();
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+sound_dvc_start(void)
+{
+    int error;
+
+    g_memset(&g_sound_dvc_procs, 0, sizeof(g_sound_dvc_procs));
+    g_sound_dvc_procs.open_response = sound_dvc_open_response;
+    g_sound_dvc_procs.close_response = sound_dvc_close_response;
+    g_sound_dvc_procs.data_first = sound_dvc_data_first;
+    g_sound_dvc_procs.data = sound_dvc_data;
+    error = chansrv_drdynvc_open(SOUND_DVC_NAME, SOUND_DVC_FLAGS,
+                                 &g_sound_dvc_procs, &g_sound_dvc_chan_id);
+    if (error != 0)
+    {
+        g_sound_dvc_chan_id = 0;
+        return error;
+    }
+    g_sound_dvc_timer = add_timeout(SOUND_DVC_OPEN_TIMEOUT,
+                                    sound_dvc_open_timeout, NULL);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+sound_encoder_start(void)
+{
+    char text[256];
+
+    g_snprintf(text, 255, "xrdp_chansrv_%8.8x_sound_pkt", g_getpid());
+    g_pkt_event = g_create_wait_obj(text);
+    g_pcm_ring = spsc_ring_create(SOUND_PCM_RING_SIZE);
+    g_pkt_ring = spsc_ring_create(SOUND_PKT_RING_SIZE);
+    g_pcm_sem = tc_sem_create(0);
+    g_encoder_done = tc_sem_create(0);
+    if ((g_pkt_event == 0) || (g_pcm_ring == NULL) || (g_pkt_ring == NULL) ||
+            (g_pcm_sem == 0) || (g_encoder_done == 0))
+    {
+        return 1;
+    }
+    g_buf_index = 0;
+    if (tc_thread_create(sound_encoder_thread, 0) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "sound_encoder_start: can't start the "
+            "encoder thread, encoding on the channel thread");
+        g_encoder_inline = 1;
+        return 0;
+    }
+    g_encoder_running = 1;
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+sound_free_ring(struct spsc_ring *ring)
+{
+    void *msg;
+
+    if (ring != NULL)
+    {
+        while ((msg = spsc_ring_pop(ring)) != NULL)
+        {
+            g_free(msg);
+        }
+        spsc_ring_delete(ring);
+    }
+}
+
+/*****************************************************************************/
+static void
+sound_encoder_stop(void)
+{
+    struct sound_msg *msg;
+
+    if (g_encoder_running)
+    {
+        msg = sound_msg_create(SOUND_MSG_QUIT, NULL, 0);
+        while ((msg != NULL) && (spsc_ring_push(g_pcm_ring, msg) != 0))
+        {
+            g_sleep(1);
+        }
+        tc_sem_inc(g_pcm_sem);
+        tc_sem_dec(g_encoder_done);
+        g_encoder_running = 0;
+    }
+    g_encoder_inline = 0;
+    sound_free_ring(g_pcm_ring);
+    g_pcm_ring = NULL;
+    sound_free_ring(g_pkt_ring);
+    g_pkt_ring = NULL;
+    if (g_pcm_sem != 0)
+    {
+        tc_sem_delete(g_pcm_sem);
+        g_pcm_sem = 0;
+    }
+    if (g_encoder_done != 0)
+    {
+        tc_sem_delete(g_encoder_done);
+        g_encoder_done = 0;
+    }
+    if (g_pkt_event != 0)
+    {
+        g_delete_wait_obj(g_pkt_event);
+        g_pkt_event = 0;
+    }
+}
+
+/*****************************************************************************/
+/* channel thread, send what the encoder thread has finished */
+static int
+sound_send_encoded(void)
+{
+    struct sound_msg *msg;
+
+    /* reset first, so a packet queued while we drain isn't missed */
+    g_reset_wait_obj(g_pkt_event);
+    while ((msg = (struct sound_msg *) spsc_ring_pop(g_pkt_ring)) != NULL)
+    {
+        if (msg->type == SOUND_MSG_WAVE)
+        {
+            sound_send_wave_data_chunk(msg->data, msg->bytes,
+                                       msg->format_index, msg->start_time);
+        }
+        else if (msg->type == SOUND_MSG_CLOSE)
+        {
+            sound_send_close();
+        }
+        g_free(msg);
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 int
 sound_init(void)
@@ -1277,8 +1955,22 @@ sound_init(void)
 
     g_stream_incoming_packet = NULL;
 
-    /* init sound output */
-    sound_send_server_output_formats();
+    /* init sound output, the formats go out once we know which channel */
+    g_sound_dvc_up = 0;
+    g_client_version = 0;
+    g_opus_frame_index = NUM_OPUS_FRAME_SIZES - 1;
+    g_depth_avg = 0;
+    g_depth_samples = 0;
+    if (!g_cfg->playback_dvc || (sound_dvc_start() != 0))
+    {
+        sound_send_server_output_formats();
+    }
+    if (sound_encoder_start() != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "sound_init: can't start the encoder thread, "
+            "no sound output");
+        sound_encoder_stop();
+    }
     sound_start_sink_listener();
 
     /* init sound input */
@@ -1317,6 +2009,9 @@ int
 sound_deinit(void)
 {
     LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_deinit:");
+    /* the encoders are the encoder thread's until it has gone */
+    sound_encoder_stop();
+
     if (g_audio_l_trans_out != 0)
     {
         trans_delete(g_audio_l_trans_out);
@@ -1352,6 +2047,20 @@ sound_deinit(void)
 
     fifo_delete(g_in_fifo, NULL);
 
+    if (g_sound_dvc_timer != 0)
+    {
+        remove_timeout(g_sound_dvc_timer);
+        g_sound_dvc_timer = 0;
+    }
+    if (g_sound_dvc_chan_id != 0)
+    {
+        chansrv_drdynvc_close(g_sound_dvc_chan_id);
+        g_sound_dvc_chan_id = 0;
+    }
+    g_sound_dvc_up = 0;
+    free_stream(g_sound_dvc_in_s);
+    g_sound_dvc_in_s = NULL;
+
     return 0;
 }
 
@@ -1379,18 +2088,6 @@ sound_data_in(struct stream *s, int chan_id, int chan_flags, int length,
 
     switch (code)
     {
-        case SNDC_WAVECONFIRM:
-            sound_process_wave_confirm(g_stream_incoming_packet, size);
-            break;
-
-        case SNDC_TRAINING:
-            sound_process_training(g_stream_incoming_packet, size);
-            break;
-
-        case SNDC_FORMATS:
-            sound_process_output_formats(g_stream_incoming_packet, size);
-            break;
-
         case SNDC_REC_NEGOTIATE:
             sound_process_input_formats(g_stream_incoming_packet, size);
             break;
@@ -1401,7 +2098,7 @@ sound_data_in(struct stream *s, int chan_id, int chan_flags, int length,
             break;
 
         default:
-            LOG_DEVEL(LOG_LEVEL_ERROR, "sound_data_in: unknown code %d size %d", code, size);
+            sound_process_playback_pdu(g_stream_incoming_packet, code, size);
             break;
     }
 
@@ -1446,6 +2143,12 @@ sound_get_wait_objs(tbus *objs, int *count, int *timeout)
         lcount++;
     }
 
+    if (g_pkt_event != 0)
+    {
+        objs[lcount] = g_pkt_event;
+        lcount++;
+    }
+
     *count = lcount;
     return 0;
 }
@@ -1454,6 +2157,11 @@ sound_get_wait_objs(tbus *objs, int *count, int *timeout)
 int
 sound_check_wait_objs(void)
 {
+    if ((g_pkt_event != 0) && g_is_wait_obj_set(g_pkt_event))
+    {
+        sound_send_encoded();
+    }
+
     if (g_audio_l_trans_out != 0)
     {
         if (trans_check_wait_objs(g_audio_l_trans_out) != 0)
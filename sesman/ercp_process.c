@@ -58,6 +58,7 @@ process_session_announce_event(struct session_item *si)
         snprintf(si->start_ip_addr, sizeof(si->start_ip_addr),
                  "%s", start_ip_addr);
         si->state = E_SESSION_RUNNING;
+        session_list_update_index(si);
     }
 
     return rv;
@@ -512,6 +512,7 @@ process_create_session_request(struct pre_session_item *psi)
                     // Add the display to the session item so we don't try
                     // to allocate it to another session
                     s_item->display = display;
+                    session_list_update_index(s_item);
                 }
             }
         }
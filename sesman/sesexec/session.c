@@ -617,6 +617,15 @@ session_start_wrapped(struct login_info *login_info,
     if (display_pid > 0)
     {
         enum xwait_status xws;
+
+        /* chansrv doesn't connect to the X server until xrdp sets up
+         * the channels, which is after we've replied. Start it now so
+         * its startup isn't added to the time taken by the X server */
+        LOG(LOG_LEVEL_INFO,
+            "Starting the xrdp channel server for display :%d",
+            s->display);
+        chansrv_pid = fork_child(start_chansrv, login_info, s, display_pid);
+
         xws = wait_for_xserver(login_info->uid,
                                g_cfg->env_names,
                                g_cfg->env_values,
@@ -641,6 +650,11 @@ session_start_wrapped(struct login_info *login_info,
              * pick up on it */
             g_sigterm(display_pid);
             g_waitpid(display_pid);
+            if (chansrv_pid > 0)
+            {
+                g_sigterm(chansrv_pid);
+                g_waitpid(chansrv_pid);
+            }
         }
         else
         {
@@ -654,16 +668,15 @@ session_start_wrapped(struct login_info *login_info,
             {
                 g_sigterm(display_pid);
                 g_waitpid(display_pid);
+                if (chansrv_pid > 0)
+                {
+                    g_sigterm(chansrv_pid);
+                    g_waitpid(chansrv_pid);
+                }
             }
             else
             {
                 utmp_login(window_manager_pid, s->display, login_info);
-                LOG(LOG_LEVEL_INFO,
-                    "Starting the xrdp channel server for display :%d",
-                    s->display);
-
-                chansrv_pid = fork_child(start_chansrv, login_info,
-                                         s, display_pid);
 
                 // Tell the caller we've started
                 LOG(LOG_LEVEL_INFO,
@@ -880,6 +880,9 @@ main(int argc, char **argv)
             g_exit(0);
         }
 
+        /* the log writer thread, if any, stayed with the parent */
+        log_fork_child();
+
     }
 
     /* Now we've forked (if necessary), we can get the program PID */
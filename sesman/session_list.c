@@ -27,6 +27,16 @@
  * @brief Session list management code
  * @author Jay Sorg, Simone Fedele
  *
+ * Running sessions are indexed in two hash tables, one by UID and one
+ * by a key made from the fields the session policy compares. A lookup
+ * only has to check the sessions on one chain. Chains are kept in the
+ * order sessions are added, so the oldest match is found first, as it
+ * was when the whole list was searched.
+ *
+ * Displays allocated to sessions are kept in a bitmap. Displays found
+ * to be in use by an X server we didn't start are kept in another, which
+ * is cleared every DISPLAY_BUSY_RECHECK_SECS. Only displays in neither
+ * bitmap are checked against the filesystem and the TCP ports.
  */
 
 #if defined(HAVE_CONFIG_H)
@@ -45,13 +55,272 @@
 #include "string_calls.h"
 #include "xrdp_sockets.h"
 
+#define SESSION_INDEX_BITS_INITIAL 6
+#define DISPLAY_BUSY_RECHECK_SECS 30
+#define DISPLAY_WORD_BITS 32
+
 static struct list *g_session_list = NULL;
 
+static struct session_item **g_uid_index = NULL;
+static struct session_item **g_policy_index = NULL;
+static unsigned int g_index_bits = 0;
+static unsigned int g_index_count = 0;
+static int g_index_policy = 0; /* policy g_policy_index is keyed for */
+
+static unsigned int *g_display_used = NULL; /* allocated to sessions */
+static unsigned int *g_display_busy = NULL; /* X servers we didn't start */
+static unsigned int g_display_words = 0;
+static int g_display_busy_time = 0;
+
 #define SESSION_IN_USE(si) \
     ((si) != NULL && \
      (si)->sesexec_trans != NULL && \
      (si)->sesexec_trans->status == TRANS_STATUS_UP)
 
+#define DISPLAY_BIT_IS_SET(bitmap, display) \
+    (((bitmap)[(display) / DISPLAY_WORD_BITS] & \
+      (1U << ((display) % DISPLAY_WORD_BITS))) != 0)
+
+/******************************************************************************/
+/**
+ * Gets the session policy in use, with the default expanded
+ */
+static int
+get_session_policy(void)
+{
+    int policy = g_cfg->sess.policy;
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_DEFAULT) != 0)
+    {
+        /* Before xrdp v0.9.14, the default
+         * session policy varied by type. If this is needed again
+         * in the future, here is the place to add it */
+        policy = SESMAN_CFG_SESS_POLICY_U | SESMAN_CFG_SESS_POLICY_B;
+    }
+
+    return policy;
+}
+
+/******************************************************************************/
+/* FNV-1a step */
+static unsigned int
+hash_add(unsigned int hash, unsigned int value)
+{
+    return (hash ^ value) * 16777619U;
+}
+
+/******************************************************************************/
+/**
+ * Makes the policy index key for a set of session parameters
+ *
+ * Sessions which match under the policy always have the same key
+ */
+static unsigned int
+make_policy_key(int policy, uid_t uid, enum scp_session_type type,
+                unsigned short width, unsigned short height,
+                unsigned char bpp, const char *ip_addr)
+{
+    unsigned int key = hash_add(2166136261U, (unsigned int)type);
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_U) != 0)
+    {
+        key = hash_add(key, (unsigned int)uid);
+    }
+    if ((policy & SESMAN_CFG_SESS_POLICY_B) != 0)
+    {
+        key = hash_add(key, bpp);
+    }
+    if ((policy & SESMAN_CFG_SESS_POLICY_D) != 0)
+    {
+        key = hash_add(key, ((unsigned int)width << 16) | height);
+    }
+    if ((policy & SESMAN_CFG_SESS_POLICY_I) != 0)
+    {
+        for (; *ip_addr != '\0'; ++ip_addr)
+        {
+            key = hash_add(key, (unsigned char)*ip_addr);
+        }
+    }
+
+    return key;
+}
+
+/******************************************************************************/
+static unsigned int
+uid_bucket(uid_t uid)
+{
+    return (unsigned int)(((unsigned int)uid * 0x9e3779b1U) >>
+                          (32 - g_index_bits));
+}
+
+/******************************************************************************/
+static unsigned int
+policy_bucket(unsigned int key)
+{
+    return key & ((1U << g_index_bits) - 1);
+}
+
+/******************************************************************************/
+/**
+ * Adds a running session to the end of its index chains
+ */
+static void
+index_add(struct session_item *si)
+{
+    struct session_item **pp;
+
+    si->uid_next = NULL;
+    pp = &g_uid_index[uid_bucket(si->uid)];
+    while (*pp != NULL)
+    {
+        pp = &(*pp)->uid_next;
+    }
+    *pp = si;
+
+    si->policy_key = make_policy_key(g_index_policy, si->uid, si->type,
+                                     si->start_width, si->start_height,
+                                     si->bpp, si->start_ip_addr);
+    si->policy_next = NULL;
+    pp = &g_policy_index[policy_bucket(si->policy_key)];
+    while (*pp != NULL)
+    {
+        pp = &(*pp)->policy_next;
+    }
+    *pp = si;
+
+    si->is_indexed = 1;
+    ++g_index_count;
+}
+
+/******************************************************************************/
+static void
+index_remove(struct session_item *si)
+{
+    struct session_item **pp;
+
+    if (!si->is_indexed)
+    {
+        return;
+    }
+
+    pp = &g_uid_index[uid_bucket(si->uid)];
+    while (*pp != si)
+    {
+        pp = &(*pp)->uid_next;
+    }
+    *pp = si->uid_next;
+
+    pp = &g_policy_index[policy_bucket(si->policy_key)];
+    while (*pp != si)
+    {
+        pp = &(*pp)->policy_next;
+    }
+    *pp = si->policy_next;
+
+    si->is_indexed = 0;
+    --g_index_count;
+}
+
+/******************************************************************************/
+/**
+ * Makes new index tables and files all the running sessions again
+ *
+ * @param bits log2 of the table size
+ * @param policy Policy to key the policy index for
+ * @return 0 for success. On failure, the old tables are kept.
+ */
+static int
+index_rebuild(unsigned int bits, int policy)
+{
+    struct session_item **uid_index;
+    struct session_item **policy_index;
+    int i;
+
+    uid_index = g_new0(struct session_item *, 1U << bits);
+    policy_index = g_new0(struct session_item *, 1U << bits);
+    if (uid_index == NULL || policy_index == NULL)
+    {
+        g_free(uid_index);
+        g_free(policy_index);
+        return 1;
+    }
+
+    g_free(g_uid_index);
+    g_free(g_policy_index);
+    g_uid_index = uid_index;
+    g_policy_index = policy_index;
+    g_index_bits = bits;
+    g_index_policy = policy;
+    g_index_count = 0;
+
+    for (i = 0 ; i < g_session_list->count ; ++i)
+    {
+        struct session_item *si;
+        si = (struct session_item *)list_get_item(g_session_list, i);
+        si->is_indexed = 0;
+        if (si->state == E_SESSION_RUNNING)
+        {
+            index_add(si);
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/**
+ * Makes sure the display bitmaps cover a display
+ * @return 0 for success
+ */
+static int
+display_bitmap_cover(unsigned int display)
+{
+    unsigned int words = display / DISPLAY_WORD_BITS + 1;
+    unsigned int *used;
+    unsigned int *busy;
+
+    if (words <= g_display_words)
+    {
+        return 0;
+    }
+
+    used = g_new0(unsigned int, words);
+    busy = g_new0(unsigned int, words);
+    if (used == NULL || busy == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't allocate memory for display bitmap");
+        g_free(used);
+        g_free(busy);
+        return 1;
+    }
+
+    if (g_display_words > 0)
+    {
+        g_memcpy(used, g_display_used, g_display_words * sizeof(used[0]));
+        g_memcpy(busy, g_display_busy, g_display_words * sizeof(busy[0]));
+    }
+    g_free(g_display_used);
+    g_free(g_display_busy);
+    g_display_used = used;
+    g_display_busy = busy;
+    g_display_words = words;
+
+    return 0;
+}
+
+/******************************************************************************/
+static void
+display_bitmap_release(struct session_item *si)
+{
+    if (si->indexed_display >= 0)
+    {
+        unsigned int d = (unsigned int)si->indexed_display;
+        g_display_used[d / DISPLAY_WORD_BITS] &=
+            ~(1U << (d % DISPLAY_WORD_BITS));
+        si->indexed_display = -1;
+    }
+}
+
 /******************************************************************************/
 int
 session_list_init(void)
@@ -69,7 +338,16 @@ session_list_init(void)
     else
     {
         g_session_list->auto_free = 0;
-        rv = 0;
+        if (g_uid_index == NULL &&
+                index_rebuild(SESSION_INDEX_BITS_INITIAL,
+                              get_session_policy()) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "Can't allocate session indexes");
+        }
+        else if (display_bitmap_cover(g_cfg->sess.max_display_number) == 0)
+        {
+            rv = 0;
+        }
     }
 
     return rv;
@@ -113,6 +391,19 @@ session_list_cleanup(void)
         list_delete(g_session_list);
         g_session_list = NULL;
     }
+
+    g_free(g_uid_index);
+    g_free(g_policy_index);
+    g_uid_index = NULL;
+    g_policy_index = NULL;
+    g_index_bits = 0;
+    g_index_count = 0;
+
+    g_free(g_display_used);
+    g_free(g_display_busy);
+    g_display_used = NULL;
+    g_display_busy = NULL;
+    g_display_words = 0;
 }
 
 /******************************************************************************/
@@ -130,6 +421,8 @@ session_list_new(void)
     if (result != NULL)
     {
         result->state = E_SESSION_STARTING;
+        result->display = -1;
+        result->indexed_display = -1;
         if (!list_add_item(g_session_list, (tintptr)result))
         {
             g_free(result);
@@ -140,6 +433,34 @@ session_list_new(void)
     return result;
 }
 
+/******************************************************************************/
+void
+session_list_update_index(struct session_item *si)
+{
+    index_remove(si);
+    if (si->state == E_SESSION_RUNNING)
+    {
+        if (g_index_count >= (2U << g_index_bits))
+        {
+            /* This files si too. If it fails, the chains just get longer */
+            (void)index_rebuild(g_index_bits + 1, g_index_policy);
+        }
+        if (!si->is_indexed)
+        {
+            index_add(si);
+        }
+    }
+
+    display_bitmap_release(si);
+    if (si->display >= 0 &&
+            display_bitmap_cover((unsigned int)si->display) == 0)
+    {
+        unsigned int d = (unsigned int)si->display;
+        g_display_used[d / DISPLAY_WORD_BITS] |= 1U << (d % DISPLAY_WORD_BITS);
+        si->indexed_display = si->display;
+    }
+}
+
 /******************************************************************************/
 /**
  *
@@ -207,109 +528,137 @@ x_server_running_check_ports(int display)
 }
 
 /******************************************************************************/
-/* Helper function for get_sorted_display_list():qsort() */
-static int
-icmp(const void *v1, const void *v2)
+int
+session_list_get_available_display(void)
 {
-    // Pointers point to unsigned ints
-    unsigned int i1 = *(unsigned int *)v1;
-    unsigned int i2 = *(unsigned int *)v2;
-    return (i1 < i2) ? -1 : (i1 > i2) ? 1 : 0;
-}
-
-/******************************************************************************/
-/**
- * Get a sorted array of all the displays allocated to sessions
- * @param[out] cnt Count of displays in list
- * @return Allocated array of displays or NULL for no memory
- *
- * Result must always be freed, even if cnt == 0
- */
+    int rv = -1;
+    unsigned int display;
+    int now;
 
-static unsigned int *
-get_sorted_session_displays(unsigned int *cnt)
-{
-    unsigned int *displays;
+    if (display_bitmap_cover(g_cfg->sess.max_display_number) != 0)
+    {
+        return -1;
+    }
 
-    *cnt = 0;
-    displays = g_new(unsigned int, session_list_get_count() + 1);
-    if (displays == NULL)
+    // Displays already allocated to sessions are skipped without looking
+    // at the file system. This also prevents us allocating the same
+    // display number to two callers who call in quick succession  i.e. if
+    // the first caller has not created its X server by the time we
+    // service the second request.
+    //
+    // Displays used by other X servers are remembered for a while, so
+    // we don't keep checking them.
+    now = g_time1();
+    if (now - g_display_busy_time >= DISPLAY_BUSY_RECHECK_SECS ||
+            now < g_display_busy_time)
     {
-        LOG(LOG_LEVEL_ERROR, "Can't allocate memory for display list");
+        g_memset(g_display_busy, 0,
+                 g_display_words * sizeof(g_display_busy[0]));
+        g_display_busy_time = now;
     }
-    else if (g_session_list != NULL)
+
+    for (display = g_cfg->sess.x11_display_offset;
+            display <= g_cfg->sess.max_display_number;
+            ++display)
     {
-        int i;
+        unsigned int word = display / DISPLAY_WORD_BITS;
 
-        for (i = 0 ; i < g_session_list->count ; ++i)
+        if ((g_display_used[word] | g_display_busy[word]) == ~0U)
         {
-            const struct session_item *si;
-            si = (const struct session_item *)list_get_item(g_session_list, i);
-            if (SESSION_IN_USE(si) && si->display >= 0)
-            {
-                displays[(*cnt)++] = si->display;
-            }
+            // Skip to the last display in this word
+            display |= DISPLAY_WORD_BITS - 1;
+            continue;
+        }
+
+        if (DISPLAY_BIT_IS_SET(g_display_used, display) ||
+                DISPLAY_BIT_IS_SET(g_display_busy, display))
+        {
+            continue;
         }
-        qsort(displays, *cnt, sizeof(displays[0]), icmp);
+
+        if (!x_server_running_check_ports(display))
+        {
+            break;
+        }
+        g_display_busy[word] |= 1U << (display % DISPLAY_WORD_BITS);
+    }
+
+    if (display > g_cfg->sess.max_display_number)
+    {
+        LOG(LOG_LEVEL_ERROR,
+            "X server -- no display in range (%d to %d) is available",
+            g_cfg->sess.x11_display_offset,
+            g_cfg->sess.max_display_number);
+    }
+    else
+    {
+        rv = display;
     }
 
-    return displays;
+    return rv;
 }
 
 /******************************************************************************/
-int
-session_list_get_available_display(void)
+/**
+ * Checks a session against the parameters of a session request
+ * @return nonzero if the session matches under the policy
+ */
+static int
+session_matches(const struct session_item *si, int policy,
+                uid_t uid,
+                enum scp_session_type type,
+                unsigned short width,
+                unsigned short height,
+                unsigned char  bpp,
+                const char *ip_addr)
 {
-    int rv = -1;
-    unsigned int max_alloc = 0;
-
-    // Find all displays already allocated. We do this to prevent
-    // unnecessary file system accesses, and also to prevent us allocating
-    // the same display number to two callers who call in quick
-    // succession  i.e. if the first caller has not created its X server
-    // by the time we service the second request
-    unsigned int *allocated_displays = get_sorted_session_displays(&max_alloc);
-    if (allocated_displays != NULL)
-    {
-        unsigned int i = 0;
-        unsigned int display;
-
-        for (display = g_cfg->sess.x11_display_offset;
-                display <= g_cfg->sess.max_display_number;
-                ++display)
-        {
-            // Have we already allocated this one?
-            while (i < max_alloc && display > allocated_displays[i])
-            {
-                ++i;
-            }
-            if (i < max_alloc && display == allocated_displays[i])
-            {
-                continue; // Already allocated
-            }
+    LOG(LOG_LEVEL_DEBUG,
+        "%s: try %p type=%s U=%d B=%d D=(%dx%d) I=%s",
+        __func__,
+        si,
+        SCP_SESSION_TYPE_TO_STR(si->type),
+        si->uid, si->bpp,
+        si->start_width, si->start_height,
+        si->start_ip_addr);
 
-            if (!x_server_running_check_ports(display))
-            {
-                break;
-            }
-        }
+    if (si->type != type)
+    {
+        LOG(LOG_LEVEL_DEBUG, "%s: Type doesn't match", __func__);
+        return 0;
+    }
 
-        g_free(allocated_displays);
+    if ((policy & SESMAN_CFG_SESS_POLICY_U) && uid != si->uid)
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: UID doesn't match for 'U' policy", __func__);
+        return 0;
+    }
 
-        if (display > g_cfg->sess.max_display_number)
-        {
-            LOG(LOG_LEVEL_ERROR,
-                "X server -- no display in range (%d to %d) is available",
-                g_cfg->sess.x11_display_offset,
-                g_cfg->sess.max_display_number);
-        }
-        else
-        {
-            rv = display;
-        }
+    if ((policy & SESMAN_CFG_SESS_POLICY_B) && si->bpp != bpp)
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: bpp doesn't match for 'B' policy", __func__);
+        return 0;
     }
 
-    return rv;
+    if ((policy & SESMAN_CFG_SESS_POLICY_D) &&
+            (si->start_width != width ||
+             si->start_height != height))
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: Dimensions don't match for 'D' policy", __func__);
+        return 0;
+    }
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_I) &&
+            g_strcmp(si->start_ip_addr, ip_addr) != 0)
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: IPs don't match for 'I' policy", __func__);
+        return 0;
+    }
+
+    return 1;
 }
 
 /******************************************************************************/
@@ -322,22 +671,15 @@ session_list_get_bydata(uid_t uid,
                         const char *ip_addr)
 {
     char policy_str[64];
-    int policy = g_cfg->sess.policy;
-    int i;
+    int policy = get_session_policy();
+    unsigned int key;
+    struct session_item *si;
 
     if (ip_addr == NULL)
     {
         ip_addr = "";
     }
 
-    if ((policy & SESMAN_CFG_SESS_POLICY_DEFAULT) != 0)
-    {
-        /* Before xrdp v0.9.14, the default
-         * session policy varied by type. If this is needed again
-         * in the future, here is the place to add it */
-        policy = SESMAN_CFG_SESS_POLICY_U | SESMAN_CFG_SESS_POLICY_B;
-    }
-
     config_output_policy_string(policy, policy_str, sizeof(policy_str));
 
     LOG(LOG_LEVEL_DEBUG,
@@ -354,64 +696,27 @@ session_list_get_bydata(uid_t uid,
         return NULL;
     }
 
-    for (i = 0 ; i < g_session_list->count ; ++i)
+    /* The policy may have changed on a config reload */
+    if (policy != g_index_policy &&
+            index_rebuild(g_index_bits, policy) != 0)
     {
-        struct session_item *si;
-        si = (struct session_item *)list_get_item(g_session_list, i);
-        if (!SESSION_IN_USE(si))
-        {
-            continue;
-        }
-
-        LOG(LOG_LEVEL_DEBUG,
-            "%s: try %p type=%s U=%d B=%d D=(%dx%d) I=%s",
-            __func__,
-            si,
-            SCP_SESSION_TYPE_TO_STR(si->type),
-            si->uid, si->bpp,
-            si->start_width, si->start_height,
-            si->start_ip_addr);
-
-        if (si->type != type)
-        {
-            LOG(LOG_LEVEL_DEBUG, "%s: Type doesn't match", __func__);
-            continue;
-        }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_U) && uid != si->uid)
-        {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: UID doesn't match for 'U' policy", __func__);
-            continue;
-        }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_B) && si->bpp != bpp)
-        {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: bpp doesn't match for 'B' policy", __func__);
-            continue;
-        }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_D) &&
-                (si->start_width != width ||
-                 si->start_height != height))
-        {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: Dimensions don't match for 'D' policy", __func__);
-            continue;
-        }
+        LOG(LOG_LEVEL_ERROR, "Can't allocate session indexes");
+        return NULL;
+    }
 
-        if ((policy & SESMAN_CFG_SESS_POLICY_I) &&
-                g_strcmp(si->start_ip_addr, ip_addr) != 0)
+    key = make_policy_key(policy, uid, type, width, height, bpp, ip_addr);
+    for (si = g_policy_index[policy_bucket(key)] ;
+            si != NULL ;
+            si = si->policy_next)
+    {
+        if (si->policy_key == key && SESSION_IN_USE(si) &&
+                session_matches(si, policy, uid, type, width, height,
+                                bpp, ip_addr))
         {
             LOG(LOG_LEVEL_DEBUG,
-                "%s: IPs don't match for 'I' policy", __func__);
-            continue;
+                "%s: Got match, display=%d", __func__, si->display);
+            return si;
         }
-
-        LOG(LOG_LEVEL_DEBUG,
-            "%s: Got match, display=%d", __func__, si->display);
-        return si;
     }
 
     LOG(LOG_LEVEL_DEBUG, "%s: No matches found", __func__);
@@ -422,7 +727,7 @@ session_list_get_bydata(uid_t uid,
 struct scp_session_info *
 session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
 {
-    int i;
+    const struct session_item *si;
     struct scp_session_info *sess;
     int count;
     int index;
@@ -431,10 +736,8 @@ session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
 
     LOG(LOG_LEVEL_DEBUG, "searching for session by UID: %d", uid);
 
-    for (i = 0 ; i < g_session_list->count ; ++i)
+    for (si = g_uid_index[uid_bucket(uid)] ; si != NULL ; si = si->uid_next)
     {
-        const struct session_item *si;
-        si = (const struct session_item *)list_get_item(g_session_list, i);
         if (SESSION_IN_USE(si) && uid == si->uid)
         {
             count++;
@@ -457,11 +760,8 @@ session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
     }
 
     index = 0;
-    for (i = 0 ; i < g_session_list->count ; ++i)
+    for (si = g_uid_index[uid_bucket(uid)] ; si != NULL ; si = si->uid_next)
     {
-        const struct session_item *si;
-        si = (const struct session_item *)list_get_item(g_session_list, i);
-
         if (SESSION_IN_USE(si) && uid == si->uid)
         {
             (sess[index]).sid = si->sesexec_pid;
@@ -550,6 +850,8 @@ session_list_check_wait_objs(void)
         }
         else
         {
+            index_remove(si);
+            display_bitmap_release(si);
             free_session(si);
             list_remove_item(g_session_list, i);
         }
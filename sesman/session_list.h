@@ -66,6 +66,13 @@ struct session_item
     struct guid guid;
     char start_ip_addr[MAX_PEER_ADDRSTRLEN];
     time_t start_time;
+
+    /* Index links. These are private to session_list.c */
+    int is_indexed;
+    unsigned int policy_key;
+    int indexed_display;
+    struct session_item *uid_next;
+    struct session_item *policy_next;
 };
 
 /**
@@ -107,11 +114,24 @@ session_list_get_count(void);
 struct session_item *
 session_list_new(void);
 
+/**
+ * Updates the list indexes for a session
+ *
+ * Call this after setting the display of a session, or after it
+ * changes to E_SESSION_RUNNING, so the session can be found by
+ * display, UID and policy.
+ *
+ * @param si Session item
+ */
+void
+session_list_update_index(struct session_item *si);
+
 /**
  * Get the next available display
  *
  * The display isn't reserved until the caller has allocated a new session
- * (with session_list_new()) and put the new display in it.
+ * (with session_list_new()), put the new display in it and called
+ * session_list_update_index().
  */
 int
 session_list_get_available_display(void);
@@ -0,0 +1,1013 @@
+/*
+ * codec throughput on recorded frames
+ *
+ * Each frame of a frame trace is encoded with each codec, called the way
+ * xrdp calls it. The copy rects go to the codec as they would from
+ * xorgxrdp. For planar and interleaved RLE, they are cut into 64x64
+ * bitmaps as libxrdp sends them. For RemoteFX, they are covered by
+ * 64x64 tiles. Reports, for each codec,
+ *   MP/s         copy rect pixels encoded per second of codec time
+ *   bytes/frame  compressed output
+ *   p50, p99     codec time per frame
+ *   allocs/frame heap allocations made while encoding
+ *
+ * usage: bench_codecs [-c codec] [-n frames] [-g out.trace] [trace]
+ *   -c codec     run only this codec
+ *   -n frames    stop after this many frames
+ *   -g file      write the synthetic trace to file and exit
+ * Without a trace, a synthetic desktop trace is made and used.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arch.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "log.h"
+#include "ms-rdpbcgr.h"
+#include "libxrdp.h"
+#include "xrdp_frame_trace.h"
+
+#ifdef XRDP_RFXCODEC
+#include "rfxcodec_encode.h"
+#endif
+
+#ifdef XRDP_X264
+#include "xrdp_encoder_x264.h"
+#endif
+
+#define TILE 64
+#define OUT_BYTES (16 * 1024 * 1024)
+#define JPEG_QUALITY 75
+
+/* synthetic trace */
+#define SYN_WIDTH 1280
+#define SYN_HEIGHT 720
+#define SYN_FRAMES 120
+#define SYN_FRAME_MS 33
+
+struct bench
+{
+    struct xrdp_frame_trace_frame *frame;
+    struct stream *s;
+    struct stream *temp_s;
+    char *out;
+    char *tile;
+    void *handle;
+    /* RemoteFX tiles covering the copy rects */
+    char *tile_map;
+    int tiles_across;
+    int tiles_down;
+    short *tiles;
+    int num_tiles;
+    /* h264 input */
+    char *nv12;
+    int nv12_width;
+    int nv12_height;
+};
+
+struct codec
+{
+    const char *name;
+    int (*init)(struct bench *b);
+    /* untimed work on the frame, before encode */
+    int (*prepare)(struct bench *b);
+    /* timed, returns compressed bytes or -1 on error */
+    int (*encode)(struct bench *b);
+    void (*deinit)(struct bench *b);
+};
+
+/*****************************************************************************/
+/* counts heap allocations, glibc lets the program replace malloc */
+#if defined(__GLIBC__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static long g_allocs;
+
+void *
+malloc(size_t size)
+{
+    __atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    __atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    __atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+#define ALLOCS() __atomic_load_n(&g_allocs, __ATOMIC_RELAXED)
+#else
+#define ALLOCS() 0L
+#endif
+
+/*****************************************************************************/
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*****************************************************************************/
+static int
+bench_no_prepare(struct bench *b)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+bench_bitmap_init(struct bench *b)
+{
+    make_stream(b->s);
+    init_stream(b->s, TILE * TILE * 8);
+    make_stream(b->temp_s);
+    init_stream(b->temp_s, TILE * TILE * 8);
+    b->tile = g_new(char, TILE * TILE * 4);
+    return b->tile == NULL;
+}
+
+/*****************************************************************************/
+static void
+bench_bitmap_deinit(struct bench *b)
+{
+    free_stream(b->s);
+    free_stream(b->temp_s);
+    g_free(b->tile);
+}
+
+/*****************************************************************************/
+/* copies a bitmap out of the screen, as xrdp does before compressing,
+   the width is a multiple of 4 as libxrdp wants */
+static int
+copy_tile(struct bench *b, int x, int y, int cx, int cy)
+{
+    struct xrdp_frame_trace_frame *frame;
+    int width;
+    int line;
+
+    frame = b->frame;
+    width = (cx + 3) & ~3;
+    for (line = 0; line < cy; line++)
+    {
+        g_memcpy(b->tile + line * width * 4,
+                 frame->data + (y + line) * frame->stride + x * 4,
+                 width * 4);
+    }
+    return width;
+}
+
+/*****************************************************************************/
+/* calls fn for each 64x64 bitmap in the copy rects, returns bytes */
+static int
+for_each_tile(struct bench *b, int (*fn)(struct bench *b, int width,
+              int height))
+{
+    struct xrdp_frame_trace_frame *frame;
+    short *r;
+    int index;
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int bytes;
+    int rv;
+
+    frame = b->frame;
+    bytes = 0;
+    for (index = 0; index < frame->num_crects; index++)
+    {
+        r = frame->crects + index * 4;
+        for (y = r[1]; y < r[1] + r[3]; y += TILE)
+        {
+            for (x = r[0]; x < r[0] + r[2]; x += TILE)
+            {
+                cx = MIN(TILE, r[0] + r[2] - x);
+                cy = MIN(TILE, r[1] + r[3] - y);
+                rv = fn(b, copy_tile(b, x, y, cx, cy), cy);
+                if (rv < 0)
+                {
+                    return -1;
+                }
+                bytes += rv;
+            }
+        }
+    }
+    return bytes;
+}
+
+/*****************************************************************************/
+static int
+planar_tile(struct bench *b, int width, int height)
+{
+    int lines;
+
+    init_stream(b->s, 0);
+    lines = libxrdp_planar_compress(b->tile, width, height, b->s, 32,
+                                    TILE * TILE * 8, height - 1,
+                                    b->temp_s, 0, 0x10);
+    if (lines != height)
+    {
+        return -1;
+    }
+    return (int)(b->s->p - b->s->data);
+}
+
+/*****************************************************************************/
+static int
+planar_encode(struct bench *b)
+{
+    return for_each_tile(b, planar_tile);
+}
+
+/*****************************************************************************/
+/* as libxrdp_send_bitmap, lines are compressed bottom up until the
+   byte limit, and the rest goes in the next bitmap */
+static int
+interleaved_tile(struct bench *b, int width, int height)
+{
+    int bytes;
+    int lines;
+    int i;
+
+    bytes = 0;
+    i = height;
+    while (i > 0)
+    {
+        init_stream(b->s, 0);
+        init_stream(b->temp_s, 0);
+        lines = xrdp_bitmap_compress(b->tile, width, height, b->s, 24,
+                                     8192, i - 1, b->temp_s, 0);
+        if (lines < 1)
+        {
+            return -1;
+        }
+        i -= lines;
+        bytes += (int)(b->s->p - b->s->data);
+    }
+    return bytes;
+}
+
+/*****************************************************************************/
+static int
+interleaved_encode(struct bench *b)
+{
+    return for_each_tile(b, interleaved_tile);
+}
+
+#ifdef XRDP_JPEG
+/*****************************************************************************/
+static int
+jpeg_init(struct bench *b)
+{
+    b->handle = xrdp_jpeg_init();
+    b->out = g_new(char, OUT_BYTES);
+    return b->out == NULL;
+}
+
+/*****************************************************************************/
+static void
+jpeg_deinit(struct bench *b)
+{
+    xrdp_jpeg_deinit(b->handle);
+    g_free(b->out);
+}
+
+/*****************************************************************************/
+/* as process_enc_jpg, one image for each copy rect */
+static int
+jpeg_encode(struct bench *b)
+{
+    struct xrdp_frame_trace_frame *frame;
+    short *r;
+    int index;
+    int bytes;
+    int out_bytes;
+
+    frame = b->frame;
+    bytes = 0;
+    for (index = 0; index < frame->num_crects; index++)
+    {
+        r = frame->crects + index * 4;
+        out_bytes = MAX((r[2] + 4) * r[3] * 4, 8192);
+        if (out_bytes > OUT_BYTES)
+        {
+            return -1;
+        }
+        if (xrdp_codec_jpeg_compress(b->handle, 0, frame->data,
+                                     frame->width, frame->height,
+                                     frame->stride, r[0], r[1], r[2], r[3],
+                                     JPEG_QUALITY, b->out,
+                                     &out_bytes) < 0)
+        {
+            return -1;
+        }
+        bytes += out_bytes;
+    }
+    return bytes;
+}
+#endif
+
+#ifdef XRDP_RFXCODEC
+/* standard quality, as xrdp_encoder.c */
+static const char g_quants[] =
+{
+    0x66, 0x66, 0x77, 0x87, 0x98,
+    0x76, 0x77, 0x88, 0x98, 0x99
+};
+
+/*****************************************************************************/
+static int
+rfx_init_common(struct bench *b, int flags)
+{
+    struct xrdp_frame_trace_frame *frame;
+
+    frame = b->frame;
+    b->tiles_across = (frame->width + TILE - 1) / TILE;
+    b->tiles_down = (frame->height + TILE - 1) / TILE;
+    b->tile_map = g_new0(char, b->tiles_across * b->tiles_down);
+    b->tiles = g_new(short, b->tiles_across * b->tiles_down * 4);
+    b->out = g_new(char, OUT_BYTES);
+    b->handle = rfxcodec_encode_create(frame->width, frame->height,
+                                       RFX_FORMAT_BGRA, flags);
+    return b->tile_map == NULL || b->tiles == NULL || b->out == NULL ||
+           b->handle == NULL;
+}
+
+/*****************************************************************************/
+static int
+rfx_init(struct bench *b)
+{
+    return rfx_init_common(b, 0);
+}
+
+/*****************************************************************************/
+static int
+rfx_pro_init(struct bench *b)
+{
+    return rfx_init_common(b, RFX_FLAGS_RLGR1 | RFX_FLAGS_PRO1);
+}
+
+/*****************************************************************************/
+static void
+rfx_deinit(struct bench *b)
+{
+    if (b->handle != NULL)
+    {
+        rfxcodec_encode_destroy(b->handle);
+    }
+    g_free(b->tile_map);
+    g_free(b->tiles);
+    g_free(b->out);
+}
+
+/*****************************************************************************/
+/* xorgxrdp sends 64x64 tiles as the copy rects for RemoteFX, make the
+   tiles which cover the copy rects of other traces */
+static int
+rfx_prepare(struct bench *b)
+{
+    struct xrdp_frame_trace_frame *frame;
+    short *r;
+    int index;
+    int x;
+    int y;
+
+    frame = b->frame;
+    g_memset(b->tile_map, 0, b->tiles_across * b->tiles_down);
+    b->num_tiles = 0;
+    for (index = 0; index < frame->num_crects; index++)
+    {
+        r = frame->crects + index * 4;
+        for (y = r[1] / TILE; y <= (r[1] + r[3] - 1) / TILE; y++)
+        {
+            for (x = r[0] / TILE; x <= (r[0] + r[2] - 1) / TILE; x++)
+            {
+                if (!b->tile_map[y * b->tiles_across + x])
+                {
+                    b->tile_map[y * b->tiles_across + x] = 1;
+                    b->tiles[b->num_tiles * 4 + 0] = x * TILE;
+                    b->tiles[b->num_tiles * 4 + 1] = y * TILE;
+                    b->num_tiles++;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* fills in the tile and rect arrays the codec wants, returns the
+   count of tiles */
+static int
+rfx_tiles(struct bench *b, struct rfx_tile *tiles, struct rfx_rect *rects)
+{
+    struct xrdp_frame_trace_frame *frame;
+    int index;
+
+    frame = b->frame;
+    for (index = 0; index < b->num_tiles; index++)
+    {
+        tiles[index].x = b->tiles[index * 4 + 0];
+        tiles[index].y = b->tiles[index * 4 + 1];
+        tiles[index].cx = TILE;
+        tiles[index].cy = TILE;
+        tiles[index].quant_y = 0;
+        tiles[index].quant_cb = 1;
+        tiles[index].quant_cr = 1;
+    }
+    for (index = 0; index < frame->num_drects; index++)
+    {
+        rects[index].x = frame->drects[index * 4 + 0];
+        rects[index].y = frame->drects[index * 4 + 1];
+        rects[index].cx = frame->drects[index * 4 + 2];
+        rects[index].cy = frame->drects[index * 4 + 3];
+    }
+    return b->num_tiles;
+}
+
+/*****************************************************************************/
+/* as process_enc_rfx, passes until all tiles are written */
+static int
+rfx_encode(struct bench *b)
+{
+    struct xrdp_frame_trace_frame *frame;
+    struct rfx_tile *tiles;
+    struct rfx_rect *rects;
+    int num_tiles;
+    int written;
+    int rv;
+    int out_bytes;
+    int bytes;
+
+    frame = b->frame;
+    tiles = g_new(struct rfx_tile, b->num_tiles + 1);
+    rects = g_new(struct rfx_rect, frame->num_drects + 1);
+    if (tiles == NULL || rects == NULL)
+    {
+        g_free(tiles);
+        g_free(rects);
+        return -1;
+    }
+    num_tiles = rfx_tiles(b, tiles, rects);
+    bytes = 0;
+    written = 0;
+    while (written < num_tiles)
+    {
+        out_bytes = OUT_BYTES;
+        rv = rfxcodec_encode_ex(b->handle, b->out, &out_bytes, frame->data,
+                                frame->width, frame->height, frame->stride,
+                                rects, frame->num_drects,
+                                tiles + written, num_tiles - written,
+                                NULL, 0, 0);
+        if (rv < 1)
+        {
+            bytes = -1;
+            break;
+        }
+        written += rv;
+        bytes += out_bytes;
+    }
+    g_free(tiles);
+    g_free(rects);
+    return bytes;
+}
+
+/*****************************************************************************/
+/* as gfx_wiretosurface2 */
+static int
+rfx_pro_encode(struct bench *b)
+{
+    struct xrdp_frame_trace_frame *frame;
+    struct rfx_tile *tiles;
+    struct rfx_rect *rects;
+    int num_tiles;
+    int written;
+    int rv;
+    int out_bytes;
+    int bytes;
+
+    frame = b->frame;
+    tiles = g_new(struct rfx_tile, b->num_tiles + 1);
+    rects = g_new(struct rfx_rect, frame->num_drects + 1);
+    if (tiles == NULL || rects == NULL)
+    {
+        g_free(tiles);
+        g_free(rects);
+        return -1;
+    }
+    num_tiles = rfx_tiles(b, tiles, rects);
+    bytes = 0;
+    written = 0;
+    while (written < num_tiles)
+    {
+        out_bytes = OUT_BYTES;
+        rv = rfxcodec_encode(b->handle, b->out, &out_bytes, frame->data,
+                             frame->width, frame->height, frame->stride,
+                             rects, frame->num_drects,
+                             tiles + written, num_tiles - written,
+                             g_quants, 2);
+        if (rv < 1)
+        {
+            bytes = -1;
+            break;
+        }
+        written += rv;
+        bytes += out_bytes;
+    }
+    g_free(tiles);
+    g_free(rects);
+    return bytes;
+}
+#endif
+
+#ifdef XRDP_X264
+/*****************************************************************************/
+static int
+h264_init(struct bench *b)
+{
+    b->nv12_width = (b->frame->width + 1) & ~1;
+    b->nv12_height = (b->frame->height + 1) & ~1;
+    b->nv12 = g_new0(char, b->nv12_width * b->nv12_height * 3 / 2);
+    b->out = g_new(char, OUT_BYTES);
+    b->handle = xrdp_encoder_x264_create();
+    return b->nv12 == NULL || b->out == NULL || b->handle == NULL;
+}
+
+/*****************************************************************************/
+static void
+h264_deinit(struct bench *b)
+{
+    xrdp_encoder_x264_delete(b->handle);
+    g_free(b->nv12);
+    g_free(b->out);
+}
+
+/*****************************************************************************/
+/* xorgxrdp does the colour conversion for h264, do it here untimed,
+   BT.709 full range, on 2x2 blocks */
+static int
+h264_prepare(struct bench *b)
+{
+    struct xrdp_frame_trace_frame *frame;
+    unsigned char *yp;
+    unsigned char *uvp;
+    const unsigned int *src;
+    unsigned int pixel;
+    short *r;
+    int index;
+    int x;
+    int y;
+    int i;
+    int red;
+    int green;
+    int blue;
+    int u;
+    int v;
+
+    frame = b->frame;
+    for (index = 0; index < frame->num_crects; index++)
+    {
+        r = frame->crects + index * 4;
+        for (y = r[1] & ~1; y < r[1] + r[3]; y += 2)
+        {
+            for (x = r[0] & ~1; x < r[0] + r[2]; x += 2)
+            {
+                u = 0;
+                v = 0;
+                for (i = 0; i < 4; i++)
+                {
+                    src = (const unsigned int *)
+                          (frame->data + (y + i / 2) * frame->stride);
+                    pixel = src[x + i % 2];
+                    red = (pixel >> 16) & 0xff;
+                    green = (pixel >> 8) & 0xff;
+                    blue = pixel & 0xff;
+                    yp = (unsigned char *) b->nv12 +
+                         (y + i / 2) * b->nv12_width + x + i % 2;
+                    *yp = (54 * red + 183 * green + 19 * blue) >> 8;
+                    u += (-29 * red - 99 * green + 128 * blue) >> 8;
+                    v += (128 * red - 116 * green - 12 * blue) >> 8;
+                }
+                uvp = (unsigned char *) b->nv12 +
+                      b->nv12_width * b->nv12_height +
+                      (y / 2) * b->nv12_width + x;
+                uvp[0] = u / 4 + 128;
+                uvp[1] = v / 4 + 128;
+            }
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* as gfx_wiretosurface1 */
+static int
+h264_encode(struct bench *b)
+{
+    struct xrdp_frame_trace_frame *frame;
+    int out_bytes;
+
+    frame = b->frame;
+    if (frame->num_crects < 1)
+    {
+        return 0;
+    }
+    out_bytes = OUT_BYTES;
+    if (xrdp_encoder_x264_encode(b->handle, 0, 0, 0,
+                                 frame->width, frame->height,
+                                 b->nv12_width, b->nv12_height, 0,
+                                 b->nv12, frame->crects, frame->num_crects,
+                                 b->out, &out_bytes,
+                                 CONNECTION_TYPE_LAN, 0, NULL) != 0)
+    {
+        return -1;
+    }
+    return out_bytes;
+}
+#endif
+
+static const struct codec g_codecs[] =
+{
+    {
+        "planar", bench_bitmap_init, bench_no_prepare, planar_encode,
+        bench_bitmap_deinit
+    },
+    {
+        "rle", bench_bitmap_init, bench_no_prepare, interleaved_encode,
+        bench_bitmap_deinit
+    },
+#ifdef XRDP_JPEG
+    { "jpeg", jpeg_init, bench_no_prepare, jpeg_encode, jpeg_deinit },
+#endif
+#ifdef XRDP_RFXCODEC
+    { "rfx", rfx_init, rfx_prepare, rfx_encode, rfx_deinit },
+    { "rfxpro", rfx_pro_init, rfx_prepare, rfx_pro_encode, rfx_deinit },
+#endif
+#ifdef XRDP_X264
+    { "h264", h264_init, h264_prepare, h264_encode, h264_deinit },
+#endif
+};
+
+#define NUM_CODECS ((int) (sizeof(g_codecs) / sizeof(g_codecs[0])))
+
+/*****************************************************************************/
+static int
+compare_double(const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return (da > db) - (da < db);
+}
+
+/*****************************************************************************/
+static int
+run_codec(const struct codec *codec, const char *filename, int max_frames)
+{
+    struct xrdp_frame_trace *trace;
+    struct bench b;
+    double *times;
+    double start;
+    double total_ms;
+    long long pixels;
+    long long bytes;
+    long allocs;
+    long allocs_start;
+    int frames;
+    int index;
+    int rv;
+
+    trace = xrdp_frame_trace_open(filename);
+    if (trace == NULL)
+    {
+        return 1;
+    }
+    g_memset(&b, 0, sizeof(b));
+    times = g_new(double, max_frames);
+    if (times == NULL ||
+            xrdp_frame_trace_read(trace, &b.frame) != 0 || b.frame == NULL)
+    {
+        g_free(times);
+        xrdp_frame_trace_delete(trace);
+        return 1;
+    }
+    if (codec->init(&b) != 0)
+    {
+        printf("%-8s failed to start\n", codec->name);
+        codec->deinit(&b);
+        g_free(times);
+        xrdp_frame_trace_delete(trace);
+        return 1;
+    }
+    frames = 0;
+    pixels = 0;
+    bytes = 0;
+    allocs = 0;
+    total_ms = 0;
+    rv = 0;
+    while (b.frame != NULL && frames < max_frames)
+    {
+        codec->prepare(&b);
+        allocs_start = ALLOCS();
+        start = now_ms();
+        rv = codec->encode(&b);
+        times[frames] = now_ms() - start;
+        allocs += ALLOCS() - allocs_start;
+        if (rv < 0)
+        {
+            printf("%-8s error on frame %d\n", codec->name, frames);
+            break;
+        }
+        total_ms += times[frames];
+        bytes += rv;
+        for (index = 0; index < b.frame->num_crects; index++)
+        {
+            pixels += b.frame->crects[index * 4 + 2] *
+                      b.frame->crects[index * 4 + 3];
+        }
+        frames++;
+        if (xrdp_frame_trace_read(trace, &b.frame) != 0)
+        {
+            rv = -1;
+            break;
+        }
+    }
+    if (frames > 0)
+    {
+        qsort(times, frames, sizeof(double), compare_double);
+        printf("%-8s %7d %9.1f %12lld %8.2f %8.2f %8.1f\n", codec->name,
+               frames, pixels / (total_ms > 0 ? total_ms : 1) / 1000.0,
+               bytes / frames, times[(frames - 1) / 2],
+               times[(frames - 1) * 99 / 100], (double) allocs / frames);
+    }
+    codec->deinit(&b);
+    g_free(times);
+    xrdp_frame_trace_delete(trace);
+    return rv < 0;
+}
+
+/*****************************************************************************/
+static unsigned int g_seed = 1;
+
+static int
+syn_rand(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return (g_seed >> 16) & 0x7fff;
+}
+
+/*****************************************************************************/
+static void
+syn_fill(int *pixels, int x, int y, int cx, int cy, int colour)
+{
+    int i;
+    int j;
+
+    for (j = y; j < y + cy; j++)
+    {
+        for (i = x; i < x + cx; i++)
+        {
+            pixels[j * SYN_WIDTH + i] = colour;
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+syn_background(int *pixels, int x, int y, int cx, int cy)
+{
+    int i;
+    int j;
+
+    for (j = y; j < y + cy; j++)
+    {
+        for (i = x; i < x + cx; i++)
+        {
+            pixels[j * SYN_WIDTH + i] = 0xff204060 + ((j / 4) << 8) +
+                                        (i / 8);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* a line of text like marks on a terminal background */
+static void
+syn_text_line(int *pixels, int x, int y, int cx)
+{
+    int i;
+    int j;
+    int glyph;
+
+    syn_fill(pixels, x, y, cx, 16, 0xff101010);
+    for (i = x + 4; i + 8 < x + cx; i += 9)
+    {
+        glyph = syn_rand();
+        if ((glyph & 7) == 0)
+        {
+            continue; /* a space */
+        }
+        for (j = 0; j < 12; j++)
+        {
+            if ((glyph >> (j % 12)) & 1)
+            {
+                syn_fill(pixels, i + (j % 3) * 2, y + 2 + j, 4, 1, 0xffd0d0d0);
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+/* a desktop, a scrolling terminal, a dragged window and a video */
+static int
+make_synthetic_trace(const char *filename)
+{
+    struct xrdp_frame_trace *trace;
+    int *pixels;
+    short rects[6 * 4];
+    int num_rects;
+    int frame;
+    int i;
+    int j;
+    int wx;
+    int rv;
+
+    trace = xrdp_frame_trace_create(filename, SYN_WIDTH, SYN_HEIGHT,
+                                    CC_SIMPLE, XRDP_a8r8g8b8);
+    pixels = g_new(int, SYN_WIDTH * SYN_HEIGHT);
+    if (trace == NULL || pixels == NULL)
+    {
+        xrdp_frame_trace_delete(trace);
+        g_free(pixels);
+        return 1;
+    }
+    syn_background(pixels, 0, 0, SYN_WIDTH, SYN_HEIGHT);
+    for (j = 0; j < 400; j += 16)
+    {
+        syn_text_line(pixels, 32, 32 + j, 576);
+    }
+    rects[0] = 0;
+    rects[1] = 0;
+    rects[2] = SYN_WIDTH;
+    rects[3] = SYN_HEIGHT;
+    rv = xrdp_frame_trace_add_frame(trace, 0, 0, rects, 1, rects, 1,
+                                    (char *) pixels, SYN_WIDTH * 4);
+    for (frame = 1; frame < SYN_FRAMES && rv == 0; frame++)
+    {
+        num_rects = 0;
+
+        /* terminal scrolls a line */
+        memmove(pixels + 32 * SYN_WIDTH, pixels + 48 * SYN_WIDTH,
+                  384 * SYN_WIDTH * 4);
+        syn_background(pixels, 0, 32, 32, 384);
+        syn_background(pixels, 608, 32, SYN_WIDTH - 608, 384);
+        syn_text_line(pixels, 32, 416, 576);
+        rects[num_rects * 4 + 0] = 32;
+        rects[num_rects * 4 + 1] = 32;
+        rects[num_rects * 4 + 2] = 576;
+        rects[num_rects * 4 + 3] = 400;
+        num_rects++;
+
+        /* window dragged to the right, and back to the start */
+        wx = 640 + ((frame - 1) % 64) * 4;
+        syn_background(pixels, wx, 440, 4, 200);
+        syn_fill(pixels, wx + 4, 440, 300, 200, 0xff808080);
+        syn_fill(pixels, wx + 8, 464, 292, 172, 0xfff0f0f0);
+        rects[num_rects * 4 + 0] = wx;
+        rects[num_rects * 4 + 1] = 440;
+        rects[num_rects * 4 + 2] = 304;
+        rects[num_rects * 4 + 3] = 200;
+        num_rects++;
+
+        /* video, smooth gradients which move */
+        for (j = 0; j < 240; j++)
+        {
+            for (i = 0; i < 320; i++)
+            {
+                pixels[(64 + j) * SYN_WIDTH + 880 + i] =
+                    0xff000000 |
+                    (((i + frame * 3) & 0xff) << 16) |
+                    (((j + frame * 2) & 0xff) << 8) |
+                    (((i + j) / 2 + frame) & 0xff) |
+                    (syn_rand() & 0x070707);
+            }
+        }
+        rects[num_rects * 4 + 0] = 880;
+        rects[num_rects * 4 + 1] = 64;
+        rects[num_rects * 4 + 2] = 320;
+        rects[num_rects * 4 + 3] = 240;
+        num_rects++;
+
+        rv = xrdp_frame_trace_add_frame(trace, frame * SYN_FRAME_MS, frame,
+                                        rects, num_rects, rects, num_rects,
+                                        (char *) pixels, SYN_WIDTH * 4);
+    }
+    g_free(pixels);
+    xrdp_frame_trace_delete(trace);
+    return rv;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct log_config *lc;
+    const char *filename;
+    const char *codec_name;
+    char temp_name[256];
+    int max_frames;
+    int index;
+    int rv;
+
+    filename = NULL;
+    codec_name = NULL;
+    max_frames = 100000;
+    for (index = 1; index < argc; index++)
+    {
+        if (strcmp(argv[index], "-c") == 0 && index + 1 < argc)
+        {
+            codec_name = argv[++index];
+        }
+        else if (strcmp(argv[index], "-n") == 0 && index + 1 < argc)
+        {
+            max_frames = atoi(argv[++index]);
+        }
+        else if (strcmp(argv[index], "-g") == 0 && index + 1 < argc)
+        {
+            return make_synthetic_trace(argv[index + 1]);
+        }
+        else if (argv[index][0] != '-' && filename == NULL)
+        {
+            filename = argv[index];
+        }
+        else
+        {
+            printf("usage: %s [-c codec] [-n frames] [-g out.trace] "
+                   "[trace]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_frames < 1)
+    {
+        max_frames = 1;
+    }
+
+    lc = log_config_init_for_console(LOG_LEVEL_WARNING, NULL);
+    log_start_from_param(lc);
+    log_config_free(lc);
+
+    temp_name[0] = '\0';
+    if (filename == NULL)
+    {
+        g_snprintf(temp_name, sizeof(temp_name),
+                   "/tmp/bench_codecs_%d.trace", g_getpid());
+        if (make_synthetic_trace(temp_name) != 0)
+        {
+            printf("can't write %s\n", temp_name);
+            log_end();
+            return 1;
+        }
+        filename = temp_name;
+        printf("synthetic trace, %dx%d, %d frames\n",
+               SYN_WIDTH, SYN_HEIGHT, SYN_FRAMES);
+    }
+
+    printf("%-8s %7s %9s %12s %8s %8s %8s\n", "codec", "frames", "MP/s",
+           "bytes/frame", "p50 ms", "p99 ms", "allocs");
+    rv = 0;
+    for (index = 0; index < NUM_CODECS; index++)
+    {
+        if (codec_name == NULL || strcmp(codec_name, g_codecs[index].name) == 0)
+        {
+            rv |= run_codec(&g_codecs[index], filename, max_frames);
+        }
+    }
+
+    if (temp_name[0] != '\0')
+    {
+        g_file_delete(temp_name);
+    }
+    log_end();
+    return rv;
+}
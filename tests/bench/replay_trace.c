@@ -0,0 +1,632 @@
+/*
+ * replay a frame trace through xrdp_encoder
+ *
+ * The frames, or the egfx commands, of a trace made with frame_trace_dir
+ * in xrdp.ini are given to xrdp_encoder as server_paint_rects_ex() and
+ * server_egfx_cmd_ex() would, with no X server or client. Each frame is
+ * queued once the encoder has finished the one before, as the module
+ * would not reuse its shared memory sooner. Frames go either as fast as
+ * the encoder takes them, or at the times they were recorded (-r).
+ * Reports
+ *   frames        frames, or egfx command batches, replayed
+ *   MP/s          copy rect pixels per second of encoder time
+ *   bytes/frame   encoder output
+ *   p50, p99      time from queueing a frame to its last result
+ * and, from the session the trace came from,
+ *   input to frame  time from an input event to the next frame
+ *   frame to ack    time from a frame to the client acking it
+ *
+ * Frames are only traced from CC_SIMPLE captures, so are 32 bpp. The
+ * RemoteFX codec, which xorgxrdp would give YUVA tiles, is made to take
+ * them as they are. Egfx data is replayed as it was captured, so the
+ * codec must be the one the trace was made with.
+ *
+ * usage: replay_trace [-c codec] [-r] [-n frames] trace
+ *   -c codec     jpeg or rfx for frames, gfx-rfxpro or gfx-h264 for
+ *                egfx commands, jpeg is the default
+ *   -r           replay at the recorded times
+ *   -n frames    stop after this many frames
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "arch.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "log.h"
+#include "string_calls.h"
+#include "fifo.h"
+#include "thread_calls.h"
+#include "xrdp.h"
+#include "xrdp_mm.h"
+#include "xrdp_encoder.h"
+#include "xrdp_egfx.h"
+#include "libxrdp.h"
+#include "xrdp_frame_trace.h"
+
+#if defined(XRDP_RFXCODEC)
+#include "rfxcodec_encode.h"
+#endif
+
+#define RESULT_TIMEOUT_MS 5000
+#define FRAME_TIMES 1024 /* recorded frames remembered for acks */
+
+struct replay
+{
+    struct xrdp_frame_trace *trace;
+    struct xrdp_encoder *encoder;
+    int gfx;
+    int realtime;
+    double start_ms;
+    /* what xrdp_encoder looks at */
+    struct xrdp_mm mm;
+    struct xrdp_wm wm;
+    struct xrdp_client_info client_info;
+    struct xrdp_bitmap screen;
+    struct xrdp_session session;
+    struct xrdp_orders orders;
+    struct xrdp_egfx egfx;
+    struct xrdp_egfx_bulk bulk;
+    /* replay results */
+    double *times;
+    int frames;
+    long long pixels;
+    long long bytes;
+    double total_ms;
+    /* recorded results */
+    double *input_times;
+    int num_input_times;
+    double *ack_times;
+    int num_ack_times;
+    int input_pending;
+    unsigned int input_ms;
+    int frame_ids[FRAME_TIMES];
+    unsigned int frame_ms[FRAME_TIMES];
+    int frame_index;
+};
+
+/*****************************************************************************/
+/* xrdp_encoder.o and xrdp_egfx.o call these, they live with the session
+   loop in xrdp */
+tintptr
+g_get_term(void)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+int
+advance_resize_state_machine(struct xrdp_mm *mm,
+                             enum display_resize_state new_state)
+{
+    return 0;
+}
+
+/*****************************************************************************/
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*****************************************************************************/
+static int
+compare_double(const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return (da > db) - (da < db);
+}
+
+/*****************************************************************************/
+static int
+replay_init(struct replay *r, const char *codec)
+{
+    struct xrdp_client_info *ci;
+
+    ci = &r->client_info;
+    ci->bpp = 32;
+    ci->mcs_connection_type = CONNECTION_TYPE_LAN;
+    ci->max_unacknowledged_frame_count = 2;
+    ci->max_fastpath_frag_bytes = 16 * 1024 * 1024;
+    if (g_strcmp(codec, "jpeg") == 0)
+    {
+        ci->jpeg_codec_id = 1;
+        ci->jpeg_prop[0] = 75;
+    }
+    else if (g_strcmp(codec, "rfx") == 0)
+    {
+        ci->rfx_codec_id = 1;
+    }
+    else if (g_strcmp(codec, "gfx-rfxpro") == 0)
+    {
+        ci->gfx = 1;
+        r->mm.egfx_flags = XRDP_EGFX_RFX_PRO;
+    }
+    else if (g_strcmp(codec, "gfx-h264") == 0)
+    {
+        ci->gfx = 1;
+        r->mm.egfx_flags = XRDP_EGFX_H264;
+    }
+    else
+    {
+        printf("unknown codec %s\n", codec);
+        return 1;
+    }
+    r->gfx = ci->gfx;
+    r->screen.width = xrdp_frame_trace_get_width(r->trace);
+    r->screen.height = xrdp_frame_trace_get_height(r->trace);
+    r->orders.jpeg_han = xrdp_jpeg_init();
+    r->session.orders = &r->orders;
+    r->egfx.bulk = &r->bulk;
+    r->wm.client_info = ci;
+    r->wm.screen = &r->screen;
+    r->wm.session = &r->session;
+    r->mm.wm = &r->wm;
+    r->mm.egfx = &r->egfx;
+    r->encoder = xrdp_encoder_create(&r->mm);
+    if (r->encoder == NULL)
+    {
+        printf("codec %s is not available in this build\n", codec);
+        return 1;
+    }
+    if (r->gfx)
+    {
+        if (xrdp_frame_trace_get_capture_code(r->trace) !=
+                (int) ci->capture_code ||
+                xrdp_frame_trace_get_capture_format(r->trace) !=
+                ci->capture_format)
+        {
+            printf("the trace's egfx data is not in the format %s "
+                   "takes\n", codec);
+            return 1;
+        }
+        return 0;
+    }
+    if (xrdp_frame_trace_get_capture_code(r->trace) != CC_SIMPLE)
+    {
+        printf("the trace holds no frames\n");
+        return 1;
+    }
+#if defined(XRDP_RFXCODEC)
+    if (ci->capture_code == CC_SUF_RFX)
+    {
+        rfxcodec_encode_destroy(r->encoder->codec_handle_rfx);
+        r->encoder->codec_handle_rfx =
+            rfxcodec_encode_create(r->screen.width, r->screen.height,
+                                   RFX_FORMAT_BGRA, 0);
+        if (r->encoder->codec_handle_rfx == NULL)
+        {
+            return 1;
+        }
+        return 0;
+    }
+#endif
+    if (ci->capture_code != CC_SIMPLE)
+    {
+        printf("codec %s can't take 32 bpp frames\n", codec);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+replay_deinit(struct replay *r)
+{
+    xrdp_encoder_delete(r->encoder);
+    xrdp_jpeg_deinit(r->orders.jpeg_han);
+}
+
+/*****************************************************************************/
+static void
+free_enc(XRDP_ENC_DATA *enc)
+{
+    if (ENC_IS_BIT_SET(enc->flags, ENC_FLAGS_GFX_BIT))
+    {
+        g_free(enc->u.gfx.cmd);
+    }
+    else
+    {
+        g_free(enc->u.sc.drects);
+        g_free(enc->u.sc.crects);
+    }
+    g_free(enc);
+}
+
+/*****************************************************************************/
+/* queues enc and waits for its last result, returns the time taken or
+   a negative value on error */
+static double
+encode(struct replay *r, XRDP_ENC_DATA *enc)
+{
+    struct xrdp_encoder *encoder;
+    XRDP_ENC_DATA_DONE *enc_done;
+    tbus event;
+    double start;
+    int last;
+
+    encoder = r->encoder;
+    event = encoder->xrdp_encoder_event_processed;
+    start = now_ms();
+    tc_mutex_lock(encoder->mutex);
+    fifo_add_item(encoder->fifo_to_proc, enc);
+    tc_mutex_unlock(encoder->mutex);
+    g_set_wait_obj(encoder->xrdp_encoder_event_to_proc);
+    last = 0;
+    while (!last)
+    {
+        if (g_obj_wait(&event, 1, NULL, 0, RESULT_TIMEOUT_MS) != 0 ||
+                !g_is_wait_obj_set(event))
+        {
+            /* the encoder gave up on it, or it made nothing to send */
+            return -1;
+        }
+        g_reset_wait_obj(event);
+        for (;;)
+        {
+            tc_mutex_lock(encoder->mutex);
+            enc_done = (XRDP_ENC_DATA_DONE *)
+                       fifo_remove_item(encoder->fifo_processed);
+            tc_mutex_unlock(encoder->mutex);
+            if (enc_done == NULL)
+            {
+                break;
+            }
+            r->bytes += enc_done->comp_bytes;
+            if (enc_done->last)
+            {
+                free_enc(enc_done->enc);
+                last = 1;
+            }
+            g_free(enc_done->comp_pad_data);
+            g_free(enc_done);
+        }
+    }
+    return now_ms() - start;
+}
+
+/*****************************************************************************/
+static XRDP_ENC_DATA *
+make_frame_enc(struct xrdp_frame_trace_frame *frame)
+{
+    XRDP_ENC_DATA *enc;
+
+    enc = g_new0(XRDP_ENC_DATA, 1);
+    if (enc == NULL)
+    {
+        return NULL;
+    }
+    enc->u.sc.drects = g_new(short, frame->num_drects * 4 + 1);
+    enc->u.sc.crects = g_new(short, frame->num_crects * 4 + 1);
+    if (enc->u.sc.drects == NULL || enc->u.sc.crects == NULL)
+    {
+        free_enc(enc);
+        return NULL;
+    }
+    g_memcpy(enc->u.sc.drects, frame->drects,
+             frame->num_drects * 4 * sizeof(short));
+    g_memcpy(enc->u.sc.crects, frame->crects,
+             frame->num_crects * 4 * sizeof(short));
+    enc->u.sc.num_drects = frame->num_drects;
+    enc->u.sc.num_crects = frame->num_crects;
+    /* the trace's screen buffer is padded to 64 pixels, as from
+       xorgxrdp */
+    enc->u.sc.data = frame->data;
+    enc->u.sc.width = frame->stride / 4;
+    enc->u.sc.height = (frame->height + 63) & ~63;
+    enc->u.sc.frame_id = frame->frame_id;
+    return enc;
+}
+
+/*****************************************************************************/
+static XRDP_ENC_DATA *
+make_egfx_enc(struct xrdp_frame_trace_record *rec)
+{
+    XRDP_ENC_DATA *enc;
+
+    enc = g_new0(XRDP_ENC_DATA, 1);
+    if (enc == NULL)
+    {
+        return NULL;
+    }
+    ENC_SET_BIT(enc->flags, ENC_FLAGS_GFX_BIT);
+    enc->u.gfx.cmd = g_new(char, rec->cmd_bytes + 1);
+    if (enc->u.gfx.cmd == NULL)
+    {
+        g_free(enc);
+        return NULL;
+    }
+    g_memcpy(enc->u.gfx.cmd, rec->cmd, rec->cmd_bytes);
+    enc->u.gfx.cmd_bytes = rec->cmd_bytes;
+    enc->u.gfx.data = rec->data;
+    enc->u.gfx.data_bytes = rec->data_bytes;
+    return enc;
+}
+
+/*****************************************************************************/
+/* frame_id of the end frame command in an egfx record, or -1 */
+static int
+egfx_end_frame_id(struct xrdp_frame_trace_record *rec)
+{
+    struct stream s;
+    char *next;
+    int cmd_id;
+    int cmd_bytes;
+    int frame_id;
+
+    g_memset(&s, 0, sizeof(s));
+    s.data = rec->cmd;
+    s.p = s.data;
+    s.end = s.data + rec->cmd_bytes;
+    frame_id = -1;
+    while (s_check_rem(&s, 8))
+    {
+        next = s.p;
+        in_uint16_le(&s, cmd_id);
+        in_uint8s(&s, 2);
+        in_uint32_le(&s, cmd_bytes);
+        if (cmd_bytes < 8 || !s_check_rem(&s, cmd_bytes - 8))
+        {
+            break;
+        }
+        if (cmd_id == XR_RDPGFX_CMDID_ENDFRAME && cmd_bytes >= 12)
+        {
+            in_uint32_le(&s, frame_id);
+        }
+        s.p = next + cmd_bytes;
+    }
+    return frame_id;
+}
+
+/*****************************************************************************/
+/* notes the time of a recorded frame, for the recorded latencies */
+static void
+note_frame(struct replay *r, int frame_id, unsigned int time_ms)
+{
+    if (r->input_pending)
+    {
+        r->input_times[r->num_input_times++] = time_ms - r->input_ms;
+        r->input_pending = 0;
+    }
+    r->frame_ids[r->frame_index] = frame_id;
+    r->frame_ms[r->frame_index] = time_ms;
+    r->frame_index = (r->frame_index + 1) % FRAME_TIMES;
+}
+
+/*****************************************************************************/
+static void
+note_ack(struct replay *r, int frame_id, unsigned int time_ms)
+{
+    int index;
+
+    for (index = 0; index < FRAME_TIMES; index++)
+    {
+        if (r->frame_ids[index] == frame_id)
+        {
+            r->ack_times[r->num_ack_times++] =
+                time_ms - r->frame_ms[index];
+            r->frame_ids[index] = -1; /* only the first ack counts */
+            return;
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+wait_until(struct replay *r, unsigned int time_ms)
+{
+    double late;
+
+    if (r->realtime)
+    {
+        late = now_ms() - r->start_ms;
+        if (late < time_ms)
+        {
+            g_sleep((int) (time_ms - late));
+        }
+    }
+}
+
+/*****************************************************************************/
+/* replays one record, returns 1 when it was a replayed frame */
+static int
+replay_record(struct replay *r, struct xrdp_frame_trace_record *rec)
+{
+    XRDP_ENC_DATA *enc;
+    double took;
+    int index;
+    short *c;
+
+    enc = NULL;
+    switch (rec->type)
+    {
+        case XRDP_FRAME_TRACE_INPUT:
+            if (!r->input_pending)
+            {
+                r->input_pending = 1;
+                r->input_ms = rec->time_ms;
+            }
+            return 0;
+        case XRDP_FRAME_TRACE_ACK:
+            note_ack(r, rec->frame_id, rec->time_ms);
+            return 0;
+        case XRDP_FRAME_TRACE_FRAME:
+            note_frame(r, rec->frame->frame_id, rec->time_ms);
+            if (!r->gfx && rec->frame->num_crects > 0)
+            {
+                enc = make_frame_enc(rec->frame);
+                c = rec->frame->crects;
+                for (index = 0; index < rec->frame->num_crects; index++)
+                {
+                    r->pixels += c[index * 4 + 2] * c[index * 4 + 3];
+                }
+            }
+            break;
+        case XRDP_FRAME_TRACE_EGFX:
+            index = egfx_end_frame_id(rec);
+            if (index >= 0)
+            {
+                note_frame(r, index, rec->time_ms);
+            }
+            if (r->gfx)
+            {
+                enc = make_egfx_enc(rec);
+            }
+            break;
+    }
+    if (enc == NULL)
+    {
+        return 0;
+    }
+    wait_until(r, rec->time_ms);
+    took = encode(r, enc);
+    if (took < 0)
+    {
+        printf("no result for the record at %u ms\n", rec->time_ms);
+        return 0;
+    }
+    r->times[r->frames++] = took;
+    r->total_ms += took;
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+print_times(const char *name, double *times, int count)
+{
+    if (count > 0)
+    {
+        qsort(times, count, sizeof(double), compare_double);
+        printf("%-14s %7d %8.2f %8.2f\n", name, count,
+               times[(count - 1) / 2], times[(count - 1) * 99 / 100]);
+    }
+}
+
+/*****************************************************************************/
+static void
+usage(void)
+{
+    printf("usage: replay_trace [-c codec] [-r] [-n frames] trace\n");
+    printf("  -c codec     jpeg or rfx for frames, gfx-rfxpro or gfx-h264 "
+           "for\n");
+    printf("               egfx commands, jpeg is the default\n");
+    printf("  -r           replay at the recorded times\n");
+    printf("  -n frames    stop after this many frames\n");
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct log_config *lc;
+    struct replay r;
+    struct xrdp_frame_trace_record *rec;
+    const char *codec;
+    const char *filename;
+    int max_frames;
+    int index;
+    int rv;
+
+    g_init("replay_trace");
+    g_memset(&r, 0, sizeof(r));
+    for (index = 0; index < FRAME_TIMES; index++)
+    {
+        r.frame_ids[index] = -1;
+    }
+    codec = "jpeg";
+    filename = NULL;
+    max_frames = 1000000;
+    for (index = 1; index < argc; index++)
+    {
+        if (g_strcmp(argv[index], "-c") == 0 && index + 1 < argc)
+        {
+            codec = argv[++index];
+        }
+        else if (g_strcmp(argv[index], "-n") == 0 && index + 1 < argc)
+        {
+            max_frames = g_atoi(argv[++index]);
+        }
+        else if (g_strcmp(argv[index], "-r") == 0)
+        {
+            r.realtime = 1;
+        }
+        else if (argv[index][0] != '-' && filename == NULL)
+        {
+            filename = argv[index];
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (filename == NULL || max_frames < 1)
+    {
+        usage();
+        return 1;
+    }
+    lc = log_config_init_for_console(LOG_LEVEL_WARNING, NULL);
+    log_start_from_param(lc);
+    log_config_free(lc);
+
+    rv = 1;
+    r.trace = xrdp_frame_trace_open(filename);
+    r.times = g_new(double, max_frames);
+    r.input_times = g_new(double, max_frames);
+    r.ack_times = g_new(double, max_frames);
+    if (r.trace != NULL && r.times != NULL && r.input_times != NULL &&
+            r.ack_times != NULL && replay_init(&r, codec) == 0)
+    {
+        rv = 0;
+        r.start_ms = now_ms();
+        while (r.frames < max_frames && r.num_input_times < max_frames &&
+                r.num_ack_times < max_frames)
+        {
+            if (xrdp_frame_trace_read_record(r.trace, &rec) != 0)
+            {
+                rv = 1;
+                break;
+            }
+            if (rec == NULL)
+            {
+                break;
+            }
+            replay_record(&r, rec);
+        }
+        printf("%-8s %7s %9s %12s %8s %8s\n", "codec", "frames", "MP/s",
+               "bytes/frame", "p50 ms", "p99 ms");
+        if (r.frames > 0)
+        {
+            qsort(r.times, r.frames, sizeof(double), compare_double);
+            printf("%-8s %7d %9.1f %12lld %8.2f %8.2f\n", codec, r.frames,
+                   r.pixels / (r.total_ms > 0 ? r.total_ms : 1) / 1000.0,
+                   r.bytes / r.frames, r.times[(r.frames - 1) / 2],
+                   r.times[(r.frames - 1) * 99 / 100]);
+        }
+        printf("\nrecorded       %7s %8s %8s\n", "count", "p50 ms", "p99 ms");
+        print_times("input to frame", r.input_times, r.num_input_times);
+        print_times("frame to ack", r.ack_times, r.num_ack_times);
+    }
+    if (r.encoder != NULL)
+    {
+        replay_deinit(&r);
+    }
+    xrdp_frame_trace_delete(r.trace);
+    g_free(r.times);
+    g_free(r.input_times);
+    g_free(r.ack_times);
+    log_end();
+    g_deinit();
+    return rv;
+}
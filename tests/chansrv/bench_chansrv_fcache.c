@@ -0,0 +1,254 @@
+/*
+ * redirected drive throughput with and without the file cache
+ *
+ * The cache is driven by an application which waits for each read or
+ * write to be answered before sending the next, as cp(1) does. The
+ * client is simulated on a link with a fixed round trip time and
+ * bandwidth, on a virtual clock, so the run is quick and repeatable.
+ *
+ * usage: bench_chansrv_fcache [rtt ms] [link Mbit/s]
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arch.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "chansrv_fcache.h"
+
+#define FILE_SIZE (64 * 1024 * 1024)
+#define APP_READ (128 * 1024)
+#define APP_WRITE 4096
+#define MAX_EVENTS 1024
+
+/* an IRP the simulated client answers at 'when' */
+struct event
+{
+    double when;
+    int is_write;
+    void *tag;
+    tui64 offset;
+    tui32 length;
+};
+
+static struct event events[MAX_EVENTS];
+static int num_events;
+static double now;
+static double link_free;  /* when the link has sent all it has queued */
+static double rtt;
+static double bytes_per_sec;
+static long irps;
+static int replied;
+static char data[FILE_SIZE];
+static struct fcache *cache;
+static int req; /* stands in for a FUSE request */
+
+/*****************************************************************************/
+/* requests are small, the data rides the link one way or the other */
+static void
+add_event(int is_write, void *tag, tui64 offset, tui32 length)
+{
+    struct event *e;
+    double start;
+
+    if (num_events == MAX_EVENTS)
+    {
+        fprintf(stderr, "too many IRPs in flight\n");
+        exit(1);
+    }
+    start = MAX(now + rtt, link_free);
+    link_free = start + length / bytes_per_sec;
+    e = &events[num_events++];
+    e->when = link_free;
+    e->is_write = is_write;
+    e->tag = tag;
+    e->offset = offset;
+    e->length = length;
+    irps++;
+}
+
+/*****************************************************************************/
+/* completes the IRP due first */
+static void
+run_event(void)
+{
+    struct event e;
+    int index;
+    int first;
+    tui32 length;
+
+    first = 0;
+    for (index = 1; index < num_events; index++)
+    {
+        if (events[index].when < events[first].when)
+        {
+            first = index;
+        }
+    }
+    e = events[first];
+    events[first] = events[--num_events];
+    now = MAX(now, e.when);
+    if (e.is_write)
+    {
+        fcache_write_done(cache, e.tag, 0, e.offset, e.length);
+    }
+    else
+    {
+        length = 0;
+        if (e.offset < FILE_SIZE)
+        {
+            length = (tui32)MIN(e.length, FILE_SIZE - e.offset);
+        }
+        fcache_read_done(cache, e.tag, 0, data + e.offset, length);
+    }
+}
+
+/*****************************************************************************/
+static int
+sim_start_read(void *arg, struct fcache *cache, void *tag,
+               tui64 offset, tui32 length)
+{
+    add_event(0, tag, offset, length);
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+sim_start_write(void *arg, struct fcache *cache, void *req,
+                const char *buf, tui32 length, tui64 offset)
+{
+    add_event(1, req, offset, length);
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+sim_read_reply(void *arg, void *req, int error, const char *buf,
+               tui32 length)
+{
+    replied = 1;
+}
+
+/*****************************************************************************/
+static void
+sim_write_reply(void *arg, void *req, int error, tui64 offset, tui32 length)
+{
+    replied = 1;
+}
+
+/*****************************************************************************/
+static void
+sim_flushed(void *arg, int error)
+{
+    replied = 1;
+}
+
+static const struct fcache_ops sim_ops =
+{
+    sim_start_read,
+    sim_start_write,
+    sim_read_reply,
+    sim_write_reply
+};
+
+/*****************************************************************************/
+static void
+wait_reply(void)
+{
+    while (!replied)
+    {
+        run_event();
+    }
+    replied = 0;
+}
+
+/*****************************************************************************/
+static void
+report(const char *what, const char *how)
+{
+    printf("%-6s %-9s %8.2f s %8.2f MB/s %7ld IRPs\n", what, how, now,
+           FILE_SIZE / now / (1024 * 1024), irps);
+}
+
+/*****************************************************************************/
+static void
+reset(const struct fcache_params *params)
+{
+    num_events = 0;
+    now = 0;
+    link_free = 0;
+    irps = 0;
+    replied = 0;
+    cache = fcache_create(params, &sim_ops, NULL);
+}
+
+/*****************************************************************************/
+static void
+bench_read(const struct fcache_params *params, const char *how)
+{
+    tui64 offset;
+
+    reset(params);
+    for (offset = 0; offset < FILE_SIZE; offset += APP_READ)
+    {
+        fcache_read(cache, NULL, offset, APP_READ);
+        wait_reply();
+    }
+    report("read", how);
+    fcache_delete(cache);
+    while (num_events > 0)
+    {
+        run_event();
+    }
+}
+
+/*****************************************************************************/
+static void
+bench_write(const struct fcache_params *params, const char *how)
+{
+    tui64 offset;
+
+    reset(params);
+    for (offset = 0; offset < FILE_SIZE; offset += APP_WRITE)
+    {
+        fcache_write(cache, &req, data + offset, APP_WRITE, offset);
+        wait_reply();
+    }
+    fcache_flush(cache, sim_flushed, NULL);
+    wait_reply();
+    report("write", how);
+    fcache_delete(cache);
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct fcache_params off;
+    struct fcache_params on;
+    double mbits;
+
+    rtt = ((argc > 1) ? atof(argv[1]) : 50.0) / 1000.0;
+    mbits = (argc > 2) ? atof(argv[2]) : 100.0;
+    bytes_per_sec = mbits * 1000000.0 / 8.0;
+    printf("%.0f ms round trip, %.0f Mbit/s, %d MB file\n",
+           rtt * 1000.0, mbits, FILE_SIZE / (1024 * 1024));
+
+    /* no cache, each application request is one IRP */
+    fcache_params_default(&off);
+    off.read_piece = APP_READ;
+    off.read_ahead_max = 0;
+    off.write_buffer = 0;
+    fcache_params_default(&on);
+
+    bench_read(&off, "no cache");
+    bench_read(&on, "cache");
+    bench_write(&off, "no cache");
+    bench_write(&on, "cache");
+    return 0;
+}
@@ -0,0 +1,576 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <errno.h>
+
+#include "arch.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "chansrv_fcache.h"
+
+#include "test_chansrv.h"
+
+#define FILE_SIZE (256 * 1024)
+#define MAX_IRPS 64
+
+/* a fake client, reads and writes wait in here until a test
+   completes them */
+struct irp
+{
+    void *tag;
+    tui64 offset;
+    tui32 length;
+};
+
+static char file_data[FILE_SIZE];
+static int file_size;
+static struct irp reads[MAX_IRPS];
+static int num_reads;
+static int total_reads;
+static struct irp writes[MAX_IRPS];
+static int num_writes;
+static int fail_irps;
+
+/* replies to the application */
+static char read_buf[FILE_SIZE];
+static int read_replies;
+static int read_error;
+static int read_length;
+static int write_replies;
+static int write_error;
+static int flushes;
+static int flush_error;
+
+static struct fcache *cache;
+static int req; /* stands in for a FUSE request */
+
+/******************************************************************************/
+static int
+fake_start_read(void *data, struct fcache *cache, void *tag,
+                tui64 offset, tui32 length)
+{
+    ck_assert_int_lt(num_reads, MAX_IRPS);
+    reads[num_reads].tag = tag;
+    reads[num_reads].offset = offset;
+    reads[num_reads].length = length;
+    num_reads++;
+    total_reads++;
+    return 0;
+}
+
+/******************************************************************************/
+static int
+fake_start_write(void *data, struct fcache *cache, void *req,
+                 const char *buf, tui32 length, tui64 offset)
+{
+    ck_assert_int_lt(num_writes, MAX_IRPS);
+    ck_assert_int_le(offset + length, FILE_SIZE);
+    if (!fail_irps)
+    {
+        g_memcpy(file_data + offset, buf, length);
+        if ((int)(offset + length) > file_size)
+        {
+            file_size = (int)(offset + length);
+        }
+    }
+    writes[num_writes].tag = req;
+    writes[num_writes].offset = offset;
+    writes[num_writes].length = length;
+    num_writes++;
+    return 0;
+}
+
+/******************************************************************************/
+static void
+fake_read_reply(void *data, void *req, int error,
+                const char *buf, tui32 length)
+{
+    read_replies++;
+    read_error = error;
+    read_length = length;
+    if (length > 0)
+    {
+        g_memcpy(read_buf, buf, length);
+    }
+}
+
+/******************************************************************************/
+static void
+fake_write_reply(void *data, void *req, int error,
+                 tui64 offset, tui32 length)
+{
+    write_replies++;
+    write_error = error;
+}
+
+/******************************************************************************/
+static void
+flush_done(void *arg, int error)
+{
+    flushes++;
+    flush_error = error;
+}
+
+static const struct fcache_ops fake_ops =
+{
+    fake_start_read,
+    fake_start_write,
+    fake_read_reply,
+    fake_write_reply
+};
+
+/******************************************************************************/
+/* completes the oldest read IRP, returns 0 if there were none */
+static int
+complete_read(void)
+{
+    struct irp irp;
+    int length;
+
+    if (num_reads == 0)
+    {
+        return 0;
+    }
+    irp = reads[0];
+    num_reads--;
+    g_memmove(reads, reads + 1, num_reads * sizeof(reads[0]));
+    length = 0;
+    if ((int)irp.offset < file_size)
+    {
+        length = MIN((int)irp.length, file_size - (int)irp.offset);
+    }
+    fcache_read_done(cache, irp.tag, fail_irps, file_data + irp.offset,
+                     fail_irps ? 0 : length);
+    return 1;
+}
+
+/******************************************************************************/
+static void
+complete_reads(void)
+{
+    while (complete_read())
+    {
+    }
+}
+
+/******************************************************************************/
+static void
+complete_writes(void)
+{
+    struct irp irp;
+
+    while (num_writes > 0)
+    {
+        irp = writes[0];
+        num_writes--;
+        g_memmove(writes, writes + 1, num_writes * sizeof(writes[0]));
+        fcache_write_done(cache, irp.tag, fail_irps, irp.offset, irp.length);
+    }
+}
+
+/******************************************************************************/
+static void
+make_cache(tui32 read_ahead_max, tui32 write_buffer)
+{
+    struct fcache_params params;
+
+    fcache_params_default(&params);
+    params.read_piece = 4096;
+    params.read_ahead_max = read_ahead_max;
+    params.max_reads = 4;
+    params.write_buffer = write_buffer;
+    cache = fcache_create(&params, &fake_ops, NULL);
+    ck_assert_ptr_ne(cache, NULL);
+}
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    int index;
+
+    for (index = 0; index < FILE_SIZE; index++)
+    {
+        file_data[index] = (char)(index * 7 + index / 251);
+    }
+    file_size = FILE_SIZE;
+    num_reads = 0;
+    total_reads = 0;
+    num_writes = 0;
+    fail_irps = 0;
+    read_replies = 0;
+    read_error = 0;
+    read_length = 0;
+    write_replies = 0;
+    write_error = 0;
+    flushes = 0;
+    flush_error = 0;
+    cache = NULL;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    fcache_delete(cache);
+}
+
+/******************************************************************************/
+START_TEST(test_fcache__read_ahead_grows)
+{
+    int offset;
+    int max_in_flight;
+
+    make_cache(64 * 1024, 0);
+
+    /* the first read only fetches itself and one piece ahead */
+    fcache_read(cache, NULL, 0, 4096);
+    ck_assert_int_eq(num_reads, 2);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 1);
+    ck_assert_int_eq(read_length, 4096);
+    ck_assert_mem_eq(read_buf, file_data, 4096);
+
+    /* several reads go out at once as the window grows, and the whole
+       file still comes back right */
+    max_in_flight = 0;
+    for (offset = 4096; offset < FILE_SIZE; offset += 4096)
+    {
+        fcache_read(cache, NULL, offset, 4096);
+        max_in_flight = MAX(max_in_flight, num_reads);
+        complete_read();
+        complete_read();
+        complete_reads();
+        ck_assert_int_eq(read_replies, offset / 4096 + 1);
+        ck_assert_int_eq(read_error, 0);
+        ck_assert_int_eq(read_length, 4096);
+        ck_assert_mem_eq(read_buf, file_data + offset, 4096);
+    }
+    ck_assert_int_eq(max_in_flight, 4);
+    /* plus one to find the end of the file */
+    ck_assert_int_eq(total_reads, FILE_SIZE / 4096 + 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__read_ahead_answers_from_cache)
+{
+    make_cache(64 * 1024, 0);
+
+    fcache_read(cache, NULL, 0, 4096);
+    fcache_read(cache, NULL, 4096, 4096);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 2);
+
+    /* the next piece is already here */
+    fcache_read(cache, NULL, 8192, 4096);
+    ck_assert_int_eq(read_replies, 3);
+    ck_assert_mem_eq(read_buf, file_data + 8192, 4096);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__random_reads_no_read_ahead)
+{
+    make_cache(64 * 1024, 0);
+
+    fcache_read(cache, NULL, 100000, 1000);
+    fcache_read(cache, NULL, 20000, 1000);
+    fcache_read(cache, NULL, 60000, 1000);
+    ck_assert_int_eq(num_reads, 3);
+    ck_assert_int_eq(reads[1].offset, 20000);
+    ck_assert_int_eq(reads[1].length, 1000);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 3);
+    ck_assert_mem_eq(read_buf, file_data + 60000, 1000);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__big_read_spans_pieces)
+{
+    make_cache(0, 0);
+
+    fcache_read(cache, NULL, 1000, 10000);
+    ck_assert_int_eq(num_reads, 3);
+    complete_read();
+    complete_read();
+    ck_assert_int_eq(read_replies, 0);
+    complete_read();
+    ck_assert_int_eq(read_replies, 1);
+    ck_assert_int_eq(read_length, 10000);
+    ck_assert_mem_eq(read_buf, file_data + 1000, 10000);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__end_of_file)
+{
+    file_size = 10000;
+    make_cache(64 * 1024, 0);
+
+    fcache_read(cache, NULL, 8192, 4096);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 1);
+    ck_assert_int_eq(read_length, 10000 - 8192);
+    ck_assert_mem_eq(read_buf, file_data + 8192, 10000 - 8192);
+
+    /* past the end is answered without asking the client */
+    fcache_read(cache, NULL, 20000, 4096);
+    ck_assert_int_eq(read_replies, 2);
+    ck_assert_int_eq(read_length, 0);
+    ck_assert_int_eq(num_reads, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__read_error)
+{
+    make_cache(64 * 1024, 0);
+
+    fail_irps = 1;
+    fcache_read(cache, NULL, 0, 4096);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 1);
+    ck_assert_int_eq(read_error, EIO);
+
+    /* the failure isn't cached */
+    fail_irps = 0;
+    fcache_read(cache, NULL, 0, 4096);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 2);
+    ck_assert_int_eq(read_error, 0);
+    ck_assert_mem_eq(read_buf, file_data, 4096);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__write_behind_coalesces)
+{
+    char buf[1024];
+    int index;
+
+    make_cache(0, 16 * 1024);
+
+    g_memset(buf, 'x', sizeof(buf));
+    for (index = 0; index < 10; index++)
+    {
+        fcache_write(cache, &req, buf, sizeof(buf), index * sizeof(buf));
+    }
+    ck_assert_int_eq(write_replies, 10);
+    ck_assert_int_eq(num_writes, 0);
+
+    fcache_flush(cache, flush_done, NULL);
+    ck_assert_int_eq(num_writes, 1);
+    ck_assert_int_eq(writes[0].offset, 0);
+    ck_assert_int_eq(writes[0].length, 10 * sizeof(buf));
+    ck_assert_int_eq(flushes, 0);
+    complete_writes();
+    ck_assert_int_eq(flushes, 1);
+    ck_assert_int_eq(flush_error, 0);
+    ck_assert_int_eq(file_data[10 * sizeof(buf) - 1], 'x');
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__write_behind_splits)
+{
+    char buf[1024];
+
+    make_cache(0, 4096);
+
+    g_memset(buf, 'y', sizeof(buf));
+    /* a gap, then a full buffer, are each sent on */
+    fcache_write(cache, &req, buf, sizeof(buf), 0);
+    fcache_write(cache, &req, buf, sizeof(buf), 5000);
+    ck_assert_int_eq(num_writes, 1);
+    fcache_write(cache, &req, buf, sizeof(buf), 6024);
+    fcache_write(cache, &req, buf, sizeof(buf), 7048);
+    fcache_write(cache, &req, buf, sizeof(buf), 8072);
+    ck_assert_int_eq(num_writes, 2);
+    ck_assert_int_eq(writes[1].offset, 5000);
+    ck_assert_int_eq(writes[1].length, 4096);
+
+    /* too big to buffer, so answered by the client */
+    fcache_write(cache, &req, file_data, 8192, 16384);
+    ck_assert_int_eq(num_writes, 3);
+    ck_assert_int_eq(write_replies, 5);
+    complete_writes();
+    ck_assert_int_eq(write_replies, 6);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__write_error_reported)
+{
+    char buf[1024];
+
+    make_cache(0, 16 * 1024);
+
+    g_memset(buf, 'z', sizeof(buf));
+    fail_irps = 1;
+    fcache_write(cache, &req, buf, sizeof(buf), 0);
+    ck_assert_int_eq(write_error, 0);
+    fcache_flush(cache, flush_done, NULL);
+    complete_writes();
+    ck_assert_int_eq(flushes, 1);
+    ck_assert_int_eq(flush_error, EIO);
+
+    /* reported once only */
+    fcache_flush(cache, flush_done, NULL);
+    ck_assert_int_eq(flushes, 2);
+    ck_assert_int_eq(flush_error, 0);
+
+    /* a later write gets the error if there's no flush */
+    fcache_write(cache, &req, buf, sizeof(buf), 0);
+    fcache_write(cache, &req, buf, sizeof(buf), 5000);
+    complete_writes();
+    fcache_write(cache, &req, buf, sizeof(buf), 10000);
+    ck_assert_int_eq(write_error, EIO);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__read_sees_write)
+{
+    char buf[100];
+
+    make_cache(64 * 1024, 16 * 1024);
+
+    fcache_read(cache, NULL, 0, 4096);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 1);
+
+    g_memset(buf, 'w', sizeof(buf));
+    fcache_write(cache, &req, buf, sizeof(buf), 1000);
+
+    /* the buffer goes first, and the read waits for it */
+    fcache_read(cache, NULL, 0, 4096);
+    ck_assert_int_eq(num_writes, 1);
+    ck_assert_int_eq(num_reads, 0);
+    complete_writes();
+    ck_assert_int_gt(num_reads, 0);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 2);
+    ck_assert_int_eq(read_buf[1000], 'w');
+    ck_assert_mem_eq(read_buf, file_data, 4096);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__stale_read_dropped)
+{
+    char buf[100];
+
+    make_cache(64 * 1024, 0);
+
+    fcache_read(cache, NULL, 0, 4096);
+    ck_assert_int_gt(num_reads, 0);
+
+    /* the write overtakes the read in flight */
+    g_memset(buf, 's', sizeof(buf));
+    fcache_write(cache, &req, buf, sizeof(buf), 0);
+    complete_writes();
+    complete_reads();
+    ck_assert_int_eq(read_replies, 1);
+    ck_assert_int_eq(read_buf[0], 's');
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__stale_read_buffered_write)
+{
+    char buf[100];
+
+    make_cache(64 * 1024, 16 * 1024);
+
+    fcache_read(cache, NULL, 0, 4096);
+    ck_assert_int_gt(num_reads, 0);
+
+    /* a buffered write sends no IRP of its own, so the waiting read
+       must not be left behind */
+    g_memset(buf, 'b', sizeof(buf));
+    fcache_write(cache, &req, buf, sizeof(buf), 0);
+    ck_assert_int_eq(write_replies, 1);
+    ck_assert_int_eq(num_writes, 1);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 0);
+    complete_writes();
+    complete_reads();
+    ck_assert_int_eq(read_replies, 1);
+    ck_assert_int_eq(read_length, 4096);
+    ck_assert_int_eq(read_buf[0], 'b');
+    ck_assert_mem_eq(read_buf + 100, file_data + 100, 4096 - 100);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__invalidate)
+{
+    int reads_before;
+
+    make_cache(64 * 1024, 0);
+
+    fcache_read(cache, NULL, 0, 4096);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 1);
+
+    /* the file is truncated other than through the cache */
+    file_size = 1000;
+    fcache_invalidate(cache);
+    reads_before = total_reads;
+    fcache_read(cache, NULL, 0, 4096);
+    ck_assert_int_gt(total_reads, reads_before);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 2);
+    ck_assert_int_eq(read_length, 1000);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fcache__delete_in_flight)
+{
+    make_cache(64 * 1024, 0);
+
+    fcache_read(cache, NULL, 0, 4096);
+    fcache_delete(cache);
+    complete_reads();
+    ck_assert_int_eq(read_replies, 0);
+    cache = NULL;
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_chansrv_fcache(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("ChansrvFcache");
+
+    tc = tcase_create("read");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_fcache__read_ahead_grows);
+    tcase_add_test(tc, test_fcache__read_ahead_answers_from_cache);
+    tcase_add_test(tc, test_fcache__random_reads_no_read_ahead);
+    tcase_add_test(tc, test_fcache__big_read_spans_pieces);
+    tcase_add_test(tc, test_fcache__end_of_file);
+    tcase_add_test(tc, test_fcache__read_error);
+
+    tc = tcase_create("write");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_fcache__write_behind_coalesces);
+    tcase_add_test(tc, test_fcache__write_behind_splits);
+    tcase_add_test(tc, test_fcache__write_error_reported);
+    tcase_add_test(tc, test_fcache__read_sees_write);
+    tcase_add_test(tc, test_fcache__stale_read_dropped);
+    tcase_add_test(tc, test_fcache__stale_read_buffered_write);
+    tcase_add_test(tc, test_fcache__invalidate);
+    tcase_add_test(tc, test_fcache__delete_in_flight);
+
+    return s;
+}
@@ -0,0 +1,209 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "arch.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "irp.h"
+
+#include "test_chansrv.h"
+
+#define MANY_IRPS 5000
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    IRP *irp;
+
+    while ((irp = devredir_irp_get_last()) != NULL)
+    {
+        devredir_irp_delete(irp);
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_irp__find_by_completion_id)
+{
+    static IRP *irps[MANY_IRPS];
+    int i;
+
+    for (i = 0; i < MANY_IRPS; i++)
+    {
+        irps[i] = devredir_irp_new();
+        ck_assert_ptr_ne(irps[i], NULL);
+        devredir_irp_set_completion_id(irps[i], i * 7 + 1);
+    }
+
+    for (i = MANY_IRPS - 1; i >= 0; i--)
+    {
+        ck_assert_ptr_eq(devredir_irp_find(i * 7 + 1), irps[i]);
+    }
+    ck_assert_ptr_eq(devredir_irp_find(0), NULL);
+    ck_assert_ptr_eq(devredir_irp_get_last(), irps[MANY_IRPS - 1]);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_irp__find_by_file_id)
+{
+    static IRP *irps[MANY_IRPS];
+    int i;
+
+    for (i = 0; i < MANY_IRPS; i++)
+    {
+        irps[i] = devredir_irp_new();
+        devredir_irp_set_completion_id(irps[i], i);
+        devredir_irp_set_file_id(irps[i], 0x10000 + i);
+    }
+
+    for (i = 0; i < MANY_IRPS; i++)
+    {
+        ck_assert_ptr_eq(devredir_irp_find_by_fileid(0x10000 + i), irps[i]);
+    }
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(0x10000 + MANY_IRPS), NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_irp__file_id_oldest_first)
+{
+    IRP *open_irp;
+    IRP *read_irp;
+
+    /* The IRP from the open and a later one for the same file share a
+     * FileId. The open one is found first, as with a list walk */
+    open_irp = devredir_irp_new();
+    devredir_irp_set_completion_id(open_irp, 1);
+    devredir_irp_set_file_id(open_irp, 99);
+    read_irp = devredir_irp_new();
+    devredir_irp_set_completion_id(read_irp, 2);
+    devredir_irp_set_file_id(read_irp, 99);
+
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(99), open_irp);
+    devredir_irp_delete(open_irp);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(99), read_irp);
+    ck_assert_ptr_eq(devredir_irp_find(1), NULL);
+    ck_assert_ptr_eq(devredir_irp_find(2), read_irp);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_irp__file_id_set_late)
+{
+    IRP *open_irp;
+    IRP *read_irp;
+    IRP *write_irp;
+    IRP *irp;
+    int i;
+
+    /* enough other IRPs that the lookup tables are in use */
+    for (i = 0; i < 100; i++)
+    {
+        irp = devredir_irp_new();
+        devredir_irp_set_completion_id(irp, 1000 + i);
+        devredir_irp_set_file_id(irp, 1000 + i);
+    }
+
+    /* The open IRP gets its FileId from the create response, after
+     * lookups have already seen it with a FileId of 0 */
+    open_irp = devredir_irp_new();
+    devredir_irp_set_completion_id(open_irp, 1);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(99), NULL);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(0), open_irp);
+    devredir_irp_set_file_id(open_irp, 99);
+
+    read_irp = devredir_irp_new();
+    devredir_irp_set_file_id(read_irp, 99);
+    devredir_irp_set_completion_id(read_irp, 2);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(99), open_irp);
+    write_irp = devredir_irp_new();
+    devredir_irp_set_file_id(write_irp, 99);
+    devredir_irp_set_completion_id(write_irp, 3);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(99), open_irp);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(0), NULL);
+
+    devredir_irp_delete(read_irp);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(99), open_irp);
+    devredir_irp_delete(open_irp);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(99), write_irp);
+    ck_assert_ptr_eq(devredir_irp_find(3), write_irp);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_irp__ids_changed)
+{
+    IRP *irp;
+
+    irp = devredir_irp_with_pathname_new("\\dir\\file");
+    ck_assert_str_eq(irp->pathname, "\\dir\\file");
+    devredir_irp_set_completion_id(irp, 10);
+    ck_assert_ptr_eq(devredir_irp_find(10), irp);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(0), irp);
+
+    /* The FileId arrives with the create response */
+    devredir_irp_set_file_id(irp, 1234);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(0), NULL);
+    ck_assert_ptr_eq(devredir_irp_find_by_fileid(1234), irp);
+
+    /* CompletionIds are sometimes reused for the next request */
+    devredir_irp_set_completion_id(irp, 11);
+    ck_assert_ptr_eq(devredir_irp_find(10), NULL);
+    ck_assert_ptr_eq(devredir_irp_find(11), irp);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_irp__delete)
+{
+    IRP *irps[3];
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        irps[i] = devredir_irp_new();
+        devredir_irp_set_completion_id(irps[i], i);
+    }
+    ck_assert_ptr_eq(devredir_irp_find(1), irps[1]);
+
+    ck_assert_int_eq(devredir_irp_delete(irps[1]), 0);
+    ck_assert_ptr_eq(devredir_irp_find(1), NULL);
+    ck_assert_ptr_eq(irps[0]->next, irps[2]);
+    ck_assert_ptr_eq(irps[2]->prev, irps[0]);
+
+    ck_assert_int_eq(devredir_irp_delete(irps[2]), 0);
+    ck_assert_ptr_eq(devredir_irp_get_last(), irps[0]);
+    ck_assert_ptr_eq(devredir_irp_find(0), irps[0]);
+
+    /* A new IRP goes on the end of the list */
+    irps[1] = devredir_irp_new();
+    devredir_irp_set_completion_id(irps[1], 5);
+    ck_assert_ptr_eq(devredir_irp_get_last(), irps[1]);
+    ck_assert_ptr_eq(devredir_irp_find(5), irps[1]);
+    ck_assert_int_ne(devredir_irp_delete(NULL), 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_chansrv_irp(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("ChansrvIrp");
+
+    tc = tcase_create("irp");
+    tcase_add_checked_fixture(tc, NULL, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_irp__find_by_completion_id);
+    tcase_add_test(tc, test_irp__find_by_file_id);
+    tcase_add_test(tc, test_irp__file_id_oldest_first);
+    tcase_add_test(tc, test_irp__file_id_set_late);
+    tcase_add_test(tc, test_irp__ids_changed);
+    tcase_add_test(tc, test_irp__delete);
+
+    return s;
+}
@@ -17,6 +17,9 @@ Suite *make_suite_test_ssl_calls(void);
 Suite *make_suite_test_base64(void);
 Suite *make_suite_test_guid(void);
 Suite *make_suite_test_scancode(void);
+Suite *make_suite_test_timer_heap(void);
+Suite *make_suite_test_spsc_ring(void);
+Suite *make_suite_test_log(void);
 
 TCase *make_tcase_test_os_calls_signals(void);
 
@@ -56,6 +56,9 @@ int main (void)
     srunner_add_suite(sr, make_suite_test_base64());
     srunner_add_suite(sr, make_suite_test_guid());
     srunner_add_suite(sr, make_suite_test_scancode());
+    srunner_add_suite(sr, make_suite_test_timer_heap());
+    srunner_add_suite(sr, make_suite_test_spsc_ring());
+    srunner_add_suite(sr, make_suite_test_log());
 
     srunner_set_tap(sr, "-");
     /*
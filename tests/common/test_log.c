@@ -0,0 +1,384 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+#include "os_calls.h"
+#include "string_calls.h"
+#include "thread_calls.h"
+#include "test_common.h"
+
+#define LOG_THREADS 4
+#define LOG_MESSAGES 2000
+
+static char log_file[256];
+static tbus threads_done;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_snprintf(log_file, sizeof(log_file), "/tmp/xrdp_test_log_%d.log",
+               g_getpid());
+    g_file_delete(log_file);
+    /* the test program logs to the console, stop that while we run */
+    log_end();
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    struct log_config *lc;
+
+    log_end();
+    g_file_delete(log_file);
+    lc = log_config_init_for_console(LOG_LEVEL_INFO, NULL);
+    log_start_from_param(lc);
+    log_config_free(lc);
+}
+
+/******************************************************************************/
+static void
+start_async_log(int queue_size, enum log_async_overflow overflow)
+{
+    struct log_config *lc;
+
+    lc = log_config_init_for_console(LOG_LEVEL_INFO, NULL);
+    ck_assert_ptr_ne(lc, NULL);
+    lc->enable_console = 0;
+    lc->log_file = g_strdup(log_file);
+    lc->log_level = LOG_LEVEL_INFO;
+    lc->enable_async = 1;
+    lc->async_queue_size = queue_size;
+    lc->async_overflow = overflow;
+    ck_assert_int_eq(log_start_from_param(lc), LOG_STARTUP_OK);
+    log_config_free(lc);
+}
+
+/******************************************************************************/
+static THREAD_RV THREAD_CC
+log_thread(void *arg)
+{
+    int thread = (int)(tintptr)arg;
+    int index;
+
+    for (index = 0; index < LOG_MESSAGES; index++)
+    {
+        LOG(LOG_LEVEL_INFO, "thread %d message %d", thread, index);
+    }
+    tc_sem_inc(threads_done);
+    return 0;
+}
+
+/******************************************************************************/
+/* logs from a few threads at once, and waits for them */
+static void
+log_from_threads(void)
+{
+    int thread;
+
+    threads_done = tc_sem_create(0);
+    for (thread = 0; thread < LOG_THREADS; thread++)
+    {
+        ck_assert_int_eq(tc_thread_create(log_thread,
+                                          (void *)(tintptr)thread), 0);
+    }
+    for (thread = 0; thread < LOG_THREADS; thread++)
+    {
+        tc_sem_dec(threads_done);
+    }
+    tc_sem_delete(threads_done);
+}
+
+/******************************************************************************/
+/* reads the log back, checking each thread's messages are in order.
+ * Returns the number of messages, adding any reported as dropped to
+ * *dropped */
+static int
+read_log(int *dropped)
+{
+    FILE *fp;
+    char line[LOG_BUFFER_SIZE];
+    int next[LOG_THREADS] = {0};
+    int count = 0;
+    const char *p;
+    int thread;
+    int index;
+    int n;
+
+    fp = fopen(log_file, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if ((p = g_strstr(line, "thread ")) != NULL &&
+                sscanf(p, "thread %d message %d", &thread, &index) == 2)
+        {
+            ck_assert_int_ge(thread, 0);
+            ck_assert_int_lt(thread, LOG_THREADS);
+            /* nothing lost or reordered, unless messages were dropped */
+            if (dropped == NULL)
+            {
+                ck_assert_int_eq(index, next[thread]);
+            }
+            else
+            {
+                ck_assert_int_ge(index, next[thread]);
+            }
+            next[thread] = index + 1;
+            count++;
+        }
+        else if ((p = g_strstr(line, "] ")) != NULL &&
+                 sscanf(p + 2, "[WARN ] %d log messages dropped", &n) == 1)
+        {
+            ck_assert_ptr_ne(dropped, NULL);
+            *dropped += n;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+/******************************************************************************/
+START_TEST(test_log__async_threads)
+{
+    start_async_log(LOG_ASYNC_DEFAULT_QUEUE_SIZE, LOG_ASYNC_OVERFLOW_BLOCK);
+    log_from_threads();
+    log_end();
+    ck_assert_int_eq(read_log(NULL), LOG_THREADS * LOG_MESSAGES);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_log__async_block)
+{
+    /* a tiny queue, so the threads have to wait for the writer */
+    start_async_log(2, LOG_ASYNC_OVERFLOW_BLOCK);
+    log_from_threads();
+    log_flush();
+    ck_assert_int_eq(read_log(NULL), LOG_THREADS * LOG_MESSAGES);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_log__async_drop)
+{
+    int dropped = 0;
+    int count;
+
+    start_async_log(2, LOG_ASYNC_OVERFLOW_DROP);
+    log_from_threads();
+    log_end();
+    /* every message is either written or counted */
+    count = read_log(&dropped);
+    ck_assert_int_eq(count + dropped, LOG_THREADS * LOG_MESSAGES);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_log__async_crash_flush)
+{
+    struct proc_exit_status e;
+    int pid;
+
+    pid = g_fork();
+    if (pid == 0)
+    {
+        /* no core file */
+        g_set_current_dir("/");
+        start_async_log(LOG_ASYNC_DEFAULT_QUEUE_SIZE,
+                        LOG_ASYNC_OVERFLOW_BLOCK);
+        log_from_threads();
+        /* whatever the writer hasn't got to is written by the handler */
+        raise(SIGABRT);
+        g_exit(0);
+    }
+    ck_assert_int_gt(pid, 0);
+    e = g_waitpid_status(pid);
+    ck_assert_int_eq(e.reason, E_PXR_SIGNAL);
+    ck_assert_int_eq(e.val, SIGABRT);
+    ck_assert_int_eq(read_log(NULL), LOG_THREADS * LOG_MESSAGES);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_log__async_config)
+{
+    static const char ini[] =
+        "[Logging]\n"
+        "EnableAsync=yes\n"
+        "AsyncQueueSize=16\n"
+        "AsyncOverflow=drop\n";
+    char ini_file[256];
+    struct log_config *lc;
+    int fd;
+
+    g_snprintf(ini_file, sizeof(ini_file), "/tmp/xrdp_test_log_%d.ini",
+               g_getpid());
+    fd = g_file_open_rw(ini_file);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(g_file_write(fd, ini, sizeof(ini) - 1),
+                     sizeof(ini) - 1);
+    g_file_close(fd);
+
+    lc = log_config_init_from_config(ini_file, "test_log", "");
+    g_file_delete(ini_file);
+    ck_assert_ptr_ne(lc, NULL);
+    ck_assert_int_eq(lc->enable_async, 1);
+    ck_assert_int_eq(lc->async_queue_size, 16);
+    ck_assert_int_eq(lc->async_overflow, LOG_ASYNC_OVERFLOW_DROP);
+    log_config_free(lc);
+}
+END_TEST
+
+/******************************************************************************/
+/* starts logging to the test file only, at the given level */
+static void
+start_file_log(enum logLevels level)
+{
+    struct log_config *lc;
+
+    lc = log_config_init_for_console(LOG_LEVEL_INFO, NULL);
+    ck_assert_ptr_ne(lc, NULL);
+    lc->enable_console = 0;
+    lc->log_file = g_strdup(log_file);
+    lc->log_level = level;
+    ck_assert_int_eq(log_start_from_param(lc), LOG_STARTUP_OK);
+    log_config_free(lc);
+}
+
+/******************************************************************************/
+/* counts the lines in the log containing text */
+static int
+count_log_lines(const char *text)
+{
+    FILE *fp;
+    char line[LOG_BUFFER_SIZE];
+    int count = 0;
+
+    fp = fopen(log_file, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (g_strstr(line, text) != NULL)
+        {
+            count++;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+/******************************************************************************/
+static void
+log_at_levels(void)
+{
+    LOG(LOG_LEVEL_INFO, "callsite info");
+    LOG(LOG_LEVEL_TRACE, "callsite trace");
+}
+
+/******************************************************************************/
+START_TEST(test_log__callsite_levels)
+{
+    start_file_log(LOG_LEVEL_INFO);
+    log_at_levels();
+    log_at_levels();
+    log_end();
+
+    /* the call sites have cached INFO, and have to see the change */
+    start_file_log(LOG_LEVEL_TRACE);
+    log_at_levels();
+    log_end();
+
+    start_file_log(LOG_LEVEL_ERROR);
+    log_at_levels();
+    log_end();
+
+    ck_assert_int_eq(count_log_lines("callsite info"), 3);
+    ck_assert_int_eq(count_log_lines("callsite trace"), 1);
+}
+END_TEST
+
+/******************************************************************************/
+/* one rate limited call site for the test to use */
+static void
+log_limited(enum logLevels level, int index)
+{
+    LOG_RATELIMITED(level, 10, "limited %d", index);
+}
+
+/******************************************************************************/
+START_TEST(test_log__ratelimited)
+{
+    int index;
+    int suppressed = 0;
+    FILE *fp;
+    char line[LOG_BUFFER_SIZE];
+    const char *p;
+    int n;
+
+    start_file_log(LOG_LEVEL_INFO);
+    for (index = 0; index < 100; index++)
+    {
+        log_limited(LOG_LEVEL_INFO, index);
+    }
+    /* the count is logged by the first message of a new window */
+    g_sleep(1100);
+    log_limited(LOG_LEVEL_INFO, index);
+
+    /* messages which aren't logged anyway don't count */
+    for (index = 0; index < 100; index++)
+    {
+        log_limited(LOG_LEVEL_DEBUG, index);
+    }
+    log_end();
+
+    ck_assert_int_eq(count_log_lines("limited "), 11);
+    fp = fopen(log_file, "r");
+    ck_assert_ptr_ne(fp, NULL);
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        /* after the level, and the location in a devel build */
+        if ((p = strrchr(line, ']')) != NULL &&
+                sscanf(p + 1, " %d similar messages suppressed", &n) == 1)
+        {
+            suppressed += n;
+        }
+    }
+    fclose(fp);
+    ck_assert_int_eq(suppressed, 90);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_log(void)
+{
+    Suite *s;
+    TCase *tc_async;
+    TCase *tc_callsite;
+
+    s = suite_create("Log");
+
+    tc_async = tcase_create("async");
+    tcase_add_checked_fixture(tc_async, setup, teardown);
+    suite_add_tcase(s, tc_async);
+    tcase_add_test(tc_async, test_log__async_threads);
+    tcase_add_test(tc_async, test_log__async_block);
+    tcase_add_test(tc_async, test_log__async_drop);
+    tcase_add_test(tc_async, test_log__async_crash_flush);
+    tcase_add_test(tc_async, test_log__async_config);
+
+    tc_callsite = tcase_create("callsite");
+    tcase_add_checked_fixture(tc_callsite, setup, teardown);
+    suite_add_tcase(s, tc_callsite);
+    tcase_add_test(tc_callsite, test_log__callsite_levels);
+    tcase_add_test(tc_callsite, test_log__ratelimited);
+
+    return s;
+}
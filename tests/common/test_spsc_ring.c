@@ -0,0 +1,140 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "spsc_ring.h"
+
+#include "os_calls.h"
+#include "thread_calls.h"
+#include "test_common.h"
+
+#define THREAD_TEST_ITEMS 100000
+
+static struct spsc_ring *ring;
+static tbus producer_done;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    ring = spsc_ring_create(5);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    spsc_ring_delete(ring);
+}
+
+/******************************************************************************/
+START_TEST(test_spsc_ring__fifo_order)
+{
+    int index;
+
+    ck_assert_ptr_eq(spsc_ring_pop(ring), NULL);
+    for (index = 1; index <= 3; index++)
+    {
+        ck_assert_int_eq(spsc_ring_push(ring, (void *)(tintptr)index), 0);
+    }
+    ck_assert_int_eq(spsc_ring_count(ring), 3);
+    for (index = 1; index <= 3; index++)
+    {
+        ck_assert_ptr_eq(spsc_ring_pop(ring), (void *)(tintptr)index);
+    }
+    ck_assert_ptr_eq(spsc_ring_pop(ring), NULL);
+    ck_assert_int_eq(spsc_ring_count(ring), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_spsc_ring__full_and_wrap)
+{
+    int index;
+    int round;
+
+    /* 5 is rounded up to 8 */
+    for (round = 0; round < 3; round++)
+    {
+        for (index = 1; index <= 8; index++)
+        {
+            ck_assert_int_eq(spsc_ring_push(ring, (void *)(tintptr)index), 0);
+        }
+        ck_assert_int_eq(spsc_ring_push(ring, (void *)(tintptr)9), 1);
+        ck_assert_int_eq(spsc_ring_count(ring), 8);
+
+        /* make room for one, which goes in at the end */
+        ck_assert_ptr_eq(spsc_ring_pop(ring), (void *)(tintptr)1);
+        ck_assert_int_eq(spsc_ring_push(ring, (void *)(tintptr)9), 0);
+        for (index = 2; index <= 9; index++)
+        {
+            ck_assert_ptr_eq(spsc_ring_pop(ring), (void *)(tintptr)index);
+        }
+        ck_assert_ptr_eq(spsc_ring_pop(ring), NULL);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+static THREAD_RV THREAD_CC
+producer_thread(void *arg)
+{
+    int index;
+
+    for (index = 1; index <= THREAD_TEST_ITEMS; index++)
+    {
+        while (spsc_ring_push(ring, (void *)(tintptr)index) != 0)
+        {
+            g_sleep(0);
+        }
+    }
+    tc_sem_inc(producer_done);
+    return 0;
+}
+
+/******************************************************************************/
+START_TEST(test_spsc_ring__two_threads)
+{
+    void *item;
+    int expected;
+
+    producer_done = tc_sem_create(0);
+    ck_assert_int_eq(tc_thread_create(producer_thread, NULL), 0);
+
+    /* every item arrives once, in order, whatever the interleaving */
+    expected = 1;
+    while (expected <= THREAD_TEST_ITEMS)
+    {
+        item = spsc_ring_pop(ring);
+        if (item == NULL)
+        {
+            g_sleep(0);
+            continue;
+        }
+        ck_assert_ptr_eq(item, (void *)(tintptr)expected);
+        expected++;
+    }
+    tc_sem_dec(producer_done);
+    tc_sem_delete(producer_done);
+    ck_assert_ptr_eq(spsc_ring_pop(ring), NULL);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_spsc_ring(void)
+{
+    Suite *s;
+    TCase *tc_simple;
+
+    s = suite_create("SpscRing");
+
+    tc_simple = tcase_create("simple");
+    tcase_add_checked_fixture(tc_simple, setup, teardown);
+    suite_add_tcase(s, tc_simple);
+    tcase_add_test(tc_simple, test_spsc_ring__fifo_order);
+    tcase_add_test(tc_simple, test_spsc_ring__full_and_wrap);
+    tcase_add_test(tc_simple, test_spsc_ring__two_threads);
+
+    return s;
+}
@@ -0,0 +1,201 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "timer_heap.h"
+
+#include "os_calls.h"
+#include "test_common.h"
+
+#define LARGE_TEST_SIZE 1000
+
+static struct timer_heap *timers;
+static int fired[LARGE_TEST_SIZE];
+static int fired_count;
+
+/******************************************************************************/
+static void
+record_callback(void *data)
+{
+    fired[fired_count++] = (int)(tintptr)data;
+}
+
+/******************************************************************************/
+static void
+rearm_callback(void *data)
+{
+    fired_count++;
+    timer_heap_add(timers, 0, rearm_callback, data);
+}
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    timers = timer_heap_create();
+    fired_count = 0;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    timer_heap_delete(timers);
+}
+
+/******************************************************************************/
+START_TEST(test_timer_heap__null)
+{
+    int timeout = -1;
+
+    // These calls should not crash!
+    timer_heap_delete(NULL);
+    timer_heap_get_timeout(NULL, &timeout);
+    ck_assert_int_eq(timeout, -1);
+    ck_assert_int_eq(timer_heap_check(NULL), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_timer_heap__expired_in_order)
+{
+    int timeout = -1;
+    int index;
+
+    /* the far one must not run, the rest run in the order added */
+    timer_heap_add(timers, 1000000, record_callback, (void *)(tintptr)99);
+    for (index = 0; index < 10; index++)
+    {
+        timer_heap_add(timers, 0, record_callback, (void *)(tintptr)index);
+    }
+    timer_heap_get_timeout(timers, &timeout);
+    ck_assert_int_eq(timeout, 0);
+
+    ck_assert_int_eq(timer_heap_check(timers), 10);
+    for (index = 0; index < 10; index++)
+    {
+        ck_assert_int_eq(fired[index], index);
+    }
+    ck_assert_int_eq(timer_heap_count(timers), 1);
+
+    timeout = -1;
+    timer_heap_get_timeout(timers, &timeout);
+    ck_assert_int_gt(timeout, 1000000 - 1000);
+    ck_assert_int_le(timeout, 1000000);
+
+    /* a lower timeout is left alone */
+    timeout = 5;
+    timer_heap_get_timeout(timers, &timeout);
+    ck_assert_int_eq(timeout, 5);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_timer_heap__cancel)
+{
+    int h1;
+    int h2;
+    int h3;
+
+    h1 = timer_heap_add(timers, 0, record_callback, (void *)(tintptr)1);
+    h2 = timer_heap_add(timers, 0, record_callback, (void *)(tintptr)2);
+    h3 = timer_heap_add(timers, 0, record_callback, (void *)(tintptr)3);
+    ck_assert_int_ne(h1, 0);
+    ck_assert_int_ne(h2, h1);
+
+    ck_assert_int_eq(timer_heap_cancel(timers, h2), 1);
+    ck_assert_int_eq(timer_heap_cancel(timers, h2), 0);
+    ck_assert_int_eq(timer_heap_cancel(timers, 0), 0);
+    ck_assert_int_eq(timer_heap_check(timers), 2);
+    ck_assert_int_eq(fired[0], 1);
+    ck_assert_int_eq(fired[1], 3);
+
+    /* the slot of a run timer is reused, its old handle must not match */
+    ck_assert_int_eq(timer_heap_cancel(timers, h3), 0);
+    h2 = timer_heap_add(timers, 0, record_callback, (void *)(tintptr)4);
+    ck_assert_int_eq(timer_heap_cancel(timers, h1), 0);
+    ck_assert_int_eq(timer_heap_cancel(timers, h3), 0);
+    ck_assert_int_eq(timer_heap_count(timers), 1);
+    ck_assert_int_eq(timer_heap_cancel(timers, h2), 1);
+    ck_assert_int_eq(timer_heap_count(timers), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_timer_heap__rearm_runs_next_time)
+{
+    timer_heap_add(timers, 0, rearm_callback, NULL);
+    ck_assert_int_eq(timer_heap_check(timers), 1);
+    ck_assert_int_eq(timer_heap_check(timers), 1);
+    ck_assert_int_eq(fired_count, 2);
+    ck_assert_int_eq(timer_heap_count(timers), 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_timer_heap__large)
+{
+    int handles[LARGE_TEST_SIZE];
+    int index;
+    int min_offset;
+    int offset;
+    int timeout;
+
+    /* offsets 10s apart in a scrambled order, then cancel two thirds of
+       them from all over the heap, the earliest one left must be on top */
+    for (index = 0; index < LARGE_TEST_SIZE; index++)
+    {
+        offset = ((index * 379) % LARGE_TEST_SIZE + 1) * 10000;
+        handles[index] = timer_heap_add(timers, offset, record_callback,
+                                        (void *)(tintptr)index);
+        ck_assert_int_ne(handles[index], 0);
+    }
+    ck_assert_int_eq(timer_heap_count(timers), LARGE_TEST_SIZE);
+    for (index = 0; index < LARGE_TEST_SIZE; index++)
+    {
+        if ((index * 7919) % 3 != 1)
+        {
+            ck_assert_int_eq(timer_heap_cancel(timers, handles[index]), 1);
+            handles[index] = 0;
+        }
+    }
+    min_offset = 0;
+    for (index = 0; index < LARGE_TEST_SIZE; index++)
+    {
+        if (handles[index] != 0)
+        {
+            offset = ((index * 379) % LARGE_TEST_SIZE + 1) * 10000;
+            if ((min_offset == 0) || (offset < min_offset))
+            {
+                min_offset = offset;
+            }
+        }
+    }
+    timeout = -1;
+    timer_heap_get_timeout(timers, &timeout);
+    ck_assert_int_gt(timeout, min_offset - 1000);
+    ck_assert_int_le(timeout, min_offset);
+    ck_assert_int_eq(timer_heap_check(timers), 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_timer_heap(void)
+{
+    Suite *s;
+    TCase *tc_simple;
+
+    s = suite_create("TimerHeap");
+
+    tc_simple = tcase_create("simple");
+    tcase_add_checked_fixture(tc_simple, setup, teardown);
+    suite_add_tcase(s, tc_simple);
+    tcase_add_test(tc_simple, test_timer_heap__null);
+    tcase_add_test(tc_simple, test_timer_heap__expired_in_order);
+    tcase_add_test(tc_simple, test_timer_heap__cancel);
+    tcase_add_test(tc_simple, test_timer_heap__rearm_runs_next_time);
+    tcase_add_test(tc_simple, test_timer_heap__large);
+
+    return s;
+}
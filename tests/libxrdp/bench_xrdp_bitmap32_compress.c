@@ -0,0 +1,124 @@
+/*
+ * planar codec throughput, scalar kernels against the kernels picked
+ * for this cpu
+ *
+ * usage: bench_xrdp_bitmap32_compress [milliseconds per run]
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libxrdp.h"
+#include "os_calls.h"
+
+#define TILE 64
+
+/*****************************************************************************/
+/* desktop like content, flat areas with some text like noise */
+static void
+fill_tile(char *data, int seed)
+{
+    int *pixels = (int *) data;
+    int x;
+    int y;
+
+    for (y = 0; y < TILE; y++)
+    {
+        for (x = 0; x < TILE; x++)
+        {
+            if (((x + seed) % 23) < 4 && (y % 11) < 7)
+            {
+                pixels[y * TILE + x] = 0xff000000 | (rand() & 0x3f3f3f);
+            }
+            else
+            {
+                pixels[y * TILE + x] = 0xff000000 | (0x10 * (y / 16)) << 16 |
+                                       (seed & 0xff) << 8 | 0xe0;
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+run(const struct xrdp_planar_kernels *kernels, char *tiles, int num_tiles,
+    int flags, int run_ms)
+{
+    struct stream *s;
+    struct stream *temp_s;
+    int start;
+    int elapsed;
+    int index;
+    long long pixels;
+    long long bytes;
+
+    make_stream(s);
+    init_stream(s, TILE * TILE * 8);
+    make_stream(temp_s);
+    init_stream(temp_s, TILE * TILE * 8);
+    pixels = 0;
+    bytes = 0;
+    start = g_time3();
+    do
+    {
+        for (index = 0; index < num_tiles; index++)
+        {
+            init_stream(s, 0);
+            xrdp_bitmap32_compress_kernels(kernels,
+                                           tiles + index * TILE * TILE * 4,
+                                           TILE, TILE, s, 32,
+                                           TILE * TILE * 4, TILE - 1,
+                                           temp_s, 0, flags);
+            pixels += TILE * TILE;
+            bytes += s->p - s->data;
+        }
+        elapsed = g_time3() - start;
+    }
+    while (elapsed < run_ms);
+    if (elapsed < 1)
+    {
+        elapsed = 1;
+    }
+    printf("%-8s flags 0x%2.2x %10.1f MP/s  ratio %5.2f\n",
+           kernels->name, flags, (pixels / 1000.0) / elapsed,
+           (double) (pixels * 4) / (bytes > 0 ? bytes : 1));
+    free_stream(temp_s);
+    free_stream(s);
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    static const int flags[] = { 0x30, 0x10 };
+    const struct xrdp_planar_kernels *scalar;
+    const struct xrdp_planar_kernels *best;
+    char *tiles;
+    int num_tiles;
+    int run_ms;
+    int index;
+
+    run_ms = argc > 1 ? atoi(argv[1]) : 1000;
+    num_tiles = 64;
+    tiles = (char *) g_malloc(num_tiles * TILE * TILE * 4, 0);
+    for (index = 0; index < num_tiles; index++)
+    {
+        fill_tile(tiles + index * TILE * TILE * 4, index);
+    }
+    scalar = xrdp_planar_kernels_scalar();
+    best = xrdp_planar_kernels_best();
+    for (index = 0; index < (int) (sizeof(flags) / sizeof(flags[0])); index++)
+    {
+        run(scalar, tiles, num_tiles, flags[index], run_ms);
+        if (best != scalar)
+        {
+            run(best, tiles, num_tiles, flags[index], run_ms);
+        }
+    }
+    g_free(tiles);
+    return 0;
+}
@@ -5,5 +5,11 @@
 
 Suite *make_suite_test_xrdp_sec_process_mcs_data_monitors(void);
 Suite *make_suite_test_monitor_processing(void);
+Suite *make_suite_test_xrdp_bitmap32_compress(void);
+Suite *make_suite_test_xrdp_orders_batch(void);
+Suite *make_suite_test_xrdp_orders_multi(void);
+Suite *make_suite_test_xrdp_channel_sched(void);
+Suite *make_suite_test_xrdp_autodetect(void);
+Suite *make_suite_test_xrdp_caps_process_confirm_active(void);
 
 #endif /* TEST_LIBXRDP_H */
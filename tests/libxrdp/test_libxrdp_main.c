@@ -14,6 +14,12 @@ int main (void)
 
     sr = srunner_create(make_suite_test_xrdp_sec_process_mcs_data_monitors());
     srunner_add_suite(sr, make_suite_test_monitor_processing());
+    srunner_add_suite(sr, make_suite_test_xrdp_bitmap32_compress());
+    srunner_add_suite(sr, make_suite_test_xrdp_orders_batch());
+    srunner_add_suite(sr, make_suite_test_xrdp_orders_multi());
+    srunner_add_suite(sr, make_suite_test_xrdp_channel_sched());
+    srunner_add_suite(sr, make_suite_test_xrdp_autodetect());
+    srunner_add_suite(sr, make_suite_test_xrdp_caps_process_confirm_active());
 
     srunner_set_tap(sr, "-");
 
@@ -0,0 +1,255 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+static struct xrdp_autodetect *ad;
+static struct stream *rsp;
+
+static void setup(void)
+{
+    /* no owner, so nothing is sent and there's no callback */
+    ad = xrdp_autodetect_create(NULL);
+    make_stream(rsp);
+    init_stream(rsp, 64);
+}
+
+static void teardown(void)
+{
+    xrdp_autodetect_delete(ad);
+    free_stream(rsp);
+}
+
+/* makes an Auto-Detect Response PDU in rsp, without the security header */
+static void
+make_response(int header_length, int header_type_id, int seq,
+              int response_type, int extra_count, const int *extra)
+{
+    int index;
+
+    init_stream(rsp, 64);
+    out_uint8(rsp, header_length);
+    out_uint8(rsp, header_type_id);
+    out_uint16_le(rsp, seq);
+    out_uint16_le(rsp, response_type);
+    for (index = 0; index < extra_count; index++)
+    {
+        out_uint32_le(rsp, extra[index]);
+    }
+    s_mark_end(rsp);
+    rsp->p = rsp->data;
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__connection_type)
+{
+    ck_assert_int_eq(xrdp_autodetect_connection_type(56, 200),
+                     CONNECTION_TYPE_MODEM);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(1500, 40),
+                     CONNECTION_TYPE_BROADBAND_LOW);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(8000, 600),
+                     CONNECTION_TYPE_SATELLITE);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(8000, 30),
+                     CONNECTION_TYPE_BROADBAND_HIGH);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(50000, 80),
+                     CONNECTION_TYPE_WAN);
+    ck_assert_int_eq(xrdp_autodetect_connection_type(500000, 1),
+                     CONNECTION_TYPE_LAN);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__rtt)
+{
+    int sent;
+
+    ck_assert_int_eq(xrdp_autodetect_send_rtt(ad), 0);
+    sent = ad->rtt_sent;
+    make_response(6, TYPE_ID_AUTODETECT_RESPONSE, ad->rtt_seq,
+                  RDP_RTT_RESPONSE_TYPE, 0, NULL);
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, sent + 40), 0);
+    ck_assert_int_eq(ad->base_rtt, 40);
+    ck_assert_int_eq(ad->avg_rtt, 40);
+    ck_assert_int_eq(ad->rtt_seq, -1);
+
+    /* a second answer to the same request is ignored */
+    rsp->p = rsp->data;
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, sent + 1000), 0);
+    ck_assert_int_eq(ad->avg_rtt, 40);
+
+    ck_assert_int_eq(xrdp_autodetect_send_rtt(ad), 0);
+    sent = ad->rtt_sent;
+    make_response(6, TYPE_ID_AUTODETECT_RESPONSE, ad->rtt_seq,
+                  RDP_RTT_RESPONSE_TYPE, 0, NULL);
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, sent + 20), 0);
+    ck_assert_int_eq(ad->base_rtt, 20);
+    ck_assert_int_eq(ad->avg_rtt, (40 * 7 + 20) / 8);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__bandwidth)
+{
+    int results[2];
+
+    /* stop before start, and start twice */
+    ck_assert_int_ne(xrdp_autodetect_send_bw_stop(ad), 0);
+    ck_assert_int_eq(xrdp_autodetect_send_bw_start(ad), 0);
+    ck_assert_int_ne(xrdp_autodetect_send_bw_start(ad), 0);
+    ck_assert_int_eq(xrdp_autodetect_send_bw_stop(ad), 0);
+
+    /* 125000 bytes in 100 ms is 10 Mbit/s */
+    results[0] = 100;
+    results[1] = 125000;
+    make_response(14, TYPE_ID_AUTODETECT_RESPONSE, ad->bw_seq,
+                  RDP_BW_RESULTS_RESPONSE_TYPE_CONTINUOUS, 2, results);
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, 0), 0);
+    ck_assert_int_eq(ad->bandwidth, 10000);
+
+    /* results for another measure are ignored */
+    results[1] = 12500;
+    make_response(14, TYPE_ID_AUTODETECT_RESPONSE, ad->bw_seq + 1,
+                  RDP_BW_RESULTS_RESPONSE_TYPE_CONTINUOUS, 2, results);
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, 0), 0);
+    ck_assert_int_eq(ad->bandwidth, 10000);
+
+    /* too few bytes to say anything */
+    xrdp_autodetect_send_bw_start(ad);
+    xrdp_autodetect_send_bw_stop(ad);
+    results[0] = 1;
+    results[1] = 1000;
+    make_response(14, TYPE_ID_AUTODETECT_RESPONSE, ad->bw_seq,
+                  RDP_BW_RESULTS_RESPONSE_TYPE_CONTINUOUS, 2, results);
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, 0), 0);
+    ck_assert_int_eq(ad->bandwidth, 10000);
+
+    /* a new measure is smoothed in */
+    xrdp_autodetect_send_bw_start(ad);
+    xrdp_autodetect_send_bw_stop(ad);
+    results[0] = 100;
+    results[1] = 25000;
+    make_response(14, TYPE_ID_AUTODETECT_RESPONSE, ad->bw_seq,
+                  RDP_BW_RESULTS_RESPONSE_TYPE_CONTINUOUS, 2, results);
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, 0), 0);
+    ck_assert_int_eq(ad->bandwidth, (10000 * 3 + 2000) / 4);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__netchar_sync)
+{
+    int sync[2];
+
+    sync[0] = 20000; /* bandwidth */
+    sync[1] = 15; /* rtt */
+    make_response(14, TYPE_ID_AUTODETECT_RESPONSE, 0,
+                  RDP_NETCHAR_SYNC_RESPONSE_TYPE, 2, sync);
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, 0), 0);
+    ck_assert_int_eq(ad->bandwidth, 20000);
+    ck_assert_int_eq(ad->base_rtt, 15);
+    ck_assert_int_eq(ad->avg_rtt, 15);
+}
+END_TEST
+
+/******************************************************************************/
+/* feeds a Network Characteristics Sync, which sets the link directly */
+static void
+netchar_sync(int bandwidth, int rtt)
+{
+    int sync[2];
+
+    sync[0] = bandwidth;
+    sync[1] = rtt;
+    make_response(14, TYPE_ID_AUTODETECT_RESPONSE, 0,
+                  RDP_NETCHAR_SYNC_RESPONSE_TYPE, 2, sync);
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, 0), 0);
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__type_hysteresis)
+{
+    int index;
+
+    ck_assert_int_eq(ad->connection_type, 0);
+    /* the first result is used at once */
+    netchar_sync(20000, 45);
+    ck_assert_int_eq(ad->connection_type, CONNECTION_TYPE_LAN);
+
+    /* an RTT either side of 50 ms doesn't change it */
+    for (index = 0; index < 10; index++)
+    {
+        netchar_sync(20000, (index & 1) ? 45 : 55);
+        ck_assert_int_eq(ad->connection_type, CONNECTION_TYPE_LAN);
+    }
+
+    /* a few results in a row do */
+    netchar_sync(20000, 55);
+    netchar_sync(20000, 55);
+    ck_assert_int_eq(ad->connection_type, CONNECTION_TYPE_LAN);
+    netchar_sync(20000, 55);
+    ck_assert_int_eq(ad->connection_type, CONNECTION_TYPE_WAN);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_autodetect__bad_input)
+{
+    int results[1];
+
+    /* too short for the header */
+    init_stream(rsp, 64);
+    out_uint8(rsp, 6);
+    out_uint8(rsp, TYPE_ID_AUTODETECT_RESPONSE);
+    s_mark_end(rsp);
+    rsp->p = rsp->data;
+    ck_assert_int_ne(xrdp_autodetect_process(ad, rsp, 0), 0);
+
+    /* a request, not a response */
+    make_response(6, TYPE_ID_AUTODETECT_REQUEST, 0,
+                  RDP_RTT_RESPONSE_TYPE, 0, NULL);
+    ck_assert_int_ne(xrdp_autodetect_process(ad, rsp, 0), 0);
+
+    /* bandwidth results with no byteCount */
+    xrdp_autodetect_send_bw_start(ad);
+    xrdp_autodetect_send_bw_stop(ad);
+    results[0] = 100;
+    make_response(10, TYPE_ID_AUTODETECT_RESPONSE, ad->bw_seq,
+                  RDP_BW_RESULTS_RESPONSE_TYPE_CONTINUOUS, 1, results);
+    ck_assert_int_ne(xrdp_autodetect_process(ad, rsp, 0), 0);
+
+    /* unknown response types are skipped */
+    make_response(6, TYPE_ID_AUTODETECT_RESPONSE, 0, 0x7777, 0, NULL);
+    ck_assert_int_eq(xrdp_autodetect_process(ad, rsp, 0), 0);
+
+    ck_assert_int_eq(ad->bandwidth, 0);
+    ck_assert_int_eq(ad->avg_rtt, -1);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_autodetect(void)
+{
+    Suite *s;
+    TCase *tc_autodetect;
+
+    s = suite_create("test_xrdp_autodetect");
+
+    tc_autodetect = tcase_create("xrdp_autodetect");
+    tcase_add_checked_fixture(tc_autodetect, setup, teardown);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__connection_type);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__rtt);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__bandwidth);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__netchar_sync);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__type_hysteresis);
+    tcase_add_test(tc_autodetect, test_xrdp_autodetect__bad_input);
+
+    suite_add_tcase(s, tc_autodetect);
+
+    return s;
+}
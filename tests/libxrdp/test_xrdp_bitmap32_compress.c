@@ -0,0 +1,222 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdlib.h>
+
+#include "libxrdp.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+/* widths chosen to hit every vector tail length for 16 and 32 wide
+   kernels */
+static const int g_widths[] = { 1, 3, 4, 15, 16, 17, 31, 32, 33, 63, 64 };
+
+#define NUM_WIDTHS ((int) (sizeof(g_widths) / sizeof(g_widths[0])))
+
+enum pattern
+{
+    PATTERN_RANDOM,
+    PATTERN_SOLID,
+    PATTERN_STRIPES,
+    PATTERN_GRADIENT
+};
+
+/******************************************************************************/
+static void
+fill_pixels(char *data, int width, int height, enum pattern pattern)
+{
+    int *pixels = (int *) data;
+    int x;
+    int y;
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            switch (pattern)
+            {
+                case PATTERN_RANDOM:
+                    pixels[y * width + x] = rand() ^ (rand() << 16);
+                    break;
+                case PATTERN_SOLID:
+                    pixels[y * width + x] = 0xff336699;
+                    break;
+                case PATTERN_STRIPES:
+                    pixels[y * width + x] = ((x / 5) & 1) ? 0xff000000 :
+                                            0x80ffffff;
+                    break;
+                default:
+                    pixels[y * width + x] = 0xff000000 | (x * 4) << 16 |
+                                            (y * 4) << 8 | (x ^ y);
+                    break;
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+/* checks the best kernel set gives the same planes as the scalar one */
+START_TEST(test_xrdp_planar_kernels__split_and_delta_match_scalar)
+{
+    const struct xrdp_planar_kernels *ref = xrdp_planar_kernels_scalar();
+    const struct xrdp_planar_kernels *opt = xrdp_planar_kernels_best();
+    char in[64 * 4];
+    char ref_planes[4][64];
+    char opt_planes[4][64];
+    char prev[64];
+    int i;
+    int width;
+
+    for (i = 0; i < NUM_WIDTHS; i++)
+    {
+        width = g_widths[i];
+        fill_pixels(in, width, 1, PATTERN_RANDOM);
+        g_memset(ref_planes, 0, sizeof(ref_planes));
+        g_memset(opt_planes, 0, sizeof(opt_planes));
+
+        ref->split3_row(in, width, ref_planes[1], ref_planes[2],
+                        ref_planes[3]);
+        opt->split3_row(in, width, opt_planes[1], opt_planes[2],
+                        opt_planes[3]);
+        ck_assert_mem_eq(ref_planes, opt_planes, sizeof(ref_planes));
+
+        ref->split4_row(in, width, ref_planes[0], ref_planes[1],
+                        ref_planes[2], ref_planes[3]);
+        opt->split4_row(in, width, opt_planes[0], opt_planes[1],
+                        opt_planes[2], opt_planes[3]);
+        ck_assert_mem_eq(ref_planes, opt_planes, sizeof(ref_planes));
+
+        /* every byte difference, including -128 */
+        fill_pixels(prev, 16, 1, PATTERN_RANDOM);
+        ref->delta(prev, ref_planes[0], ref_planes[1], width);
+        opt->delta(prev, ref_planes[0], opt_planes[1], width);
+        ck_assert_mem_eq(ref_planes[1], opt_planes[1], width);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_planar_kernels__runs_match_scalar)
+{
+    const struct xrdp_planar_kernels *ref = xrdp_planar_kernels_scalar();
+    const struct xrdp_planar_kernels *opt = xrdp_planar_kernels_best();
+    char line[80];
+    int count;
+    int start;
+
+    /* equal run followed by a change at every position */
+    for (count = 0; count < 72; count++)
+    {
+        g_memset(line, 7, sizeof(line));
+        line[count + 1] = 8;
+        for (start = 0; start < 4; start++)
+        {
+            ck_assert_int_eq(ref->equal_run(line + start, 72),
+                             opt->equal_run(line + start, 72));
+        }
+    }
+
+    /* differing run followed by a repeat at every position */
+    for (count = 0; count < 72; count++)
+    {
+        for (start = 0; start < (int) sizeof(line); start++)
+        {
+            line[start] = (char) start;
+        }
+        line[count + 1] = line[count];
+        for (start = 0; start < 4; start++)
+        {
+            ck_assert_int_eq(ref->differ_run(line + start, 72),
+                             opt->differ_run(line + start, 72));
+        }
+    }
+
+    /* no terminator inside the scanned range */
+    g_memset(line, 0, sizeof(line));
+    ck_assert_int_eq(opt->equal_run(line, 70), 70);
+    ck_assert_int_eq(opt->differ_run(line, 70), 0);
+}
+END_TEST
+
+/******************************************************************************/
+/* checks full planar output is byte identical for both kernel sets */
+START_TEST(test_xrdp_bitmap32_compress__output_matches_scalar)
+{
+    static const int flags[] = { 0x10, 0x30, 0x00, 0x20 };
+    const struct xrdp_planar_kernels *ref = xrdp_planar_kernels_scalar();
+    const struct xrdp_planar_kernels *opt = xrdp_planar_kernels_best();
+    struct stream *ref_s;
+    struct stream *opt_s;
+    struct stream *temp_s;
+    char *in;
+    int i;
+    int j;
+    int p;
+    int e;
+    int width;
+    int height;
+    int ref_lines;
+    int opt_lines;
+
+    make_stream(ref_s);
+    init_stream(ref_s, 64 * 64 * 8);
+    make_stream(opt_s);
+    init_stream(opt_s, 64 * 64 * 8);
+    make_stream(temp_s);
+    init_stream(temp_s, 64 * 64 * 8);
+    in = (char *) g_malloc(64 * 64 * 4, 0);
+
+    for (p = PATTERN_RANDOM; p <= PATTERN_GRADIENT; p++)
+    {
+        for (i = 0; i < NUM_WIDTHS; i++)
+        {
+            width = g_widths[i];
+            height = 64;
+            e = (width % 4) == 0 ? 0 : 4 - (width % 4);
+            fill_pixels(in, width, height, (enum pattern) p);
+            for (j = 0; j < (int) (sizeof(flags) / sizeof(flags[0])); j++)
+            {
+                init_stream(ref_s, 0);
+                init_stream(opt_s, 0);
+                ref_lines = xrdp_bitmap32_compress_kernels(
+                                ref, in, width, height, ref_s, 32,
+                                64 * 64 * 4, height - 1, temp_s, e, flags[j]);
+                opt_lines = xrdp_bitmap32_compress_kernels(
+                                opt, in, width, height, opt_s, 32,
+                                64 * 64 * 4, height - 1, temp_s, e, flags[j]);
+                ck_assert_int_eq(ref_lines, opt_lines);
+                ck_assert_int_eq(ref_s->p - ref_s->data,
+                                 opt_s->p - opt_s->data);
+                ck_assert_mem_eq(ref_s->data, opt_s->data,
+                                 ref_s->p - ref_s->data);
+            }
+        }
+    }
+
+    g_free(in);
+    free_stream(temp_s);
+    free_stream(opt_s);
+    free_stream(ref_s);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_bitmap32_compress(void)
+{
+    Suite *s;
+    TCase *tc_kernels;
+
+    s = suite_create("test_xrdp_bitmap32_compress");
+
+    tc_kernels = tcase_create("xrdp_bitmap32_compress");
+    tcase_add_test(tc_kernels, test_xrdp_planar_kernels__split_and_delta_match_scalar);
+    tcase_add_test(tc_kernels, test_xrdp_planar_kernels__runs_match_scalar);
+    tcase_add_test(tc_kernels, test_xrdp_bitmap32_compress__output_matches_scalar);
+
+    suite_add_tcase(s, tc_kernels);
+
+    return s;
+}
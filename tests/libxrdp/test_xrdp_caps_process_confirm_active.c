@@ -0,0 +1,162 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+static struct xrdp_rdp *rdp_layer;
+static struct stream *g_s;
+
+/******************************************************************************/
+static void setup(void)
+{
+    rdp_layer = (struct xrdp_rdp *)g_malloc(sizeof(struct xrdp_rdp), 1);
+    rdp_layer->client_info.vc_chunk_size = CHANNEL_CHUNK_MAX_LENGTH;
+    make_stream(g_s);
+    init_stream(g_s, 1024);
+}
+
+/******************************************************************************/
+static void teardown(void)
+{
+    free_stream(g_s);
+    g_free(rdp_layer);
+}
+
+/******************************************************************************/
+/* a TS_CONFIRM_ACTIVE_PDU, the capability sets go between this and
+   end_confirm_active() */
+static void
+start_confirm_active(int num_caps)
+{
+    out_uint32_le(g_s, 0x1000ea); /* shareId */
+    out_uint16_le(g_s, 1002); /* originatorId */
+    out_uint16_le(g_s, 4); /* lengthSourceDescriptor */
+    s_push_layer(g_s, rdp_hdr, 2); /* lengthCombinedCapabilities */
+    out_uint8a(g_s, "MSTS", 4);
+    out_uint16_le(g_s, num_caps);
+    out_uint16_le(g_s, 0); /* pad2Octets */
+}
+
+/******************************************************************************/
+static void
+end_confirm_active(void)
+{
+    int cap_len;
+
+    s_mark_end(g_s);
+    cap_len = (int)(g_s->end - g_s->rdp_hdr) - 2 - 4;
+    g_s->p = g_s->rdp_hdr;
+    out_uint16_le(g_s, cap_len);
+    g_s->p = g_s->data;
+}
+
+/******************************************************************************/
+static void
+out_virtual_channel_caps(int len, int flags, int chunk_size)
+{
+    out_uint16_le(g_s, CAPSTYPE_VIRTUALCHANNEL);
+    out_uint16_le(g_s, len);
+    if (len >= 8)
+    {
+        out_uint32_le(g_s, flags);
+    }
+    if (len >= 12)
+    {
+        out_uint32_le(g_s, chunk_size);
+    }
+}
+
+/******************************************************************************/
+static void
+out_pointer_caps(int cache_size)
+{
+    out_uint16_le(g_s, CAPSTYPE_POINTER);
+    out_uint16_le(g_s, 10);
+    out_uint16_le(g_s, 1); /* colorPointerFlag */
+    out_uint16_le(g_s, cache_size); /* colorPointerCacheSize */
+    out_uint16_le(g_s, cache_size); /* pointerCacheSize */
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_caps_process_confirm_active__vc_chunk_size_ignored)
+{
+    start_confirm_active(2);
+    out_virtual_channel_caps(CAPSTYPE_VIRTUALCHANNEL_CHUNK_LEN, 0, 3200);
+    out_pointer_caps(25);
+    end_confirm_active();
+
+    ck_assert_int_eq(xrdp_caps_process_confirm_active(rdp_layer, g_s), 0);
+    /* what the client may send us stays as configured */
+    ck_assert_int_eq(rdp_layer->client_info.vc_chunk_size,
+                     CHANNEL_CHUNK_MAX_LENGTH);
+    /* and the caps after it are still read */
+    ck_assert_int_eq(rdp_layer->client_info.pointer_cache_entries, 25);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_caps_process_confirm_active__vc_without_chunk_size)
+{
+    start_confirm_active(2);
+    out_virtual_channel_caps(CAPSTYPE_VIRTUALCHANNEL_LEN, 0, 0);
+    out_pointer_caps(20);
+    end_confirm_active();
+
+    ck_assert_int_eq(xrdp_caps_process_confirm_active(rdp_layer, g_s), 0);
+    ck_assert_int_eq(rdp_layer->client_info.vc_chunk_size,
+                     CHANNEL_CHUNK_MAX_LENGTH);
+    ck_assert_int_eq(rdp_layer->client_info.pointer_cache_entries, 20);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_caps_process_confirm_active__vc_too_short)
+{
+    /* a set with no flags is skipped, not read past */
+    start_confirm_active(2);
+    out_virtual_channel_caps(4, 0, 0);
+    out_pointer_caps(15);
+    end_confirm_active();
+
+    ck_assert_int_eq(xrdp_caps_process_confirm_active(rdp_layer, g_s), 0);
+    ck_assert_int_eq(rdp_layer->client_info.pointer_cache_entries, 15);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_caps_process_confirm_active__caps_truncated)
+{
+    start_confirm_active(1);
+    out_uint16_le(g_s, CAPSTYPE_VIRTUALCHANNEL);
+    out_uint16_le(g_s, CAPSTYPE_VIRTUALCHANNEL_CHUNK_LEN);
+    out_uint32_le(g_s, 0); /* no VCChunkSize */
+    end_confirm_active();
+
+    ck_assert_int_ne(xrdp_caps_process_confirm_active(rdp_layer, g_s), 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_caps_process_confirm_active(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("test_xrdp_caps_process_confirm_active");
+
+    tc = tcase_create("xrdp_caps_process_confirm_active");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_xrdp_caps_process_confirm_active__vc_chunk_size_ignored);
+    tcase_add_test(tc, test_xrdp_caps_process_confirm_active__vc_without_chunk_size);
+    tcase_add_test(tc, test_xrdp_caps_process_confirm_active__vc_too_short);
+    tcase_add_test(tc, test_xrdp_caps_process_confirm_active__caps_truncated);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
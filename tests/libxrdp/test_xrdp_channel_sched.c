@@ -0,0 +1,207 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#define CHUNK 1600
+
+static struct xrdp_client_info client_info;
+static struct xrdp_channel_sched *sched;
+static char chunk_data[CHUNK];
+
+static void setup(void)
+{
+    g_memset(&client_info, 0, sizeof(client_info));
+    client_info.channel_qos = 1;
+    client_info.channel_qos_max_queued_kb = 64;
+    sched = xrdp_channel_sched_create(&client_info);
+}
+
+static void teardown(void)
+{
+    xrdp_channel_sched_delete(sched);
+}
+
+static void
+add_chunks(int class_id, int channel_id, int count)
+{
+    int index;
+
+    for (index = 0; index < count; index++)
+    {
+        /* each chunk of a channel carries its sequence in flags */
+        ck_assert_int_eq(xrdp_channel_sched_add(sched, class_id, channel_id,
+                                                chunk_data, CHUNK,
+                                                CHUNK, index), 0);
+    }
+}
+
+/* returns the channel_id of the next chunk, -1 if none */
+static int
+next_channel(int now, int backlog)
+{
+    struct xrdp_channel_chunk *chunk;
+    int rv;
+
+    chunk = xrdp_channel_sched_next(sched, now, backlog);
+    if (chunk == NULL)
+    {
+        return -1;
+    }
+    rv = chunk->channel_id;
+    g_free(chunk);
+    return rv;
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_channel_sched__class_by_name)
+{
+    ck_assert_int_eq(xrdp_channel_sched_class("rail"),
+                     XRDP_CHAN_CLASS_INTERACTIVE);
+    ck_assert_int_eq(xrdp_channel_sched_class("rail_wi"),
+                     XRDP_CHAN_CLASS_INTERACTIVE);
+    ck_assert_int_eq(xrdp_channel_sched_class("rdpsnd"),
+                     XRDP_CHAN_CLASS_AUDIO);
+    ck_assert_int_eq(xrdp_channel_sched_class("rdpdr"),
+                     XRDP_CHAN_CLASS_BULK);
+    ck_assert_int_eq(xrdp_channel_sched_class("cliprdr"),
+                     XRDP_CHAN_CLASS_BULK);
+    ck_assert_int_eq(xrdp_channel_sched_class("drdynvc"),
+                     XRDP_CHAN_CLASS_BULK);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_channel_sched__backlog_holds_all_but_interactive)
+{
+    int backlog = 128 * 1024;
+
+    ck_assert_int_eq(xrdp_channel_sched_can_send(sched, XRDP_CHAN_CLASS_BULK,
+                     CHUNK, 0, backlog), 0);
+    add_chunks(XRDP_CHAN_CLASS_BULK, 3, 2);
+    add_chunks(XRDP_CHAN_CLASS_INTERACTIVE, 1, 1);
+
+    /* nothing goes direct while anything is queued */
+    ck_assert_int_eq(xrdp_channel_sched_can_send(sched,
+                     XRDP_CHAN_CLASS_INTERACTIVE,
+                     CHUNK, 0, 0), 0);
+
+    ck_assert_int_eq(next_channel(0, backlog), 1);
+    ck_assert_int_eq(next_channel(0, backlog), -1);
+    ck_assert_int_gt(xrdp_channel_sched_get_timeout(sched, 0, backlog), 0);
+
+    /* the client caught up */
+    ck_assert_int_eq(xrdp_channel_sched_get_timeout(sched, 0, 0), 0);
+    ck_assert_int_eq(next_channel(0, 0), 3);
+    ck_assert_int_eq(next_channel(0, 0), 3);
+    ck_assert_int_eq(next_channel(0, 0), -1);
+    ck_assert_int_eq(xrdp_channel_sched_get_timeout(sched, 0, 0), -1);
+    ck_assert_int_eq(sched->queued_bytes, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_channel_sched__weighted_share)
+{
+    int counts[8] = { 0 };
+    int index;
+    int channel_id;
+
+    add_chunks(XRDP_CHAN_CLASS_BULK, 3, 32);
+    add_chunks(XRDP_CHAN_CLASS_AUDIO, 2, 32);
+
+    /* one full round is 4 audio and 1 bulk */
+    for (index = 0; index < 10; index++)
+    {
+        channel_id = next_channel(0, 0);
+        ck_assert_int_ge(channel_id, 2);
+        counts[channel_id]++;
+    }
+    ck_assert_int_eq(counts[2], 8);
+    ck_assert_int_eq(counts[3], 2);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_channel_sched__channel_order_kept)
+{
+    struct xrdp_channel_chunk *chunk;
+    int expected[4] = { 0 };
+
+    add_chunks(XRDP_CHAN_CLASS_BULK, 2, 10);
+    add_chunks(XRDP_CHAN_CLASS_BULK, 3, 10);
+    add_chunks(XRDP_CHAN_CLASS_AUDIO, 1, 10);
+    while ((chunk = xrdp_channel_sched_next(sched, 0, 0)) != NULL)
+    {
+        ck_assert_int_eq(chunk->flags, expected[chunk->channel_id]);
+        expected[chunk->channel_id]++;
+        g_free(chunk);
+    }
+    ck_assert_int_eq(expected[1], 10);
+    ck_assert_int_eq(expected[2], 10);
+    ck_assert_int_eq(expected[3], 10);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_channel_sched__rate_limit)
+{
+    int sent;
+    int timeout;
+    int now;
+
+    xrdp_channel_sched_delete(sched);
+    client_info.channel_qos_rate[XRDP_CHAN_CLASS_BULK] = 16 * 1024;
+    sched = xrdp_channel_sched_create(&client_info);
+    add_chunks(XRDP_CHAN_CLASS_BULK, 3, 64);
+
+    /* the burst goes at once, then the class waits for tokens */
+    now = sched->classes[XRDP_CHAN_CLASS_BULK].last_refill;
+    sent = 0;
+    while (next_channel(now, 0) == 3)
+    {
+        sent++;
+    }
+    ck_assert_int_eq(sent, (64 * 1024 + CHUNK - 1) / CHUNK);
+    timeout = xrdp_channel_sched_get_timeout(sched, now, 0);
+    ck_assert_int_gt(timeout, 0);
+    ck_assert_int_le(timeout, 1000);
+
+    /* a second later there is room for another 16 KB */
+    now += 1000;
+    sent = 0;
+    while (next_channel(now, 0) == 3)
+    {
+        sent++;
+    }
+    ck_assert_int_ge(sent, 9);
+    ck_assert_int_le(sent, 11);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_channel_sched(void)
+{
+    Suite *s;
+    TCase *tc_sched;
+
+    s = suite_create("test_xrdp_channel_sched");
+
+    tc_sched = tcase_create("xrdp_channel_sched");
+    tcase_add_checked_fixture(tc_sched, setup, teardown);
+    tcase_add_test(tc_sched, test_xrdp_channel_sched__class_by_name);
+    tcase_add_test(tc_sched,
+                   test_xrdp_channel_sched__backlog_holds_all_but_interactive);
+    tcase_add_test(tc_sched, test_xrdp_channel_sched__weighted_share);
+    tcase_add_test(tc_sched, test_xrdp_channel_sched__channel_order_kept);
+    tcase_add_test(tc_sched, test_xrdp_channel_sched__rate_limit);
+
+    suite_add_tcase(s, tc_sched);
+
+    return s;
+}
@@ -0,0 +1,147 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpegdi.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+static struct xrdp_rdp *rdp_layer;
+static struct xrdp_orders *plain;
+static struct xrdp_orders *batched;
+
+/* instead of xrdp_orders_init(), which needs a connected rdp layer */
+static void
+begin_orders(struct xrdp_orders *orders)
+{
+    init_stream(orders->out_s, 0);
+    orders->order_level = 1;
+    orders->order_count = 0;
+    orders->order_count_ptr = orders->out_s->p;
+    out_uint8s(orders->out_s, 2);
+}
+
+/* encode what the batcher is holding, returns bytes encoded */
+static int
+end_orders(struct xrdp_orders *orders)
+{
+    ck_assert_int_eq(xrdp_orders_batch_flush(orders), 0);
+    return (int) (orders->out_s->p - orders->order_count_ptr);
+}
+
+static void setup(void)
+{
+    rdp_layer = (struct xrdp_rdp *)g_malloc(sizeof(struct xrdp_rdp), 1);
+    rdp_layer->client_info.max_fastpath_frag_bytes = 16 * 1024;
+    plain = xrdp_orders_create(NULL, rdp_layer);
+    rdp_layer->client_info.order_batching = 1;
+    rdp_layer->client_info.order_stats = 1;
+    batched = xrdp_orders_create(NULL, rdp_layer);
+    begin_orders(plain);
+    begin_orders(batched);
+}
+
+static void teardown(void)
+{
+    xrdp_orders_delete(batched);
+    xrdp_orders_delete(plain);
+    g_free(rdp_layer);
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_batch__overlapping_orders_keep_order)
+{
+    struct xrdp_pen pen = { 0, 1, 0x123456 };
+    int plain_bytes;
+    int batched_bytes;
+
+    /* every order touches the first rect, nothing can move */
+    xrdp_orders_rect(plain, 10, 10, 100, 100, 0xff0000, NULL);
+    xrdp_orders_line(plain, 1, 20, 20, 50, 50, 0x0d, 0, &pen, NULL);
+    xrdp_orders_rect(plain, 40, 40, 10, 10, 0x00ff00, NULL);
+    xrdp_orders_line(plain, 1, 30, 30, 60, 45, 0x0d, 0, &pen, NULL);
+
+    xrdp_orders_rect(batched, 10, 10, 100, 100, 0xff0000, NULL);
+    xrdp_orders_line(batched, 1, 20, 20, 50, 50, 0x0d, 0, &pen, NULL);
+    xrdp_orders_rect(batched, 40, 40, 10, 10, 0x00ff00, NULL);
+    xrdp_orders_line(batched, 1, 30, 30, 60, 45, 0x0d, 0, &pen, NULL);
+
+    /* nothing encoded until the batch is flushed */
+    ck_assert_int_eq(batched->order_count, 0);
+
+    plain_bytes = end_orders(plain);
+    batched_bytes = end_orders(batched);
+    ck_assert_int_eq(batched->order_count, 4);
+    ck_assert_int_eq(plain_bytes, batched_bytes);
+    ck_assert_mem_eq(plain->order_count_ptr, batched->order_count_ptr,
+                     plain_bytes);
+    ck_assert_int_eq(batched->batch->moved, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_batch__independent_orders_are_grouped)
+{
+    struct xrdp_pen pen = { 0, 1, 0x123456 };
+    int index;
+    int plain_bytes;
+    int batched_bytes;
+
+    /* rects down the left, lines down the right, interleaved */
+    for (index = 0; index < 16; index++)
+    {
+        xrdp_orders_rect(plain, 0, index * 20, 100, 10, 0xff0000, NULL);
+        xrdp_orders_line(plain, 1, 500, index * 20, 600, index * 20 + 10,
+                         0x0d, 0, &pen, NULL);
+        xrdp_orders_rect(batched, 0, index * 20, 100, 10, 0xff0000, NULL);
+        xrdp_orders_line(batched, 1, 500, index * 20, 600, index * 20 + 10,
+                         0x0d, 0, &pen, NULL);
+    }
+    plain_bytes = end_orders(plain);
+    batched_bytes = end_orders(batched);
+    ck_assert_int_eq(plain->order_count, 32);
+    ck_assert_int_eq(batched->order_count, 32);
+    ck_assert_int_gt(batched->batch->moved, 0);
+    ck_assert_int_lt(batched_bytes, plain_bytes);
+    ck_assert_int_eq(batched->stats->count[RDP_ORDER_RECT], 16);
+    ck_assert_int_eq(batched->stats->count[RDP_ORDER_LINE], 16);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_batch__direct_order_flushes_queue)
+{
+    struct xrdp_rect clip = { 0, 0, 50, 50 };
+
+    xrdp_orders_rect(batched, 0, 0, 100, 100, 0xff0000, &clip);
+    xrdp_orders_screen_blt(batched, 200, 200, 10, 10, 0, 0, 0xcc, NULL);
+    ck_assert_int_eq(batched->batch->count, 2);
+
+    /* anything not batched, a switch surface here, goes after the queue */
+    xrdp_orders_send_switch_os_surface(batched, 0xffff);
+    ck_assert_int_eq(batched->batch->count, 0);
+    ck_assert_int_eq(batched->order_count, 3);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_orders_batch(void)
+{
+    Suite *s;
+    TCase *tc_batch;
+
+    s = suite_create("test_xrdp_orders_batch");
+
+    tc_batch = tcase_create("xrdp_orders_batch");
+    tcase_add_checked_fixture(tc_batch, setup, teardown);
+    tcase_add_test(tc_batch, test_xrdp_orders_batch__overlapping_orders_keep_order);
+    tcase_add_test(tc_batch, test_xrdp_orders_batch__independent_orders_are_grouped);
+    tcase_add_test(tc_batch, test_xrdp_orders_batch__direct_order_flushes_queue);
+
+    suite_add_tcase(s, tc_batch);
+
+    return s;
+}
@@ -0,0 +1,211 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+#include "ms-rdpegdi.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+static struct xrdp_rdp *rdp_layer;
+static struct xrdp_orders *orders;
+
+/* instead of xrdp_orders_init(), which needs a connected rdp layer */
+static void
+begin_orders(struct xrdp_orders *self)
+{
+    init_stream(self->out_s, 0);
+    self->order_level = 1;
+    self->order_count = 0;
+    self->order_count_ptr = self->out_s->p;
+    out_uint8s(self->out_s, 2);
+}
+
+/* returns bytes encoded, without the order count */
+static int
+orders_size(struct xrdp_orders *self)
+{
+    ck_assert_int_eq(xrdp_orders_batch_flush(self), 0);
+    return (int) (self->out_s->p - self->order_count_ptr) - 2;
+}
+
+static struct xrdp_orders *
+create_orders(int order_batching)
+{
+    struct xrdp_orders *self;
+
+    rdp_layer->client_info.order_batching = order_batching;
+    self = xrdp_orders_create(NULL, rdp_layer);
+    begin_orders(self);
+    return self;
+}
+
+static void setup(void)
+{
+    rdp_layer = (struct xrdp_rdp *)g_malloc(sizeof(struct xrdp_rdp), 1);
+    rdp_layer->client_info.max_fastpath_frag_bytes = 16 * 1024;
+    rdp_layer->client_info.order_stats = 1;
+    rdp_layer->client_info.orders[TS_NEG_DSTBLT_INDEX] = 1;
+    rdp_layer->client_info.orders[TS_NEG_PATBLT_INDEX] = 1;
+    rdp_layer->client_info.orders[TS_NEG_SCRBLT_INDEX] = 1;
+    rdp_layer->client_info.orders[TS_NEG_LINETO_INDEX] = 1;
+    rdp_layer->client_info.orders[TS_NEG_MULTIDSTBLT_INDEX] = 1;
+    rdp_layer->client_info.orders[TS_NEG_MULTIPATBLT_INDEX] = 1;
+    rdp_layer->client_info.orders[TS_NEG_MULTISCRBLT_INDEX] = 1;
+    rdp_layer->client_info.orders[TS_NEG_MULTIOPAQUERECT_INDEX] = 1;
+    rdp_layer->client_info.orders[TS_NEG_POLYLINE_INDEX] = 1;
+    orders = create_orders(0);
+}
+
+static void teardown(void)
+{
+    xrdp_orders_delete(orders);
+    g_free(rdp_layer);
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_multi__multi_rect_encoding)
+{
+    static const struct xrdp_rect rects[2] =
+    {
+        { 10, 10, 20, 20 },
+        { 30, 10, 40, 20 }
+    };
+    static const unsigned char expected[] =
+    {
+        TS_STANDARD | TS_TYPE_CHANGE | TS_DELTA_COORDINATES,
+        RDP_ORDER_MULTIOPAQUERECT,
+        0xff, 0x01,             /* present */
+        10, 10, 30, 10,         /* extents, as deltas from 0 */
+        0x33, 0x22, 0x11,       /* red, green, blue */
+        2,                      /* nDeltaEntries */
+        6, 0,                   /* cbData */
+        0x07,                   /* zeroBits, the second rect only moves */
+        10, 10, 10, 10,         /* left, top, width, height */
+        20                      /* left delta */
+    };
+
+    ck_assert_int_eq(xrdp_orders_multi_rect(orders, 0x112233, rects, 2), 0);
+    ck_assert_int_eq(orders->order_count, 1);
+    ck_assert_int_eq(orders_size(orders), sizeof(expected));
+    ck_assert_mem_eq(orders->order_count_ptr + 2, expected,
+                     sizeof(expected));
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_multi__fallback_without_client_support)
+{
+    struct xrdp_orders *single;
+    struct xrdp_rect rects[3];
+    int index;
+    int size;
+
+    rdp_layer->client_info.orders[TS_NEG_MULTIDSTBLT_INDEX] = 0;
+    for (index = 0; index < 3; index++)
+    {
+        rects[index].left = index * 300;
+        rects[index].top = 50;
+        rects[index].right = index * 300 + 40;
+        rects[index].bottom = 90;
+    }
+    single = create_orders(0);
+    for (index = 0; index < 3; index++)
+    {
+        xrdp_orders_dest_blt(single, rects[index].left, rects[index].top,
+                             40, 40, 0x55, NULL);
+    }
+    ck_assert_int_eq(xrdp_orders_multi_dest_blt(orders, 0x55, rects, 3), 0);
+    ck_assert_int_eq(orders->order_count, 3);
+    size = orders_size(orders);
+    ck_assert_int_eq(size, orders_size(single));
+    ck_assert_mem_eq(orders->order_count_ptr, single->order_count_ptr, size);
+    xrdp_orders_delete(single);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_multi__rects_split_and_smaller)
+{
+    struct xrdp_orders *single;
+    struct xrdp_brush brush;
+    struct xrdp_rect rects[100];
+    int index;
+
+    g_memset(&brush, 0, sizeof(brush));
+    brush.style = 3;
+    brush.pattern[0] = 0xaa;
+    single = create_orders(0);
+    for (index = 0; index < 100; index++)
+    {
+        /* a column of text lines, far apart enough to need 2 byte deltas */
+        rects[index].left = 8 + (index & 1) * 400;
+        rects[index].top = index * 16;
+        rects[index].right = rects[index].left + 300;
+        rects[index].bottom = rects[index].top + 14;
+        xrdp_orders_pat_blt(single, rects[index].left, rects[index].top,
+                            300, 14, 0xf0, 0, 0xffffff, &brush, NULL);
+    }
+    ck_assert_int_eq(xrdp_orders_multi_pat_blt(orders, 0xf0, 0, 0xffffff,
+                     &brush, rects, 100), 0);
+    /* 45 + 45 + 10 */
+    ck_assert_int_eq(orders->order_count, 3);
+    ck_assert_int_eq(orders->stats->count[RDP_ORDER_MULTIPATBLT], 3);
+    ck_assert_int_lt(orders_size(orders), orders_size(single));
+    xrdp_orders_delete(single);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_orders_multi__batched_lines_become_polyline)
+{
+    struct xrdp_orders *batched;
+    struct xrdp_pen pen = { 0, 1, 0x00ff00 };
+    struct xrdp_pen dashed = { 1, 1, 0x00ff00 };
+
+    batched = create_orders(1);
+    /* a box outline and a dashed line that can't join it */
+    xrdp_orders_line(batched, 1, 0, 0, 10, 0, 0x0d, 0, &pen, NULL);
+    xrdp_orders_line(batched, 1, 10, 0, 10, 10, 0x0d, 0, &pen, NULL);
+    xrdp_orders_line(batched, 1, 100, 100, 200, 200, 0x0d, 0, &dashed, NULL);
+    xrdp_orders_line(batched, 1, 10, 10, 0, 10, 0x0d, 0, &pen, NULL);
+    xrdp_orders_line(batched, 1, 0, 10, 0, 0, 0x0d, 0, &pen, NULL);
+    orders_size(batched);
+    ck_assert_int_eq(batched->order_count, 2);
+    ck_assert_int_eq(batched->stats->count[RDP_ORDER_POLYLINE], 1);
+    ck_assert_int_eq(batched->stats->count[RDP_ORDER_LINE], 1);
+    xrdp_orders_delete(batched);
+
+    rdp_layer->client_info.orders[TS_NEG_POLYLINE_INDEX] = 0;
+    batched = create_orders(1);
+    xrdp_orders_line(batched, 1, 0, 0, 10, 0, 0x0d, 0, &pen, NULL);
+    xrdp_orders_line(batched, 1, 10, 0, 10, 10, 0x0d, 0, &pen, NULL);
+    orders_size(batched);
+    ck_assert_int_eq(batched->order_count, 2);
+    ck_assert_int_eq(batched->stats->count[RDP_ORDER_POLYLINE], 0);
+    xrdp_orders_delete(batched);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_orders_multi(void)
+{
+    Suite *s;
+    TCase *tc_multi;
+
+    s = suite_create("test_xrdp_orders_multi");
+
+    tc_multi = tcase_create("xrdp_orders_multi");
+    tcase_add_checked_fixture(tc_multi, setup, teardown);
+    tcase_add_test(tc_multi, test_xrdp_orders_multi__multi_rect_encoding);
+    tcase_add_test(tc_multi, test_xrdp_orders_multi__fallback_without_client_support);
+    tcase_add_test(tc_multi, test_xrdp_orders_multi__rects_split_and_smaller);
+    tcase_add_test(tc_multi, test_xrdp_orders_multi__batched_lines_become_polyline);
+
+    suite_add_tcase(s, tc_multi);
+
+    return s;
+}
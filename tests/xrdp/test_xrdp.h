@@ -8,5 +8,9 @@ Suite *make_suite_test_keymap_load(void);
 Suite *make_suite_egfx_base_functions(void);
 Suite *make_suite_region(void);
 Suite *make_suite_tconfig_load_gfx(void);
+Suite *make_suite_frame_trace(void);
+Suite *make_suite_frame_sched(void);
+Suite *make_suite_metrics(void);
+Suite *make_suite_rate_ctl(void);
 
 #endif /* TEST_XRDP_H */
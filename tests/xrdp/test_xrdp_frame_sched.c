@@ -0,0 +1,337 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "arch.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "trans.h"
+#include "xrdp.h"
+#include "xrdp_frame_sched.h"
+#include "test_xrdp.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#define WIDTH 64
+#define HEIGHT 32
+
+/* pixman_region_not_empty() is wrapped in test_xrdp_region.c, so every
+   damage check made by the scheduler takes one queued result */
+#define EXPECT_DAMAGE(_not_empty) \
+    do \
+    { \
+        expect_any(__wrap_pixman_region_not_empty, region); \
+        will_return(__wrap_pixman_region_not_empty, (_not_empty)); \
+    } while (0)
+
+static struct xrdp_mm *g_mm;
+static struct xrdp_frame_sched *g_fs;
+static int g_pixels[16 * 16];
+
+/******************************************************************************/
+static int
+setup(void **state)
+{
+    struct xrdp_wm *wm;
+    int index;
+
+    wm = g_new0(struct xrdp_wm, 1);
+    wm->xrdp_config = g_new0(struct xrdp_config, 1);
+    wm->client_info = g_new0(struct xrdp_client_info, 1);
+    wm->session = g_new0(struct xrdp_session, 1);
+    wm->screen = xrdp_bitmap_create(WIDTH, HEIGHT, 32, WND_TYPE_BITMAP, wm);
+    g_mm = g_new0(struct xrdp_mm, 1);
+    g_mm->wm = wm;
+    /* one frame a second, so a test never runs into the next frame */
+    g_fs = xrdp_frame_sched_create(g_mm, 1);
+    g_memset(g_fs->backing->data, 0, g_fs->backing->line_size * HEIGHT);
+    for (index = 0; index < 16 * 16; index++)
+    {
+        g_pixels[index] = 0x11223344;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+static int
+teardown(void **state)
+{
+    struct xrdp_wm *wm;
+
+    xrdp_frame_sched_delete(g_fs);
+    wm = g_mm->wm;
+    if (wm->session->trans != NULL)
+    {
+        free_stream(wm->session->trans->wait_s);
+        wm->session->trans->wait_s = NULL;
+        trans_delete(wm->session->trans);
+    }
+    xrdp_bitmap_delete(wm->screen);
+    g_free(wm->session);
+    g_free(wm->client_info);
+    g_free(wm->xrdp_config);
+    g_free(wm);
+    g_free(g_mm);
+    return 0;
+}
+
+/******************************************************************************/
+static int
+backing_pixel(int x, int y)
+{
+    return ((int *)(g_fs->backing->data))[y * WIDTH + x];
+}
+
+/******************************************************************************/
+/* damage older than the frame interval, so only back-pressure and
+   frame acks can hold it */
+static void
+add_due_damage(void)
+{
+    xrdp_frame_sched_add_rect(g_fs, (const char *)g_pixels, 16, 16,
+                              0, 0, 16, 16, 0, 0);
+    g_fs->last_flush_time = g_time3() - g_fs->frame_interval;
+}
+
+/******************************************************************************/
+static void
+test_frame_sched__create(void **state)
+{
+    assert_non_null(g_fs);
+    assert_int_equal(g_fs->frame_interval, 1000);
+    assert_int_equal(g_fs->max_wait_bytes, 0);
+    assert_int_equal(g_fs->backing->width, WIDTH);
+    assert_int_equal(g_fs->backing->height, HEIGHT);
+}
+
+/******************************************************************************/
+static void
+test_frame_sched__add_rect_clipped(void **state)
+{
+    struct xrdp_rect rect;
+
+    /* 16x16 at 56, -4 leaves 8x12 on the screen */
+    assert_int_equal(xrdp_frame_sched_add_rect(g_fs, (const char *)g_pixels,
+                     16, 16, 56, -4, 16, 16, 0, 0), 0);
+    assert_int_equal(xrdp_region_get_rect(g_fs->damage, 0, &rect), 0);
+    assert_int_equal(rect.left, 56);
+    assert_int_equal(rect.top, 0);
+    assert_int_equal(rect.right, WIDTH);
+    assert_int_equal(rect.bottom, 12);
+    assert_int_not_equal(xrdp_region_get_rect(g_fs->damage, 1, &rect), 0);
+    assert_int_equal(backing_pixel(56, 0), 0x11223344);
+    assert_int_equal(backing_pixel(WIDTH - 1, 11), 0x11223344);
+    assert_int_equal(backing_pixel(55, 0), 0);
+    assert_int_equal(backing_pixel(56, 12), 0);
+
+    /* nothing on the screen adds nothing */
+    assert_int_equal(xrdp_frame_sched_add_rect(g_fs, (const char *)g_pixels,
+                     16, 16, WIDTH, 0, 16, 16, 0, 0), 0);
+    assert_int_not_equal(xrdp_region_get_rect(g_fs->damage, 1, &rect), 0);
+}
+
+/******************************************************************************/
+static void
+test_frame_sched__add_rects(void **state)
+{
+    const short rects[8] = { 0, 0, 4, 4, 8, 8, 4, 4 };
+    struct xrdp_rect rect;
+
+    assert_int_equal(xrdp_frame_sched_add_rects(g_fs, (const char *)g_pixels,
+                     16, 16, rects, 2), 0);
+    assert_int_equal(g_fs->frames_in, 1);
+    assert_int_equal(xrdp_region_get_rect(g_fs->damage, 0, &rect), 0);
+    assert_int_equal(xrdp_region_get_rect(g_fs->damage, 1, &rect), 0);
+    assert_int_equal(backing_pixel(3, 3), 0x11223344);
+    assert_int_equal(backing_pixel(4, 4), 0);
+    assert_int_equal(backing_pixel(11, 11), 0x11223344);
+}
+
+/******************************************************************************/
+static void
+test_frame_sched__paced(void **state)
+{
+    int timeout;
+
+    /* nothing to send, the timeout is left alone */
+    EXPECT_DAMAGE(0);
+    assert_int_equal(xrdp_frame_sched_check(g_fs), 0);
+    timeout = -1;
+    EXPECT_DAMAGE(0);
+    xrdp_frame_sched_get_timeout(g_fs, &timeout);
+    assert_int_equal(timeout, -1);
+
+    /* just flushed, the damage waits for the next frame */
+    xrdp_frame_sched_add_rect(g_fs, (const char *)g_pixels, 16, 16,
+                              0, 0, 16, 16, 0, 0);
+    g_fs->last_flush_time = g_time3();
+    EXPECT_DAMAGE(1);
+    assert_int_equal(xrdp_frame_sched_check(g_fs), 0);
+    assert_int_equal(g_fs->frames_out, 0);
+    assert_int_equal(g_fs->flushes_deferred, 0);
+
+    EXPECT_DAMAGE(1);
+    xrdp_frame_sched_get_timeout(g_fs, &timeout);
+    assert_in_range(timeout, 1, 1000);
+    /* a shorter timeout is kept */
+    timeout = 0;
+    EXPECT_DAMAGE(1);
+    xrdp_frame_sched_get_timeout(g_fs, &timeout);
+    assert_int_equal(timeout, 0);
+
+    /* once the interval is up it wants to run at once */
+    g_fs->last_flush_time -= g_fs->frame_interval;
+    timeout = -1;
+    EXPECT_DAMAGE(1);
+    xrdp_frame_sched_get_timeout(g_fs, &timeout);
+    assert_int_equal(timeout, 0);
+}
+
+/******************************************************************************/
+static void
+test_frame_sched__held_by_frame_acks(void **state)
+{
+    struct xrdp_client_info *client_info;
+    int timeout;
+
+    client_info = g_mm->wm->client_info;
+    client_info->use_frame_acks = 1;
+    client_info->max_unacknowledged_frame_count = 2;
+    g_fs->frame_id_sent = 2;
+    g_fs->frames_in_flight = 2;
+    add_due_damage();
+
+    EXPECT_DAMAGE(1);
+    assert_int_equal(xrdp_frame_sched_check(g_fs), 0);
+    assert_int_equal(g_fs->frames_out, 0);
+    assert_int_equal(g_fs->flushes_deferred, 1);
+    /* blocked, the main loop only polls once a frame */
+    timeout = -1;
+    EXPECT_DAMAGE(1);
+    xrdp_frame_sched_get_timeout(g_fs, &timeout);
+    assert_int_equal(timeout, g_fs->frame_interval);
+
+    /* an ack for the first frame opens the window again */
+    assert_int_equal(xrdp_frame_sched_frame_ack(g_fs, 1), 0);
+    assert_int_equal(g_fs->frames_in_flight, 1);
+    timeout = -1;
+    EXPECT_DAMAGE(1);
+    xrdp_frame_sched_get_timeout(g_fs, &timeout);
+    assert_int_equal(timeout, 0);
+}
+
+/******************************************************************************/
+static void
+test_frame_sched__held_by_backlog(void **state)
+{
+    struct trans *trans;
+    struct stream *s;
+    int timeout;
+
+    trans = trans_create(TRANS_MODE_TCP, 8192, 8192);
+    make_stream(s);
+    init_stream(s, 8192);
+    s->end = s->p + 4096;
+    trans->wait_s = s;
+    g_mm->wm->session->trans = trans;
+    g_fs->max_wait_bytes = 1024;
+    add_due_damage();
+
+    EXPECT_DAMAGE(1);
+    assert_int_equal(xrdp_frame_sched_check(g_fs), 0);
+    assert_int_equal(g_fs->frames_out, 0);
+    assert_int_equal(g_fs->flushes_deferred, 1);
+
+    /* once the backlog is under the limit it is due */
+    s->end = s->p + 1024;
+    timeout = -1;
+    EXPECT_DAMAGE(1);
+    xrdp_frame_sched_get_timeout(g_fs, &timeout);
+    assert_int_equal(timeout, 0);
+}
+
+/******************************************************************************/
+static void
+test_frame_sched__frame_ack(void **state)
+{
+    g_fs->frame_id_sent = 5;
+    g_fs->frames_in_flight = 5;
+
+    xrdp_frame_sched_frame_ack(g_fs, 3);
+    assert_int_equal(g_fs->frame_id_acked, 3);
+    assert_int_equal(g_fs->frames_in_flight, 2);
+    /* an old ack doesn't go back */
+    xrdp_frame_sched_frame_ack(g_fs, 2);
+    assert_int_equal(g_fs->frame_id_acked, 3);
+    assert_int_equal(g_fs->frames_in_flight, 2);
+    /* an id we never sent acks everything */
+    xrdp_frame_sched_frame_ack(g_fs, 9);
+    assert_int_equal(g_fs->frame_id_acked, 5);
+    assert_int_equal(g_fs->frames_in_flight, 0);
+
+    g_fs->frame_id_sent = 7;
+    g_fs->frames_in_flight = 2;
+    xrdp_frame_sched_frame_ack(g_fs, -1);
+    assert_int_equal(g_fs->frame_id_acked, 7);
+    assert_int_equal(g_fs->frames_in_flight, 0);
+}
+
+/******************************************************************************/
+static void
+test_frame_sched__null(void **state)
+{
+    int timeout;
+
+    timeout = -1;
+    xrdp_frame_sched_get_timeout(NULL, &timeout);
+    assert_int_equal(timeout, -1);
+    assert_int_equal(xrdp_frame_sched_check(NULL), 0);
+    assert_int_equal(xrdp_frame_sched_flush(NULL), 0);
+    assert_int_equal(xrdp_frame_sched_frame_ack(NULL, 1), 0);
+    xrdp_frame_sched_delete(NULL);
+}
+
+/******************************************************************************/
+START_TEST(test_frame_sched__all)
+{
+    const struct CMUnitTest tests[] =
+    {
+        cmocka_unit_test_setup_teardown(test_frame_sched__create,
+                                        setup, teardown),
+        cmocka_unit_test_setup_teardown(test_frame_sched__add_rect_clipped,
+                                        setup, teardown),
+        cmocka_unit_test_setup_teardown(test_frame_sched__add_rects,
+                                        setup, teardown),
+        cmocka_unit_test_setup_teardown(test_frame_sched__paced,
+                                        setup, teardown),
+        cmocka_unit_test_setup_teardown(test_frame_sched__held_by_frame_acks,
+                                        setup, teardown),
+        cmocka_unit_test_setup_teardown(test_frame_sched__held_by_backlog,
+                                        setup, teardown),
+        cmocka_unit_test_setup_teardown(test_frame_sched__frame_ack,
+                                        setup, teardown),
+        cmocka_unit_test(test_frame_sched__null)
+    };
+
+    ck_assert_int_eq(cmocka_run_group_tests(tests, NULL, NULL), 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_frame_sched(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("FrameSched");
+
+    tc = tcase_create("frame_sched");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_frame_sched__all);
+
+    return s;
+}
@@ -0,0 +1,261 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "arch.h"
+#include "os_calls.h"
+#include "xrdp_client_info.h"
+#include "xrdp_frame_trace.h"
+#include "test_xrdp.h"
+
+#define WIDTH 100
+#define HEIGHT 70
+
+static char g_trace_name[256];
+static int g_screen[WIDTH * HEIGHT];
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    int index;
+
+    g_snprintf(g_trace_name, sizeof(g_trace_name),
+               "/tmp/test_xrdp_frame_trace_%d.trace", g_getpid());
+    for (index = 0; index < WIDTH * HEIGHT; index++)
+    {
+        g_screen[index] = index;
+    }
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    g_file_delete(g_trace_name);
+}
+
+/******************************************************************************/
+static int
+pixel(const struct xrdp_frame_trace_frame *frame, int x, int y)
+{
+    return ((const int *) (frame->data + y * frame->stride))[x];
+}
+
+/******************************************************************************/
+START_TEST(test_frame_trace__round_trip)
+{
+    struct xrdp_frame_trace *trace;
+    struct xrdp_frame_trace_frame *frame;
+    static const short drects[] = { 0, 0, 20, 10, 50, 50, 5, 5 };
+    static const short crects[] = { 10, 5, 8, 4 };
+
+    trace = xrdp_frame_trace_create(g_trace_name, WIDTH, HEIGHT,
+                                    CC_SIMPLE, XRDP_a8r8g8b8);
+    ck_assert_ptr_ne(trace, NULL);
+    ck_assert_int_eq(xrdp_frame_trace_add_frame(trace, 10, 1,
+                     drects, 2, crects, 1,
+                     (char *) g_screen, WIDTH * 4), 0);
+    g_screen[6 * WIDTH + 12] = -1;
+    ck_assert_int_eq(xrdp_frame_trace_add_frame(trace, 45, 2,
+                     crects, 1, crects, 1,
+                     (char *) g_screen, WIDTH * 4), 0);
+    xrdp_frame_trace_delete(trace);
+
+    trace = xrdp_frame_trace_open(g_trace_name);
+    ck_assert_ptr_ne(trace, NULL);
+    ck_assert_int_eq(xrdp_frame_trace_get_capture_code(trace), CC_SIMPLE);
+    ck_assert_int_eq(xrdp_frame_trace_get_capture_format(trace),
+                     XRDP_a8r8g8b8);
+
+    ck_assert_int_eq(xrdp_frame_trace_read(trace, &frame), 0);
+    ck_assert_ptr_ne(frame, NULL);
+    ck_assert_int_eq(frame->width, WIDTH);
+    ck_assert_int_eq(frame->height, HEIGHT);
+    ck_assert_int_eq(frame->stride, 128 * 4);
+    ck_assert_int_eq(frame->time_ms, 10);
+    ck_assert_int_eq(frame->frame_id, 1);
+    ck_assert_int_eq(frame->num_drects, 2);
+    ck_assert_int_eq(frame->drects[4], 50);
+    ck_assert_int_eq(frame->drects[7], 5);
+    ck_assert_int_eq(frame->num_crects, 1);
+    ck_assert_int_eq(frame->crects[0], 10);
+    ck_assert_int_eq(frame->crects[3], 4);
+    /* only the copy rect is stored */
+    ck_assert_int_eq(pixel(frame, 10, 5), 5 * WIDTH + 10);
+    ck_assert_int_eq(pixel(frame, 17, 8), 8 * WIDTH + 17);
+    ck_assert_int_eq(pixel(frame, 0, 0), 0);
+    ck_assert_int_eq(pixel(frame, 18, 8), 0);
+
+    ck_assert_int_eq(xrdp_frame_trace_read(trace, &frame), 0);
+    ck_assert_ptr_ne(frame, NULL);
+    ck_assert_int_eq(frame->time_ms, 45);
+    ck_assert_int_eq(frame->frame_id, 2);
+    ck_assert_int_eq(pixel(frame, 12, 6), -1);
+    ck_assert_int_eq(pixel(frame, 10, 5), 5 * WIDTH + 10);
+
+    ck_assert_int_eq(xrdp_frame_trace_read(trace, &frame), 0);
+    ck_assert_ptr_eq(frame, NULL);
+    xrdp_frame_trace_delete(trace);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_frame_trace__clipped)
+{
+    struct xrdp_frame_trace *trace;
+    struct xrdp_frame_trace_frame *frame;
+    static const short rects[] =
+    {
+        -5, -5, 10, 10,
+        200, 0, 10, 10,
+        95, 65, 10, 10
+    };
+
+    trace = xrdp_frame_trace_create(g_trace_name, WIDTH, HEIGHT,
+                                    CC_SIMPLE, XRDP_a8r8g8b8);
+    ck_assert_int_eq(xrdp_frame_trace_add_frame(trace, 0, 0,
+                     rects, 3, rects, 3,
+                     (char *) g_screen, WIDTH * 4), 0);
+    xrdp_frame_trace_delete(trace);
+
+    trace = xrdp_frame_trace_open(g_trace_name);
+    ck_assert_int_eq(xrdp_frame_trace_read(trace, &frame), 0);
+    ck_assert_ptr_ne(frame, NULL);
+    ck_assert_int_eq(frame->num_crects, 2);
+    ck_assert_int_eq(frame->crects[0], 0);
+    ck_assert_int_eq(frame->crects[2], 5);
+    ck_assert_int_eq(frame->crects[4], 95);
+    ck_assert_int_eq(frame->crects[7], 5);
+    ck_assert_int_eq(pixel(frame, 99, 69), 69 * WIDTH + 99);
+    xrdp_frame_trace_delete(trace);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_frame_trace__records)
+{
+    struct xrdp_frame_trace *trace;
+    struct xrdp_frame_trace_record *rec;
+    static const short all[] = { 0, 0, WIDTH, HEIGHT };
+    static const char cmd[] = "\x0b\x00\x00\x00\x10\x00\x00\x00";
+    char data[10];
+
+    trace = xrdp_frame_trace_create(g_trace_name, WIDTH, HEIGHT,
+                                    CC_SIMPLE, XRDP_a8r8g8b8);
+    ck_assert_int_eq(xrdp_frame_trace_add_frame(trace, 0, 1, all, 1, all, 1,
+                     (char *) g_screen, WIDTH * 4), 0);
+    ck_assert_int_eq(xrdp_frame_trace_add_input(trace, 5, 0x8001,
+                     0x0800, 30, 40), 0);
+    g_screen[WIDTH + 1] = 7;
+    ck_assert_int_eq(xrdp_frame_trace_add_frame(trace, 10, 2, all, 1, all, 1,
+                     (char *) g_screen, WIDTH * 4), 0);
+    ck_assert_int_eq(xrdp_frame_trace_add_ack(trace, 20, 2), 0);
+    g_memset(data, 'a', sizeof(data));
+    ck_assert_int_eq(xrdp_frame_trace_add_egfx(trace, 30, cmd, 8,
+                     data, sizeof(data)), 0);
+    data[9] = 'b';
+    ck_assert_int_eq(xrdp_frame_trace_add_egfx(trace, 31, cmd, 8,
+                     data, sizeof(data)), 0);
+    xrdp_frame_trace_delete(trace);
+
+    /* the second frame only costs its changes */
+    ck_assert_int_lt(g_file_get_size(g_trace_name),
+                     WIDTH * HEIGHT * 4 + WIDTH * HEIGHT / 2);
+
+    trace = xrdp_frame_trace_open(g_trace_name);
+    ck_assert_int_eq(xrdp_frame_trace_read_record(trace, &rec), 0);
+    ck_assert_int_eq(rec->type, XRDP_FRAME_TRACE_FRAME);
+    ck_assert_int_eq(xrdp_frame_trace_read_record(trace, &rec), 0);
+    ck_assert_int_eq(rec->type, XRDP_FRAME_TRACE_INPUT);
+    ck_assert_int_eq(rec->time_ms, 5);
+    ck_assert_int_eq(rec->input_msg, 0x8001);
+    ck_assert_int_eq(rec->device_flags, 0x0800);
+    ck_assert_int_eq(rec->x, 30);
+    ck_assert_int_eq(rec->y, 40);
+    ck_assert_int_eq(xrdp_frame_trace_read_record(trace, &rec), 0);
+    ck_assert_int_eq(rec->type, XRDP_FRAME_TRACE_FRAME);
+    ck_assert_int_eq(pixel(rec->frame, 1, 1), 7);
+    ck_assert_int_eq(pixel(rec->frame, 2, 1), WIDTH + 2);
+    ck_assert_int_eq(pixel(rec->frame, WIDTH - 1, HEIGHT - 1),
+                     WIDTH * HEIGHT - 1);
+    ck_assert_int_eq(xrdp_frame_trace_read_record(trace, &rec), 0);
+    ck_assert_int_eq(rec->type, XRDP_FRAME_TRACE_ACK);
+    ck_assert_int_eq(rec->frame_id, 2);
+    ck_assert_int_eq(xrdp_frame_trace_read_record(trace, &rec), 0);
+    ck_assert_int_eq(rec->type, XRDP_FRAME_TRACE_EGFX);
+    ck_assert_int_eq(rec->cmd_bytes, 8);
+    ck_assert_int_eq(rec->cmd[0], 0x0b);
+    ck_assert_int_eq(rec->data_bytes, 10);
+    ck_assert_int_eq(g_memcmp(rec->data, "aaaaaaaaaa", 10), 0);
+    ck_assert_int_eq(xrdp_frame_trace_read_record(trace, &rec), 0);
+    ck_assert_int_eq(rec->type, XRDP_FRAME_TRACE_EGFX);
+    ck_assert_int_eq(rec->time_ms, 31);
+    ck_assert_int_eq(g_memcmp(rec->data, "aaaaaaaaab", 10), 0);
+    ck_assert_int_eq(xrdp_frame_trace_read_record(trace, &rec), 0);
+    ck_assert_ptr_eq(rec, NULL);
+    xrdp_frame_trace_delete(trace);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_frame_trace__truncated)
+{
+    struct xrdp_frame_trace *trace;
+    struct xrdp_frame_trace_frame *frame;
+    static const short rects[] = { 0, 0, 50, 50 };
+    int fd;
+    int size;
+    char *data;
+
+    trace = xrdp_frame_trace_create(g_trace_name, WIDTH, HEIGHT,
+                                    CC_SIMPLE, XRDP_a8r8g8b8);
+    xrdp_frame_trace_add_frame(trace, 0, 0, rects, 1, rects, 1,
+                               (char *) g_screen, WIDTH * 4);
+    xrdp_frame_trace_delete(trace);
+
+    /* cut the frame short */
+    size = g_file_get_size(g_trace_name);
+    data = g_new(char, size);
+    fd = g_file_open_ro(g_trace_name);
+    ck_assert_int_eq(g_file_read(fd, data, size), size);
+    g_file_close(fd);
+    g_file_delete(g_trace_name);
+    fd = g_file_open_ex(g_trace_name, 0, 1, 1, 1);
+    ck_assert_int_eq(g_file_write(fd, data, size - 100), size - 100);
+    g_file_close(fd);
+    g_free(data);
+
+    trace = xrdp_frame_trace_open(g_trace_name);
+    ck_assert_ptr_ne(trace, NULL);
+    ck_assert_int_ne(xrdp_frame_trace_read(trace, &frame), 0);
+    ck_assert_ptr_eq(frame, NULL);
+    xrdp_frame_trace_delete(trace);
+
+    /* not a trace */
+    fd = g_file_open_ex(g_trace_name, 0, 1, 1, 1);
+    g_file_write(fd, "not a frame trace", 17);
+    g_file_close(fd);
+    ck_assert_ptr_eq(xrdp_frame_trace_open(g_trace_name), NULL);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_frame_trace(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("FrameTrace");
+
+    tc = tcase_create("frame_trace");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_frame_trace__round_trip);
+    tcase_add_test(tc, test_frame_trace__clipped);
+    tcase_add_test(tc, test_frame_trace__records);
+    tcase_add_test(tc, test_frame_trace__truncated);
+
+    return s;
+}
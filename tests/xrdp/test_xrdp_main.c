@@ -59,6 +59,10 @@ int main (void)
     srunner_add_suite(sr, make_suite_egfx_base_functions());
     srunner_add_suite(sr, make_suite_region());
     srunner_add_suite(sr, make_suite_tconfig_load_gfx());
+    srunner_add_suite(sr, make_suite_frame_trace());
+    srunner_add_suite(sr, make_suite_frame_sched());
+    srunner_add_suite(sr, make_suite_metrics());
+    srunner_add_suite(sr, make_suite_rate_ctl());
 
     srunner_set_tap(sr, "-");
     srunner_run_all (sr, CK_ENV);
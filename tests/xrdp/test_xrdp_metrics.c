@@ -0,0 +1,193 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "arch.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "string_calls.h"
+#include "xrdp_metrics.h"
+#include "test_xrdp.h"
+
+static struct xrdp_metrics *g_metrics;
+static struct stream *g_s;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_metrics = xrdp_metrics_create();
+    make_stream(g_s);
+    init_stream(g_s, 32 * 1024);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xrdp_metrics_delete(g_metrics);
+    free_stream(g_s);
+}
+
+/******************************************************************************/
+/* formats the metrics into g_s as a string */
+static const char *
+format(void)
+{
+    init_stream(g_s, 0);
+    ck_assert_int_eq(xrdp_metrics_format(g_metrics, g_s), 0);
+    out_uint8(g_s, 0);
+    return g_s->data;
+}
+
+/******************************************************************************/
+static int
+has_line(const char *text, const char *line)
+{
+    char buf[256];
+
+    g_snprintf(buf, sizeof(buf), "\n%s\n", line);
+    return g_strstr(text, buf) != NULL;
+}
+
+/******************************************************************************/
+START_TEST(test_metrics__encode)
+{
+    const char *text;
+
+    xrdp_metrics_add_encode(g_metrics, "rfx", 3);
+    xrdp_metrics_add_encode(g_metrics, "rfx", 30);
+    xrdp_metrics_add_encode(g_metrics, "jpeg", 7000);
+    text = format();
+
+    ck_assert(has_line(text, "# TYPE xrdp_encode_seconds histogram"));
+    ck_assert(has_line(text,
+                       "xrdp_encode_seconds_bucket{codec=\"rfx\",le=\"0.002\"} 0"));
+    ck_assert(has_line(text,
+                       "xrdp_encode_seconds_bucket{codec=\"rfx\",le=\"0.005\"} 1"));
+    ck_assert(has_line(text,
+                       "xrdp_encode_seconds_bucket{codec=\"rfx\",le=\"0.050\"} 2"));
+    ck_assert(has_line(text,
+                       "xrdp_encode_seconds_bucket{codec=\"rfx\",le=\"+Inf\"} 2"));
+    ck_assert(has_line(text, "xrdp_encode_seconds_sum{codec=\"rfx\"} 0.033"));
+    ck_assert(has_line(text, "xrdp_encode_seconds_count{codec=\"rfx\"} 2"));
+    /* bigger than the last bound */
+    ck_assert(has_line(text,
+                       "xrdp_encode_seconds_bucket{codec=\"jpeg\",le=\"5.000\"} 0"));
+    ck_assert(has_line(text,
+                       "xrdp_encode_seconds_bucket{codec=\"jpeg\",le=\"+Inf\"} 1"));
+    ck_assert(has_line(text, "xrdp_encode_seconds_sum{codec=\"jpeg\"} 7.000"));
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_metrics__frame_ack)
+{
+    const char *text;
+
+    xrdp_metrics_frame_sent(g_metrics, 1, 1000);
+    xrdp_metrics_frame_sent(g_metrics, 2, 1010);
+    xrdp_metrics_frame_sent(g_metrics, 3, 1020);
+    /* covers 1 and 2, only 2 is timed */
+    ck_assert_int_eq(xrdp_metrics_frame_acked(g_metrics, 2, 1060), 50);
+    /* already covered */
+    ck_assert_int_eq(xrdp_metrics_frame_acked(g_metrics, 1, 1070), -1);
+    ck_assert_int_eq(xrdp_metrics_frame_acked(g_metrics, 3, 1021), 1);
+    text = format();
+
+    ck_assert(has_line(text, "xrdp_frame_ack_seconds_count 2"));
+    ck_assert(has_line(text, "xrdp_frame_ack_seconds_bucket{le=\"0.001\"} 1"));
+    ck_assert(has_line(text, "xrdp_frame_ack_seconds_bucket{le=\"0.050\"} 2"));
+    ck_assert(has_line(text, "xrdp_frame_ack_seconds_sum 0.051"));
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_metrics__input_to_paint)
+{
+    const char *text;
+
+    /* paints with no input before them aren't timed */
+    xrdp_metrics_paint(g_metrics, 10);
+    xrdp_metrics_input(g_metrics, 100);
+    xrdp_metrics_input(g_metrics, 110);
+    xrdp_metrics_paint(g_metrics, 115);
+    xrdp_metrics_paint(g_metrics, 200);
+    text = format();
+
+    ck_assert(has_line(text, "xrdp_input_to_paint_seconds_count 1"));
+    ck_assert(has_line(text, "xrdp_input_to_paint_seconds_sum 0.015"));
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_metrics__values_and_channels)
+{
+    const char *text;
+
+    xrdp_metrics_set_value(g_metrics, XRDP_METRICS_FRAMES_UNACKED, 3);
+    xrdp_metrics_set_value(g_metrics, XRDP_METRICS_CHANSRV_WAIT_BYTES, 4096);
+    xrdp_metrics_set_value(g_metrics, XRDP_METRICS_BULK_IN_BYTES, 5000000000LL);
+    xrdp_metrics_add_channel(g_metrics, 1, 1, 100);
+    xrdp_metrics_add_channel(g_metrics, 1, 1, 20);
+    xrdp_metrics_add_channel(g_metrics, 1, 0, 7);
+    xrdp_metrics_add_channel(g_metrics, 2, 0, 7);
+    xrdp_metrics_add_channel(g_metrics, XRDP_METRICS_MAX_CHANNELS, 0, 7);
+    xrdp_metrics_set_channel_name(g_metrics, 1, "cliprdr");
+    text = format();
+
+    ck_assert(has_line(text, "xrdp_frames_unacked 3"));
+    ck_assert(has_line(text, "xrdp_trans_wait_bytes{trans=\"chansrv\"} 4096"));
+    ck_assert(has_line(text, "xrdp_trans_wait_bytes{trans=\"client\"} 0"));
+    ck_assert(has_line(text, "xrdp_bulk_in_bytes_total 5000000000"));
+    /* the TYPE line is only written once for the two connections */
+    ck_assert_ptr_eq(g_strstr(g_strstr(text, "# TYPE xrdp_trans_wait_bytes")
+                              + 1, "# TYPE xrdp_trans_wait_bytes"), NULL);
+    ck_assert(has_line(text, "xrdp_channel_bytes_total"
+                       "{channel=\"cliprdr\",direction=\"out\"} 120"));
+    ck_assert(has_line(text, "xrdp_channel_bytes_total"
+                       "{channel=\"cliprdr\",direction=\"in\"} 7"));
+    /* channel 2 has no name, so the cliprdr lines are the last */
+    ck_assert_str_eq(g_strstr(text, "direction=\"out\"} 120\n"),
+                     "direction=\"out\"} 120\n");
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_metrics__too_small)
+{
+    struct stream *s;
+
+    make_stream(s);
+    init_stream(s, 100);
+    ck_assert_int_ne(xrdp_metrics_format(g_metrics, s), 0);
+    ck_assert_int_le((int) (s->p - s->data), 100);
+    free_stream(s);
+
+    /* calls on a NULL object do nothing */
+    xrdp_metrics_add_encode(NULL, "rfx", 1);
+    xrdp_metrics_frame_acked(NULL, 1, 1);
+    ck_assert_int_eq(xrdp_metrics_format(NULL, g_s), 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_metrics(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("Metrics");
+
+    tc = tcase_create("metrics");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_metrics__encode);
+    tcase_add_test(tc, test_metrics__frame_ack);
+    tcase_add_test(tc, test_metrics__input_to_paint);
+    tcase_add_test(tc, test_metrics__values_and_channels);
+    tcase_add_test(tc, test_metrics__too_small);
+
+    return s;
+}
@@ -0,0 +1,176 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "arch.h"
+#include "os_calls.h"
+#include "xrdp_rate_ctl.h"
+#include "test_xrdp.h"
+
+static struct xrdp_rate_ctl *g_rc;
+static int g_now;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_rc = xrdp_rate_ctl_create();
+    g_now = g_time3();
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xrdp_rate_ctl_delete(g_rc);
+}
+
+/******************************************************************************/
+/* feeds count acks, step ms apart, returns how many changed the level */
+static int
+acks(int count, int step, int rtt, int queue_depth, int wait_bytes)
+{
+    int changes;
+
+    changes = 0;
+    while (count-- > 0)
+    {
+        g_now += step;
+        changes += xrdp_rate_ctl_ack(g_rc, g_now, rtt, queue_depth,
+                                     wait_bytes);
+    }
+    return changes;
+}
+
+/******************************************************************************/
+START_TEST(test_rate_ctl__steady)
+{
+    /* 10 seconds of a steady link */
+    ck_assert_int_eq(acks(600, 16, 20, 0, 0), 0);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), 0);
+    ck_assert_int_eq(xrdp_rate_ctl_get_frame_interval(g_rc), 0);
+    /* unknown ack times and queue depths are fine */
+    ck_assert_int_eq(acks(600, 16, -1, -1, 0), 0);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_rate_ctl__queue_depth)
+{
+    acks(60, 16, 20, 0, 0);
+    /* the first congested ack steps up at once, the next waits */
+    ck_assert_int_eq(acks(1, 16, 20, 5, 0), 1);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), 1);
+    ck_assert_int_eq(acks(25, 16, 20, 5, 0), 0);
+    ck_assert_int_eq(acks(10, 16, 20, 5, 0), 1);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), 2);
+    ck_assert_int_gt(xrdp_rate_ctl_get_frame_interval(g_rc), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_rate_ctl__wait_bytes)
+{
+    acks(60, 16, 20, -1, 0);
+    ck_assert_int_eq(acks(1, 16, 20, -1, 1024 * 1024), 1);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), 1);
+    /* neither congested nor clear, so it stays */
+    ck_assert_int_eq(acks(400, 16, 20, -1, 64 * 1024), 0);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_rate_ctl__rtt)
+{
+    acks(60, 16, 20, -1, 0);
+    /* ack times up from 20 to 300 ms, a bufferbloated link */
+    ck_assert_int_gt(acks(200, 16, 300, -1, 0), 0);
+    ck_assert_int_gt(xrdp_rate_ctl_get_level(g_rc), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_rate_ctl__max_and_recover)
+{
+    int level;
+
+    acks(60, 16, 20, 0, 0);
+    ck_assert_int_eq(acks(1000, 16, 20, 10, 0), XRDP_RATE_CTL_MAX_LEVEL);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), XRDP_RATE_CTL_MAX_LEVEL);
+    ck_assert_int_ge(xrdp_rate_ctl_get_frame_interval(g_rc), 100);
+
+    /* nothing for the first 3 seconds clear */
+    ck_assert_int_eq(acks(180, 16, 20, 0, 0), 0);
+    ck_assert_int_eq(acks(10, 16, 20, 0, 0), 1);
+    level = xrdp_rate_ctl_get_level(g_rc);
+    ck_assert_int_eq(level, XRDP_RATE_CTL_MAX_LEVEL - 1);
+
+    /* congestion stops the climb back */
+    acks(1, 16, 20, 10, 0);
+    ck_assert_int_eq(acks(180, 16, 20, 0, 0), 0);
+
+    /* and it gets back to 0 in the end */
+    acks(2000, 16, 20, 0, 0);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), 0);
+    ck_assert_int_eq(xrdp_rate_ctl_get_frame_interval(g_rc), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_rate_ctl__bandwidth)
+{
+    /* 64K waiting is neither congested nor clear at the default ... */
+    acks(60, 16, 20, -1, 0);
+    ck_assert_int_eq(acks(1, 16, 20, -1, 64 * 1024), 0);
+
+    /* ... but is more than 250 ms on a 1 Mbit/s link */
+    xrdp_rate_ctl_set_bandwidth(g_rc, 1000);
+    ck_assert_int_eq(acks(1, 16, 20, -1, 64 * 1024), 1);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), 1);
+
+    /* and clear on a 100 Mbit/s one */
+    xrdp_rate_ctl_set_bandwidth(g_rc, 100000);
+    acks(400, 16, 20, -1, 64 * 1024);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(g_rc), 0);
+
+    /* back to the default */
+    xrdp_rate_ctl_set_bandwidth(g_rc, 0);
+    ck_assert_int_eq(acks(1, 16, 20, -1, 1024 * 1024), 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_rate_ctl__null)
+{
+    ck_assert_int_eq(xrdp_rate_ctl_ack(NULL, 0, 1000, 10, 0), 0);
+    ck_assert_int_eq(xrdp_rate_ctl_get_level(NULL), 0);
+    ck_assert_int_eq(xrdp_rate_ctl_get_frame_interval(NULL), 0);
+    xrdp_rate_ctl_set_bandwidth(NULL, 1000);
+    xrdp_rate_ctl_delete(NULL);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_rate_ctl(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("RateCtl");
+
+    tc = tcase_create("rate_ctl");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_rate_ctl__steady);
+    tcase_add_test(tc, test_rate_ctl__queue_depth);
+    tcase_add_test(tc, test_rate_ctl__wait_bytes);
+    tcase_add_test(tc, test_rate_ctl__rtt);
+    tcase_add_test(tc, test_rate_ctl__max_and_recover);
+    tcase_add_test(tc, test_rate_ctl__bandwidth);
+    tcase_add_test(tc, test_rate_ctl__null);
+
+    return s;
+}
@@ -0,0 +1,8 @@
+#ifndef TEST_XUP_H
+#define TEST_XUP_H
+
+#include <check.h>
+
+Suite *make_suite_test_xup_shm_ring(void);
+
+#endif /* TEST_XUP_H */
@@ -0,0 +1,33 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "log.h"
+#include "test_xup.h"
+
+int main (void)
+{
+    int number_failed;
+    SRunner *sr;
+
+    sr = srunner_create(make_suite_test_xup_shm_ring());
+
+    srunner_set_tap(sr, "-");
+
+    /*
+     * Set up console logging */
+    struct log_config *lc = log_config_init_for_console(LOG_LEVEL_INFO, NULL);
+    log_start_from_param(lc);
+    log_config_free(lc);
+    /* Disable stdout buffering, as this can confuse the error
+     * reporting when running in libcheck fork mode */
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    srunner_run_all (sr, CK_ENV);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    log_end();
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,188 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "arch.h"
+#include "os_calls.h"
+#include "list.h"
+#include "xup.h"
+#include "xup_shm_ring.h"
+
+#include "test_xup.h"
+
+#define SLOTS 3
+#define SLOT_BYTES 4096
+
+static char g_ring_name[256];
+static struct mod *g_mod;
+static int g_fd;
+
+/******************************************************************************/
+/* a ring file where every byte of a slot holds the slot number */
+static void
+setup(void)
+{
+    char slot_data[SLOT_BYTES];
+    int slot;
+
+    g_mod = g_new0(struct mod, 1);
+    g_snprintf(g_ring_name, sizeof(g_ring_name),
+               "/tmp/test_xup_shm_ring_%d", g_getpid());
+    g_fd = g_file_open_rw(g_ring_name);
+    ck_assert_int_ge(g_fd, 0);
+    for (slot = 0; slot < SLOTS; slot++)
+    {
+        g_memset(slot_data, slot, sizeof(slot_data));
+        ck_assert_int_eq(g_file_write(g_fd, slot_data, sizeof(slot_data)),
+                         sizeof(slot_data));
+    }
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xup_shm_ring_unmap_all(g_mod);
+    g_free(g_mod);
+    g_file_close(g_fd);
+    g_file_delete(g_ring_name);
+}
+
+/******************************************************************************/
+static int
+retired_count(void)
+{
+    if (g_mod->shm_ring_retired == NULL)
+    {
+        return 0;
+    }
+    return g_mod->shm_ring_retired->count;
+}
+
+/******************************************************************************/
+START_TEST(test_xup_shm_ring__bad_sizes)
+{
+    ck_assert_int_ne(xup_shm_ring_map(g_mod, g_fd, -1, SLOT_BYTES), 0);
+    ck_assert_int_ne(xup_shm_ring_map(g_mod, g_fd, SLOTS, 0), 0);
+    ck_assert_int_ne(xup_shm_ring_map(g_mod, g_fd, 0x10000, 0x10000), 0);
+    ck_assert_ptr_eq(g_mod->shm_ring_ptr, NULL);
+    ck_assert_ptr_eq(xup_shm_ring_get_data(g_mod, 0, 0, 0, 1, 1), NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xup_shm_ring__get_data)
+{
+    char *data;
+
+    ck_assert_int_eq(xup_shm_ring_map(g_mod, g_fd, SLOTS, SLOT_BYTES), 0);
+    data = xup_shm_ring_get_data(g_mod, 1, 0, 16, 100, 7);
+    ck_assert_ptr_eq(data, g_mod->shm_ring_ptr + SLOT_BYTES + 16);
+    ck_assert_int_eq(data[0], 1);
+    ck_assert_int_eq(data[99], 1);
+    ck_assert_int_eq(g_mod->shm_ring_seq, 1);
+    ck_assert_int_eq(g_mod->shm_ring_frame_id, 7);
+
+    /* the last byte of the last slot */
+    data = xup_shm_ring_get_data(g_mod, SLOTS - 1, 1, SLOT_BYTES - 1, 1, 8);
+    ck_assert_ptr_ne(data, NULL);
+    ck_assert_int_eq(data[0], SLOTS - 1);
+    /* nothing at the end of a slot */
+    ck_assert_ptr_ne(xup_shm_ring_get_data(g_mod, 0, 2, SLOT_BYTES, 0, 9),
+                     NULL);
+    ck_assert_int_eq(g_mod->shm_ring_frame_id, 9);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xup_shm_ring__outside_ring)
+{
+    ck_assert_int_eq(xup_shm_ring_map(g_mod, g_fd, SLOTS, SLOT_BYTES), 0);
+    ck_assert_ptr_eq(xup_shm_ring_get_data(g_mod, -1, 0, 0, 1, 1), NULL);
+    ck_assert_ptr_eq(xup_shm_ring_get_data(g_mod, SLOTS, 0, 0, 1, 1), NULL);
+    ck_assert_ptr_eq(xup_shm_ring_get_data(g_mod, 0, 0, -1, 1, 1), NULL);
+    ck_assert_ptr_eq(xup_shm_ring_get_data(g_mod, 0, 0, SLOT_BYTES + 1, 0, 1),
+                     NULL);
+    ck_assert_ptr_eq(xup_shm_ring_get_data(g_mod, 0, 0, 1, SLOT_BYTES, 1),
+                     NULL);
+    /* a 64K x 64K 32 bpp paint, too big for an int */
+    ck_assert_ptr_eq(xup_shm_ring_get_data(g_mod, 0, 0, 0,
+                                           (size_t) 0xffff * 0xffff * 4, 1),
+                     NULL);
+    /* a rejected frame doesn't move the sequence on */
+    ck_assert_int_eq(g_mod->shm_ring_seq, 0);
+    ck_assert_int_eq(g_mod->shm_ring_frame_id, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xup_shm_ring__retire_waits_for_ack)
+{
+    ck_assert_int_eq(xup_shm_ring_map(g_mod, g_fd, SLOTS, SLOT_BYTES), 0);
+    ck_assert_ptr_ne(xup_shm_ring_get_data(g_mod, 0, 0, 0, 1, 5), NULL);
+    g_mod->shm_ring_acked = 3;
+    xup_shm_ring_retire(g_mod);
+    ck_assert_ptr_eq(g_mod->shm_ring_ptr, NULL);
+    ck_assert_int_eq(g_mod->shm_ring_slots, 0);
+    ck_assert_int_eq(retired_count(), 1);
+
+    /* a new ring starts from the last ack */
+    ck_assert_int_eq(xup_shm_ring_map(g_mod, g_fd, SLOTS, SLOT_BYTES), 0);
+    ck_assert_int_eq(g_mod->shm_ring_frame_id, 3);
+
+    xup_shm_ring_release_retired(g_mod, 4);
+    ck_assert_int_eq(retired_count(), 1);
+    xup_shm_ring_release_retired(g_mod, 5);
+    ck_assert_int_eq(retired_count(), 0);
+    ck_assert_ptr_ne(g_mod->shm_ring_ptr, NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xup_shm_ring__retire_acked)
+{
+    ck_assert_int_eq(xup_shm_ring_map(g_mod, g_fd, SLOTS, SLOT_BYTES), 0);
+    ck_assert_ptr_ne(xup_shm_ring_get_data(g_mod, 0, 0, 0, 1, 5), NULL);
+    g_mod->shm_ring_acked = 5;
+    xup_shm_ring_retire(g_mod);
+    ck_assert_ptr_eq(g_mod->shm_ring_ptr, NULL);
+    ck_assert_int_eq(retired_count(), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xup_shm_ring__unmap_all)
+{
+    ck_assert_int_eq(xup_shm_ring_map(g_mod, g_fd, SLOTS, SLOT_BYTES), 0);
+    ck_assert_ptr_ne(xup_shm_ring_get_data(g_mod, 0, 0, 0, 1, 5), NULL);
+    xup_shm_ring_retire(g_mod);
+    ck_assert_int_eq(xup_shm_ring_map(g_mod, g_fd, SLOTS, SLOT_BYTES), 0);
+    ck_assert_int_eq(retired_count(), 1);
+
+    xup_shm_ring_unmap_all(g_mod);
+    ck_assert_ptr_eq(g_mod->shm_ring_ptr, NULL);
+    ck_assert_ptr_eq(g_mod->shm_ring_retired, NULL);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xup_shm_ring(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("ShmRing");
+
+    tc = tcase_create("shm_ring");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_xup_shm_ring__bad_sizes);
+    tcase_add_test(tc, test_xup_shm_ring__get_data);
+    tcase_add_test(tc, test_xup_shm_ring__outside_ring);
+    tcase_add_test(tc, test_xup_shm_ring__retire_waits_for_ack);
+    tcase_add_test(tc, test_xup_shm_ring__retire_acked);
+    tcase_add_test(tc, test_xup_shm_ring__unmap_all);
+
+    return s;
+}
@@ -6,12 +6,23 @@
 #include <unistd.h>
 
 #include "config_ac.h"
+#include "defines.h"
 #include "os_calls.h"
 #include "string_calls.h"
 #include "xwait.h" // For return status codes
 
-#define ATTEMPTS 10
+#if defined(HAVE_SYS_INOTIFY_H)
+#include <sys/inotify.h>
+#endif
+
 #define ALARM_WAIT 30
+/* time allowed for each of the display and its RandR outputs to appear */
+#define STAGE_WAIT_MS 10000
+/* longest time between attempts when nothing can wake us up sooner */
+#define MAX_RETRY_MS 250
+/* with something to wake us up, retries are only a backstop */
+#define MAX_EVENT_RETRY_MS 1000
+#define X11_UNIX_DIR "/tmp/.X11-unix"
 
 /*****************************************************************************/
 static void
@@ -26,29 +37,137 @@ alarm_handler(int signal_num)
     exit(XW_STATUS_TIMED_OUT);
 }
 
+/*****************************************************************************/
+/**
+ * Watch for sockets appearing in the X11 socket directory
+ *
+ * The X server creates its socket there when it starts listening, so
+ * an event is a good time to try the display again
+ *
+ * @param display Display name
+ * @return fd to wait on, or -1 if the display isn't local or there is
+ *         no way to watch
+ */
+static int
+socket_watch_create(const char *display)
+{
+    int fd = -1;
+
+#if defined(HAVE_SYS_INOTIFY_H)
+    if (display[0] == ':' || g_strncmp(display, "unix:", 5) == 0)
+    {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd >= 0 &&
+                inotify_add_watch(fd, X11_UNIX_DIR, IN_CREATE | IN_MOVED_TO) < 0)
+        {
+            printf("<D>Can't watch %s, polling for display\n", X11_UNIX_DIR);
+            g_file_close(fd);
+            fd = -1;
+        }
+    }
+#endif
+    return fd;
+}
+
+/*****************************************************************************/
+/**
+ * Waits up to ms for fd to be readable, then empties it
+ *
+ * @param fd fd to wait on, or -1 to just sleep
+ */
+static void
+wait_on_fd(int fd, int ms)
+{
+    char buf[1024];
+    tintptr obj;
+
+    if (fd < 0)
+    {
+        g_sleep(ms);
+        return;
+    }
+    obj = fd;
+    g_obj_wait(&obj, 1, NULL, 0, ms);
+    while (g_file_read(fd, buf, sizeof(buf)) > 0)
+    {
+    }
+}
+
 /*****************************************************************************/
 static Display *
 open_display(const char *display)
 {
     Display *dpy = NULL;
-    unsigned int wait = ATTEMPTS;
+    int fd;
+    int start;
+    int elapsed;
+    int retry_ms = 10;
+    int max_retry_ms;
     unsigned int n;
 
-    for (n = 1; n <= ATTEMPTS; ++n)
+    fd = socket_watch_create(display);
+    max_retry_ms = (fd < 0) ? MAX_RETRY_MS : MAX_EVENT_RETRY_MS;
+    start = g_time3();
+    printf("<D>Opening display %s\n", display);
+    for (n = 1; ; ++n)
     {
-        printf("<D>Opening display %s. Attempt %u of %u\n", display, n, wait);
         dpy = XOpenDisplay(display);
+        elapsed = g_time3() - start;
         if (dpy != NULL)
         {
-            printf("<D>Opened display %s\n", display);
+            printf("<D>Opened display %s after %d ms, attempt %u\n",
+                   display, elapsed, n);
+            break;
+        }
+        if (elapsed >= STAGE_WAIT_MS)
+        {
             break;
         }
-        g_sleep(1000);
+        wait_on_fd(fd, MIN(retry_ms, STAGE_WAIT_MS - elapsed));
+        retry_ms = MIN(retry_ms * 2, max_retry_ms);
     }
 
+    if (fd >= 0)
+    {
+        g_file_close(fd);
+    }
     return dpy;
 }
 
+/*****************************************************************************/
+/**
+ * Gets the number of RandR outputs on the display
+ */
+static unsigned int
+count_outputs(Display *dpy)
+{
+    unsigned int outputs = 0;
+    XRRScreenResources *res;
+
+    res = XRRGetScreenResources(dpy, DefaultRootWindow(dpy));
+    if (res != NULL)
+    {
+        if (res->noutput > 0)
+        {
+            outputs = res->noutput;
+        }
+        XRRFreeScreenResources(res);
+    }
+    return outputs;
+}
+
+/*****************************************************************************/
+/**
+ * Waits up to ms for something from the X server
+ */
+static void
+wait_on_x(Display *dpy, int ms)
+{
+    tintptr obj = ConnectionNumber(dpy);
+
+    g_obj_wait(&obj, 1, NULL, 0, ms);
+}
+
 /*****************************************************************************/
 /**
  * Wait for the RandR extension (if in use) to be available
@@ -61,11 +180,13 @@ wait_for_r_and_r(Display *dpy)
 {
     int error_base = 0;
     int event_base = 0;
-    unsigned int outputs = 0;
-    unsigned int wait = ATTEMPTS;
+    int major = 0;
+    int minor = 0;
+    unsigned int outputs;
     unsigned int n;
-
-    XRRScreenResources *res = NULL;
+    int start;
+    int elapsed;
+    XEvent event;
 
     if (!XRRQueryExtension(dpy, &event_base, &error_base))
     {
@@ -74,26 +195,44 @@ wait_for_r_and_r(Display *dpy)
         return 0;
     }
 
-    for (n = 1; n <= wait; ++n)
+    /* Outputs showing up are notified, so we only need to look again
+     * when something changes */
+    XRRQueryVersion(dpy, &major, &minor);
+    if (major > 1 || (major == 1 && minor >= 2))
     {
-        printf("<D>Waiting for outputs. Attempt %u of %u\n", n, wait);
-        res = XRRGetScreenResources(dpy, DefaultRootWindow(dpy));
-        if (res != NULL)
-        {
-            if (res->noutput > 0)
-            {
-                outputs = res->noutput;
-            }
-            XRRFreeScreenResources(res);
-        }
+        XRRSelectInput(dpy, DefaultRootWindow(dpy),
+                       RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask |
+                       RROutputChangeNotifyMask);
+    }
+    else
+    {
+        XRRSelectInput(dpy, DefaultRootWindow(dpy), RRScreenChangeNotifyMask);
+    }
 
+    start = g_time3();
+    printf("<D>Waiting for outputs\n");
+    for (n = 1; ; ++n)
+    {
+        outputs = count_outputs(dpy);
+        elapsed = g_time3() - start;
         if (outputs > 0)
         {
-            printf("<D>Display %s ready with %u RandR outputs\n",
-                   DisplayString(dpy), outputs);
+            printf("<D>Display %s ready with %u RandR outputs after %d ms, "
+                   "check %u\n", DisplayString(dpy), outputs, elapsed, n);
             return 0;
         }
-        g_sleep(1000);
+        if (elapsed >= STAGE_WAIT_MS)
+        {
+            break;
+        }
+        if (XPending(dpy) == 0)
+        {
+            wait_on_x(dpy, MIN(MAX_EVENT_RETRY_MS, STAGE_WAIT_MS - elapsed));
+        }
+        while (XPending(dpy) > 0)
+        {
+            XNextEvent(dpy, &event);
+        }
     }
 
     printf("<E>Unable to find any RandR outputs\n");
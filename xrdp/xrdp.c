@@ -704,6 +704,9 @@ main(int argc, char **argv)
             g_exit(0);
         }
 
+        /* the log writer thread, if any, stayed with the parent */
+        log_fork_child();
+
         g_sleep(1000);
         /* write our pid to file */
         g_sprintf(text, "%d", g_getpid());
@@ -119,6 +119,14 @@ int
 xrdp_cache_remove_os_bitmap(struct xrdp_cache *self, int rdpindex);
 struct xrdp_os_bitmap_item *
 xrdp_cache_get_os_bitmap(struct xrdp_cache *self, int rdpindex);
+int
+xrdp_cache_send_os_bitmap(struct xrdp_cache *self,
+                          struct xrdp_bitmap *bitmap);
+int
+xrdp_cache_os_bitmap_lost(struct xrdp_cache *self, struct xrdp_bitmap *bitmap);
+void
+xrdp_cache_set_os_bitmap_lost(struct xrdp_cache *self,
+                              struct xrdp_bitmap *bitmap);
 
 /* xrdp_wm.c */
 struct xrdp_wm *
@@ -511,6 +519,9 @@ xrdp_mm_suppress_output(struct xrdp_mm *self, int suppress,
                         int left, int top, int right, int bottom);
 int
 xrdp_mm_up_and_running(struct xrdp_mm *self);
+void
+xrdp_mm_autodetect(struct xrdp_mm *self, int avg_rtt, int bandwidth,
+                   int base_rtt);
 int xrdp_mm_send_unicode_to_chansrv(struct xrdp_mm *self,
                                     int key_down,
                                     char32_t unicode);
@@ -534,6 +545,11 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self);
 int
 xrdp_mm_frame_ack(struct xrdp_mm *self, int frame_id);
 void
+xrdp_mm_frame_trace_input(struct xrdp_mm *self, int msg, int device_flags,
+                          int x, int y);
+int
+xrdp_mm_metrics_listen(struct xrdp_mm *self);
+void
 xrdp_mm_efgx_add_dirty_region_to_planar_list(struct xrdp_mm *self,
         struct xrdp_region *dirty_region);
 int
@@ -696,5 +712,10 @@ int
 server_egfx_cmd(struct xrdp_mod *v,
                 char *cmd, int cmd_bytes,
                 char *data, int data_bytes);
+int
+server_egfx_cmd_ex(struct xrdp_mod *v,
+                   char *cmd, int cmd_bytes,
+                   char *data, int data_bytes,
+                   void *shmem_ptr, int shmem_bytes);
 
 #endif
@@ -112,6 +112,8 @@ xrdp_cache_create(struct xrdp_wm *owner,
     self->bitmap_cache_version = client_info->bitmap_cache_version;
     self->pointer_cache_entries = client_info->pointer_cache_entries;
     self->xrdp_os_del_list = list_create();
+    self->os_max_bytes = client_info->offscreen_cache_size;
+    self->os_max_entries = client_info->offscreen_cache_entries;
     xrdp_cache_reset_lru(self);
     xrdp_cache_reset_crc(self);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_create: 0 %d 1 %d 2 %d",
@@ -154,6 +156,9 @@ clear_all_cached_items(struct xrdp_cache *self)
     {
         xrdp_bitmap_delete(self->os_bitmap_items[i].bitmap);
     }
+    LOG(LOG_LEVEL_DEBUG, "off screen cache: %d bytes in %d surfaces, "
+        "%d evictions, %d surfaces not cached", self->os_bytes,
+        self->os_entries, self->os_evictions, self->os_failures);
 
     list_delete(self->xrdp_os_del_list);
 
@@ -203,6 +208,9 @@ xrdp_cache_reset(struct xrdp_cache *self,
     self->bitmap_cache_persist_enable = client_info->bitmap_cache_persist_enable;
     self->bitmap_cache_version = client_info->bitmap_cache_version;
     self->pointer_cache_entries = client_info->pointer_cache_entries;
+    self->xrdp_os_del_list = list_create();
+    self->os_max_bytes = client_info->offscreen_cache_size;
+    self->os_max_entries = client_info->offscreen_cache_entries;
     xrdp_cache_reset_lru(self);
     xrdp_cache_reset_crc(self);
     return 0;
@@ -769,6 +777,11 @@ xrdp_cache_add_os_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
     }
 
     bi = self->os_bitmap_items + rdpindex;
+    if (bi->bitmap != 0)
+    {
+        /* module reused the id without a delete */
+        xrdp_cache_remove_os_bitmap(self, rdpindex);
+    }
     bi->bitmap = bitmap;
     return 0;
 }
@@ -788,14 +801,22 @@ xrdp_cache_remove_os_bitmap(struct xrdp_cache *self, int rdpindex)
 
     bi = self->os_bitmap_items + rdpindex;
 
+    if (bi->bitmap == 0)
+    {
+        return 0;
+    }
+
     if (bi->bitmap->tab_stop)
     {
+        /* the client frees it before the next create */
         index = list_index_of(self->xrdp_os_del_list, rdpindex);
 
         if (index == -1)
         {
             list_add_item(self->xrdp_os_del_list, rdpindex);
         }
+        self->os_bytes -= bi->bytes;
+        self->os_entries--;
     }
 
     xrdp_bitmap_delete(bi->bitmap);
@@ -817,3 +838,184 @@ xrdp_cache_get_os_bitmap(struct xrdp_cache *self, int rdpindex)
     bi = self->os_bitmap_items + rdpindex;
     return bi;
 }
+
+/*****************************************************************************/
+/* client memory for an off screen surface, the client keeps surfaces at
+   the session colour depth */
+static int
+xrdp_cache_os_bitmap_bytes(struct xrdp_cache *self,
+                           struct xrdp_bitmap *bitmap)
+{
+    int bpp;
+
+    bpp = self->wm->client_info->bpp;
+    if (bpp == 15)
+    {
+        bpp = 16;
+    }
+    return bitmap->width * bitmap->height * ((bpp + 7) / 8);
+}
+
+/*****************************************************************************/
+/* returns boolean, true if a new surface of bytes fits the client's caps */
+static int
+xrdp_cache_os_bitmap_fits(struct xrdp_cache *self, int bytes)
+{
+    if ((self->os_max_bytes > 0) &&
+            (self->os_bytes + bytes > self->os_max_bytes))
+    {
+        return 0;
+    }
+    if ((self->os_max_entries > 0) &&
+            (self->os_entries >= self->os_max_entries))
+    {
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* drop the client copy of a lost surface, or else the least recently used
+   one, that is not being drawn to, returns error if there is none */
+static int
+xrdp_cache_evict_os_bitmap(struct xrdp_cache *self, int keep_index)
+{
+    struct xrdp_os_bitmap_item *bi;
+    int index;
+    int oldest;
+    int oldest_index;
+
+    oldest = 0x7fffffff;
+    oldest_index = -1;
+    for (index = 0; index < 2000; index++)
+    {
+        bi = self->os_bitmap_items + index;
+        if ((bi->bitmap == 0) || !bi->bitmap->tab_stop ||
+                (index == keep_index) ||
+                (index == self->wm->current_surface_index) ||
+                (bi->bitmap == self->wm->target_surface))
+        {
+            continue;
+        }
+        if (bi->lost)
+        {
+            /* can never be a source again, so it goes first */
+            oldest_index = index;
+            break;
+        }
+        if (bi->stamp < oldest)
+        {
+            oldest = bi->stamp;
+            oldest_index = index;
+        }
+    }
+    if (oldest_index < 0)
+    {
+        return 1;
+    }
+    bi = self->os_bitmap_items + oldest_index;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_evict_os_bitmap: evicting %d, "
+              "%d bytes", oldest_index, bi->bytes);
+    if (list_index_of(self->xrdp_os_del_list, oldest_index) == -1)
+    {
+        list_add_item(self->xrdp_os_del_list, oldest_index);
+    }
+    bi->bitmap->tab_stop = 0;
+    bi->lost = 1;
+    self->os_bytes -= bi->bytes;
+    self->os_entries--;
+    bi->bytes = 0;
+    self->os_evictions++;
+    return 0;
+}
+
+/*****************************************************************************/
+/* make sure the client has a copy of the off screen surface, creating it,
+   after evicting others if they don't fit the client's caps, if needed
+   returns error if the client has no room for it, or it is lost. A lost
+   surface is not created again, its content could only come from the
+   module deleting and remaking it */
+int
+xrdp_cache_send_os_bitmap(struct xrdp_cache *self,
+                          struct xrdp_bitmap *bitmap)
+{
+    struct xrdp_os_bitmap_item *bi;
+    int rdpindex;
+    int bytes;
+    int index;
+
+    rdpindex = bitmap->item_index;
+    bi = xrdp_cache_get_os_bitmap(self, rdpindex);
+    if ((bi == 0) || (bi->bitmap != bitmap) || bi->lost)
+    {
+        return 1;
+    }
+    self->os_stamp++;
+    bi->stamp = self->os_stamp;
+    if (bitmap->tab_stop) /* tab_stop is hack, set when the client has it */
+    {
+        return 0;
+    }
+    bytes = xrdp_cache_os_bitmap_bytes(self, bitmap);
+    if ((self->os_max_bytes < 1) || (bytes <= self->os_max_bytes))
+    {
+        while (!xrdp_cache_os_bitmap_fits(self, bytes))
+        {
+            if (xrdp_cache_evict_os_bitmap(self, rdpindex) != 0)
+            {
+                break;
+            }
+        }
+    }
+    if (!xrdp_cache_os_bitmap_fits(self, bytes))
+    {
+        LOG(LOG_LEVEL_DEBUG, "xrdp_cache_send_os_bitmap: no room for "
+            "surface %d %dx%d, %d of %d bytes used", rdpindex,
+            bitmap->width, bitmap->height, self->os_bytes,
+            self->os_max_bytes);
+        bi->lost = 1;
+        self->os_failures++;
+        return 1;
+    }
+    index = list_index_of(self->xrdp_os_del_list, rdpindex);
+    list_remove_item(self->xrdp_os_del_list, index);
+    libxrdp_orders_send_create_os_surface(self->session, rdpindex,
+                                          bitmap->width, bitmap->height,
+                                          self->xrdp_os_del_list);
+    list_clear(self->xrdp_os_del_list);
+    bitmap->tab_stop = 1;
+    bi->bytes = bytes;
+    self->os_bytes += bytes;
+    self->os_entries++;
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns boolean, true if the surface content is not on the client */
+int
+xrdp_cache_os_bitmap_lost(struct xrdp_cache *self, struct xrdp_bitmap *bitmap)
+{
+    struct xrdp_os_bitmap_item *bi;
+
+    bi = xrdp_cache_get_os_bitmap(self, bitmap->item_index);
+    if ((bi == 0) || (bi->bitmap != bitmap))
+    {
+        return 1;
+    }
+    return bi->lost || !bitmap->tab_stop;
+}
+
+/*****************************************************************************/
+/* the surface was drawn from a lost one, so its content is gone too */
+void
+xrdp_cache_set_os_bitmap_lost(struct xrdp_cache *self,
+                              struct xrdp_bitmap *bitmap)
+{
+    struct xrdp_os_bitmap_item *bi;
+
+    bi = xrdp_cache_get_os_bitmap(self, bitmap->item_index);
+    if ((bi != 0) && (bi->bitmap == bitmap))
+    {
+        bi->lost = 1;
+    }
+}
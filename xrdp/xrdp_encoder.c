@@ -28,6 +28,8 @@
 #include "thread_calls.h"
 #include "fifo.h"
 #include "xrdp_egfx.h"
+#include "xrdp_metrics.h"
+#include "xrdp_rate_ctl.h"
 #include "string_calls.h"
 
 #ifdef XRDP_RFXCODEC
@@ -77,8 +79,43 @@ static const unsigned char g_rfx_quantization_values_ulq[] =
     0x66, 0x66, 0x77, 0x87, 0x98,
     0xBB, 0xBB, 0xBB, 0xBB, 0xBB /* TODO: tentative value */
 };
+
+/* by rfx_quant_level(), each rate control level moves one further down */
+static const unsigned char *g_rfx_quantization_values[] =
+{
+    g_rfx_quantization_values_std,
+    g_rfx_quantization_values_lq,
+    g_rfx_quantization_values_ulq
+};
+#define RFX_MAX_QUANT_LEVEL 2
+
+/*****************************************************************************/
+/* g_rfx_quantization_values index at rate control level 0 */
+static int
+rfx_quant_level(int connection_type)
+{
+    switch (connection_type)
+    {
+        case CONNECTION_TYPE_MODEM:
+        case CONNECTION_TYPE_BROADBAND_LOW:
+        case CONNECTION_TYPE_SATELLITE:
+            return 2;
+        case CONNECTION_TYPE_BROADBAND_HIGH:
+        case CONNECTION_TYPE_WAN:
+            return 1;
+        default:
+            return 0;
+    }
+}
 #endif
 
+/* jpeg quality in percent of codec_quality, by rate control level */
+static const int g_jpeg_rate_quality[XRDP_RATE_CTL_MAX_LEVEL + 1] =
+{
+    100, 80, 60, 45, 30
+};
+#define JPEG_MIN_QUALITY 10
+
 struct enc_rect
 {
     short x1;
@@ -101,6 +138,20 @@ process_enc_h264(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
 static int
 process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
 
+/*****************************************************************************/
+/* the connection type the client asked for, or if it asked for
+   auto-detect, what has been detected so far */
+static int
+xrdp_encoder_connection_type(const struct xrdp_client_info *client_info)
+{
+    if (client_info->mcs_connection_type == CONNECTION_TYPE_AUTODETECT &&
+            client_info->detected_connection_type != 0)
+    {
+        return client_info->detected_connection_type;
+    }
+    return client_info->mcs_connection_type;
+}
+
 /*****************************************************************************/
 /* Item destructor for self->fifo_to_proc */
 static void
@@ -142,7 +193,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     client_info = mm->wm->client_info;
 
     /* RemoteFX 7.1 requires LAN but GFX does not */
-    if (client_info->mcs_connection_type != CONNECTION_TYPE_LAN)
+    if (xrdp_encoder_connection_type(client_info) != CONNECTION_TYPE_LAN)
     {
         if ((mm->egfx_flags & (XRDP_EGFX_H264 | XRDP_EGFX_RFX_PRO)) == 0)
         {
@@ -170,6 +221,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         client_info->capture_code = CC_SIMPLE;
         client_info->capture_format = XRDP_a8b8g8r8;
         self->process_enc = process_enc_jpg;
+        self->codec_name = "jpeg";
     }
 #ifdef XRDP_X264
     else if (mm->egfx_flags & XRDP_EGFX_H264)
@@ -180,6 +232,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         client_info->capture_code = CC_GFX_A2;
         client_info->capture_format = XRDP_nv12_709fr;
         self->gfx = 1;
+        self->codec_name = "gfx_h264";
     }
     else if (client_info->h264_codec_id != 0)
     {
@@ -189,6 +242,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         client_info->capture_code = CC_SUF_A2;
         client_info->capture_format = XRDP_nv12;
         self->process_enc = process_enc_h264;
+        self->codec_name = "h264";
     }
 #endif
 #ifdef XRDP_RFXCODEC
@@ -199,28 +253,14 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         self->in_codec_mode = 1;
         client_info->capture_code = CC_GFX_PRO;
         self->gfx = 1;
+        self->codec_name = "gfx_rfx_pro";
         self->num_quants = 2;
         self->quant_idx_y = 0;
         self->quant_idx_u = 1;
         self->quant_idx_v = 1;
-
-        switch (client_info->mcs_connection_type)
-        {
-            case CONNECTION_TYPE_MODEM:
-            case CONNECTION_TYPE_BROADBAND_LOW:
-            case CONNECTION_TYPE_SATELLITE:
-                self->quants = (const char *) g_rfx_quantization_values_ulq;
-                break;
-            case CONNECTION_TYPE_BROADBAND_HIGH:
-            case CONNECTION_TYPE_WAN:
-                self->quants = (const char *) g_rfx_quantization_values_lq;
-                break;
-            case CONNECTION_TYPE_LAN:
-            case CONNECTION_TYPE_AUTODETECT: /* not implemented yet */
-            default:
-                self->quants = (const char *) g_rfx_quantization_values_std;
-
-        }
+        self->quants = (const char *) g_rfx_quantization_values[
+                           rfx_quant_level(
+                               xrdp_encoder_connection_type(client_info))];
     }
     else if (client_info->rfx_codec_id != 0)
     {
@@ -229,6 +269,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         self->in_codec_mode = 1;
         client_info->capture_code = CC_SUF_RFX;
         self->process_enc = process_enc_rfx;
+        self->codec_name = "rfx";
         self->codec_handle_rfx = rfxcodec_encode_create(mm->wm->screen->width,
                                  mm->wm->screen->height,
                                  RFX_FORMAT_YUV, 0);
@@ -402,7 +443,9 @@ process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     tbus event_processed;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_jpg:");
-    quality = self->codec_quality;
+    quality = self->codec_quality *
+              g_jpeg_rate_quality[enc->rate_level] / 100;
+    quality = MAX(quality, JPEG_MIN_QUALITY);
     fifo_processed = self->fifo_processed;
     mutex = self->mutex;
     event_processed = self->xrdp_encoder_event_processed;
@@ -504,6 +547,9 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     int alloc_bytes;
     int encode_flags;
     int encode_passes;
+    const char *quants;
+    int num_quants;
+    int quant_idx_uv;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_rfx:");
     LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_rfx: num_crects %d num_drects %d",
@@ -511,6 +557,17 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     fifo_processed = self->fifo_processed;
     mutex = self->mutex;
     event_processed = self->xrdp_encoder_event_processed;
+    /* the codec's own tables unless rate control has lowered quality */
+    quants = self->quants;
+    num_quants = self->num_quants;
+    quant_idx_uv = self->quant_idx_u;
+    if (enc->rate_level > 0)
+    {
+        quants = (const char *) g_rfx_quantization_values[
+                     MIN(enc->rate_level, RFX_MAX_QUANT_LEVEL)];
+        num_quants = 2;
+        quant_idx_uv = 1;
+    }
 
     all_tiles_written = 0;
     encode_passes = 0;
@@ -547,8 +604,8 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
                     tiles[index].cx = cx;
                     tiles[index].cy = cy;
                     tiles[index].quant_y = self->quant_idx_y;
-                    tiles[index].quant_cb = self->quant_idx_u;
-                    tiles[index].quant_cr = self->quant_idx_v;
+                    tiles[index].quant_cb = quant_idx_uv;
+                    tiles[index].quant_cr = quant_idx_uv;
                 }
 
                 count = enc->u.sc.num_drects;
@@ -578,7 +635,7 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
                                                    ((enc->u.sc.width + 63) & ~63) * 4,
                                                    rfxrects, enc->u.sc.num_drects,
                                                    tiles, enc->u.sc.num_crects,
-                                                   self->quants, self->num_quants,
+                                                   quants, num_quants,
                                                    encode_flags);
             }
             ++encode_passes;
@@ -761,7 +818,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     int mon_index;
     int connection_type;
 
-    connection_type = self->mm->wm->client_info->mcs_connection_type;
+    connection_type = xrdp_encoder_connection_type(self->mm->wm->client_info);
 
     s = &ls;
     g_memset(s, 0, sizeof(struct stream));
@@ -916,7 +973,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
                     enc_gfx_cmd->data,
                     crects, num_rects_c,
                     s->p, &bitmap_data_length,
-                    connection_type, NULL);
+                    connection_type, enc->rate_level, NULL);
         if (error == 0)
         {
             xstream_seek(s, bitmap_data_length);
@@ -974,6 +1031,8 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
     int total_tiles;
     int tiles_written;
     int mon_index;
+    int quant_level;
+    const char *quants;
 
     if (!s_check_rem(in_s, 15))
     {
@@ -1074,6 +1133,11 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
         g_free(rfxrects);
         return NULL;
     }
+    /* the connection type can change with network auto-detect */
+    quant_level = rfx_quant_level(
+                      xrdp_encoder_connection_type(self->mm->wm->client_info));
+    quants = (const char *) g_rfx_quantization_values[
+                 MIN(quant_level + enc->rate_level, RFX_MAX_QUANT_LEVEL)];
     rv = NULL;
     tiles_written = 0;
     total_tiles = num_rects_c;
@@ -1088,7 +1152,7 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
                             ((width + 63) & ~63) * 4,
                             rfxrects, num_rects_d,
                             tiles + tiles_written, total_tiles - tiles_written,
-                            self->quants, self->num_quants);
+                            quants, self->num_quants);
         if (tiles_compressed < 1)
         {
             break;
@@ -1441,6 +1505,7 @@ proc_enc_msg(void *arg)
     int wobjs_count;
     int cont;
     int timeout;
+    int start;
     tbus robjs[32];
     tbus wobjs[32];
     struct xrdp_encoder *self;
@@ -1501,7 +1566,10 @@ proc_enc_msg(void *arg)
             while (enc != 0)
             {
                 /* do work */
+                start = g_time3();
                 self->process_enc(self, enc);
+                xrdp_metrics_add_encode(self->mm->metrics, self->codec_name,
+                                        g_time3() - start);
                 /* get next msg */
                 tc_mutex_lock(mutex);
                 enc = (XRDP_ENC_DATA *) fifo_remove_item(fifo_to_proc);
@@ -21,6 +21,7 @@ struct xrdp_encoder
     int in_codec_mode;
     int codec_id;
     int codec_quality;
+    const char *codec_name; /* for xrdp_metrics */
     int max_compressed_bytes;
     tbus xrdp_encoder_event_to_proc;
     tbus xrdp_encoder_event_processed;
@@ -104,7 +105,7 @@ struct xrdp_enc_data
 {
     struct xrdp_mod *mod;
     int flags; /* ENC_FLAGS_* */
-    int pad0;
+    int rate_level; /* xrdp_rate_ctl level when queued */
     void *shmem_ptr;
     int shmem_bytes;
     int pad1;
@@ -35,6 +35,8 @@
 #include "xrdp_tconfig.h"
 
 #define X264_MAX_ENCODERS 16
+/* CRF added for each rate control level */
+#define X264_RATE_LEVEL_CRF 4
 
 struct x264_encoder
 {
@@ -43,6 +45,11 @@ struct x264_encoder
     x264_param_t x264_params;
     int width;
     int height;
+    int ct; /* connection type the encoder was opened for */
+    int rate_level;
+    float crf; /* at rate level 0 */
+    int vbv_max_bitrate; /* at rate level 0 */
+    int vbv_buffer_size; /* at rate level 0 */
 };
 
 struct x264_global
@@ -95,6 +102,29 @@ xrdp_encoder_x264_delete(void *handle)
     return 0;
 }
 
+/*****************************************************************************/
+/* raises the CRF, and lowers the VBV limits if they are set, as the level
+   goes up. x264 can't turn VBV on once the encoder is open */
+static void
+xrdp_encoder_x264_set_rate_level(struct x264_encoder *xe, int rate_level)
+{
+    xe->x264_params.rc.f_rf_constant = xe->crf +
+                                       X264_RATE_LEVEL_CRF * rate_level;
+    if (xe->vbv_max_bitrate > 0)
+    {
+        xe->x264_params.rc.i_vbv_max_bitrate =
+            MAX(xe->vbv_max_bitrate >> rate_level, 1);
+        xe->x264_params.rc.i_vbv_buffer_size =
+            MAX(xe->vbv_buffer_size >> rate_level, 1);
+    }
+    if (x264_encoder_reconfig(xe->x264_enc_han, &(xe->x264_params)) < 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_encoder_x264_set_rate_level: "
+            "x264_encoder_reconfig failed for level %d", rate_level);
+    }
+    xe->rate_level = rate_level;
+}
+
 /*****************************************************************************/
 int
 xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
@@ -102,7 +132,7 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
                          int format, const char *data,
                          short *crects, int num_crects,
                          char *cdata, int *cdata_bytes, int connection_type,
-                         int *flags_ptr)
+                         int rate_level, int *flags_ptr)
 {
     struct x264_global *xg;
     struct x264_encoder *xe;
@@ -135,13 +165,16 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
         ct = CONNECTION_TYPE_LAN;
     }
 
-    if ((xe->x264_enc_han == NULL) ||
+    /* with network auto-detect the connection type can change, which
+       needs the encoder opened again with the other parameters */
+    if ((xe->x264_enc_han == NULL) || (xe->ct != ct) ||
             (xe->width != width) || (xe->height != height))
     {
         if (xe->x264_enc_han != NULL)
         {
-            LOG(LOG_LEVEL_INFO, "xrdp_encoder_x264_encode: "
-                "x264_encoder_close %p", xe->x264_enc_han);
+            /* a resize can do this for every frame */
+            LOG_RATELIMITED(LOG_LEVEL_INFO, 10, "xrdp_encoder_x264_encode: "
+                            "x264_encoder_close %p", xe->x264_enc_han);
             x264_encoder_close(xe->x264_enc_han);
             xe->x264_enc_han = NULL;
             g_free(xe->yuvdata);
@@ -164,13 +197,17 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
             x264_param_apply_profile(&(xe->x264_params),
                                      xg->x264_param[ct].profile);
             xe->x264_enc_han = x264_encoder_open(&(xe->x264_params));
-            LOG(LOG_LEVEL_INFO, "xrdp_encoder_x264_encode: "
-                "x264_encoder_open rv %p for width %d height %d",
-                xe->x264_enc_han, width, height);
+            LOG_RATELIMITED(LOG_LEVEL_INFO, 10, "xrdp_encoder_x264_encode: "
+                            "x264_encoder_open rv %p for width %d height %d",
+                            xe->x264_enc_han, width, height);
             if (xe->x264_enc_han == NULL)
             {
                 return 1;
             }
+            xe->rate_level = 0;
+            xe->crf = xe->x264_params.rc.f_rf_constant;
+            xe->vbv_max_bitrate = xe->x264_params.rc.i_vbv_max_bitrate;
+            xe->vbv_buffer_size = xe->x264_params.rc.i_vbv_buffer_size;
             xe->yuvdata = g_new(char, width * height * 2);
             if (xe->yuvdata == NULL)
             {
@@ -182,6 +219,12 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
         }
         xe->width = width;
         xe->height = height;
+        xe->ct = ct;
+    }
+
+    if ((xe->x264_enc_han != NULL) && (xe->rate_level != rate_level))
+    {
+        xrdp_encoder_x264_set_rate_level(xe, rate_level);
     }
 
     if ((data != NULL) && (xe->x264_enc_han != NULL))
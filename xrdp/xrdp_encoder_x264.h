@@ -33,7 +33,7 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
                          int format, const char *data,
                          short *crects, int num_crects,
                          char *cdata, int *cdata_bytes, int connection_type,
-                         int *flags_ptr);
+                         int rate_level, int *flags_ptr);
 
 #endif
 
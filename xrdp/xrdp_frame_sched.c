@@ -0,0 +1,380 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * frame scheduler for sessions without a codec
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "xrdp_frame_sched.h"
+#include "xrdp.h"
+#include "log.h"
+
+/*****************************************************************************/
+static int
+xrdp_frame_sched_bpp_to_Bpp(int bpp)
+{
+    switch (bpp)
+    {
+        case 8:
+            return 1;
+        case 15:
+        case 16:
+            return 2;
+    }
+    return 4;
+}
+
+/*****************************************************************************/
+/* the backing bitmap follows the screen, on a resize the old content and
+   damage are dropped, the module repaints everything after a resize */
+static int
+xrdp_frame_sched_check_size(struct xrdp_frame_sched *self)
+{
+    struct xrdp_wm *wm;
+    struct xrdp_bitmap *screen;
+
+    wm = self->mm->wm;
+    screen = wm->screen;
+    if ((self->backing != NULL) &&
+            (self->backing->width == screen->width) &&
+            (self->backing->height == screen->height) &&
+            (self->backing->bpp == screen->bpp))
+    {
+        return 0;
+    }
+    xrdp_bitmap_delete(self->backing);
+    xrdp_region_delete(self->damage);
+    self->backing = xrdp_bitmap_create(screen->width, screen->height,
+                                       screen->bpp, WND_TYPE_BITMAP, wm);
+    self->damage = xrdp_region_create(wm);
+    if ((self->backing == NULL) || (self->damage == NULL))
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_frame_sched_check_size: no memory for "
+            "%dx%d backing bitmap", screen->width, screen->height);
+        return 1;
+    }
+    LOG(LOG_LEVEL_DEBUG, "xrdp_frame_sched_check_size: backing bitmap "
+        "%dx%d bpp %d", screen->width, screen->height, screen->bpp);
+    return 0;
+}
+
+/*****************************************************************************/
+struct xrdp_frame_sched *
+xrdp_frame_sched_create(struct xrdp_mm *mm, int fps)
+{
+    struct xrdp_frame_sched *self;
+    struct xrdp_cfg_globals *globals;
+
+    self = g_new0(struct xrdp_frame_sched, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    globals = &(mm->wm->xrdp_config->cfg_globals);
+    self->mm = mm;
+    fps = MAX(fps, 1);
+    fps = MIN(fps, 1000);
+    self->frame_interval = 1000 / fps;
+    self->max_wait_bytes = MAX(globals->frame_scheduler_max_queued_kb, 0) *
+                           1024;
+    self->last_flush_time = g_time3() - self->frame_interval;
+    if (xrdp_frame_sched_check_size(self) != 0)
+    {
+        xrdp_frame_sched_delete(self);
+        return NULL;
+    }
+    LOG(LOG_LEVEL_INFO, "xrdp_frame_sched_create: frame interval %d ms, "
+        "max queued %d bytes", self->frame_interval, self->max_wait_bytes);
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_frame_sched_delete(struct xrdp_frame_sched *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    LOG(LOG_LEVEL_DEBUG, "xrdp_frame_sched_delete: frames in %d, frames "
+        "out %d, deferred %d", self->frames_in, self->frames_out,
+        self->flushes_deferred);
+    xrdp_bitmap_delete(self->backing);
+    xrdp_region_delete(self->damage);
+    g_free(self);
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_sched_add_rect(struct xrdp_frame_sched *self,
+                          const char *data, int width, int height,
+                          int x, int y, int cx, int cy,
+                          int srcx, int srcy)
+{
+    struct xrdp_rect rect;
+    const char *src;
+    char *dst;
+    int Bpp;
+    int src_stride;
+    int index;
+
+    if (xrdp_frame_sched_check_size(self) != 0)
+    {
+        return 1;
+    }
+    /* clip to the source data */
+    if (srcx < 0)
+    {
+        x -= srcx;
+        cx += srcx;
+        srcx = 0;
+    }
+    if (srcy < 0)
+    {
+        y -= srcy;
+        cy += srcy;
+        srcy = 0;
+    }
+    cx = MIN(cx, width - srcx);
+    cy = MIN(cy, height - srcy);
+    /* clip to the backing bitmap */
+    if (x < 0)
+    {
+        srcx -= x;
+        cx += x;
+        x = 0;
+    }
+    if (y < 0)
+    {
+        srcy -= y;
+        cy += y;
+        y = 0;
+    }
+    cx = MIN(cx, self->backing->width - x);
+    cy = MIN(cy, self->backing->height - y);
+    if ((cx < 1) || (cy < 1))
+    {
+        return 0;
+    }
+    Bpp = xrdp_frame_sched_bpp_to_Bpp(self->backing->bpp);
+    src_stride = width * Bpp;
+    src = data + srcy * src_stride + srcx * Bpp;
+    dst = self->backing->data + y * self->backing->line_size + x * Bpp;
+    for (index = 0; index < cy; index++)
+    {
+        g_memcpy(dst, src, cx * Bpp);
+        src += src_stride;
+        dst += self->backing->line_size;
+    }
+    rect.left = x;
+    rect.top = y;
+    rect.right = x + cx;
+    rect.bottom = y + cy;
+    return xrdp_region_add_rect(self->damage, &rect);
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_sched_add_rects(struct xrdp_frame_sched *self,
+                           const char *data, int width, int height,
+                           const short *rects, int num_rects)
+{
+    int index;
+
+    self->frames_in++;
+    for (index = 0; index < num_rects; index++)
+    {
+        if (xrdp_frame_sched_add_rect(self, data, width, height,
+                                      rects[0], rects[1],
+                                      rects[2], rects[3],
+                                      rects[0], rects[1]) != 0)
+        {
+            return 1;
+        }
+        rects += 4;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* frame markers are only used when the orders go out before the end
+   marker, i.e. when not nested inside a module update */
+static int
+xrdp_frame_sched_send(struct xrdp_frame_sched *self, int use_markers)
+{
+    struct xrdp_wm *wm;
+    struct xrdp_painter *p;
+    struct xrdp_bitmap *target;
+    struct xrdp_rect rect;
+    int index;
+
+    if ((self->damage == NULL) || !xrdp_region_not_empty(self->damage))
+    {
+        return 0;
+    }
+    wm = self->mm->wm;
+    use_markers = use_markers && wm->client_info->use_frame_acks &&
+                  (wm->client_info->use_fast_path & 1);
+    p = xrdp_painter_create(wm, wm->session);
+    if (p == NULL)
+    {
+        return 1;
+    }
+    if (use_markers)
+    {
+        self->frame_id_sent++;
+        libxrdp_fastpath_send_frame_marker(wm->session, 0,
+                                           self->frame_id_sent);
+    }
+    target = wm->target_surface;
+    wm->target_surface = wm->screen;
+    xrdp_painter_begin_update(p);
+    index = 0;
+    while (xrdp_region_get_rect(self->damage, index, &rect) == 0)
+    {
+        xrdp_painter_copy(p, self->backing, wm->screen,
+                          rect.left, rect.top,
+                          rect.right - rect.left, rect.bottom - rect.top,
+                          rect.left, rect.top);
+        index++;
+    }
+    wm->target_surface = target;
+    wm_painter_set_target(p);
+    xrdp_painter_end_update(p);
+    xrdp_painter_delete(p);
+    if (use_markers)
+    {
+        libxrdp_fastpath_send_frame_marker(wm->session, 1,
+                                           self->frame_id_sent);
+        self->frames_in_flight = self->frame_id_sent - self->frame_id_acked;
+    }
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_frame_sched_send: %d rects, frame %d",
+              index, self->frame_id_sent);
+    xrdp_region_delete(self->damage);
+    self->damage = xrdp_region_create(wm);
+    self->last_flush_time = g_time3();
+    self->frames_out++;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_sched_flush(struct xrdp_frame_sched *self)
+{
+    if (self == NULL)
+    {
+        return 0;
+    }
+    return xrdp_frame_sched_send(self, 0);
+}
+
+/*****************************************************************************/
+/* returns non zero if the client can't take a frame now */
+static int
+xrdp_frame_sched_blocked(struct xrdp_frame_sched *self)
+{
+    struct xrdp_client_info *client_info;
+
+    client_info = self->mm->wm->client_info;
+    if ((self->max_wait_bytes > 0) &&
+            (trans_get_wait_bytes(self->mm->wm->session->trans) >
+             self->max_wait_bytes))
+    {
+        return 1;
+    }
+    if (client_info->use_frame_acks &&
+            (self->frames_in_flight >=
+             MAX(client_info->max_unacknowledged_frame_count, 1)))
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_sched_check(struct xrdp_frame_sched *self)
+{
+    int diff;
+
+    if ((self == NULL) || (self->damage == NULL) ||
+            !xrdp_region_not_empty(self->damage))
+    {
+        return 0;
+    }
+    diff = g_time3() - self->last_flush_time;
+    if ((diff >= 0) && (diff < self->frame_interval))
+    {
+        return 0;
+    }
+    if (xrdp_frame_sched_blocked(self))
+    {
+        self->flushes_deferred++;
+        return 0;
+    }
+    return xrdp_frame_sched_send(self, 1);
+}
+
+/*****************************************************************************/
+void
+xrdp_frame_sched_get_timeout(struct xrdp_frame_sched *self, int *timeout)
+{
+    int diff;
+
+    if ((self == NULL) || (self->damage == NULL) ||
+            !xrdp_region_not_empty(self->damage))
+    {
+        return;
+    }
+    if (xrdp_frame_sched_blocked(self))
+    {
+        /* socket writes and frame acks wake us, this is a fallback */
+        diff = self->frame_interval;
+    }
+    else
+    {
+        diff = self->last_flush_time + self->frame_interval - g_time3();
+        diff = MAX(diff, 0);
+        diff = MIN(diff, self->frame_interval);
+    }
+    if ((*timeout < 0) || (*timeout > diff))
+    {
+        *timeout = diff;
+    }
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_sched_frame_ack(struct xrdp_frame_sched *self, int frame_id)
+{
+    if (self == NULL)
+    {
+        return 0;
+    }
+    if ((frame_id < 0) || (frame_id > self->frame_id_sent))
+    {
+        /* same as the encoder, a big or negative id acks everything */
+        self->frame_id_acked = self->frame_id_sent;
+    }
+    else
+    {
+        self->frame_id_acked = MAX(frame_id, self->frame_id_acked);
+    }
+    self->frames_in_flight = self->frame_id_sent - self->frame_id_acked;
+    return 0;
+}
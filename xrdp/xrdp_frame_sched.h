@@ -0,0 +1,117 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * frame scheduler for sessions without a codec
+ *
+ * Pixels painted by the module are copied into a screen sized backing
+ * bitmap and the damage is accumulated. The damage is sent to the
+ * client as bitmap updates at most at the configured frame rate, and only
+ * when the client socket and the client frame acks allow it. Content
+ * which is overwritten before it is sent is never sent.
+ */
+
+#ifndef _XRDP_FRAME_SCHED_H
+#define _XRDP_FRAME_SCHED_H
+
+#include "arch.h"
+
+struct xrdp_mm;
+struct xrdp_bitmap;
+struct xrdp_region;
+
+struct xrdp_frame_sched
+{
+    struct xrdp_mm *mm; /* owner */
+    struct xrdp_bitmap *backing; /* latest pixels, screen sized */
+    struct xrdp_region *damage; /* parts of backing not sent yet */
+    int frame_interval; /* min ms between flushes */
+    int max_wait_bytes; /* don't flush with more than this queued */
+    int last_flush_time;
+    /* client frame acks, only used if the client supports them */
+    int frame_id_sent;
+    int frame_id_acked;
+    int frames_in_flight;
+    /* statistics */
+    int frames_in;
+    int frames_out;
+    int flushes_deferred;
+};
+
+/**
+ * Create a frame scheduler for the module manager
+ *
+ * @param mm Owning module manager
+ * @param fps Target frames per second
+ * @return scheduler or NULL on error
+ */
+struct xrdp_frame_sched *
+xrdp_frame_sched_create(struct xrdp_mm *mm, int fps);
+void
+xrdp_frame_sched_delete(struct xrdp_frame_sched *self);
+
+/**
+ * Copy painted pixels into the backing bitmap and add them to the damage
+ *
+ * @param self Scheduler
+ * @param data Source pixels, screen bpp, width * height
+ * @param width Width of data
+ * @param height Height of data
+ * @param rects num_rects x, y, cx, cy rectangles to copy, in screen
+ *              co-ordinates which are also data co-ordinates
+ * @param num_rects Number of rectangles
+ * @return 0 on success
+ */
+int
+xrdp_frame_sched_add_rects(struct xrdp_frame_sched *self,
+                           const char *data, int width, int height,
+                           const short *rects, int num_rects);
+/**
+ * As xrdp_frame_sched_add_rects(), for a single rectangle whose source
+ * is at srcx, srcy in data
+ */
+int
+xrdp_frame_sched_add_rect(struct xrdp_frame_sched *self,
+                          const char *data, int width, int height,
+                          int x, int y, int cx, int cy,
+                          int srcx, int srcy);
+
+/**
+ * Send pending damage now, regardless of frame rate and back-pressure
+ *
+ * Used before drawing which must be ordered after the pending pixels
+ */
+int
+xrdp_frame_sched_flush(struct xrdp_frame_sched *self);
+
+/**
+ * Send pending damage if the frame interval has elapsed and the client
+ * can take it
+ */
+int
+xrdp_frame_sched_check(struct xrdp_frame_sched *self);
+
+/**
+ * Lower *timeout so the main loop wakes up for the next flush
+ */
+void
+xrdp_frame_sched_get_timeout(struct xrdp_frame_sched *self, int *timeout);
+
+/**
+ * Client TS_FRAME_ACKNOWLEDGE_PDU for a frame we sent
+ */
+int
+xrdp_frame_sched_frame_ack(struct xrdp_frame_sched *self, int frame_id);
+
+#endif
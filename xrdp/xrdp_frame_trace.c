@@ -0,0 +1,867 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * frame trace files
+ *
+ * All values are little endian. The file starts with
+ *   magic "XRDPFTR1", version u16, width u16, height u16,
+ *   capture_code u16, capture_format u32
+ * where the capture code and format are those the module was asked for,
+ * as they say what the pixels and egfx data hold
+ * followed by records, each
+ *   type u16, flags u16, time_ms u32, bytes u32, then bytes of payload
+ * Readers skip records of types they don't know, flags must be 0.
+ *
+ * A frame record is
+ *   frame_id u32, num_drects u16, num_crects u16,
+ *   drects and crects, x, y, cx, cy s16 each,
+ *   then the pixels of each crect in turn, delta coded a line at a time
+ *   against the screen as it was after the previous frame
+ * An egfx record is
+ *   cmd_bytes u32, data_bytes u32, the commands, then the data, delta
+ *   coded against the data of the previous egfx record if that was the
+ *   same size, otherwise against zeros. The last data_bytes % 4 bytes
+ *   are stored as they are
+ * An input record is
+ *   msg u16, device_flags u16, x s16, y s16
+ *   key events only keep msg, so what was typed is not recorded
+ * An ack record is
+ *   frame_id u32
+ *
+ * Delta coding works on 32 bit words, each code byte is followed by
+ *   0x00 - 0x7f  nothing, (code + 1) words are as they were
+ *   0x80 - 0xbf  ((code & 0x3f) + 1) words
+ *   0xc0 - 0xff  one word, repeated ((code & 0x3f) + 1) times
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "arch.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "log.h"
+#include "xrdp_frame_trace.h"
+
+#define FRAME_TRACE_MAGIC "XRDPFTR1"
+#define FRAME_TRACE_VERSION 2
+#define FRAME_TRACE_HEADER_BYTES 20
+#define FRAME_TRACE_RECORD_BYTES 12
+#define FRAME_TRACE_MAX_RECORD_BYTES (256 * 1024 * 1024)
+#define FRAME_TRACE_MAX_RECTS 0xffff
+#define FRAME_TRACE_MAX_DIM 16384
+
+/* most bytes delta coding can take for a word */
+#define DELTA_MAX_WORD_BYTES 5
+
+struct xrdp_frame_trace
+{
+    int fd;
+    int width;
+    int height;
+    int capture_code;
+    int capture_format;
+    struct stream *s; /* one record */
+    /* writing, what the reader will have */
+    unsigned int *screen;
+    /* reading */
+    struct xrdp_frame_trace_record record;
+    struct xrdp_frame_trace_frame frame;
+    int drects_alloc;
+    int crects_alloc;
+    /* last egfx data, both */
+    char *egfx_data;
+    int egfx_data_bytes;
+};
+
+/*****************************************************************************/
+static struct xrdp_frame_trace *
+xrdp_frame_trace_new(int fd, int width, int height)
+{
+    struct xrdp_frame_trace *self;
+
+    self = g_new0(struct xrdp_frame_trace, 1);
+    if (self == NULL)
+    {
+        g_file_close(fd);
+        return NULL;
+    }
+    self->fd = fd;
+    self->width = width;
+    self->height = height;
+    make_stream(self->s);
+    init_stream(self->s, 64 * 1024);
+    return self;
+}
+
+/*****************************************************************************/
+/* returns 0 if all len bytes were read, 1 at end of file before any
+   were read, otherwise 2 */
+static int
+read_all(int fd, char *data, int len)
+{
+    int bytes;
+    int got;
+
+    got = 0;
+    while (got < len)
+    {
+        bytes = g_file_read(fd, data + got, len - got);
+        if (bytes <= 0)
+        {
+            return (got == 0 && bytes == 0) ? 1 : 2;
+        }
+        got += bytes;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* clips a rect to the screen, returns 0 if nothing is left */
+static int
+clip_rect(struct xrdp_frame_trace *self, const short *in, short *out)
+{
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+
+    x1 = MAX(in[0], 0);
+    y1 = MAX(in[1], 0);
+    x2 = MIN(in[0] + in[2], self->width);
+    y2 = MIN(in[1] + in[3], self->height);
+    if (x2 <= x1 || y2 <= y1)
+    {
+        return 0;
+    }
+    out[0] = x1;
+    out[1] = y1;
+    out[2] = x2 - x1;
+    out[3] = y2 - y1;
+    return 1;
+}
+
+/*****************************************************************************/
+/* codes count words of cur against ref */
+static void
+delta_encode(struct stream *s, const unsigned int *ref,
+             const unsigned int *cur, int count)
+{
+    int index;
+    int run;
+    int jndex;
+
+    index = 0;
+    while (index < count)
+    {
+        run = 1;
+        if (cur[index] == ref[index])
+        {
+            while (index + run < count && run < 128 &&
+                    cur[index + run] == ref[index + run])
+            {
+                run++;
+            }
+            out_uint8(s, run - 1);
+        }
+        else if (index + 1 < count && cur[index + 1] == cur[index])
+        {
+            while (index + run < count && run < 64 &&
+                    cur[index + run] == cur[index])
+            {
+                run++;
+            }
+            out_uint8(s, 0xc0 | (run - 1));
+            out_uint32_le(s, cur[index]);
+        }
+        else
+        {
+            /* stop before a word that is unchanged or starts a repeat */
+            while (index + run < count && run < 64 &&
+                    cur[index + run] != ref[index + run] &&
+                    !(index + run + 1 < count &&
+                      cur[index + run + 1] == cur[index + run]))
+            {
+                run++;
+            }
+            out_uint8(s, 0x80 | (run - 1));
+            for (jndex = 0; jndex < run; jndex++)
+            {
+                out_uint32_le(s, cur[index + jndex]);
+            }
+        }
+        index += run;
+    }
+}
+
+/*****************************************************************************/
+/* decodes count words into dst, which holds the reference */
+static int
+delta_decode(struct stream *s, unsigned int *dst, int count)
+{
+    unsigned int word;
+    int index;
+    int jndex;
+    int run;
+    int code;
+
+    index = 0;
+    while (index < count)
+    {
+        if (!s_check_rem(s, 1))
+        {
+            return 1;
+        }
+        in_uint8(s, code);
+        run = (code < 0x80) ? code + 1 : (code & 0x3f) + 1;
+        if (run > count - index)
+        {
+            return 1;
+        }
+        if (code >= 0xc0)
+        {
+            if (!s_check_rem(s, 4))
+            {
+                return 1;
+            }
+            in_uint32_le(s, word);
+            for (jndex = 0; jndex < run; jndex++)
+            {
+                dst[index + jndex] = word;
+            }
+        }
+        else if (code >= 0x80)
+        {
+            if (!s_check_rem(s, run * 4))
+            {
+                return 1;
+            }
+            for (jndex = 0; jndex < run; jndex++)
+            {
+                in_uint32_le(s, dst[index + jndex]);
+            }
+        }
+        index += run;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* makes self->egfx_data bytes long, zeroed if the size changes */
+static int
+size_egfx_data(struct xrdp_frame_trace *self, int bytes)
+{
+    if (self->egfx_data != NULL && bytes == self->egfx_data_bytes)
+    {
+        return 0;
+    }
+    g_free(self->egfx_data);
+    self->egfx_data = g_new0(char, MAX(bytes, 1));
+    self->egfx_data_bytes = (self->egfx_data == NULL) ? 0 : bytes;
+    return (self->egfx_data == NULL) ? 1 : 0;
+}
+
+/*****************************************************************************/
+/* starts a record in self->s with room for bytes of payload */
+static void
+start_record(struct xrdp_frame_trace *self, int type,
+             unsigned int time_ms, int bytes)
+{
+    struct stream *s;
+
+    s = self->s;
+    init_stream(s, FRAME_TRACE_RECORD_BYTES + bytes);
+    out_uint16_le(s, type);
+    out_uint16_le(s, 0); /* flags */
+    out_uint32_le(s, time_ms);
+    out_uint32_le(s, 0); /* bytes, set by write_record */
+}
+
+/*****************************************************************************/
+static int
+write_record(struct xrdp_frame_trace *self)
+{
+    struct stream *s;
+    int bytes;
+
+    s = self->s;
+    s_mark_end(s);
+    bytes = (int)(s->end - s->data);
+    s->p = s->data + 8;
+    out_uint32_le(s, bytes - FRAME_TRACE_RECORD_BYTES);
+    if (g_file_write(self->fd, s->data, bytes) != bytes)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_frame_trace: write failed");
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+struct xrdp_frame_trace *
+xrdp_frame_trace_create(const char *filename, int width, int height,
+                        int capture_code, int capture_format)
+{
+    struct xrdp_frame_trace *self;
+    struct stream *s;
+    int fd;
+
+    if (width < 1 || width > FRAME_TRACE_MAX_DIM ||
+            height < 1 || height > FRAME_TRACE_MAX_DIM)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_frame_trace_create: bad size %dx%d",
+            width, height);
+        return NULL;
+    }
+    fd = g_file_open_ex(filename, 0, 1, 1, 1);
+    if (fd < 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_frame_trace_create: can't create %s",
+            filename);
+        return NULL;
+    }
+    self = xrdp_frame_trace_new(fd, width, height);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->capture_code = capture_code;
+    self->capture_format = capture_format;
+    self->screen = g_new0(unsigned int, width * height);
+    if (self->screen == NULL)
+    {
+        xrdp_frame_trace_delete(self);
+        return NULL;
+    }
+    s = self->s;
+    out_uint8a(s, FRAME_TRACE_MAGIC, 8);
+    out_uint16_le(s, FRAME_TRACE_VERSION);
+    out_uint16_le(s, width);
+    out_uint16_le(s, height);
+    out_uint16_le(s, capture_code);
+    out_uint32_le(s, capture_format);
+    s_mark_end(s);
+    if (g_file_write(fd, s->data, FRAME_TRACE_HEADER_BYTES) !=
+            FRAME_TRACE_HEADER_BYTES)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_frame_trace_create: write failed");
+        xrdp_frame_trace_delete(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+struct xrdp_frame_trace *
+xrdp_frame_trace_open(const char *filename)
+{
+    struct xrdp_frame_trace *self;
+    struct stream *s;
+    char magic[8];
+    int fd;
+    int version;
+    int width;
+    int height;
+    int rows;
+
+    fd = g_file_open_ro(filename);
+    if (fd < 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_frame_trace_open: can't open %s",
+            filename);
+        return NULL;
+    }
+    self = xrdp_frame_trace_new(fd, 0, 0);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    s = self->s;
+    if (read_all(fd, s->data, FRAME_TRACE_HEADER_BYTES) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_frame_trace_open: %s is too short",
+            filename);
+        xrdp_frame_trace_delete(self);
+        return NULL;
+    }
+    s->end = s->data + FRAME_TRACE_HEADER_BYTES;
+    in_uint8a(s, magic, 8);
+    in_uint16_le(s, version);
+    in_uint16_le(s, width);
+    in_uint16_le(s, height);
+    in_uint16_le(s, self->capture_code);
+    in_uint32_le(s, self->capture_format);
+    if (g_memcmp(magic, FRAME_TRACE_MAGIC, 8) != 0 ||
+            version != FRAME_TRACE_VERSION ||
+            width < 1 || width > FRAME_TRACE_MAX_DIM ||
+            height < 1 || height > FRAME_TRACE_MAX_DIM)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_frame_trace_open: %s is not a "
+            "version %d frame trace", filename, FRAME_TRACE_VERSION);
+        xrdp_frame_trace_delete(self);
+        return NULL;
+    }
+    self->width = width;
+    self->height = height;
+    self->frame.width = width;
+    self->frame.height = height;
+    self->frame.stride = ((width + 63) & ~63) * 4;
+    rows = (height + 63) & ~63;
+    self->frame.data = g_new0(char, self->frame.stride * rows);
+    if (self->frame.data == NULL)
+    {
+        xrdp_frame_trace_delete(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_frame_trace_delete(struct xrdp_frame_trace *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    g_file_close(self->fd);
+    free_stream(self->s);
+    g_free(self->screen);
+    g_free(self->frame.drects);
+    g_free(self->frame.crects);
+    g_free(self->frame.data);
+    g_free(self->egfx_data);
+    g_free(self);
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_get_width(struct xrdp_frame_trace *self)
+{
+    return self->width;
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_get_height(struct xrdp_frame_trace *self)
+{
+    return self->height;
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_get_capture_code(struct xrdp_frame_trace *self)
+{
+    return self->capture_code;
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_get_capture_format(struct xrdp_frame_trace *self)
+{
+    return self->capture_format;
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_add_frame(struct xrdp_frame_trace *self,
+                           unsigned int time_ms, int frame_id,
+                           const short *drects, int num_drects,
+                           const short *crects, int num_crects,
+                           const char *data, int stride)
+{
+    struct stream *s;
+    unsigned int *ref;
+    const unsigned int *cur;
+    short rect[4];
+    int index;
+    int line;
+    int nd;
+    int nc;
+    int bytes;
+
+    /* first pass sizes the record, for the worst case coding */
+    nd = 0;
+    nc = 0;
+    bytes = 8;
+    for (index = 0; index < num_drects; index++)
+    {
+        nd += clip_rect(self, drects + index * 4, rect);
+    }
+    for (index = 0; index < num_crects; index++)
+    {
+        if (clip_rect(self, crects + index * 4, rect))
+        {
+            nc++;
+            bytes += rect[2] * rect[3] * DELTA_MAX_WORD_BYTES;
+            if (bytes > FRAME_TRACE_MAX_RECORD_BYTES)
+            {
+                return 1;
+            }
+        }
+    }
+    if (nd > FRAME_TRACE_MAX_RECTS || nc > FRAME_TRACE_MAX_RECTS)
+    {
+        return 1;
+    }
+    bytes += (nd + nc) * 8;
+
+    start_record(self, XRDP_FRAME_TRACE_FRAME, time_ms, bytes);
+    s = self->s;
+    out_uint32_le(s, frame_id);
+    out_uint16_le(s, nd);
+    out_uint16_le(s, nc);
+    for (index = 0; index < num_drects; index++)
+    {
+        if (clip_rect(self, drects + index * 4, rect))
+        {
+            out_uint16_le(s, rect[0]);
+            out_uint16_le(s, rect[1]);
+            out_uint16_le(s, rect[2]);
+            out_uint16_le(s, rect[3]);
+        }
+    }
+    for (index = 0; index < num_crects; index++)
+    {
+        if (clip_rect(self, crects + index * 4, rect))
+        {
+            out_uint16_le(s, rect[0]);
+            out_uint16_le(s, rect[1]);
+            out_uint16_le(s, rect[2]);
+            out_uint16_le(s, rect[3]);
+        }
+    }
+    for (index = 0; index < num_crects; index++)
+    {
+        if (clip_rect(self, crects + index * 4, rect))
+        {
+            for (line = 0; line < rect[3]; line++)
+            {
+                ref = self->screen + (rect[1] + line) * self->width + rect[0];
+                cur = (const unsigned int *)
+                      (data + (rect[1] + line) * stride + rect[0] * 4);
+                delta_encode(s, ref, cur, rect[2]);
+                g_memcpy(ref, cur, rect[2] * 4);
+            }
+        }
+    }
+    return write_record(self);
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_add_egfx(struct xrdp_frame_trace *self,
+                          unsigned int time_ms,
+                          const char *cmd, int cmd_bytes,
+                          const char *data, int data_bytes)
+{
+    struct stream *s;
+    int words;
+
+    if (cmd_bytes < 0 || data_bytes < 0 ||
+            cmd_bytes > FRAME_TRACE_MAX_RECORD_BYTES / 2 ||
+            data_bytes / 4 > FRAME_TRACE_MAX_RECORD_BYTES / 2 /
+            DELTA_MAX_WORD_BYTES)
+    {
+        return 1;
+    }
+    if (size_egfx_data(self, data_bytes) != 0)
+    {
+        return 1;
+    }
+    words = data_bytes / 4;
+    start_record(self, XRDP_FRAME_TRACE_EGFX, time_ms,
+                 8 + cmd_bytes + words * DELTA_MAX_WORD_BYTES + 3);
+    s = self->s;
+    out_uint32_le(s, cmd_bytes);
+    out_uint32_le(s, data_bytes);
+    out_uint8a(s, cmd, cmd_bytes);
+    if (data_bytes > 0)
+    {
+        delta_encode(s, (const unsigned int *) self->egfx_data,
+                     (const unsigned int *) data, words);
+        out_uint8a(s, data + words * 4, data_bytes - words * 4);
+        g_memcpy(self->egfx_data, data, data_bytes);
+    }
+    return write_record(self);
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_add_input(struct xrdp_frame_trace *self,
+                           unsigned int time_ms, int msg,
+                           int device_flags, int x, int y)
+{
+    struct stream *s;
+
+    start_record(self, XRDP_FRAME_TRACE_INPUT, time_ms, 8);
+    s = self->s;
+    out_uint16_le(s, msg);
+    out_uint16_le(s, device_flags);
+    out_uint16_le(s, x);
+    out_uint16_le(s, y);
+    return write_record(self);
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_add_ack(struct xrdp_frame_trace *self,
+                         unsigned int time_ms, int frame_id)
+{
+    struct stream *s;
+
+    start_record(self, XRDP_FRAME_TRACE_ACK, time_ms, 4);
+    s = self->s;
+    out_uint32_le(s, frame_id);
+    return write_record(self);
+}
+
+/*****************************************************************************/
+/* reads num rects from s into *rects, growing it, rects must be on the
+   screen */
+static int
+read_rects(struct xrdp_frame_trace *self, struct stream *s, int num,
+           short **rects, int *alloc)
+{
+    short *r;
+    int index;
+
+    if (num > *alloc)
+    {
+        g_free(*rects);
+        *rects = g_new(short, num * 4);
+        *alloc = (*rects == NULL) ? 0 : num;
+        if (*rects == NULL)
+        {
+            return 1;
+        }
+    }
+    r = *rects;
+    for (index = 0; index < num * 4; index++)
+    {
+        in_sint16_le(s, r[index]);
+    }
+    for (index = 0; index < num; index++, r += 4)
+    {
+        if (r[0] < 0 || r[1] < 0 || r[2] < 1 || r[3] < 1 ||
+                r[0] + r[2] > self->width || r[1] + r[3] > self->height)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+read_frame(struct xrdp_frame_trace *self, struct stream *s)
+{
+    struct xrdp_frame_trace_frame *frame;
+    short *r;
+    int frame_id;
+    int nd;
+    int nc;
+    int index;
+    int line;
+
+    frame = &self->frame;
+    if (!s_check_rem(s, 8))
+    {
+        return 1;
+    }
+    in_uint32_le(s, frame_id);
+    in_uint16_le(s, nd);
+    in_uint16_le(s, nc);
+    if (!s_check_rem(s, (nd + nc) * 8) ||
+            read_rects(self, s, nd, &frame->drects, &self->drects_alloc) != 0 ||
+            read_rects(self, s, nc, &frame->crects, &self->crects_alloc) != 0)
+    {
+        return 1;
+    }
+    for (index = 0; index < nc; index++)
+    {
+        r = frame->crects + index * 4;
+        for (line = 0; line < r[3]; line++)
+        {
+            if (delta_decode(s, (unsigned int *)
+                             (frame->data + (r[1] + line) * frame->stride +
+                              r[0] * 4), r[2]) != 0)
+            {
+                return 1;
+            }
+        }
+    }
+    frame->frame_id = frame_id;
+    frame->num_drects = nd;
+    frame->num_crects = nc;
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+read_egfx(struct xrdp_frame_trace *self, struct stream *s)
+{
+    struct xrdp_frame_trace_record *rec;
+    int cmd_bytes;
+    int data_bytes;
+    int words;
+
+    rec = &self->record;
+    if (!s_check_rem(s, 8))
+    {
+        return 1;
+    }
+    in_uint32_le(s, cmd_bytes);
+    in_uint32_le(s, data_bytes);
+    if (cmd_bytes < 0 || data_bytes < 0 || !s_check_rem(s, cmd_bytes) ||
+            data_bytes / 4 > FRAME_TRACE_MAX_RECORD_BYTES / 2 /
+            DELTA_MAX_WORD_BYTES)
+    {
+        return 1;
+    }
+    rec->cmd = s->p;
+    rec->cmd_bytes = cmd_bytes;
+    in_uint8s(s, cmd_bytes);
+    if (size_egfx_data(self, data_bytes) != 0)
+    {
+        return 1;
+    }
+    words = data_bytes / 4;
+    if (delta_decode(s, (unsigned int *) self->egfx_data, words) != 0 ||
+            !s_check_rem(s, data_bytes - words * 4))
+    {
+        return 1;
+    }
+    in_uint8a(s, self->egfx_data + words * 4, data_bytes - words * 4);
+    rec->data = self->egfx_data;
+    rec->data_bytes = data_bytes;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_read_record(struct xrdp_frame_trace *self,
+                             struct xrdp_frame_trace_record **record)
+{
+    struct xrdp_frame_trace_record *rec;
+    struct stream *s;
+    int rv;
+    int type;
+    int flags;
+    unsigned int time_ms;
+    unsigned int bytes;
+
+    *record = NULL;
+    rec = &self->record;
+    s = self->s;
+    for (;;)
+    {
+        init_stream(s, FRAME_TRACE_RECORD_BYTES);
+        rv = read_all(self->fd, s->data, FRAME_TRACE_RECORD_BYTES);
+        if (rv == 1)
+        {
+            return 0; /* end of trace */
+        }
+        if (rv != 0)
+        {
+            break;
+        }
+        s->end = s->data + FRAME_TRACE_RECORD_BYTES;
+        in_uint16_le(s, type);
+        in_uint16_le(s, flags);
+        in_uint32_le(s, time_ms);
+        in_uint32_le(s, bytes);
+        if (bytes > FRAME_TRACE_MAX_RECORD_BYTES)
+        {
+            break;
+        }
+        init_stream(s, (int)bytes);
+        if (read_all(self->fd, s->data, (int)bytes) != 0)
+        {
+            break;
+        }
+        s->end = s->data + bytes;
+        g_memset(rec, 0, sizeof(*rec));
+        if (type == XRDP_FRAME_TRACE_FRAME)
+        {
+            if (flags != 0 || read_frame(self, s) != 0)
+            {
+                break;
+            }
+            self->frame.time_ms = time_ms;
+            rec->frame = &self->frame;
+        }
+        else if (type == XRDP_FRAME_TRACE_EGFX)
+        {
+            if (flags != 0 || read_egfx(self, s) != 0)
+            {
+                break;
+            }
+        }
+        else if (type == XRDP_FRAME_TRACE_INPUT)
+        {
+            if (flags != 0 || !s_check_rem(s, 8))
+            {
+                break;
+            }
+            in_uint16_le(s, rec->input_msg);
+            in_uint16_le(s, rec->device_flags);
+            in_sint16_le(s, rec->x);
+            in_sint16_le(s, rec->y);
+        }
+        else if (type == XRDP_FRAME_TRACE_ACK)
+        {
+            if (flags != 0 || !s_check_rem(s, 4))
+            {
+                break;
+            }
+            in_uint32_le(s, rec->frame_id);
+        }
+        else
+        {
+            continue;
+        }
+        rec->type = type;
+        rec->time_ms = time_ms;
+        *record = rec;
+        return 0;
+    }
+    LOG(LOG_LEVEL_ERROR, "xrdp_frame_trace_read: bad or truncated record");
+    return 1;
+}
+
+/*****************************************************************************/
+int
+xrdp_frame_trace_read(struct xrdp_frame_trace *self,
+                      struct xrdp_frame_trace_frame **frame)
+{
+    struct xrdp_frame_trace_record *rec;
+
+    *frame = NULL;
+    do
+    {
+        if (xrdp_frame_trace_read_record(self, &rec) != 0)
+        {
+            return 1;
+        }
+    }
+    while (rec != NULL && rec->type != XRDP_FRAME_TRACE_FRAME);
+    if (rec != NULL)
+    {
+        *frame = rec->frame;
+    }
+    return 0;
+}
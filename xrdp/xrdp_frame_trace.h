@@ -0,0 +1,203 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * frame trace files
+ *
+ * A trace records the frames a module sent to xrdp, the dirty rects,
+ * copy rects and pixels, so they can be fed to the encoders again
+ * without X or a client. Only the pixels inside the copy rects are
+ * stored, coded against what was there before. The reader keeps a
+ * screen sized buffer and applies each frame to it, so the encoders see
+ * what they would have seen in the shared memory.
+ *
+ * A trace can also hold the egfx commands a module sent, the input
+ * events and the frame acks from the client, with their times.
+ */
+
+#ifndef _XRDP_FRAME_TRACE_H
+#define _XRDP_FRAME_TRACE_H
+
+#include "arch.h"
+
+struct xrdp_frame_trace;
+
+enum xrdp_frame_trace_type
+{
+    XRDP_FRAME_TRACE_FRAME = 1,
+    XRDP_FRAME_TRACE_EGFX = 2,
+    XRDP_FRAME_TRACE_INPUT = 3,
+    XRDP_FRAME_TRACE_ACK = 4
+};
+
+/* a frame read back from a trace */
+struct xrdp_frame_trace_frame
+{
+    unsigned int time_ms; /* from the start of the trace */
+    int frame_id;
+    int num_drects;
+    short *drects; /* x, y, cx, cy for each */
+    int num_crects;
+    short *crects; /* x, y, cx, cy for each */
+    char *data; /* whole screen, 32 bpp */
+    int width;
+    int height;
+    int stride; /* in bytes, width is rounded up to 64 pixels, and the
+                   buffer has height rounded up to 64 rows, as RFX wants */
+};
+
+/* any record read back from a trace */
+struct xrdp_frame_trace_record
+{
+    enum xrdp_frame_trace_type type;
+    unsigned int time_ms; /* from the start of the trace */
+    /* XRDP_FRAME_TRACE_FRAME */
+    struct xrdp_frame_trace_frame *frame;
+    /* XRDP_FRAME_TRACE_EGFX, as passed to server_egfx_cmd() */
+    char *cmd;
+    int cmd_bytes;
+    char *data;
+    int data_bytes;
+    /* XRDP_FRAME_TRACE_INPUT, an RDP_INPUT_* message, the flags and
+       position are only kept for the mouse */
+    int input_msg;
+    int device_flags;
+    int x;
+    int y;
+    /* XRDP_FRAME_TRACE_ACK */
+    int frame_id;
+};
+
+/**
+ * Create a trace file for writing
+ *
+ * @param filename File to create, truncated if it exists
+ * @param width Screen width
+ * @param height Screen height
+ * @param capture_code The enum xrdp_capture_code of the session. Frames
+ *                     are only stored right for CC_SIMPLE captures
+ * @param capture_format The XRDP_* capture format of the session
+ * @return trace or NULL on error
+ */
+struct xrdp_frame_trace *
+xrdp_frame_trace_create(const char *filename, int width, int height,
+                        int capture_code, int capture_format);
+
+/**
+ * Open a trace file for reading
+ *
+ * @return trace or NULL on error
+ */
+struct xrdp_frame_trace *
+xrdp_frame_trace_open(const char *filename);
+
+/**
+ * Close a trace, for reading or writing
+ */
+void
+xrdp_frame_trace_delete(struct xrdp_frame_trace *self);
+
+/**
+ * Screen size of a trace
+ */
+int
+xrdp_frame_trace_get_width(struct xrdp_frame_trace *self);
+int
+xrdp_frame_trace_get_height(struct xrdp_frame_trace *self);
+
+/**
+ * Capture code and format of the session a trace came from
+ */
+int
+xrdp_frame_trace_get_capture_code(struct xrdp_frame_trace *self);
+int
+xrdp_frame_trace_get_capture_format(struct xrdp_frame_trace *self);
+
+/**
+ * Add a frame to a trace being written
+ *
+ * Rects are clipped to the screen
+ *
+ * @param time_ms Time from the start of the trace
+ * @param drects num_drects x, y, cx, cy dirty rects
+ * @param crects num_crects x, y, cx, cy copy rects, the pixels in
+ *               these are stored
+ * @param data Screen pixels, 32 bpp
+ * @param stride Bytes in a line of data
+ * @return 0 on success
+ */
+int
+xrdp_frame_trace_add_frame(struct xrdp_frame_trace *self,
+                           unsigned int time_ms, int frame_id,
+                           const short *drects, int num_drects,
+                           const short *crects, int num_crects,
+                           const char *data, int stride);
+
+/**
+ * Add egfx commands to a trace being written
+ *
+ * @param cmd cmd_bytes of RDPGFX commands
+ * @param data data_bytes of surface data the commands refer to
+ * @return 0 on success
+ */
+int
+xrdp_frame_trace_add_egfx(struct xrdp_frame_trace *self,
+                          unsigned int time_ms,
+                          const char *cmd, int cmd_bytes,
+                          const char *data, int data_bytes);
+
+/**
+ * Add an input event to a trace being written
+ *
+ * @param msg RDP_INPUT_* message
+ * @param device_flags, x, y pass 0 for key events
+ * @return 0 on success
+ */
+int
+xrdp_frame_trace_add_input(struct xrdp_frame_trace *self,
+                           unsigned int time_ms, int msg,
+                           int device_flags, int x, int y);
+
+/**
+ * Add a frame ack from the client to a trace being written
+ *
+ * @return 0 on success
+ */
+int
+xrdp_frame_trace_add_ack(struct xrdp_frame_trace *self,
+                         unsigned int time_ms, int frame_id);
+
+/**
+ * Read the next record from a trace being read
+ *
+ * @param record Set to the record, which is valid until the next call,
+ *               or to NULL at the end of the trace
+ * @return 0 on success, including the end of the trace
+ */
+int
+xrdp_frame_trace_read_record(struct xrdp_frame_trace *self,
+                             struct xrdp_frame_trace_record **record);
+
+/**
+ * Read the next frame from a trace being read, skipping other records
+ *
+ * @param frame Set to the frame, which is valid until the next call, or
+ *              to NULL at the end of the trace
+ * @return 0 on success, including the end of the trace
+ */
+int
+xrdp_frame_trace_read(struct xrdp_frame_trace *self,
+                      struct xrdp_frame_trace_frame **frame);
+
+#endif
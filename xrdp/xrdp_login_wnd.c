@@ -1073,6 +1073,9 @@ load_xrdp_config(struct xrdp_config *config, const char *xrdp_ini, int bpp)
     /* set default values in case we can't get them from xrdp.ini file */
     globals->ini_version = 1;
     globals->default_dpi = 96;
+    globals->frame_scheduler = 0;
+    globals->frame_scheduler_fps = 30;
+    globals->frame_scheduler_max_queued_kb = 256;
 
     globals->ls_top_window_bg_color = HCOLOR(bpp, xrdp_wm_htoi("009cb5"));
     globals->ls_bg_color = HCOLOR(bpp, xrdp_wm_htoi("dedede"));
@@ -1300,6 +1303,36 @@ load_xrdp_config(struct xrdp_config *config, const char *xrdp_ini, int bpp)
             globals->enable_token_login = g_text2bool(v);
         }
 
+        else if (g_strncmp(n, "frame_scheduler", 64) == 0)
+        {
+            globals->frame_scheduler = g_text2bool(v);
+        }
+
+        else if (g_strncmp(n, "frame_scheduler_fps", 64) == 0)
+        {
+            globals->frame_scheduler_fps = g_atoi(v);
+        }
+
+        else if (g_strncmp(n, "frame_scheduler_max_queued_kb", 64) == 0)
+        {
+            globals->frame_scheduler_max_queued_kb = g_atoi(v);
+        }
+
+        else if (g_strncmp(n, "frame_trace_dir", 64) == 0)
+        {
+            g_strncpy(globals->frame_trace_dir, v, 255);
+        }
+
+        else if (g_strncmp(n, "metrics_socket_dir", 64) == 0)
+        {
+            g_strncpy(globals->metrics_socket_dir, v, 255);
+        }
+
+        else if (g_strncmp(n, "rate_control", 64) == 0)
+        {
+            globals->rate_control = g_text2bool(v);
+        }
+
         /* login screen values */
         else if (g_strcmp(n, "default_dpi") == 0)
         {
@@ -1477,6 +1510,14 @@ load_xrdp_config(struct xrdp_config *config, const char *xrdp_ini, int bpp)
     LOG(LOG_LEVEL_DEBUG, "nego_sec_layer:          %d", globals->nego_sec_layer);
     LOG(LOG_LEVEL_DEBUG, "allow_multimon:          %d", globals->allow_multimon);
     LOG(LOG_LEVEL_DEBUG, "enable_token_login:      %d", globals->enable_token_login);
+    LOG(LOG_LEVEL_DEBUG, "frame_scheduler:         %d", globals->frame_scheduler);
+    LOG(LOG_LEVEL_DEBUG, "frame_scheduler_fps:     %d", globals->frame_scheduler_fps);
+    LOG(LOG_LEVEL_DEBUG, "frame_scheduler_max_queued_kb: %d",
+        globals->frame_scheduler_max_queued_kb);
+    LOG(LOG_LEVEL_DEBUG, "frame_trace_dir:         %s", globals->frame_trace_dir);
+    LOG(LOG_LEVEL_DEBUG, "metrics_socket_dir:      %s",
+        globals->metrics_socket_dir);
+    LOG(LOG_LEVEL_DEBUG, "rate_control:            %d", globals->rate_control);
 
     LOG(LOG_LEVEL_DEBUG, "ls_top_window_bg_color:  %x", globals->ls_top_window_bg_color);
     LOG(LOG_LEVEL_DEBUG, "ls_width (unscaled):     %d", globals->ls_unscaled.width);
@@ -139,6 +139,10 @@ xrdp_child_fork(void)
     g_sigchld_event = -1;
     g_snprintf(text, 255, "xrdp_%8.8x_main_sync", pid);
     g_sync_event = g_create_wait_obj(text);
+
+    /* this child handles a connection for a while, so it gets its own
+       log writer */
+    log_fork_child();
     return 0;
 }
 
@@ -0,0 +1,520 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * per session performance metrics
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "xrdp_metrics.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "string_calls.h"
+#include "thread_calls.h"
+
+#define MAX_CODECS 8
+#define MAX_SENT_FRAMES 64
+
+/* histogram bucket upper bounds, in ms, the last bucket is +Inf */
+static const int g_bounds_ms[] =
+{
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000
+};
+#define NUM_BOUNDS ((int) (sizeof(g_bounds_ms) / sizeof(g_bounds_ms[0])))
+
+struct xrdp_metrics_hist
+{
+    tui64 buckets[NUM_BOUNDS + 1];
+    tui64 count;
+    tui64 sum_ms;
+};
+
+struct xrdp_metrics_sent
+{
+    int frame_id;
+    int time;
+};
+
+struct xrdp_metrics
+{
+    tbus mutex;
+    const char *codecs[MAX_CODECS];
+    struct xrdp_metrics_hist encode[MAX_CODECS];
+    struct xrdp_metrics_sent sent[MAX_SENT_FRAMES];
+    int num_sent;
+    struct xrdp_metrics_hist ack_rtt;
+    int input_pending;
+    int input_time;
+    struct xrdp_metrics_hist input_to_paint;
+    tui64 chan_bytes[XRDP_METRICS_MAX_CHANNELS][2];
+    char chan_names[XRDP_METRICS_MAX_CHANNELS][9];
+    tui64 values[XRDP_METRICS_VALUE_COUNT];
+};
+
+struct xrdp_metrics_value_info
+{
+    const char *name;
+    const char *labels;
+    const char *type;
+    const char *help;
+};
+
+/* in enum xrdp_metrics_value order, entries with the same name follow
+   each other so HELP and TYPE are written once */
+static const struct xrdp_metrics_value_info g_value_info[] =
+{
+    {
+        "xrdp_frames_unacked", "", "gauge",
+        "Frames sent to the client and not acked yet"
+    },
+    {
+        "xrdp_frames_in_flight_max", "", "gauge",
+        "Frames allowed to be unacked before the module is held"
+    },
+    {
+        "xrdp_client_queue_depth", "", "gauge",
+        "Queue depth the client gave in its last frame ack"
+    },
+    {
+        "xrdp_trans_wait_streams", "{trans=\"client\"}", "gauge",
+        "Streams waiting to be sent on a connection"
+    },
+    {
+        "xrdp_trans_wait_streams", "{trans=\"chansrv\"}", "gauge",
+        "Streams waiting to be sent on a connection"
+    },
+    {
+        "xrdp_trans_wait_bytes", "{trans=\"client\"}", "gauge",
+        "Bytes waiting to be sent on a connection"
+    },
+    {
+        "xrdp_trans_wait_bytes", "{trans=\"chansrv\"}", "gauge",
+        "Bytes waiting to be sent on a connection"
+    },
+    {
+        "xrdp_bulk_in_bytes_total", "", "counter",
+        "Bytes given to the bulk compressor"
+    },
+    {
+        "xrdp_bulk_out_bytes_total", "", "counter",
+        "Bytes sent for the data given to the bulk compressor"
+    }
+};
+
+/*****************************************************************************/
+struct xrdp_metrics *
+xrdp_metrics_create(void)
+{
+    struct xrdp_metrics *self;
+
+    self = g_new0(struct xrdp_metrics, 1);
+    if (self != NULL)
+    {
+        self->mutex = tc_mutex_create();
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_metrics_delete(struct xrdp_metrics *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    tc_mutex_delete(self->mutex);
+    g_free(self);
+}
+
+/*****************************************************************************/
+static void
+xrdp_metrics_hist_add(struct xrdp_metrics_hist *hist, int ms)
+{
+    int index;
+
+    ms = MAX(ms, 0);
+    for (index = 0; index < NUM_BOUNDS; index++)
+    {
+        if (ms <= g_bounds_ms[index])
+        {
+            break;
+        }
+    }
+    hist->buckets[index]++;
+    hist->count++;
+    hist->sum_ms += ms;
+}
+
+/*****************************************************************************/
+void
+xrdp_metrics_add_encode(struct xrdp_metrics *self, const char *codec,
+                        int ms)
+{
+    int index;
+
+    if (self == NULL)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    for (index = 0; index < MAX_CODECS; index++)
+    {
+        if (self->codecs[index] == NULL)
+        {
+            self->codecs[index] = codec;
+            break;
+        }
+        if (g_strcmp(self->codecs[index], codec) == 0)
+        {
+            break;
+        }
+    }
+    if (index < MAX_CODECS)
+    {
+        xrdp_metrics_hist_add(&(self->encode[index]), ms);
+    }
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+void
+xrdp_metrics_frame_sent(struct xrdp_metrics *self, int frame_id, int now)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    if (self->num_sent == MAX_SENT_FRAMES)
+    {
+        /* the client isn't acking, forget the oldest */
+        self->num_sent--;
+        g_memmove(self->sent, self->sent + 1,
+                  self->num_sent * sizeof(self->sent[0]));
+    }
+    self->sent[self->num_sent].frame_id = frame_id;
+    self->sent[self->num_sent].time = now;
+    self->num_sent++;
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+int
+xrdp_metrics_frame_acked(struct xrdp_metrics *self, int frame_id, int now)
+{
+    int index;
+    int rtt;
+
+    if (self == NULL)
+    {
+        return -1;
+    }
+    rtt = -1;
+    tc_mutex_lock(self->mutex);
+    for (index = 0; index < self->num_sent; index++)
+    {
+        if (self->sent[index].frame_id > frame_id)
+        {
+            break;
+        }
+        if (self->sent[index].frame_id == frame_id)
+        {
+            rtt = MAX(now - self->sent[index].time, 0);
+            xrdp_metrics_hist_add(&(self->ack_rtt), rtt);
+        }
+    }
+    self->num_sent -= index;
+    g_memmove(self->sent, self->sent + index,
+              self->num_sent * sizeof(self->sent[0]));
+    tc_mutex_unlock(self->mutex);
+    return rtt;
+}
+
+/*****************************************************************************/
+void
+xrdp_metrics_input(struct xrdp_metrics *self, int now)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    if (!self->input_pending)
+    {
+        self->input_pending = 1;
+        self->input_time = now;
+    }
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+void
+xrdp_metrics_paint(struct xrdp_metrics *self, int now)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    if (self->input_pending)
+    {
+        self->input_pending = 0;
+        xrdp_metrics_hist_add(&(self->input_to_paint),
+                              now - self->input_time);
+    }
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+void
+xrdp_metrics_add_channel(struct xrdp_metrics *self, int chan_id,
+                         int to_client, int bytes)
+{
+    if (self == NULL || chan_id < 0 || chan_id >= XRDP_METRICS_MAX_CHANNELS)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    self->chan_bytes[chan_id][to_client ? 1 : 0] += bytes;
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+void
+xrdp_metrics_set_channel_name(struct xrdp_metrics *self, int chan_id,
+                              const char *name)
+{
+    if (self == NULL || chan_id < 0 || chan_id >= XRDP_METRICS_MAX_CHANNELS)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    g_strncpy(self->chan_names[chan_id], name, 8);
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+void
+xrdp_metrics_set_value(struct xrdp_metrics *self,
+                       enum xrdp_metrics_value value, tui64 v)
+{
+    if (self == NULL || (int) value < 0 || value >= XRDP_METRICS_VALUE_COUNT)
+    {
+        return;
+    }
+    tc_mutex_lock(self->mutex);
+    self->values[value] = v;
+    tc_mutex_unlock(self->mutex);
+}
+
+/*****************************************************************************/
+/* appends to s, returns non zero if it doesn't fit */
+static int
+xrdp_metrics_printf(struct stream *s, const char *format, ...)
+printflike(2, 3);
+
+static int
+xrdp_metrics_printf(struct stream *s, const char *format, ...)
+{
+    va_list ap;
+    int avail;
+    int len;
+
+    avail = (int) (s->data + s->size - s->p);
+    va_start(ap, format);
+    len = vsnprintf(s->p, avail, format, ap);
+    va_end(ap);
+    if (len < 0 || len >= avail)
+    {
+        return 1;
+    }
+    s->p += len;
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+xrdp_metrics_format_header(struct stream *s, const char *name,
+                           const char *type, const char *help)
+{
+    return xrdp_metrics_printf(s, "# HELP %s %s\n# TYPE %s %s\n",
+                               name, help, name, type);
+}
+
+/*****************************************************************************/
+/* labels is empty or name="value" */
+static int
+xrdp_metrics_format_hist(struct stream *s, const char *name,
+                         const char *labels,
+                         const struct xrdp_metrics_hist *hist)
+{
+    const char *sep;
+    const char *open;
+    const char *close;
+    tui64 total;
+    int index;
+    int error;
+
+    sep = (labels[0] == 0) ? "" : ",";
+    open = (labels[0] == 0) ? "" : "{";
+    close = (labels[0] == 0) ? "" : "}";
+    total = 0;
+    error = 0;
+    for (index = 0; index <= NUM_BOUNDS && error == 0; index++)
+    {
+        total += hist->buckets[index];
+        if (index < NUM_BOUNDS)
+        {
+            error = xrdp_metrics_printf(s, "%s_bucket{%s%sle=\"%d.%03d\"} %llu\n",
+                                        name, labels, sep,
+                                        g_bounds_ms[index] / 1000,
+                                        g_bounds_ms[index] % 1000,
+                                        (unsigned long long) total);
+        }
+        else
+        {
+            error = xrdp_metrics_printf(s, "%s_bucket{%s%sle=\"+Inf\"} %llu\n",
+                                        name, labels, sep,
+                                        (unsigned long long) total);
+        }
+    }
+    if (error == 0)
+    {
+        error = xrdp_metrics_printf(s, "%s_sum%s%s%s %llu.%03d\n"
+                                    "%s_count%s%s%s %llu\n",
+                                    name, open, labels, close,
+                                    (unsigned long long) (hist->sum_ms / 1000),
+                                    (int) (hist->sum_ms % 1000),
+                                    name, open, labels, close,
+                                    (unsigned long long) hist->count);
+    }
+    return error;
+}
+
+/*****************************************************************************/
+static int
+xrdp_metrics_format_locked(struct xrdp_metrics *self, struct stream *s)
+{
+    const struct xrdp_metrics_value_info *info;
+    const char *last_name;
+    char labels[64];
+    int index;
+    int dir;
+
+    last_name = "";
+    for (index = 0; index < XRDP_METRICS_VALUE_COUNT; index++)
+    {
+        info = g_value_info + index;
+        if (g_strcmp(info->name, last_name) != 0)
+        {
+            if (xrdp_metrics_format_header(s, info->name, info->type,
+                                           info->help) != 0)
+            {
+                return 1;
+            }
+            last_name = info->name;
+        }
+        if (xrdp_metrics_printf(s, "%s%s %llu\n", info->name, info->labels,
+                                (unsigned long long) self->values[index]))
+        {
+            return 1;
+        }
+    }
+
+    if (xrdp_metrics_format_header(s, "xrdp_encode_seconds", "histogram",
+                                   "Time to encode a frame") != 0)
+    {
+        return 1;
+    }
+    for (index = 0; index < MAX_CODECS && self->codecs[index] != NULL;
+            index++)
+    {
+        g_snprintf(labels, sizeof(labels), "codec=\"%s\"",
+                   self->codecs[index]);
+        if (xrdp_metrics_format_hist(s, "xrdp_encode_seconds", labels,
+                                     &(self->encode[index])) != 0)
+        {
+            return 1;
+        }
+    }
+
+    if (xrdp_metrics_format_header(s, "xrdp_frame_ack_seconds", "histogram",
+                                   "Time from sending a frame to its ack") != 0 ||
+            xrdp_metrics_format_hist(s, "xrdp_frame_ack_seconds", "",
+                                     &(self->ack_rtt)) != 0)
+    {
+        return 1;
+    }
+
+    if (xrdp_metrics_format_header(s, "xrdp_input_to_paint_seconds",
+                                   "histogram",
+                                   "Time from an input event to the next "
+                                   "screen update") != 0 ||
+            xrdp_metrics_format_hist(s, "xrdp_input_to_paint_seconds", "",
+                                     &(self->input_to_paint)) != 0)
+    {
+        return 1;
+    }
+
+    if (xrdp_metrics_format_header(s, "xrdp_channel_bytes_total", "counter",
+                                   "Bytes passed over a virtual channel") != 0)
+    {
+        return 1;
+    }
+    for (index = 0; index < XRDP_METRICS_MAX_CHANNELS; index++)
+    {
+        if (self->chan_names[index][0] == 0)
+        {
+            continue;
+        }
+        for (dir = 0; dir < 2; dir++)
+        {
+            if (xrdp_metrics_printf(s, "xrdp_channel_bytes_total"
+                                    "{channel=\"%s\",direction=\"%s\"} "
+                                    "%llu\n",
+                                    self->chan_names[index],
+                                    dir ? "out" : "in",
+                                    (unsigned long long)
+                                    self->chan_bytes[index][dir]) != 0)
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_metrics_format(struct xrdp_metrics *self, struct stream *s)
+{
+    int rv;
+
+    if (self == NULL)
+    {
+        return 0;
+    }
+    tc_mutex_lock(self->mutex);
+    rv = xrdp_metrics_format_locked(self, s);
+    tc_mutex_unlock(self->mutex);
+    return rv;
+}
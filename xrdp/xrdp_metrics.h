@@ -0,0 +1,114 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * per session performance metrics
+ *
+ * Counters and histograms kept while a session runs, written out in the
+ * Prometheus text format when asked. The encoder thread adds to them as
+ * well as the main thread, so all calls lock. All calls do nothing when
+ * self is NULL.
+ */
+
+#ifndef _XRDP_METRICS_H
+#define _XRDP_METRICS_H
+
+#include "arch.h"
+
+#define XRDP_METRICS_MAX_CHANNELS 32
+
+struct stream;
+struct xrdp_metrics;
+
+/* values the owner sets just before formatting */
+enum xrdp_metrics_value
+{
+    XRDP_METRICS_FRAMES_UNACKED = 0,
+    XRDP_METRICS_FRAMES_IN_FLIGHT_MAX,
+    XRDP_METRICS_CLIENT_QUEUE_DEPTH,
+    XRDP_METRICS_CLIENT_WAIT_STREAMS,
+    XRDP_METRICS_CHANSRV_WAIT_STREAMS,
+    XRDP_METRICS_CLIENT_WAIT_BYTES,
+    XRDP_METRICS_CHANSRV_WAIT_BYTES,
+    XRDP_METRICS_BULK_IN_BYTES,
+    XRDP_METRICS_BULK_OUT_BYTES,
+    XRDP_METRICS_VALUE_COUNT
+};
+
+struct xrdp_metrics *
+xrdp_metrics_create(void);
+void
+xrdp_metrics_delete(struct xrdp_metrics *self);
+
+/**
+ * Adds the time the encoder took for one frame
+ *
+ * @param codec Codec name, only the pointer is kept
+ */
+void
+xrdp_metrics_add_encode(struct xrdp_metrics *self, const char *codec,
+                        int ms);
+
+/**
+ * Notes when a frame went to the client, and when the client acked it
+ *
+ * An ack covers all the frames sent before it, only the frame it names
+ * is timed
+ *
+ * @return xrdp_metrics_frame_acked() returns the ack time in ms, or -1 if
+ *         the frame wasn't timed
+ */
+void
+xrdp_metrics_frame_sent(struct xrdp_metrics *self, int frame_id, int now);
+int
+xrdp_metrics_frame_acked(struct xrdp_metrics *self, int frame_id, int now);
+
+/**
+ * Notes an input event, and the next screen update after it
+ */
+void
+xrdp_metrics_input(struct xrdp_metrics *self, int now);
+void
+xrdp_metrics_paint(struct xrdp_metrics *self, int now);
+
+/**
+ * Adds bytes passed over a static virtual channel
+ *
+ * @param chan_id Channel index, as for libxrdp_query_channel()
+ * @param to_client true for server to client
+ */
+void
+xrdp_metrics_add_channel(struct xrdp_metrics *self, int chan_id,
+                         int to_client, int bytes);
+
+/**
+ * Names a channel for the output, channels without a name are left out
+ */
+void
+xrdp_metrics_set_channel_name(struct xrdp_metrics *self, int chan_id,
+                              const char *name);
+
+void
+xrdp_metrics_set_value(struct xrdp_metrics *self,
+                       enum xrdp_metrics_value value, tui64 v);
+
+/**
+ * Writes all the metrics to s in the Prometheus text format
+ *
+ * @return 0 on success, non zero if s is too small
+ */
+int
+xrdp_metrics_format(struct xrdp_metrics *self, struct stream *s);
+
+#endif
@@ -31,10 +31,16 @@
 #include "scp.h"
 #include <ctype.h>
 #include "xrdp_encoder.h"
+#include "xrdp_frame_sched.h"
+#include "xrdp_frame_trace.h"
+#include "xrdp_metrics.h"
+#include "xrdp_rate_ctl.h"
 #include "xrdp_sockets.h"
+#include "xrdp_tconfig.h"
 #include "xrdp_egfx.h"
 #include "libxrdp.h"
 #include "xrdp_channel.h"
+#include "timer_heap.h"
 #include <limits.h>
 
 /* Forward declarations */
@@ -45,6 +51,10 @@ xrdp_mm_connect_sm(struct xrdp_mm *self);
 
 static int
 xrdp_mm_send_unicode_shutdown(struct xrdp_mm *self, struct trans *trans);
+static void
+xrdp_mm_metrics_close(struct xrdp_mm *self);
+static int
+xrdp_mm_update_module_frame_ack(struct xrdp_mm *self);
 
 /*****************************************************************************/
 struct xrdp_mm *
@@ -60,6 +70,9 @@ xrdp_mm_create(struct xrdp_wm *owner)
     self->login_values->auto_free = 1;
 
     self->uid = -1; /* Never good to default UIDs to 0 */
+    self->timers = timer_heap_create();
+    self->metrics = xrdp_metrics_create();
+    self->metrics_cons = list_create();
 
     LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_mm_create: bpp %d mcs_connection_type %d "
               "jpeg_codec_id %d v3_codec_id %d rfx_codec_id %d "
@@ -124,6 +137,12 @@ xrdp_mm_module_cleanup(struct xrdp_mm *self)
         g_xrdp_sync(xrdp_mm_sync_unload, self->mod_handle, 0);
     }
 
+    xrdp_frame_sched_delete(self->frame_sched);
+    self->frame_sched = 0;
+    self->frame_sched_failed = 0;
+    xrdp_frame_trace_delete(self->frame_trace);
+    self->frame_trace = 0;
+
     trans_delete(self->chan_trans);
     self->chan_trans = 0;
     self->mod_init = 0;
@@ -157,12 +176,14 @@ xrdp_mm_delete(struct xrdp_mm *self)
     /* shutdown input method */
     xrdp_mm_send_unicode_shutdown(self, self->chan_trans);
 
+    /* shutdown thread, before the module as the encoder can still be
+       reading module owned shared memory */
+    xrdp_encoder_delete(self->encoder);
+    self->encoder = NULL;
+
     /* free any module stuff */
     xrdp_mm_module_cleanup(self);
 
-    /* shutdown thread */
-    xrdp_encoder_delete(self->encoder);
-
     trans_delete(self->sesman_trans);
     self->sesman_trans = 0;
     list_delete(self->login_names);
@@ -171,9 +192,281 @@ xrdp_mm_delete(struct xrdp_mm *self)
     g_free(self->resize_data);
     g_delete_wait_obj(self->resize_ready);
     xrdp_egfx_shutdown_full(self->egfx);
+    timer_heap_delete(self->timers);
+    xrdp_mm_metrics_close(self);
+    list_delete(self->metrics_cons);
+    xrdp_metrics_delete(self->metrics);
+    xrdp_rate_ctl_delete(self->rate_ctl);
     g_free(self);
 }
 
+/*****************************************************************************/
+/* returns the trace to capture to, or NULL if capture is off. A new file
+   is started when the screen size or the capture code changes */
+static struct xrdp_frame_trace *
+xrdp_mm_get_frame_trace(struct xrdp_mm *self, int width, int height)
+{
+    struct xrdp_cfg_globals *globals;
+    char filename[512];
+
+    globals = &(self->wm->xrdp_config->cfg_globals);
+    if (globals->frame_trace_dir[0] == 0)
+    {
+        return NULL;
+    }
+    if (self->frame_trace != NULL)
+    {
+        if (xrdp_frame_trace_get_width(self->frame_trace) == width &&
+                xrdp_frame_trace_get_height(self->frame_trace) == height &&
+                xrdp_frame_trace_get_capture_code(self->frame_trace) ==
+                (int) self->wm->client_info->capture_code)
+        {
+            return self->frame_trace;
+        }
+        xrdp_frame_trace_delete(self->frame_trace);
+        self->frame_trace = NULL;
+    }
+    g_snprintf(filename, sizeof(filename), "%s/xrdp-%d-%d.trace",
+               globals->frame_trace_dir, g_getpid(), self->frame_trace_seq++);
+    self->frame_trace = xrdp_frame_trace_create(
+                            filename, width, height,
+                            self->wm->client_info->capture_code,
+                            self->wm->client_info->capture_format);
+    if (self->frame_trace == NULL)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_mm_get_frame_trace: can't create %s, "
+            "frame capture is off", filename);
+        globals->frame_trace_dir[0] = 0;
+        return NULL;
+    }
+    LOG(LOG_LEVEL_INFO, "xrdp_mm_get_frame_trace: capturing frames to %s",
+        filename);
+    self->frame_trace_start = g_time3();
+    return self->frame_trace;
+}
+
+/*****************************************************************************/
+static unsigned int
+xrdp_mm_frame_trace_time(struct xrdp_mm *self)
+{
+    return (unsigned int)(g_time3() - self->frame_trace_start);
+}
+
+/*****************************************************************************/
+/* called when adding to the trace fails, the disk is likely full */
+static void
+xrdp_mm_frame_trace_failed(struct xrdp_mm *self)
+{
+    LOG(LOG_LEVEL_WARNING, "xrdp_mm_frame_trace_failed: frame capture "
+        "is off");
+    xrdp_frame_trace_delete(self->frame_trace);
+    self->frame_trace = NULL;
+    self->wm->xrdp_config->cfg_globals.frame_trace_dir[0] = 0;
+}
+
+/*****************************************************************************/
+void
+xrdp_mm_frame_trace_input(struct xrdp_mm *self, int msg, int device_flags,
+                          int x, int y)
+{
+    if (self->frame_trace != NULL &&
+            xrdp_frame_trace_add_input(self->frame_trace,
+                                       xrdp_mm_frame_trace_time(self),
+                                       msg, device_flags, x, y) != 0)
+    {
+        xrdp_mm_frame_trace_failed(self);
+    }
+}
+
+/*****************************************************************************/
+static void
+xrdp_mm_frame_trace_ack(struct xrdp_mm *self, int frame_id)
+{
+    if (self->frame_trace != NULL &&
+            xrdp_frame_trace_add_ack(self->frame_trace,
+                                     xrdp_mm_frame_trace_time(self),
+                                     frame_id) != 0)
+    {
+        xrdp_mm_frame_trace_failed(self);
+    }
+}
+
+/*****************************************************************************/
+/* sets the metrics which are kept elsewhere */
+static void
+xrdp_mm_metrics_update(struct xrdp_mm *self)
+{
+    struct xrdp_session *session;
+    struct xrdp_encoder *encoder;
+    tui64 bulk_in;
+    tui64 bulk_out;
+    char name[16];
+    int count;
+    int index;
+
+    session = self->wm->session;
+    encoder = self->encoder;
+    if (encoder != NULL)
+    {
+        xrdp_metrics_set_value(self->metrics, XRDP_METRICS_FRAMES_UNACKED,
+                               MAX(encoder->frame_id_server -
+                                   encoder->frame_id_client, 0));
+        xrdp_metrics_set_value(self->metrics,
+                               XRDP_METRICS_FRAMES_IN_FLIGHT_MAX,
+                               encoder->frames_in_flight);
+    }
+    xrdp_metrics_set_value(self->metrics, XRDP_METRICS_CLIENT_WAIT_STREAMS,
+                           trans_get_wait_count(session->trans));
+    xrdp_metrics_set_value(self->metrics, XRDP_METRICS_CLIENT_WAIT_BYTES,
+                           trans_get_wait_bytes(session->trans));
+    xrdp_metrics_set_value(self->metrics, XRDP_METRICS_CHANSRV_WAIT_STREAMS,
+                           trans_get_wait_count(self->chan_trans));
+    xrdp_metrics_set_value(self->metrics, XRDP_METRICS_CHANSRV_WAIT_BYTES,
+                           trans_get_wait_bytes(self->chan_trans));
+    libxrdp_get_bulk_stats(session, &bulk_in, &bulk_out);
+    xrdp_metrics_set_value(self->metrics, XRDP_METRICS_BULK_IN_BYTES,
+                           bulk_in);
+    xrdp_metrics_set_value(self->metrics, XRDP_METRICS_BULK_OUT_BYTES,
+                           bulk_out);
+    count = MIN(libxrdp_get_channel_count(session),
+                XRDP_METRICS_MAX_CHANNELS);
+    for (index = 0; index < count; index++)
+    {
+        if (libxrdp_query_channel(session, index, name, NULL) == 0)
+        {
+            xrdp_metrics_set_channel_name(self->metrics, index, name);
+        }
+    }
+}
+
+#define XRDP_METRICS_HTTP_OK \
+    "HTTP/1.0 200 OK\r\n" \
+    "Content-Type: text/plain; version=0.0.4\r\n" \
+    "Connection: close\r\n\r\n"
+#define XRDP_METRICS_MAX_CONS 2
+#define XRDP_METRICS_HTTP_ERROR \
+    "HTTP/1.0 500 Internal Server Error\r\n" \
+    "Connection: close\r\n\r\n"
+
+/*****************************************************************************/
+/* the request is read a byte at a time until the blank line that ends
+   the headers, whatever was asked for the metrics are sent back */
+static int
+xrdp_mm_metrics_data_in(struct trans *trans)
+{
+    struct xrdp_mm *self;
+    struct stream *in_s;
+    struct stream *out_s;
+    char *end;
+    int bytes;
+
+    self = (struct xrdp_mm *) (trans->callback_data);
+    in_s = trans->in_s;
+    end = in_s->end;
+    bytes = (int) (end - in_s->data);
+    if (!((bytes >= 2 && end[-1] == '\n' && end[-2] == '\n') ||
+            (bytes >= 4 && end[-1] == '\n' && end[-2] == '\r' &&
+             end[-3] == '\n')))
+    {
+        if (bytes >= in_s->size)
+        {
+            LOG(LOG_LEVEL_WARNING, "xrdp_mm_metrics_data_in: request too big");
+            trans->status = TRANS_STATUS_DOWN;
+            return 1;
+        }
+        trans->header_size = bytes + 1;
+        return 0;
+    }
+
+    xrdp_mm_metrics_update(self);
+    out_s = trans_get_out_s(trans, 0);
+    out_uint8a(out_s, XRDP_METRICS_HTTP_OK, sizeof(XRDP_METRICS_HTTP_OK) - 1);
+    if (xrdp_metrics_format(self->metrics, out_s) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_mm_metrics_data_in: metrics too big");
+        init_stream(out_s, 0);
+        out_uint8a(out_s, XRDP_METRICS_HTTP_ERROR,
+                   sizeof(XRDP_METRICS_HTTP_ERROR) - 1);
+    }
+    s_mark_end(out_s);
+    trans_force_write(trans);
+    /* HTTP/1.0, the end of the reply is the end of the connection */
+    trans->status = TRANS_STATUS_DOWN;
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+xrdp_mm_metrics_conn_in(struct trans *trans, struct trans *new_trans)
+{
+    struct xrdp_mm *self;
+
+    self = (struct xrdp_mm *) (trans->callback_data);
+    if (self->metrics_cons->count >= XRDP_METRICS_MAX_CONS)
+    {
+        /* wait objs are limited, new_trans is closed */
+        return 1;
+    }
+    new_trans->trans_data_in = xrdp_mm_metrics_data_in;
+    new_trans->header_size = 1;
+    new_trans->no_stream_init_on_data_in = 1;
+    new_trans->callback_data = self;
+    list_add_item(self->metrics_cons, (tintptr) new_trans);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_mm_metrics_listen(struct xrdp_mm *self)
+{
+    struct xrdp_cfg_globals *globals;
+    char port[512];
+
+    globals = &(self->wm->xrdp_config->cfg_globals);
+    if (self->metrics_lis != NULL || globals->metrics_socket_dir[0] == 0)
+    {
+        return 0;
+    }
+    g_snprintf(port, sizeof(port), "%s/xrdp-metrics-%d.sock",
+               globals->metrics_socket_dir, g_getpid());
+    /* the reply is made in one go in out_s */
+    self->metrics_lis = trans_create(TRANS_MODE_UNIX, 4096, 64 * 1024);
+    if (self->metrics_lis == NULL)
+    {
+        return 1;
+    }
+    self->metrics_lis->is_term = g_is_term;
+    self->metrics_lis->trans_conn_in = xrdp_mm_metrics_conn_in;
+    self->metrics_lis->callback_data = self;
+    if (trans_listen(self->metrics_lis, port) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_mm_metrics_listen: can't listen on %s",
+            port);
+        trans_delete(self->metrics_lis);
+        self->metrics_lis = NULL;
+        return 1;
+    }
+    LOG(LOG_LEVEL_INFO, "xrdp_mm_metrics_listen: metrics on %s", port);
+    return 0;
+}
+
+/*****************************************************************************/
+static void
+xrdp_mm_metrics_close(struct xrdp_mm *self)
+{
+    int index;
+
+    for (index = 0; index < self->metrics_cons->count; index++)
+    {
+        trans_delete((struct trans *) list_get_item(self->metrics_cons,
+                     index));
+    }
+    list_clear(self->metrics_cons);
+    /* removes the socket file */
+    trans_delete(self->metrics_lis);
+    self->metrics_lis = NULL;
+}
+
 /**************************************************************************//**
  * Looks for a string value in the login_names/login_values array
  *
@@ -434,6 +727,7 @@ xrdp_mm_setup_mod1(struct xrdp_mm *self)
             self->mod->server_paint_rects = server_paint_rects;
             self->mod->server_session_info = server_session_info;
             self->mod->server_egfx_cmd = server_egfx_cmd;
+            self->mod->server_egfx_cmd_ex = server_egfx_cmd_ex;
             self->mod->server_set_pointer_large = server_set_pointer_large;
             self->mod->server_paint_rects_ex = server_paint_rects_ex;
             self->mod->si = &(self->wm->session->si);
@@ -675,6 +969,7 @@ xrdp_mm_trans_process_channel_data(struct xrdp_mm *self, struct stream *s)
         {
             rv = libxrdp_send_to_channel(self->wm->session, chan_id,
                                          s->p, size, total_size, chan_flags);
+            xrdp_metrics_add_channel(self->metrics, chan_id, 1, size);
         }
     }
 
@@ -1518,11 +1813,55 @@ xrdp_mm_egfx_caps_advertise(void *user, int caps_count,
     return 0;
 }
 
+/*****************************************************************************/
+/* feeds a client frame ack to rate control, if it's on */
+static void
+xrdp_mm_rate_ctl_ack(struct xrdp_mm *self, int rtt, int queue_depth)
+{
+    if (self->rate_ctl == NULL)
+    {
+        if (!self->wm->xrdp_config->cfg_globals.rate_control)
+        {
+            return;
+        }
+        self->rate_ctl = xrdp_rate_ctl_create();
+        if (self->rate_ctl == NULL)
+        {
+            return;
+        }
+        xrdp_rate_ctl_set_bandwidth(self->rate_ctl,
+                                    self->autodetect_bandwidth);
+    }
+    if (xrdp_rate_ctl_ack(self->rate_ctl, g_time3(), rtt, queue_depth,
+                          trans_get_wait_bytes(self->wm->session->trans)))
+    {
+        LOG(LOG_LEVEL_INFO, "xrdp_mm_rate_ctl_ack: rate control level %d, "
+            "frame interval %d ms",
+            xrdp_rate_ctl_get_level(self->rate_ctl),
+            xrdp_rate_ctl_get_frame_interval(self->rate_ctl));
+    }
+}
+
+/*****************************************************************************/
+static void
+xrdp_mm_rate_timeout(void *data)
+{
+    struct xrdp_mm *self = (struct xrdp_mm *)data;
+
+    self->rate_timer = 0;
+    if (self->encoder != NULL && self->mod != NULL)
+    {
+        xrdp_mm_update_module_frame_ack(self);
+    }
+}
+
 /*****************************************************************************/
 static int
 xrdp_mm_update_module_frame_ack(struct xrdp_mm *self)
 {
     int fif;
+    int interval;
+    int now;
     struct xrdp_encoder *encoder;
 
     encoder = self->encoder;
@@ -1531,6 +1870,22 @@ xrdp_mm_update_module_frame_ack(struct xrdp_mm *self)
     {
         if (encoder->frame_id_server > encoder->frame_id_server_sent)
         {
+            /* rate control lowers the frame rate by holding back the ack
+               that lets the module send its next frame */
+            interval = xrdp_rate_ctl_get_frame_interval(self->rate_ctl);
+            now = g_time3();
+            if (interval > 0 && now - self->rate_last_ack < interval)
+            {
+                if (self->rate_timer == 0)
+                {
+                    self->rate_timer = timer_heap_add(
+                                           self->timers,
+                                           interval - (now - self->rate_last_ack),
+                                           xrdp_mm_rate_timeout, self);
+                }
+                return 0;
+            }
+            self->rate_last_ack = now;
             LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_update_module_ack: "
                       "frame_id_server %d", encoder->frame_id_server);
             encoder->frame_id_server_sent = encoder->frame_id_server;
@@ -1546,9 +1901,18 @@ xrdp_mm_egfx_frame_ack(void *user, uint32_t queue_depth, int frame_id,
 {
     struct xrdp_mm *self;
     struct xrdp_encoder *encoder;
+    int rtt;
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_mm_egfx_frame_ack:");
     self = (struct xrdp_mm *) user;
+    xrdp_mm_frame_trace_ack(self, frame_id);
+    rtt = xrdp_metrics_frame_acked(self->metrics, frame_id, g_time3());
+    if (queue_depth != XR_SUSPEND_FRAME_ACKNOWLEDGEMENT)
+    {
+        xrdp_metrics_set_value(self->metrics, XRDP_METRICS_CLIENT_QUEUE_DEPTH,
+                               queue_depth);
+        xrdp_mm_rate_ctl_ack(self, rtt, (int) queue_depth);
+    }
     encoder = self->encoder;
     if (encoder == NULL)
     {
@@ -1742,6 +2106,16 @@ advance_error(int error,
     return error;
 }
 
+/******************************************************************************/
+static void
+resize_timeout(void *data)
+{
+    struct xrdp_mm *mm = (struct xrdp_mm *)data;
+
+    mm->resize_timer = 0;
+    g_set_wait_obj(mm->resize_ready);
+}
+
 /******************************************************************************/
 static int
 process_display_control_monitor_layout_data(struct xrdp_wm *wm)
@@ -1753,6 +2127,7 @@ process_display_control_monitor_layout_data(struct xrdp_wm *wm)
     struct xrdp_sec *sec;
     struct xrdp_channel *chan;
     int in_progress;
+    int elapsed;
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "process_display_control_monitor_layout_data:");
 
@@ -1827,14 +2202,21 @@ process_display_control_monitor_layout_data(struct xrdp_wm *wm)
 
             // Continue to check to see if the connection is closed. If it
             // ever is, advance the state machine!
+            elapsed = g_time3() - description->last_state_update_timestamp;
             if (chan->drdynvcs[mm->egfx->channel_id].status
                     == XRDP_DRDYNVC_STATUS_CLOSED
-                    || (g_time3() - description->last_state_update_timestamp) > 100)
+                    || elapsed > 100)
             {
                 advance_resize_state_machine(mm, WMRZ_EGFX_CONN_CLOSED);
                 break;
             }
-            g_set_wait_obj(mm->resize_ready);
+            // The close response advances the state machine, check
+            // again when the wait for it times out
+            if (mm->resize_timer == 0)
+            {
+                mm->resize_timer = timer_heap_add(mm->timers, 101 - elapsed,
+                                                  resize_timeout, mm);
+            }
             break;
         case WMRZ_EGFX_CONN_CLOSED:
             advance_resize_state_machine(mm, WRMZ_EGFX_DELETE);
@@ -2196,11 +2578,101 @@ xrdp_mm_suppress_output(struct xrdp_mm *self, int suppress,
     return 0;
 }
 
+/*****************************************************************************/
+/* time between network auto-detect RTT requests */
+#define AUTODETECT_RTT_MS 2000
+/* a bandwidth measure is started at most this often ... */
+#define AUTODETECT_BW_MS 10000
+/* ... and only on an update big enough to fill the link for a while */
+#define AUTODETECT_BW_BYTES (32 * 1024)
+
+/*****************************************************************************/
+static void
+xrdp_mm_autodetect_timeout(void *data)
+{
+    struct xrdp_mm *self = (struct xrdp_mm *)data;
+
+    self->autodetect_timer = 0;
+    /* stops for good if the client didn't ask for auto-detect */
+    if (libxrdp_autodetect_rtt(self->wm->session) == 0)
+    {
+        self->autodetect_timer = timer_heap_add(self->timers,
+                                                AUTODETECT_RTT_MS,
+                                                xrdp_mm_autodetect_timeout,
+                                                self);
+    }
+}
+
+/*****************************************************************************/
+/* brackets the big updates in a network auto-detect bandwidth measure */
+static void
+xrdp_mm_autodetect_bw_start(struct xrdp_mm *self, int bytes)
+{
+    int now;
+
+    if (!self->autodetect_bw && bytes >= AUTODETECT_BW_BYTES &&
+            self->autodetect_timer != 0)
+    {
+        now = g_time3();
+        if (self->autodetect_bw_time == 0 ||
+                now - self->autodetect_bw_time >= AUTODETECT_BW_MS)
+        {
+            self->autodetect_bw_time = now;
+            self->autodetect_bw =
+                libxrdp_autodetect_bw_start(self->wm->session) == 0;
+        }
+    }
+}
+
+/*****************************************************************************/
+static void
+xrdp_mm_autodetect_bw_stop(struct xrdp_mm *self)
+{
+    if (self->autodetect_bw)
+    {
+        self->autodetect_bw = 0;
+        libxrdp_autodetect_bw_stop(self->wm->session);
+    }
+}
+
+/*****************************************************************************/
+/* network auto-detect results from the client */
+void
+xrdp_mm_autodetect(struct xrdp_mm *self, int avg_rtt, int bandwidth,
+                   int base_rtt)
+{
+    int connection_type;
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_autodetect: average RTT %d ms, "
+              "bandwidth %d kbit/s, base RTT %d ms",
+              avg_rtt, bandwidth, base_rtt);
+    connection_type = self->wm->client_info->detected_connection_type;
+    if (connection_type != self->autodetect_connection_type &&
+            connection_type > 0 &&
+            connection_type < CONNECTION_TYPE_AUTODETECT)
+    {
+        LOG(LOG_LEVEL_INFO, "xrdp_mm_autodetect: connection type %s, "
+            "bandwidth %d kbit/s, RTT %d ms",
+            rdpbcgr_connection_type_names[connection_type],
+            bandwidth, avg_rtt);
+        self->autodetect_connection_type = connection_type;
+    }
+    if (bandwidth > 0)
+    {
+        self->autodetect_bandwidth = bandwidth;
+        xrdp_rate_ctl_set_bandwidth(self->rate_ctl, bandwidth);
+    }
+}
+
 /******************************************************************************/
 int
 xrdp_mm_up_and_running(struct xrdp_mm *self)
 {
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_up_and_running:");
+    if (self->autodetect_timer == 0)
+    {
+        xrdp_mm_autodetect_timeout(self);
+    }
     if (self->resize_data != NULL &&
             self->resize_data->state == WMRZ_XRDP_CORE_RESET_PROCESSING)
     {
@@ -2778,7 +3250,8 @@ xrdp_mm_process_channel_data(struct xrdp_mm *self, tbus param1, tbus param2,
 
     if ((self->chan_trans != 0) && self->chan_trans->status == TRANS_STATUS_UP)
     {
-        s = trans_get_out_s(self->chan_trans, 8192);
+        /* client chunks can be up to vc_chunk_size */
+        s = trans_get_out_s(self->chan_trans, 8192 + (int)param2);
 
         if (s != 0)
         {
@@ -2805,6 +3278,7 @@ xrdp_mm_process_channel_data(struct xrdp_mm *self, tbus param1, tbus param2,
             out_uint8a(s, data, length);
             s_mark_end(s);
             rv = trans_force_write(self->chan_trans);
+            xrdp_metrics_add_channel(self->metrics, id, 0, length);
         }
     }
 
@@ -3097,7 +3571,8 @@ xrdp_mm_chansrv_connect(struct xrdp_mm *self, const char *port)
     }
 
     /* connect channel redir */
-    self->chan_trans = trans_create(TRANS_MODE_UNIX, 8192, 8192);
+    /* chansrv sends channel data in up to 16K pieces */
+    self->chan_trans = trans_create(TRANS_MODE_UNIX, 8192 * 4, 8192);
 
     self->chan_trans->is_term = g_is_term;
     self->chan_trans->si = &(self->wm->session->si);
@@ -3453,6 +3928,7 @@ xrdp_mm_get_wait_objs(struct xrdp_mm *self,
                       tbus *write_objs, int *wcount, int *timeout)
 {
     int rv = 0;
+    int index;
 
     if (self == 0)
     {
@@ -3473,6 +3949,8 @@ xrdp_mm_get_wait_objs(struct xrdp_mm *self,
                                write_objs, wcount, timeout);
     }
 
+    libxrdp_channel_sched_get_timeout(self->wm->session, timeout);
+
     if (self->mod != 0)
     {
         if (self->mod->mod_get_wait_objs != 0)
@@ -3492,6 +3970,20 @@ xrdp_mm_get_wait_objs(struct xrdp_mm *self,
         read_objs[(*rcount)++] = self->resize_ready;
     }
 
+    if (self->metrics_lis != NULL)
+    {
+        trans_get_wait_objs(self->metrics_lis, read_objs, rcount);
+        for (index = 0; index < self->metrics_cons->count; index++)
+        {
+            trans_get_wait_objs((struct trans *)
+                                list_get_item(self->metrics_cons, index),
+                                read_objs, rcount);
+        }
+    }
+
+    xrdp_frame_sched_get_timeout(self->frame_sched, timeout);
+    timer_heap_get_timeout(self->timers, timeout);
+
     if (self->wm->screen_dirty_region != NULL)
     {
         if (xrdp_region_not_empty(self->wm->screen_dirty_region))
@@ -3630,6 +4122,10 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
                   "bytes %d", enc_done->comp_bytes);
         if (enc_done->comp_bytes > 0)
         {
+            if (!enc_done->continuation)
+            {
+                xrdp_mm_autodetect_bw_start(self, enc_done->comp_bytes);
+            }
             if (is_gfx)
             {
                 xrdp_egfx_send_data(self->egfx,
@@ -3665,12 +4161,15 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
         /* free enc_done */
         if (enc_done->last)
         {
+            xrdp_mm_autodetect_bw_stop(self);
             enc = enc_done->enc;
             LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_process_enc_done: last set");
             if (got_frame_id)
             {
                 if (client_ack)
                 {
+                    xrdp_metrics_frame_sent(self->metrics, enc_done->frame_id,
+                                            g_time3());
                     self->encoder->frame_id_server = enc_done->frame_id;
                     xrdp_mm_update_module_frame_ack(self);
                 }
@@ -3813,6 +4312,8 @@ int
 xrdp_mm_check_wait_objs(struct xrdp_mm *self)
 {
     int rv;
+    int index;
+    struct trans *trans;
 
     if (self == 0)
     {
@@ -3884,6 +4385,33 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
         }
     }
 
+    timer_heap_check(self->timers);
+
+    if (self->metrics_lis != NULL)
+    {
+        trans_check_wait_objs(self->metrics_lis);
+        for (index = self->metrics_cons->count - 1; index >= 0; index--)
+        {
+            trans = (struct trans *) list_get_item(self->metrics_cons, index);
+            if (trans_check_wait_objs(trans) != 0 ||
+                    trans->status != TRANS_STATUS_UP)
+            {
+                trans_delete(trans);
+                list_remove_item(self->metrics_cons, index);
+            }
+        }
+    }
+
+    if (self->frame_sched != NULL)
+    {
+        xrdp_frame_sched_check(self->frame_sched);
+    }
+
+    if (rv == 0)
+    {
+        rv = libxrdp_channel_sched_check(self->wm->session);
+    }
+
     if (self->wm->screen_dirty_region != NULL)
     {
         if (xrdp_region_not_empty(self->wm->screen_dirty_region))
@@ -3917,13 +4445,22 @@ int
 xrdp_mm_frame_ack(struct xrdp_mm *self, int frame_id)
 {
     struct xrdp_encoder *encoder;
+    int rtt;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_frame_ack:");
     if (self->wm->client_info->use_frame_acks == 0)
     {
         return 1;
     }
+    xrdp_mm_frame_trace_ack(self, frame_id);
+    rtt = xrdp_metrics_frame_acked(self->metrics, frame_id, g_time3());
     encoder = self->encoder;
+    if (encoder == NULL)
+    {
+        /* no codec, the frame markers came from the frame scheduler */
+        return xrdp_frame_sched_frame_ack(self->frame_sched, frame_id);
+    }
+    xrdp_mm_rate_ctl_ack(self, rtt, -1);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_frame_ack: "
               "incoming %d, client %d, server %d", frame_id,
               encoder->frame_id_client, encoder->frame_id_server);
@@ -3983,8 +4520,10 @@ server_begin_update(struct xrdp_mod *mod)
 int
 server_end_update(struct xrdp_mod *mod)
 {
+    struct xrdp_wm *wm;
     struct xrdp_painter *p;
 
+    wm = (struct xrdp_wm *)(mod->wm);
     p = (struct xrdp_painter *)(mod->painter);
 
     if (p == 0)
@@ -3992,6 +4531,7 @@ server_end_update(struct xrdp_mod *mod)
         return 0;
     }
 
+    xrdp_metrics_paint(wm->mm->metrics, g_time3());
     xrdp_painter_end_update(p);
     xrdp_painter_delete(p);
     mod->painter = 0;
@@ -4031,6 +4571,44 @@ server_init_xkb_layout(struct xrdp_mod *mod,
 }
 
 
+/*****************************************************************************/
+/* returns the frame scheduler, creating it if it's configured and the
+   session has no codec */
+static struct xrdp_frame_sched *
+xrdp_mm_get_frame_sched(struct xrdp_mm *self)
+{
+    struct xrdp_cfg_globals *globals;
+
+    if (self->frame_sched == NULL && !self->frame_sched_failed &&
+            self->encoder == NULL && !self->wm->client_info->gfx)
+    {
+        globals = &(self->wm->xrdp_config->cfg_globals);
+        if (globals->frame_scheduler)
+        {
+            self->frame_sched =
+                xrdp_frame_sched_create(self, globals->frame_scheduler_fps);
+            if (self->frame_sched == NULL)
+            {
+                LOG(LOG_LEVEL_WARNING, "xrdp_mm_get_frame_sched: create "
+                    "failed, painting directly");
+                self->frame_sched_failed = 1;
+            }
+        }
+    }
+    return self->frame_sched;
+}
+
+/*****************************************************************************/
+/* pending scheduled pixels must reach the client before any other drawing */
+static void
+server_flush_frame_sched(struct xrdp_mod *mod)
+{
+    struct xrdp_wm *wm;
+
+    wm = (struct xrdp_wm *)(mod->wm);
+    xrdp_frame_sched_flush(wm->mm->frame_sched);
+}
+
 /*****************************************************************************/
 int
 server_fill_rect(struct xrdp_mod *mod, int x, int y, int cx, int cy)
@@ -4045,6 +4623,7 @@ server_fill_rect(struct xrdp_mod *mod, int x, int y, int cx, int cy)
         return 0;
     }
 
+    server_flush_frame_sched(mod);
     wm = (struct xrdp_wm *)(mod->wm);
     xrdp_painter_fill_rect(p, wm->target_surface, x, y, cx, cy);
     return 0;
@@ -4065,6 +4644,7 @@ server_screen_blt(struct xrdp_mod *mod, int x, int y, int cx, int cy,
         return 0;
     }
 
+    server_flush_frame_sched(mod);
     wm = (struct xrdp_wm *)(mod->wm);
     p->rop = 0xcc;
     xrdp_painter_copy(p, wm->screen, wm->target_surface, x, y, cx, cy, srcx, srcy);
@@ -4079,6 +4659,7 @@ server_paint_rect(struct xrdp_mod *mod, int x, int y, int cx, int cy,
     struct xrdp_wm *wm;
     struct xrdp_bitmap *b;
     struct xrdp_painter *p;
+    struct xrdp_frame_sched *fs;
 
     p = (struct xrdp_painter *)(mod->painter);
 
@@ -4088,6 +4669,16 @@ server_paint_rect(struct xrdp_mod *mod, int x, int y, int cx, int cy,
     }
 
     wm = (struct xrdp_wm *)(mod->wm);
+    fs = xrdp_mm_get_frame_sched(wm->mm);
+    if (fs != NULL)
+    {
+        if (p->use_clip == 0 && wm->target_surface == wm->screen)
+        {
+            return xrdp_frame_sched_add_rect(fs, data, width, height,
+                                             x, y, cx, cy, srcx, srcy);
+        }
+        xrdp_frame_sched_flush(fs);
+    }
     b = xrdp_bitmap_create_with_data(width, height, wm->screen->bpp, data, wm);
     xrdp_painter_copy(p, b, wm->target_surface, x, y, cx, cy, srcx, srcy);
     xrdp_bitmap_delete(b);
@@ -4109,6 +4700,7 @@ server_paint_rect_bpp(struct xrdp_mod *mod, int x, int y, int cx, int cy,
     {
         return 0;
     }
+    server_flush_frame_sched(mod);
     wm = (struct xrdp_wm *)(mod->wm);
     b = xrdp_bitmap_create_with_data(width, height, bpp, data, wm);
     xrdp_painter_copy(p, b, wm->target_surface, x, y, cx, cy, srcx, srcy);
@@ -4136,6 +4728,7 @@ server_composite(struct xrdp_mod *mod, int srcidx, int srcformat,
     {
         return 0;
     }
+    server_flush_frame_sched(mod);
     wm = (struct xrdp_wm *)(mod->wm);
     b = 0;
     msk = 0;
@@ -4192,6 +4785,8 @@ server_paint_rects_ex(struct xrdp_mod *mod,
     struct xrdp_mm *mm;
     struct xrdp_painter *p;
     struct xrdp_bitmap *b;
+    struct xrdp_frame_sched *fs;
+    struct xrdp_frame_trace *trace;
     short *s;
     int index;
     XRDP_ENC_DATA *enc_data;
@@ -4200,6 +4795,19 @@ server_paint_rects_ex(struct xrdp_mod *mod,
     mm = wm->mm;
 
     LOG(LOG_LEVEL_TRACE, "server_paint_rects_ex: %p", mm->encoder);
+    xrdp_metrics_paint(mm->metrics, g_time3());
+
+    /* only CC_SIMPLE captures hold pixels where they are on the screen,
+       the others are NV12 or tiled YUVA, so can't be traced */
+    if (wm->client_info->capture_code == CC_SIMPLE &&
+            (trace = xrdp_mm_get_frame_trace(mm, width, height)) != NULL &&
+            xrdp_frame_trace_add_frame(trace, xrdp_mm_frame_trace_time(mm),
+                                       frame_id, drects, num_drects,
+                                       crects, num_crects,
+                                       data, width * 4) != 0)
+    {
+        xrdp_mm_frame_trace_failed(mm);
+    }
 
     if (mm->encoder != 0)
     {
@@ -4252,6 +4860,7 @@ server_paint_rects_ex(struct xrdp_mod *mod,
         enc_data->u.sc.height = height;
         enc_data->u.sc.flags = flags;
         enc_data->u.sc.frame_id = frame_id;
+        enc_data->rate_level = xrdp_rate_ctl_get_level(mm->rate_ctl);
         enc_data->shmem_ptr = shmem_ptr;
         enc_data->shmem_bytes = shmem_bytes;
         if (width == 0 || height == 0)
@@ -4277,11 +4886,26 @@ server_paint_rects_ex(struct xrdp_mod *mod,
         return 0;
     }
 
+    fs = xrdp_mm_get_frame_sched(mm);
+    if (fs != NULL && wm->target_surface == wm->screen)
+    {
+        /* the pixels are copied, so the module can go on drawing */
+        xrdp_frame_sched_add_rects(fs, data, width, height,
+                                   crects, num_crects);
+        mm->mod->mod_frame_ack(mm->mod, flags, frame_id);
+        if (shmem_ptr != NULL)
+        {
+            g_munmap(shmem_ptr, shmem_bytes);
+        }
+        return 0;
+    }
+
     p = (struct xrdp_painter *)(mod->painter);
     if (p == 0)
     {
         return 0;
     }
+    xrdp_frame_sched_flush(fs);
     b = xrdp_bitmap_create_with_data(width, height, wm->screen->bpp,
                                      data, wm);
     s = crects;
@@ -4316,29 +4940,53 @@ int
 server_egfx_cmd(struct xrdp_mod *mod,
                 char *cmd, int cmd_bytes,
                 char *data, int data_bytes)
+{
+    return server_egfx_cmd_ex(mod, cmd, cmd_bytes, data, data_bytes,
+                              data, data_bytes);
+}
+
+/*****************************************************************************/
+/* data is used by the encoder thread, shmem_ptr, if not NULL, is unmapped
+   when done */
+int
+server_egfx_cmd_ex(struct xrdp_mod *mod,
+                   char *cmd, int cmd_bytes,
+                   char *data, int data_bytes,
+                   void *shmem_ptr, int shmem_bytes)
 {
     XRDP_ENC_DATA *enc;
     struct xrdp_wm *wm;
     struct xrdp_mm *mm;
+    struct xrdp_frame_trace *trace;
 
     wm = (struct xrdp_wm *)(mod->wm);
     mm = wm->mm;
+    xrdp_metrics_paint(mm->metrics, g_time3());
+    trace = xrdp_mm_get_frame_trace(mm, wm->screen->width,
+                                    wm->screen->height);
+    if (trace != NULL &&
+            xrdp_frame_trace_add_egfx(trace, xrdp_mm_frame_trace_time(mm),
+                                      cmd, cmd_bytes,
+                                      data, data_bytes) != 0)
+    {
+        xrdp_mm_frame_trace_failed(mm);
+    }
     if (mm->encoder == NULL)
     {
         // This can happen when we are in the resize state machine, if
         // there are messages queued up by the X server
-        if (data != NULL)
+        if (shmem_ptr != NULL)
         {
-            g_munmap(data, data_bytes);
+            g_munmap(shmem_ptr, shmem_bytes);
         }
         return 0;
     }
     enc = g_new0(struct xrdp_enc_data, 1);
     if (enc == NULL)
     {
-        if (data != NULL)
+        if (shmem_ptr != NULL)
         {
-            g_munmap(data, data_bytes);
+            g_munmap(shmem_ptr, shmem_bytes);
         }
         return 1;
     }
@@ -4346,9 +4994,9 @@ server_egfx_cmd(struct xrdp_mod *mod,
     enc->u.gfx.cmd = g_new(char, cmd_bytes);
     if (enc->u.gfx.cmd == NULL)
     {
-        if (data != NULL)
+        if (shmem_ptr != NULL)
         {
-            g_munmap(data, data_bytes);
+            g_munmap(shmem_ptr, shmem_bytes);
         }
         g_free(enc);
         return 1;
@@ -4357,8 +5005,9 @@ server_egfx_cmd(struct xrdp_mod *mod,
     enc->u.gfx.cmd_bytes = cmd_bytes;
     enc->u.gfx.data = data;
     enc->u.gfx.data_bytes = data_bytes;
-    enc->shmem_ptr = data;
-    enc->shmem_bytes = data_bytes;
+    enc->rate_level = xrdp_rate_ctl_get_level(mm->rate_ctl);
+    enc->shmem_ptr = shmem_ptr;
+    enc->shmem_bytes = shmem_bytes;
     /* insert into fifo for encoder thread to process */
     tc_mutex_lock(mm->encoder->mutex);
     fifo_add_item(mm->encoder->fifo_to_proc, enc);
@@ -4592,6 +5241,7 @@ server_draw_line(struct xrdp_mod *mod, int x1, int y1, int x2, int y2)
         return 0;
     }
 
+    server_flush_frame_sched(mod);
     wm = (struct xrdp_wm *)(mod->wm);
     return xrdp_painter_line(p, wm->target_surface, x1, y1, x2, y2);
 }
@@ -4634,6 +5284,7 @@ server_draw_text(struct xrdp_mod *mod, int font,
         return 0;
     }
 
+    server_flush_frame_sched(mod);
     wm = (struct xrdp_wm *)(mod->wm);
     return xrdp_painter_draw_text2(p, wm->target_surface, font, flags,
                                    mixmode, clip_left, clip_top,
@@ -4809,6 +5460,7 @@ server_send_to_channel(struct xrdp_mod *mod, int channel_id,
         return 1;
     }
 
+    xrdp_metrics_add_channel(wm->mm->metrics, channel_id, 1, data_len);
     return libxrdp_send_to_channel(wm->session, channel_id, data, data_len,
                                    total_data_len, flags);
 }
@@ -4956,6 +5608,7 @@ server_paint_rect_os(struct xrdp_mod *mod, int x, int y, int cx, int cy,
         return 0;
     }
 
+    server_flush_frame_sched(mod);
     wm = (struct xrdp_wm *)(mod->wm);
     bi = xrdp_cache_get_os_bitmap(wm->cache, rdpindex);
 
@@ -197,8 +197,6 @@ int
 wm_painter_set_target(struct xrdp_painter *self)
 {
     int surface_index;
-    int index;
-    struct list *del_list;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "wm_painter_set_target:");
 
@@ -221,21 +219,14 @@ wm_painter_set_target(struct xrdp_painter *self)
 
         if (surface_index != self->wm->current_surface_index)
         {
-            if (self->wm->target_surface->tab_stop == 0) /* tab_stop is hack */
+            /* if the client has no room, drawing to it is dropped */
+            if (xrdp_cache_send_os_bitmap(self->wm->cache,
+                                          self->wm->target_surface) == 0)
             {
-                del_list = self->wm->cache->xrdp_os_del_list;
-                index = list_index_of(del_list, surface_index);
-                list_remove_item(del_list, index);
-                libxrdp_orders_send_create_os_surface(self->session, surface_index,
-                                                      self->wm->target_surface->width,
-                                                      self->wm->target_surface->height,
-                                                      del_list);
-                self->wm->target_surface->tab_stop = 1;
-                list_clear(del_list);
+                libxrdp_orders_send_switch_os_surface(self->session,
+                                                      surface_index);
+                self->wm->current_surface_index = surface_index;
             }
-
-            libxrdp_orders_send_switch_os_surface(self->session, surface_index);
-            self->wm->current_surface_index = surface_index;
         }
     }
     else
@@ -560,6 +551,93 @@ get_rgb_from_rdp_color(struct xrdp_painter *self, int rdp_color)
 
 #endif
 
+/*****************************************************************************/
+/* returns boolean, true if the client has nothing to draw dst into, xrdp
+   keeps no pixels for bitmaps and the client may have had no room for an
+   off screen surface, or it is lost so the client wasn't switched to it */
+static int
+xrdp_painter_no_client_dst(struct xrdp_painter *self, struct xrdp_bitmap *dst)
+{
+    return (dst->type == WND_TYPE_BITMAP) ||
+           ((dst->type == WND_TYPE_OFFSCREEN) &&
+            (!dst->tab_stop ||
+             (dst->item_index != self->wm->current_surface_index)));
+}
+
+/*****************************************************************************/
+/* the off screen source for x, y, cx, cy has no content on the client,
+   the module repaints screen areas, off screen ones are marked lost too */
+static void
+xrdp_painter_copy_lost(struct xrdp_painter *self, struct xrdp_bitmap *dst,
+                       struct xrdp_rect *clip_rect,
+                       int x, int y, int cx, int cy)
+{
+    struct xrdp_rect rect;
+    struct xrdp_rect draw_rect;
+
+    if (dst->type == WND_TYPE_OFFSCREEN)
+    {
+        xrdp_cache_set_os_bitmap_lost(self->wm->cache, dst);
+        return;
+    }
+    MAKERECT(rect, x, y, cx, cy);
+    if (rect_intersect(&rect, clip_rect, &draw_rect))
+    {
+        xrdp_bitmap_invalidate(self->wm->screen, &draw_rect);
+    }
+}
+
+/*****************************************************************************/
+/* the parts of x, y, cx, cy inside both the region and clip_rect, in
+   region order, returns NULL if there are none, free with g_free */
+static struct xrdp_rect *
+xrdp_painter_get_draw_rects(struct xrdp_region *region,
+                            struct xrdp_rect *clip_rect,
+                            int x, int y, int cx, int cy, int *num_rects)
+{
+    struct xrdp_rect *rects;
+    struct xrdp_rect order_rect;
+    struct xrdp_rect rect;
+    struct xrdp_rect draw_rect;
+    int k;
+
+    *num_rects = 0;
+    k = 0;
+    while (xrdp_region_get_rect(region, k, &rect) == 0)
+    {
+        k++;
+    }
+    if (k < 1)
+    {
+        return NULL;
+    }
+    rects = g_new(struct xrdp_rect, k);
+    if (rects == NULL)
+    {
+        return NULL;
+    }
+    order_rect.left = x;
+    order_rect.top = y;
+    order_rect.right = x + cx;
+    order_rect.bottom = y + cy;
+    k = 0;
+    while (xrdp_region_get_rect(region, k, &rect) == 0)
+    {
+        if (rect_intersect(&rect, clip_rect, &draw_rect) &&
+                rect_intersect(&draw_rect, &order_rect, rects + *num_rects))
+        {
+            (*num_rects)++;
+        }
+        k++;
+    }
+    if (*num_rects < 1)
+    {
+        g_free(rects);
+        return NULL;
+    }
+    return rects;
+}
+
 /*****************************************************************************/
 /* fill in an area of the screen with one color */
 int
@@ -568,11 +646,10 @@ xrdp_painter_fill_rect(struct xrdp_painter *self,
                        int x, int y, int cx, int cy)
 {
     struct xrdp_rect clip_rect;
-    struct xrdp_rect draw_rect;
-    struct xrdp_rect rect;
+    struct xrdp_rect *draw_rects;
     struct xrdp_region *region;
     struct xrdp_brush brush;
-    int k;
+    int num_draw_rects;
     int dx;
     int dy;
     int rop;
@@ -593,6 +670,9 @@ xrdp_painter_fill_rect(struct xrdp_painter *self,
         struct painter_bitmap dst_pb;
         struct xrdp_bitmap *ldst;
         struct painter_bitmap pat;
+        struct xrdp_rect draw_rect;
+        struct xrdp_rect rect;
+        int k;
 
         LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_painter_fill_rect: dst->type %d", dst->type);
         if (dst->type != WND_TYPE_OFFSCREEN)
@@ -693,7 +773,7 @@ xrdp_painter_fill_rect(struct xrdp_painter *self,
 
     /* todo data */
 
-    if (dst->type == WND_TYPE_BITMAP) /* 0 */
+    if (xrdp_painter_no_client_dst(self, dst))
     {
         return 0;
     }
@@ -714,42 +794,30 @@ xrdp_painter_fill_rect(struct xrdp_painter *self,
     x += dx;
     y += dy;
 
-    if (self->mix_mode == 0 && self->rop == 0xcc)
+    /* one multi order for all the visible parts */
+    draw_rects = xrdp_painter_get_draw_rects(region, &clip_rect,
+                 x, y, cx, cy, &num_draw_rects);
+    xrdp_region_delete(region);
+    if (draw_rects == NULL)
     {
-        k = 0;
-
-        while (xrdp_region_get_rect(region, k, &rect) == 0)
-        {
-            if (rect_intersect(&rect, &clip_rect, &draw_rect))
-            {
-                libxrdp_orders_rect(self->session, x, y, cx, cy,
-                                    self->fg_color, &draw_rect);
-            }
+        return 0;
+    }
 
-            k++;
-        }
+    if (self->mix_mode == 0 && self->rop == 0xcc)
+    {
+        libxrdp_orders_multi_rect(self->session, self->fg_color,
+                                  draw_rects, num_draw_rects);
     }
     else if (self->mix_mode == 0 &&
              ((self->rop & 0xf) == 0x0 || /* black */
               (self->rop & 0xf) == 0xf || /* white */
               (self->rop & 0xf) == 0x5))  /* DSTINVERT */
     {
-        k = 0;
-
-        while (xrdp_region_get_rect(region, k, &rect) == 0)
-        {
-            if (rect_intersect(&rect, &clip_rect, &draw_rect))
-            {
-                libxrdp_orders_dest_blt(self->session, x, y, cx, cy,
-                                        self->rop, &draw_rect);
-            }
-
-            k++;
-        }
+        libxrdp_orders_multi_dest_blt(self->session, self->rop,
+                                      draw_rects, num_draw_rects);
     }
     else
     {
-        k = 0;
         rop = self->rop;
 
         /* if opcode is in the form 0x00, 0x11, 0x22, ... convert it */
@@ -773,21 +841,12 @@ xrdp_painter_fill_rect(struct xrdp_painter *self,
         }
 
         xrdp_painter_setup_brush(self, &brush, &self->brush);
-
-        while (xrdp_region_get_rect(region, k, &rect) == 0)
-        {
-            if (rect_intersect(&rect, &clip_rect, &draw_rect))
-            {
-                libxrdp_orders_pat_blt(self->session, x, y, cx, cy,
-                                       rop, self->bg_color, self->fg_color,
-                                       &brush, &draw_rect);
-            }
-
-            k++;
-        }
+        libxrdp_orders_multi_pat_blt(self->session, rop, self->bg_color,
+                                     self->fg_color, &brush,
+                                     draw_rects, num_draw_rects);
     }
 
-    xrdp_region_delete(region);
+    g_free(draw_rects);
     return 0;
 }
 
@@ -1062,7 +1121,7 @@ xrdp_painter_draw_text2(struct xrdp_painter *self,
 
     /* todo data */
 
-    if (dst->type == WND_TYPE_BITMAP)
+    if (xrdp_painter_no_client_dst(self, dst))
     {
         return 0;
     }
@@ -1166,8 +1225,10 @@ xrdp_painter_copy(struct xrdp_painter *self,
     struct xrdp_rect draw_rect;
     struct xrdp_rect rect1;
     struct xrdp_rect rect2;
+    struct xrdp_rect *draw_rects;
     struct xrdp_region *region;
     struct xrdp_bitmap *b;
+    int num_draw_rects;
     int i;
     int j;
     int k;
@@ -1181,8 +1242,6 @@ xrdp_painter_copy(struct xrdp_painter *self,
     int dsty;
     int w;
     int h;
-    int index;
-    struct list *del_list;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_painter_copy:");
 
@@ -1256,7 +1315,7 @@ xrdp_painter_copy(struct xrdp_painter *self,
 
     /* todo data */
 
-    if (dst->type == WND_TYPE_BITMAP)
+    if (xrdp_painter_no_client_dst(self, dst))
     {
         return 0;
     }
@@ -1280,17 +1339,14 @@ xrdp_painter_copy(struct xrdp_painter *self,
         y += dy;
         srcx += dx;
         srcy += dy;
-        k = 0;
-
-        while (xrdp_region_get_rect(region, k, &rect1) == 0)
+        draw_rects = xrdp_painter_get_draw_rects(region, &clip_rect,
+                     x, y, cx, cy, &num_draw_rects);
+        if (draw_rects != NULL)
         {
-            if (rect_intersect(&rect1, &clip_rect, &draw_rect))
-            {
-                libxrdp_orders_screen_blt(self->session, x, y, cx, cy,
-                                          srcx, srcy, self->rop, &draw_rect);
-            }
-
-            k++;
+            libxrdp_orders_multi_screen_blt(self->session, srcx - x, srcy - y,
+                                            self->rop, draw_rects,
+                                            num_draw_rects);
+            g_free(draw_rects);
         }
 
         xrdp_region_delete(region);
@@ -1324,18 +1380,15 @@ xrdp_painter_copy(struct xrdp_painter *self,
         if (src->tab_stop == 0)
         {
             LOG(LOG_LEVEL_WARNING, "xrdp_painter_copy: warning src not created");
-            del_list = self->wm->cache->xrdp_os_del_list;
-            index = list_index_of(del_list, cache_idx);
-            list_remove_item(del_list, index);
-            libxrdp_orders_send_create_os_surface(self->session,
-                                                  cache_idx,
-                                                  src->width,
-                                                  src->height,
-                                                  del_list);
-            src->tab_stop = 1;
-            list_clear(del_list);
         }
 
+        if ((xrdp_cache_send_os_bitmap(self->wm->cache, src) != 0) ||
+                xrdp_cache_os_bitmap_lost(self->wm->cache, src))
+        {
+            xrdp_painter_copy_lost(self, dst, &clip_rect, x, y, cx, cy);
+            xrdp_region_delete(region);
+            return 0;
+        }
 
         k = 0;
 
@@ -1470,7 +1523,7 @@ xrdp_painter_composite(struct xrdp_painter *self,
 
     /* todo data */
 
-    if (dst->type == WND_TYPE_BITMAP)
+    if (xrdp_painter_no_client_dst(self, dst))
     {
         return 0;
     }
@@ -1478,11 +1531,23 @@ xrdp_painter_composite(struct xrdp_painter *self,
     if (src->type == WND_TYPE_OFFSCREEN)
     {
         xrdp_bitmap_get_screen_clip(dst, self, &clip_rect, &dx, &dy);
-        region = xrdp_region_create(self->wm);
-        xrdp_region_add_rect(region, &clip_rect);
         dstx += dx;
         dsty += dy;
 
+        if ((xrdp_cache_send_os_bitmap(self->wm->cache, src) != 0) ||
+                xrdp_cache_os_bitmap_lost(self->wm->cache, src) ||
+                ((mskflags & 1) && (msk != 0) &&
+                 ((xrdp_cache_send_os_bitmap(self->wm->cache, msk) != 0) ||
+                  xrdp_cache_os_bitmap_lost(self->wm->cache, msk))))
+        {
+            xrdp_painter_copy_lost(self, dst, &clip_rect,
+                                   dstx, dsty, width, height);
+            return 0;
+        }
+
+        region = xrdp_region_create(self->wm);
+        xrdp_region_add_rect(region, &clip_rect);
+
         cache_srcidx = src->item_index;
         cache_mskidx = -1;
         if (mskflags & 1)
@@ -1602,7 +1667,7 @@ xrdp_painter_line(struct xrdp_painter *self,
 
     /* todo data */
 
-    if (dst->type == WND_TYPE_BITMAP)
+    if (xrdp_painter_no_client_dst(self, dst))
     {
         return 0;
     }
@@ -0,0 +1,220 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * rate control from frame ack feedback
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "xrdp_rate_ctl.h"
+#include "defines.h"
+#include "os_calls.h"
+
+/* the least ack time is kept for two windows of this, so the base moves
+   up if the path gets longer, but a short burst doesn't reset it */
+#define BASE_WINDOW_MS 30000
+/* least time between one step down in quality and the next */
+#define STEP_UP_MS 500
+/* time it must be clear before quality goes up a step */
+#define STEP_DOWN_MS 3000
+#define CONGESTED_QUEUE_DEPTH 3
+#define CONGESTED_WAIT_BYTES (128 * 1024)
+#define CLEAR_QUEUE_DEPTH 1
+#define CLEAR_WAIT_BYTES (16 * 1024)
+/* with a measured bandwidth, congested is this much time waiting */
+#define CONGESTED_WAIT_MS 250
+#define MIN_CONGESTED_WAIT_BYTES (8 * 1024)
+
+static const int g_frame_interval_ms[XRDP_RATE_CTL_MAX_LEVEL + 1] =
+{
+    0, 0, 50, 100, 200
+};
+
+struct xrdp_rate_ctl
+{
+    int level;
+    int srtt; /* smoothed ack time, -1 until the first */
+    int base_prev; /* least ack time in the last window, -1 for none */
+    int base_cur; /* least ack time in this window, -1 for none */
+    int base_time; /* when this window started */
+    int last_change;
+    int clear; /* true if it has been clear since clear_time */
+    int clear_time;
+    int congested_wait_bytes;
+    int clear_wait_bytes;
+};
+
+/*****************************************************************************/
+struct xrdp_rate_ctl *
+xrdp_rate_ctl_create(void)
+{
+    struct xrdp_rate_ctl *self;
+
+    self = g_new0(struct xrdp_rate_ctl, 1);
+    if (self != NULL)
+    {
+        self->srtt = -1;
+        self->base_prev = -1;
+        self->base_cur = -1;
+        self->base_time = g_time3();
+        self->last_change = self->base_time;
+        self->congested_wait_bytes = CONGESTED_WAIT_BYTES;
+        self->clear_wait_bytes = CLEAR_WAIT_BYTES;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_rate_ctl_delete(struct xrdp_rate_ctl *self)
+{
+    g_free(self);
+}
+
+/*****************************************************************************/
+static void
+xrdp_rate_ctl_add_rtt(struct xrdp_rate_ctl *self, int now, int rtt_ms)
+{
+    if (self->srtt < 0)
+    {
+        self->srtt = rtt_ms;
+    }
+    else
+    {
+        self->srtt = (self->srtt * 7 + rtt_ms) / 8;
+    }
+    if (now - self->base_time >= BASE_WINDOW_MS)
+    {
+        self->base_prev = self->base_cur;
+        self->base_cur = -1;
+        self->base_time = now;
+    }
+    if (self->base_cur < 0 || rtt_ms < self->base_cur)
+    {
+        self->base_cur = rtt_ms;
+    }
+}
+
+/*****************************************************************************/
+int
+xrdp_rate_ctl_ack(struct xrdp_rate_ctl *self, int now, int rtt_ms,
+                  int queue_depth, int wait_bytes)
+{
+    int base;
+    int delay;
+    int congested;
+    int clear;
+
+    if (self == NULL)
+    {
+        return 0;
+    }
+    if (rtt_ms >= 0)
+    {
+        xrdp_rate_ctl_add_rtt(self, now, rtt_ms);
+    }
+
+    congested = (queue_depth >= CONGESTED_QUEUE_DEPTH) ||
+                (wait_bytes > self->congested_wait_bytes);
+    clear = (queue_depth <= CLEAR_QUEUE_DEPTH) &&
+            (wait_bytes <= self->clear_wait_bytes);
+    if (self->srtt >= 0)
+    {
+        base = self->base_cur;
+        if (self->base_prev >= 0)
+        {
+            base = MIN(base, self->base_prev);
+        }
+        /* time spent queued somewhere on the way */
+        delay = self->srtt - base;
+        congested = congested || (delay > MAX(base, 50));
+        clear = clear && (delay <= MAX(base / 2, 20));
+    }
+
+    if (congested)
+    {
+        self->clear = 0;
+        /* give the last step time to show in the ack times */
+        if (self->level < XRDP_RATE_CTL_MAX_LEVEL &&
+                now - self->last_change >= MAX(STEP_UP_MS, self->srtt * 2))
+        {
+            self->level++;
+            self->last_change = now;
+            return 1;
+        }
+    }
+    else if (clear)
+    {
+        if (!self->clear)
+        {
+            self->clear = 1;
+            self->clear_time = now;
+        }
+        else if (self->level > 0 &&
+                 now - self->clear_time >= STEP_DOWN_MS &&
+                 now - self->last_change >= STEP_DOWN_MS)
+        {
+            self->level--;
+            self->last_change = now;
+            self->clear_time = now;
+            return 1;
+        }
+    }
+    else
+    {
+        self->clear = 0;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_rate_ctl_get_level(const struct xrdp_rate_ctl *self)
+{
+    return (self == NULL) ? 0 : self->level;
+}
+
+/*****************************************************************************/
+int
+xrdp_rate_ctl_get_frame_interval(const struct xrdp_rate_ctl *self)
+{
+    return g_frame_interval_ms[xrdp_rate_ctl_get_level(self)];
+}
+
+/*****************************************************************************/
+void
+xrdp_rate_ctl_set_bandwidth(struct xrdp_rate_ctl *self, int bandwidth)
+{
+    tui64 bytes;
+
+    if (self == NULL)
+    {
+        return;
+    }
+    if (bandwidth <= 0)
+    {
+        self->congested_wait_bytes = CONGESTED_WAIT_BYTES;
+        self->clear_wait_bytes = CLEAR_WAIT_BYTES;
+        return;
+    }
+    /* kbit/s is bits/ms */
+    bytes = (tui64) bandwidth * CONGESTED_WAIT_MS / 8;
+    bytes = MAX(bytes, MIN_CONGESTED_WAIT_BYTES);
+    bytes = MIN(bytes, 64 * 1024 * 1024);
+    self->congested_wait_bytes = (int) bytes;
+    self->clear_wait_bytes = (int) (bytes / 8);
+}
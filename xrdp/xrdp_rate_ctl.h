@@ -0,0 +1,74 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * rate control from frame ack feedback
+ *
+ * Each frame ack gives the time the frame took to be acked, the client's
+ * decode queue depth and how much is waiting to be written to the client.
+ * When these show the link is congested the level goes up, lowering the
+ * codec quality and the frame rate, and when they have been clear for a
+ * while it comes back down one step at a time. Level 0 is what the codecs
+ * do without rate control.
+ */
+
+#ifndef _XRDP_RATE_CTL_H
+#define _XRDP_RATE_CTL_H
+
+#include "arch.h"
+
+#define XRDP_RATE_CTL_MAX_LEVEL 4
+
+struct xrdp_rate_ctl;
+
+struct xrdp_rate_ctl *
+xrdp_rate_ctl_create(void);
+void
+xrdp_rate_ctl_delete(struct xrdp_rate_ctl *self);
+
+/**
+ * Feeds back a frame ack
+ *
+ * @param now g_time3() style time in ms
+ * @param rtt_ms Time from sending the frame to its ack, -1 if not known
+ * @param queue_depth Client decode queue depth, -1 if not known
+ * @param wait_bytes Bytes waiting to be written to the client
+ * @return 1 if the level changed, 0 if not
+ */
+int
+xrdp_rate_ctl_ack(struct xrdp_rate_ctl *self, int now, int rtt_ms,
+                  int queue_depth, int wait_bytes);
+
+/**
+ * Current level, 0 to XRDP_RATE_CTL_MAX_LEVEL, 0 if self is NULL
+ */
+int
+xrdp_rate_ctl_get_level(const struct xrdp_rate_ctl *self);
+
+/**
+ * Least time between frames at the current level, 0 for no limit
+ */
+int
+xrdp_rate_ctl_get_frame_interval(const struct xrdp_rate_ctl *self);
+
+/**
+ * Sizes the client write backlog taken as congested to the measured
+ * link, about 250 ms of it
+ *
+ * @param bandwidth kbit/s from network auto-detect, 0 for the default
+ */
+void
+xrdp_rate_ctl_set_bandwidth(struct xrdp_rate_ctl *self, int bandwidth);
+
+#endif
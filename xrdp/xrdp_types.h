@@ -195,7 +195,11 @@ struct xrdp_mod
     int (*server_egfx_cmd)(struct xrdp_mod *v,
                            char *cmd, int cmd_bytes,
                            char *data, int data_bytes);
-    tintptr server_dumby[100 - 51]; /* align, 100 minus the number of server
+    int (*server_egfx_cmd_ex)(struct xrdp_mod *v,
+                              char *cmd, int cmd_bytes,
+                              char *data, int data_bytes,
+                              void *shmem_ptr, int shmem_bytes);
+    tintptr server_dumby[100 - 52]; /* align, 100 minus the number of server
                                      functions above */
     /* common */
     tintptr handle; /* pointer to self as int */
@@ -253,6 +257,9 @@ struct xrdp_os_bitmap_item
 {
     int id;
     struct xrdp_bitmap *bitmap;
+    int stamp;
+    int bytes; /* client memory used, 0 when not on the client */
+    int lost; /* client copy was evicted or never made, content is gone */
 };
 
 struct xrdp_char_item
@@ -329,6 +336,14 @@ struct xrdp_cache
     struct xrdp_brush_item brush_items[64];
     struct xrdp_os_bitmap_item os_bitmap_items[2000];
     struct list *xrdp_os_del_list;
+    /* off screen surfaces on the client, against the client's caps */
+    int os_stamp;
+    int os_bytes;
+    int os_entries;
+    int os_max_bytes; /* 0 is no limit */
+    int os_max_entries; /* 0 is no limit */
+    int os_evictions;
+    int os_failures;
 };
 
 /* defined later */
@@ -436,6 +451,22 @@ struct xrdp_mm
     struct guid guid; /* GUID for the session, or all zeros  */
     int code; /* 0=Xvnc session, 20=xorg driver mode */
     struct xrdp_encoder *encoder;
+    struct xrdp_frame_sched *frame_sched; /* non codec damage accumulator */
+    int frame_sched_failed; /* don't retry creating frame_sched */
+    struct xrdp_frame_trace *frame_trace; /* frame_trace_dir capture */
+    int frame_trace_start; /* g_time3() when frame_trace was made */
+    int frame_trace_seq;
+    struct xrdp_metrics *metrics;
+    struct trans *metrics_lis; /* metrics_socket_dir listener */
+    struct list *metrics_cons; /* connections to metrics_lis */
+    struct xrdp_rate_ctl *rate_ctl; /* rate_control, NULL until an ack */
+    int rate_timer; /* sends a module frame ack held back by rate_ctl */
+    int rate_last_ack; /* g_time3() of the last module frame ack */
+    int autodetect_timer; /* sends network auto-detect RTT requests */
+    int autodetect_bw; /* true while a bandwidth measure is running */
+    int autodetect_bw_time; /* g_time3() the last bandwidth measure started */
+    int autodetect_bandwidth; /* kbit/s, 0 until measured */
+    int autodetect_connection_type; /* last detected CONNECTION_TYPE_* */
     int cs2xr_cid_map[256];
     int xr2cr_cid_map[256];
     int dynamic_monitor_chanid;
@@ -448,6 +479,8 @@ struct xrdp_mm
     struct display_control_monitor_layout_data *resize_data;
     struct list *resize_queue;
     tbus resize_ready;
+    int resize_timer; /* wakes the resize state machine */
+    struct timer_heap *timers; /* one shot timers for the session loop */
     /* Last sync event if a module isn't loaded */
     int last_sync_saved;
     int last_sync_key_flags;
@@ -815,6 +848,12 @@ struct xrdp_cfg_globals
     int  nego_sec_layer;
     int  allow_multimon;
     int  enable_token_login;
+    int  frame_scheduler;        /* accumulate damage for non codec clients */
+    int  frame_scheduler_fps;
+    int  frame_scheduler_max_queued_kb; /* back-pressure threshold */
+    char frame_trace_dir[256];   /* capture frames here, empty for off */
+    char metrics_socket_dir[256]; /* metrics sockets here, empty for off */
+    int  rate_control;           /* codec quality and rate from frame acks */
 
     /* colors */
 
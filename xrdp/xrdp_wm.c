@@ -29,6 +29,7 @@
 #include "log.h"
 #include "string_calls.h"
 #include "unicode_defines.h"
+#include "xrdp_metrics.h"
 
 /*****************************************************************************/
 static void
@@ -648,6 +649,7 @@ xrdp_wm_init(struct xrdp_wm *self)
 
     load_xrdp_config(self->xrdp_config, self->session->xrdp_ini,
                      self->screen->bpp);
+    xrdp_mm_metrics_listen(self->mm);
 
     tconfig_load_gfx(XRDP_CFG_PATH "/gfx.toml", self->gfx_config);
 
@@ -2123,6 +2125,25 @@ callback(intptr_t id, int msg, intptr_t param1, intptr_t param2,
 
     rv = 0;
 
+    switch (msg)
+    {
+        case RDP_INPUT_SCANCODE:
+        case RDP_INPUT_UNICODE:
+            /* only the time, not the key */
+            xrdp_mm_frame_trace_input(wm->mm, msg, 0, 0, 0);
+            xrdp_metrics_input(wm->mm->metrics, g_time3());
+            break;
+        case RDP_INPUT_MOUSE:
+        case RDP_INPUT_MOUSEX:
+            xrdp_mm_frame_trace_input(wm->mm, msg, param3, param1, param2);
+            /* moves may not paint, so only presses are timed */
+            if (param3 & PTRFLAGS_DOWN)
+            {
+                xrdp_metrics_input(wm->mm->metrics, g_time3());
+            }
+            break;
+    }
+
     switch (msg)
     {
         case RDP_INPUT_SYNCHRONIZE:
@@ -2168,6 +2189,10 @@ callback(intptr_t id, int msg, intptr_t param1, intptr_t param2,
             // "yeah, up_and_running"
             xrdp_mm_up_and_running(wm->mm);
             break;
+        case 0x555b:
+            /* network auto-detect results */
+            xrdp_mm_autodetect(wm->mm, param1, param2, param3);
+            break;
     }
     return rv;
 }
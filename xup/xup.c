@@ -23,6 +23,8 @@
 #endif
 
 #include "xup.h"
+#include "xup_shm_ring.h"
+#include "list.h"
 #include "log.h"
 #include "trans.h"
 #include "string_calls.h"
@@ -45,12 +47,132 @@ static int
 lib_mod_process_message(struct mod *mod, struct stream *s);
 
 /******************************************************************************/
+/* Input events are queued in input_s and written together from
+   lib_mod_get_wait_objs, once xrdp has handled all it read from the
+   client. A mouse move that follows a queued mouse move replaces it, so
+   buttons and keys keep their order relative to the moves around them. */
+
+/******************************************************************************/
+/* return error */
+static int
+lib_mod_input_flush(struct mod *mod)
+{
+    struct stream *s;
+    int rv;
+
+    s = mod->input_s;
+    if (s == NULL || mod->input_count == 0)
+    {
+        return 0;
+    }
+    s_mark_end(s);
+    LOG_DEVEL(LOG_LEVEL_TRACE, "lib_mod_input_flush: %d events in %d bytes",
+              mod->input_count, (int)(s->end - s->data));
+    rv = trans_write_copy_s(mod->trans, s);
+    init_stream(s, 8192);
+    mod->input_count = 0;
+    mod->input_move = NULL;
+    return rv;
+}
+
+/******************************************************************************/
+/* everything else sent to xorgxrdp goes after the queued input */
 static int
 lib_send_copy(struct mod *mod, struct stream *s)
 {
+    if (lib_mod_input_flush(mod) != 0)
+    {
+        return 1;
+    }
     return trans_write_copy_s(mod->trans, s);
 }
 
+/******************************************************************************/
+/* return error */
+static int
+lib_mod_input_queue(struct mod *mod, int msg, tbus param1, tbus param2,
+                    tbus param3, tbus param4)
+{
+    struct stream *s;
+
+    if (mod->input_s == NULL)
+    {
+        make_stream(mod->input_s);
+        init_stream(mod->input_s, 8192);
+    }
+    s = mod->input_s;
+    if (msg >= WM_KEYDOWN && msg <= WM_TOUCH_HSCROLL)
+    {
+        if (mod->input_time == 0)
+        {
+            /* oldest input not yet followed by a paint */
+            mod->input_time = g_time3() | 1;
+        }
+    }
+    if (msg == WM_MOUSEMOVE && mod->input_move != NULL)
+    {
+        /* the previous event is a move, only the latest position matters */
+        mod->input_move[0] = (char) param1;
+        mod->input_move[1] = (char) (param1 >> 8);
+        mod->input_move[2] = (char) (param1 >> 16);
+        mod->input_move[3] = (char) (param1 >> 24);
+        mod->input_move[4] = (char) param2;
+        mod->input_move[5] = (char) (param2 >> 8);
+        mod->input_move[6] = (char) (param2 >> 16);
+        mod->input_move[7] = (char) (param2 >> 24);
+        mod->input_coalesced++;
+        return 0;
+    }
+    if (!s_check_rem_out(s, 4 + 2 + 4 * 5))
+    {
+        if (lib_mod_input_flush(mod) != 0)
+        {
+            return 1;
+        }
+    }
+    out_uint32_le(s, 4 + 2 + 4 * 5);
+    out_uint16_le(s, 103);
+    out_uint32_le(s, msg);
+    mod->input_move = (msg == WM_MOUSEMOVE) ? s->p : NULL;
+    out_uint32_le(s, param1);
+    out_uint32_le(s, param2);
+    out_uint32_le(s, param3);
+    out_uint32_le(s, param4);
+    mod->input_count++;
+    return 0;
+}
+
+/******************************************************************************/
+/* the X server painted, input_time to now is the input to paint latency */
+static void
+lib_mod_input_painted(struct mod *mod)
+{
+    int latency;
+
+    if (mod->input_time == 0)
+    {
+        return;
+    }
+    latency = g_time3() - mod->input_time;
+    mod->input_time = 0;
+    if (latency < 0)
+    {
+        return;
+    }
+    mod->input_latency_count++;
+    mod->input_latency_total += latency;
+    mod->input_latency_max = MAX(mod->input_latency_max, latency);
+    if ((mod->input_latency_count & 0xff) == 0)
+    {
+        LOG(LOG_LEVEL_DEBUG, "lib_mod_input_painted: input to paint "
+            "latency average %d ms max %d ms over %d samples, "
+            "%d mouse moves coalesced",
+            (int)(mod->input_latency_total / mod->input_latency_count),
+            mod->input_latency_max, mod->input_latency_count,
+            mod->input_coalesced);
+    }
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -282,14 +404,11 @@ static int
 lib_mod_event(struct mod *mod, int msg, tbus param1, tbus param2,
               tbus param3, tbus param4)
 {
-    struct stream *s;
-    int len;
     int key;
     int rv;
     int scancode;
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "in lib_mod_event");
-    make_stream(s);
 
     if ((msg >= 15) && (msg <= 16)) /* key events */
     {
@@ -307,19 +426,11 @@ lib_mod_event(struct mod *mod, int msg, tbus param1, tbus param2,
                     msg param1 param2 param3 param4
                     15  0      65507  29     0
                     16  0      65507  29     49152 */
-                    init_stream(s, 8192);
-                    s_push_layer(s, iso_hdr, 4);
-                    out_uint16_le(s, 103);
-                    out_uint32_le(s, 16); /* key up */
-                    out_uint32_le(s, 0);
-                    out_uint32_le(s, 65507); /* left control */
-                    out_uint32_le(s, 29); /* RDP scan code */
-                    out_uint32_le(s, 0xc000); /* flags */
-                    s_mark_end(s);
-                    len = (int)(s->end - s->data);
-                    s_pop_layer(s, iso_hdr);
-                    out_uint32_le(s, len);
-                    lib_send_copy(mod, s);
+                    lib_mod_input_queue(mod, 16, /* key up */
+                                        0,
+                                        65507, /* left control */
+                                        29, /* RDP scan code */
+                                        0xc000); /* flags */
                 }
             }
 
@@ -336,20 +447,7 @@ lib_mod_event(struct mod *mod, int msg, tbus param1, tbus param2,
         param1 = scancode_to_x11_keycode(scancode);
     }
 
-    init_stream(s, 8192);
-    s_push_layer(s, iso_hdr, 4);
-    out_uint16_le(s, 103);
-    out_uint32_le(s, msg);
-    out_uint32_le(s, param1);
-    out_uint32_le(s, param2);
-    out_uint32_le(s, param3);
-    out_uint32_le(s, param4);
-    s_mark_end(s);
-    len = (int)(s->end - s->data);
-    s_pop_layer(s, iso_hdr);
-    out_uint32_le(s, len);
-    rv = lib_send_copy(mod, s);
-    free_stream(s);
+    rv = lib_mod_input_queue(mod, msg, param1, param2, param3, param4);
     LOG_DEVEL(LOG_LEVEL_TRACE, "out lib_mod_event");
     return rv;
 }
@@ -1256,6 +1354,47 @@ process_server_paint_rect_shmem_ex(struct mod *amod, struct stream *s)
     return rv;
 }
 
+/******************************************************************************/
+/* return error */
+static int
+process_server_shm_ring_setup(struct mod *amod, struct stream *s)
+{
+    int slots;
+    int slot_bytes;
+    int fd;
+    int recv_bytes;
+    int rv;
+    unsigned int num_fds;
+    char msg[4];
+
+    in_uint32_le(s, slots);
+    in_uint32_le(s, slot_bytes);
+    xup_shm_ring_retire(amod);
+    if (slots == 0)
+    {
+        /* xorgxrdp went back to one fd per frame */
+        LOG(LOG_LEVEL_INFO, "process_server_shm_ring_setup: frame ring "
+            "removed");
+        return 0;
+    }
+    if (g_tcp_can_recv(amod->trans->sck, 5000) == 0)
+    {
+        return 1;
+    }
+    fd = -1;
+    num_fds = 0;
+    recv_bytes = g_sck_recv_fd_set(amod->trans->sck, msg, 4, &fd, 1, &num_fds);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_server_shm_ring_setup: "
+              "g_sck_recv_fd_set rv %d fd %d", recv_bytes, fd);
+    if (recv_bytes != 4 || num_fds != 1)
+    {
+        return 1;
+    }
+    rv = xup_shm_ring_map(amod, fd, slots, slot_bytes);
+    g_file_close(fd);
+    return rv;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1308,6 +1447,38 @@ process_server_egfx_shmfd(struct mod *amod, struct stream *s)
     return rv;
 }
 
+/******************************************************************************/
+/* return error */
+static int
+process_server_egfx_shm_ring(struct mod *amod, struct stream *s)
+{
+    char *data;
+    char *cmd;
+    int cmd_bytes;
+    int frame_id;
+    int slot;
+    int seq;
+    int offset;
+    int data_bytes;
+
+    in_uint32_le(s, cmd_bytes);
+    in_uint8p(s, cmd, cmd_bytes);
+    in_uint32_le(s, frame_id);
+    in_uint32_le(s, slot);
+    in_uint32_le(s, seq);
+    in_uint32_le(s, offset);
+    in_uint32_le(s, data_bytes);
+    data = xup_shm_ring_get_data(amod, slot, seq, offset, data_bytes,
+                                 frame_id);
+    if (data == NULL)
+    {
+        return 1;
+    }
+    /* the ring stays ours, nothing for server_egfx_cmd_ex to unmap */
+    return amod->server_egfx_cmd_ex(amod, cmd, cmd_bytes, data, data_bytes,
+                                    NULL, 0);
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1464,6 +1635,86 @@ process_server_paint_rect_shmfd(struct mod *amod, struct stream *s)
     return rv;
 }
 
+/******************************************************************************/
+/* return error */
+static int
+process_server_paint_rect_shm_ring(struct mod *amod, struct stream *s)
+{
+    int num_drects;
+    int num_crects;
+    int flags;
+    int frame_id;
+    int slot;
+    int seq;
+    int offset;
+    int left;
+    int top;
+    int width;
+    int height;
+    int Bpp;
+    int index;
+    int rv;
+    int16_t *ldrects;
+    int16_t *ldrects1;
+    int16_t *lcrects;
+    int16_t *lcrects1;
+    char *bmpdata;
+
+    /* dirty pixels */
+    in_uint16_le(s, num_drects);
+    ldrects = g_new(int16_t, 2 * 4 * num_drects);
+    ldrects1 = ldrects;
+    for (index = 0; index < num_drects; index++)
+    {
+        in_sint16_le(s, ldrects1[0]);
+        in_sint16_le(s, ldrects1[1]);
+        in_sint16_le(s, ldrects1[2]);
+        in_sint16_le(s, ldrects1[3]);
+        ldrects1 += 4;
+    }
+
+    /* copied pixels */
+    in_uint16_le(s, num_crects);
+    lcrects = g_new(int16_t, 2 * 4 * num_crects);
+    lcrects1 = lcrects;
+    for (index = 0; index < num_crects; index++)
+    {
+        in_sint16_le(s, lcrects1[0]);
+        in_sint16_le(s, lcrects1[1]);
+        in_sint16_le(s, lcrects1[2]);
+        in_sint16_le(s, lcrects1[3]);
+        lcrects1 += 4;
+    }
+
+    in_uint32_le(s, flags);
+    in_uint32_le(s, frame_id);
+    in_uint32_le(s, slot);
+    in_uint32_le(s, seq);
+    in_uint32_le(s, offset);
+
+    in_uint16_le(s, left);
+    in_uint16_le(s, top);
+    in_uint16_le(s, width);
+    in_uint16_le(s, height);
+
+    Bpp = (amod->bpp == 24) ? 4 : (amod->bpp + 7) / 8;
+    /* up to 64K x 64K, so the size does not fit an int */
+    bmpdata = xup_shm_ring_get_data(amod, slot, seq, offset,
+                                    (size_t) width * height * Bpp, frame_id);
+    rv = 1;
+    if (bmpdata != NULL)
+    {
+        /* the ring stays ours, nothing for server_paint_rects_ex to unmap */
+        rv = amod->server_paint_rects_ex(amod, num_drects, ldrects,
+                                         num_crects, lcrects, bmpdata,
+                                         left, top, width, height,
+                                         flags, frame_id, NULL, 0);
+    }
+    g_free(ldrects);
+    g_free(lcrects);
+    return rv;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1486,6 +1737,28 @@ send_server_version_message(struct mod *mod, struct stream *s)
     return rv;
 }
 
+/******************************************************************************/
+/* return error */
+static int
+send_server_shm_ring_request(struct mod *mod, struct stream *s)
+{
+    /* ask for a frame ring, xorgxrdp answers with order 65 or ignores it */
+    init_stream(s, 8192);
+    s_push_layer(s, iso_hdr, 4);
+    out_uint16_le(s, 103);
+    out_uint32_le(s, 303);
+    out_uint32_le(s, mod->shm_ring_slots_wanted);
+    out_uint32_le(s, 0);
+    out_uint32_le(s, 0);
+    out_uint32_le(s, 0);
+    s_mark_end(s);
+    int len = (int)(s->end - s->data);
+    s_pop_layer(s, iso_hdr);
+    out_uint32_le(s, len);
+    int rv = lib_send_copy(mod, s);
+    return rv;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1555,6 +1828,10 @@ lib_send_server_version_message(struct mod *mod)
     struct stream *s;
     make_stream(s);
     int rv = send_server_version_message(mod, s);
+    if (rv == 0 && mod->shm_ring_slots_wanted > 0)
+    {
+        rv = send_server_shm_ring_request(mod, s);
+    }
     free_stream(s);
     return rv;
 }
@@ -1598,6 +1875,11 @@ lib_mod_process_orders(struct mod *mod, int type, struct stream *s)
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "lib_mod_process_orders: type %d", type);
     rv = 0;
+    if (type == 2 || (type >= 60 && type <= 67 && type != 63 && type != 65))
+    {
+        /* end of update or a frame, the screen changed */
+        lib_mod_input_painted(mod);
+    }
     switch (type)
     {
         case 1: /* server_begin_update */
@@ -1699,6 +1981,15 @@ lib_mod_process_orders(struct mod *mod, int type, struct stream *s)
         case 64: /* server_paint_rect_shmfd */
             rv = process_server_paint_rect_shmfd(mod, s);
             break;
+        case 65: /* server_shm_ring_setup */
+            rv = process_server_shm_ring_setup(mod, s);
+            break;
+        case 66: /* server_paint_rect_shm_ring */
+            rv = process_server_paint_rect_shm_ring(mod, s);
+            break;
+        case 67: /* server_egfx_shm_ring */
+            rv = process_server_egfx_shm_ring(mod, s);
+            break;
         default:
             LOG_DEVEL(LOG_LEVEL_WARNING,
                       "lib_mod_process_orders: unknown order type %d", type);
@@ -1887,6 +2178,10 @@ lib_mod_set_param(struct mod *mod, const char *name, const char *value)
     {
         g_snprintf(mod->keycode_set, sizeof(mod->keycode_set), "%s", value);
     }
+    else if (g_strcasecmp(name, "shm_ring_slots") == 0)
+    {
+        mod->shm_ring_slots_wanted = MAX(g_atoi(value), 0);
+    }
     else if (g_strcasecmp(name, "client_info") == 0)
     {
         g_memcpy(&(mod->client_info), value, sizeof(mod->client_info));
@@ -1905,6 +2200,8 @@ lib_mod_get_wait_objs(struct mod *mod, tbus *read_objs, int *rcount,
     {
         if (mod->trans != 0)
         {
+            /* xrdp is done with the client for now, send its input */
+            lib_mod_input_flush(mod);
             trans_get_wait_objs_rw(mod->trans, read_objs, rcount,
                                    write_objs, wcount, timeout);
         }
@@ -1943,6 +2240,8 @@ lib_mod_frame_ack(struct mod *amod, int flags, int frame_id)
     LOG_DEVEL(LOG_LEVEL_TRACE,
               "lib_mod_frame_ack: flags 0x%8.8x frame_id %d", flags, frame_id);
     send_paint_rect_ex_ack(amod, flags, frame_id);
+    amod->shm_ring_acked = frame_id;
+    xup_shm_ring_release_retired(amod, frame_id);
     return 0;
 }
 
@@ -1969,6 +2268,7 @@ mod_init(void)
     mod->size = sizeof(struct mod);
     mod->version = CURRENT_MOD_VER;
     mod->handle = (tintptr) mod;
+    mod->shm_ring_slots_wanted = 3;
     mod->mod_connect = lib_mod_connect;
     mod->mod_start = lib_mod_start;
     mod->mod_event = lib_mod_event;
@@ -1996,7 +2296,18 @@ mod_exit(tintptr handle)
     {
         return 0;
     }
+    if (mod->input_latency_count > 0)
+    {
+        LOG(LOG_LEVEL_INFO, "Input to paint latency average %d ms max %d ms "
+            "over %d samples, %d mouse moves coalesced",
+            (int)(mod->input_latency_total / mod->input_latency_count),
+            mod->input_latency_max, mod->input_latency_count,
+            mod->input_coalesced);
+    }
+    free_stream(mod->input_s);
     trans_delete(mod->trans);
+    /* the encoder is stopped before this so the ring is not in use */
+    xup_shm_ring_unmap_all(mod);
     g_free(mod);
     return 0;
 }
@@ -179,7 +179,11 @@ struct mod
     int (*server_egfx_cmd)(struct mod *v,
                            char *cmd, int cmd_bytes,
                            char *data, int data_bytes);
-    tintptr server_dumby[100 - 51]; /* align, 100 minus the number of server
+    int (*server_egfx_cmd_ex)(struct mod *v,
+                              char *cmd, int cmd_bytes,
+                              char *data, int data_bytes,
+                              void *shmem_ptr, int shmem_bytes);
+    tintptr server_dumby[100 - 52]; /* align, 100 minus the number of server
                                      functions above */
     /* common */
     tintptr handle; /* pointer to self as long */
@@ -202,6 +206,25 @@ struct mod
     char *screen_shmem_pixels;
     struct trans *trans;
     char keycode_set[32];
+    /* frame ring shared with xorgxrdp, mapped once, see xup.c */
+    int shm_ring_slots_wanted;
+    char *shm_ring_ptr;
+    int shm_ring_bytes;
+    int shm_ring_slots;
+    int shm_ring_slot_bytes;
+    int shm_ring_seq; /* next sequence number expected */
+    int shm_ring_frame_id; /* last frame_id painted from the ring */
+    int shm_ring_acked; /* last frame_id acked to xorgxrdp */
+    struct list *shm_ring_retired; /* replaced rings waiting for acks */
+    /* input events waiting to be sent, see xup.c */
+    struct stream *input_s;
+    int input_count;
+    char *input_move; /* params of the last event if it is a mouse move */
+    int input_coalesced;
+    int input_time; /* when the oldest input not yet painted came, or 0 */
+    int input_latency_count;
+    int input_latency_max;
+    long input_latency_total;
 };
 
 #endif // XUP_H
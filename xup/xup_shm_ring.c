@@ -0,0 +1,176 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libxup shared memory frame ring
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "xup.h"
+#include "xup_shm_ring.h"
+#include "list.h"
+#include "log.h"
+
+struct shm_ring_retired
+{
+    char *ptr;
+    int bytes;
+    int frame_id;
+};
+
+/******************************************************************************/
+int
+xup_shm_ring_map(struct mod *amod, int fd, int slots, int slot_bytes)
+{
+    void *shmem_ptr;
+
+    if (slots <= 0 || slot_bytes <= 0 || slots > 0x7fffffff / slot_bytes)
+    {
+        LOG(LOG_LEVEL_ERROR, "xup_shm_ring_map: bad ring "
+            "%d slots of %d bytes", slots, slot_bytes);
+        return 1;
+    }
+    if (g_file_map(fd, 1, 0, slots * slot_bytes, &shmem_ptr) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xup_shm_ring_map: map of "
+            "%d bytes failed", slots * slot_bytes);
+        return 1;
+    }
+    amod->shm_ring_ptr = (char *) shmem_ptr;
+    amod->shm_ring_bytes = slots * slot_bytes;
+    amod->shm_ring_slots = slots;
+    amod->shm_ring_slot_bytes = slot_bytes;
+    amod->shm_ring_seq = 0;
+    amod->shm_ring_frame_id = amod->shm_ring_acked;
+    LOG(LOG_LEVEL_INFO, "xup_shm_ring_map: using frame ring "
+        "of %d slots of %d bytes", slots, slot_bytes);
+    return 0;
+}
+
+/******************************************************************************/
+void
+xup_shm_ring_release_retired(struct mod *amod, int frame_id)
+{
+    int index;
+    struct shm_ring_retired *retired;
+
+    if (amod->shm_ring_retired == NULL)
+    {
+        return;
+    }
+    for (index = amod->shm_ring_retired->count - 1; index >= 0; index--)
+    {
+        retired = (struct shm_ring_retired *)
+                  list_get_item(amod->shm_ring_retired, index);
+        if (frame_id >= retired->frame_id)
+        {
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "xup_shm_ring_release_retired: unmap "
+                      "ring %p, frame_id %d acked", retired->ptr, frame_id);
+            g_munmap(retired->ptr, retired->bytes);
+            list_remove_item(amod->shm_ring_retired, index);
+        }
+    }
+}
+
+/******************************************************************************/
+void
+xup_shm_ring_retire(struct mod *amod)
+{
+    struct shm_ring_retired *retired;
+
+    if (amod->shm_ring_ptr == NULL)
+    {
+        return;
+    }
+    if (amod->shm_ring_acked >= amod->shm_ring_frame_id)
+    {
+        g_munmap(amod->shm_ring_ptr, amod->shm_ring_bytes);
+    }
+    else
+    {
+        if (amod->shm_ring_retired == NULL)
+        {
+            amod->shm_ring_retired = list_create();
+            amod->shm_ring_retired->auto_free = 1;
+        }
+        retired = g_new0(struct shm_ring_retired, 1);
+        retired->ptr = amod->shm_ring_ptr;
+        retired->bytes = amod->shm_ring_bytes;
+        retired->frame_id = amod->shm_ring_frame_id;
+        list_add_item(amod->shm_ring_retired, (tintptr) retired);
+    }
+    amod->shm_ring_ptr = NULL;
+    amod->shm_ring_bytes = 0;
+    amod->shm_ring_slots = 0;
+    amod->shm_ring_slot_bytes = 0;
+}
+
+/******************************************************************************/
+void
+xup_shm_ring_unmap_all(struct mod *amod)
+{
+    int index;
+    struct shm_ring_retired *retired;
+
+    if (amod->shm_ring_ptr != NULL)
+    {
+        g_munmap(amod->shm_ring_ptr, amod->shm_ring_bytes);
+        amod->shm_ring_ptr = NULL;
+    }
+    if (amod->shm_ring_retired != NULL)
+    {
+        for (index = 0; index < amod->shm_ring_retired->count; index++)
+        {
+            retired = (struct shm_ring_retired *)
+                      list_get_item(amod->shm_ring_retired, index);
+            g_munmap(retired->ptr, retired->bytes);
+        }
+        list_delete(amod->shm_ring_retired);
+        amod->shm_ring_retired = NULL;
+    }
+}
+
+/******************************************************************************/
+char *
+xup_shm_ring_get_data(struct mod *amod, int slot, int seq, int offset,
+                      size_t bytes, int frame_id)
+{
+    if (amod->shm_ring_ptr == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "xup_shm_ring_get_data: no frame ring set up");
+        return NULL;
+    }
+    if (slot < 0 || slot >= amod->shm_ring_slots ||
+            offset < 0 || offset > amod->shm_ring_slot_bytes ||
+            bytes > (size_t) (amod->shm_ring_slot_bytes - offset))
+    {
+        LOG(LOG_LEVEL_ERROR, "xup_shm_ring_get_data: slot %d offset %d "
+            "bytes %lu outside ring of %d slots of %d bytes",
+            slot, offset, (unsigned long) bytes, amod->shm_ring_slots,
+            amod->shm_ring_slot_bytes);
+        return NULL;
+    }
+    if (seq != amod->shm_ring_seq)
+    {
+        LOG(LOG_LEVEL_WARNING, "xup_shm_ring_get_data: expected sequence %d "
+            "got %d", amod->shm_ring_seq, seq);
+    }
+    amod->shm_ring_seq = seq + 1;
+    amod->shm_ring_frame_id = frame_id;
+    return amod->shm_ring_ptr +
+           (size_t) slot * (size_t) amod->shm_ring_slot_bytes + offset;
+}
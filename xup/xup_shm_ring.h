@@ -0,0 +1,81 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libxup shared memory frame ring
+ *
+ * The frame ring is one shared memory object, split into shm_ring_slots
+ * slots of shm_ring_slot_bytes each, that xorgxrdp hands over once with
+ * order 65 instead of passing a new fd with every frame (orders 62 and 64).
+ * Frames then arrive as orders 66 and 67 naming a slot. xorgxrdp does not
+ * reuse a slot until the frame_id painted from it has been acked, so the
+ * existing frame ack is also the slot release. A ring replaced by a new
+ * setup, after a resize say, stays mapped until its last frame is acked.
+ */
+
+#ifndef XUP_SHM_RING_H
+#define XUP_SHM_RING_H
+
+#include <stddef.h>
+
+struct mod;
+
+/**
+ * Map a new ring from fd, which the caller still owns
+ *
+ * The ring in use must have been retired first
+ *
+ * @param amod Module
+ * @param fd Shared memory from xorgxrdp
+ * @param slots Number of slots
+ * @param slot_bytes Size of each slot
+ * @return 0 on success
+ */
+int
+xup_shm_ring_map(struct mod *amod, int fd, int slots, int slot_bytes);
+
+/**
+ * Stop using the current ring, unmapping it now if nothing painted from
+ * it can still be in use
+ */
+void
+xup_shm_ring_retire(struct mod *amod);
+
+/**
+ * Unmap retired rings whose last frame is acked by frame_id
+ */
+void
+xup_shm_ring_release_retired(struct mod *amod, int frame_id);
+
+/**
+ * Unmap all rings, called from mod_exit when the encoder can no longer be
+ * using any of them
+ */
+void
+xup_shm_ring_unmap_all(struct mod *amod);
+
+/**
+ * Find the data of a frame in the ring
+ *
+ * @param amod Module
+ * @param slot, seq, offset From the order
+ * @param bytes Size of the data
+ * @param frame_id Frame painted from the data
+ * @return start of the data or NULL if it does not fit the ring
+ */
+char *
+xup_shm_ring_get_data(struct mod *amod, int slot, int seq, int offset,
+                      size_t bytes, int frame_id);
+
+#endif